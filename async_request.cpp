@@ -0,0 +1,619 @@
+extern "C"
+{
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "datatype/timestamp.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+}
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "async_request.h"
+#include "generate_sql.h"
+
+extern int pg_gen_query_async_workers;
+extern int pg_gen_query_async_queue_size;
+extern int pg_gen_query_prune_token_budget;
+extern int pg_gen_query_prune_fk_hops;
+extern double pg_gen_query_cache_similarity;
+extern bool pg_gen_query_search_path_scope;
+
+#define ASYNC_MAX_WORKERS 64
+#define ASYNC_QUERY_LEN 4096
+#define ASYNC_SQL_LEN 8192
+#define ASYNC_ERROR_LEN 512
+#define ASYNC_SEARCH_PATH_LEN 1024
+// a worker that hasn't attached after this long failed to start
+#define ASYNC_WORKER_START_TIMEOUT_MS 60000
+
+enum AsyncState
+{
+  ASYNC_FREE = 0,
+  ASYNC_QUEUED,
+  ASYNC_RUNNING,
+  ASYNC_DONE,
+  ASYNC_FAILED
+};
+
+static const char *const async_state_names[] = {"free", "queued", "running", "done", "failed"};
+
+/*
+ One submitted question. The submitter's prune, similarity and search_path scope settings
+ travel with it, since the worker runs with the server defaults. search_path holds the
+ resolved schema names, each followed by a NUL.
+*/
+struct AsyncRequest
+{
+  uint64 id;
+  int state;
+  Oid dboid;
+  Oid userid;
+  int worker; // while running
+  TimestampTz finished;
+  int32 prune_token_budget;
+  int32 prune_fk_hops;
+  double cache_similarity;
+  bool search_path_scope;
+  int32 search_path_len;
+  char search_path[ASYNC_SEARCH_PATH_LEN];
+  char query[ASYNC_QUERY_LEN];
+  char sql[ASYNC_SQL_LEN];
+  char error[ASYNC_ERROR_LEN];
+};
+
+enum AsyncWorkerState
+{
+  WORKER_FREE = 0,
+  WORKER_STARTING,
+  WORKER_RUNNING
+};
+
+struct AsyncWorker
+{
+  int state;
+  Oid dboid;
+  TimestampTz started;
+};
+
+struct AsyncShared
+{
+  LWLock *lock;
+  ConditionVariable finished; // broadcast whenever a request is done or failed
+  uint64 next_id;
+  int nrequests;
+  AsyncWorker workers[ASYNC_MAX_WORKERS];
+  AsyncRequest requests[FLEXIBLE_ARRAY_MEMBER];
+};
+
+static AsyncShared *shared = nullptr;
+
+// set in an async worker
+static int my_worker = -1;
+static bool my_worker_connected = false;
+
+extern "C"
+{
+  PGDLLEXPORT void pg_gen_query_async_worker_main(Datum main_arg);
+}
+
+size_t async_request_shmem_size()
+{
+  if (pg_gen_query_async_queue_size <= 0)
+    return 0;
+  return MAXALIGN(add_size(offsetof(AsyncShared, requests),
+                           mul_size(sizeof(AsyncRequest), pg_gen_query_async_queue_size)));
+}
+
+void async_request_shmem_request()
+{
+  if (pg_gen_query_async_queue_size > 0)
+    RequestNamedLWLockTranche("pg_gen_query_async", 1);
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void async_request_shmem_startup()
+{
+  if (pg_gen_query_async_queue_size <= 0)
+    return;
+
+  bool found;
+  shared = (AsyncShared *)ShmemInitStruct("pg_gen_query async requests", async_request_shmem_size(), &found);
+  if (found)
+    return;
+
+  memset(shared, 0, async_request_shmem_size());
+  shared->lock = &(GetNamedLWLockTranche("pg_gen_query_async"))->lock;
+  ConditionVariableInit(&shared->finished);
+  shared->nrequests = pg_gen_query_async_queue_size;
+}
+
+static bool register_worker(int workerno)
+{
+  BackgroundWorker worker;
+  BackgroundWorkerHandle *handle;
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = BGW_NEVER_RESTART;
+  strlcpy(worker.bgw_library_name, "pg_gen_query", BGW_MAXLEN);
+  strlcpy(worker.bgw_function_name, "pg_gen_query_async_worker_main", BGW_MAXLEN);
+  strlcpy(worker.bgw_name, "pg_gen_query async worker", BGW_MAXLEN);
+  strlcpy(worker.bgw_type, "pg_gen_query async worker", BGW_MAXLEN);
+  worker.bgw_main_arg = Int32GetDatum(workerno);
+  worker.bgw_notify_pid = 0;
+  return RegisterDynamicBackgroundWorker(&worker, &handle);
+}
+
+/*
+ Starts a worker for every queued request that no starting worker will pick up yet,
+ within pg_gen_query.async_workers. Running workers take the next queued request of
+ their database when they finish, so this only adds parallelism.
+*/
+static void start_workers()
+{
+  struct DbDemand
+  {
+    Oid dboid;
+    int need;
+  };
+  DbDemand demand[ASYNC_MAX_WORKERS];
+  int ndbs = 0;
+  int start[ASYNC_MAX_WORKERS];
+  int nstart = 0;
+  TimestampTz now = GetCurrentTimestamp();
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  int used = 0;
+  for (int w = 0; w < ASYNC_MAX_WORKERS; ++w)
+  {
+    AsyncWorker *worker = &shared->workers[w];
+    if (worker->state == WORKER_STARTING &&
+        TimestampDifferenceExceeds(worker->started, now, ASYNC_WORKER_START_TIMEOUT_MS))
+      worker->state = WORKER_FREE;
+    if (worker->state != WORKER_FREE)
+      used++;
+  }
+
+  for (int i = 0; i < shared->nrequests; ++i)
+  {
+    AsyncRequest *r = &shared->requests[i];
+    if (r->state != ASYNC_QUEUED)
+      continue;
+    int d = 0;
+    while (d < ndbs && demand[d].dboid != r->dboid)
+      d++;
+    if (d == ndbs)
+    {
+      if (ndbs == ASYNC_MAX_WORKERS)
+        continue;
+      demand[ndbs].dboid = r->dboid;
+      demand[ndbs].need = 0;
+      for (int w = 0; w < ASYNC_MAX_WORKERS; ++w)
+        if (shared->workers[w].state == WORKER_STARTING && shared->workers[w].dboid == r->dboid)
+          demand[ndbs].need--;
+      ndbs++;
+    }
+    demand[d].need++;
+  }
+
+  for (int d = 0; d < ndbs; ++d)
+  {
+    for (int w = 0; w < ASYNC_MAX_WORKERS && demand[d].need > 0 && used < pg_gen_query_async_workers; ++w)
+    {
+      AsyncWorker *worker = &shared->workers[w];
+      if (worker->state != WORKER_FREE)
+        continue;
+      worker->state = WORKER_STARTING;
+      worker->dboid = demand[d].dboid;
+      worker->started = now;
+      start[nstart++] = w;
+      demand[d].need--;
+      used++;
+    }
+  }
+  LWLockRelease(shared->lock);
+
+  for (int n = 0; n < nstart; ++n)
+  {
+    if (register_worker(start[n]))
+      continue;
+    // out of background worker slots: the requests stay queued until the next submit
+    // or until a running worker of their database gets to them
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    shared->workers[start[n]].state = WORKER_FREE;
+    LWLockRelease(shared->lock);
+    ereport(WARNING,
+            (errmsg("pg_gen_query: could not start an async worker"),
+             errhint("Consider increasing max_worker_processes.")));
+    break;
+  }
+}
+
+static AsyncRequest *find_request(uint64 id)
+{
+  for (int i = 0; i < shared->nrequests; ++i)
+  {
+    if (shared->requests[i].state != ASYNC_FREE && shared->requests[i].id == id)
+      return &shared->requests[i];
+  }
+  return nullptr;
+}
+
+static void check_available()
+{
+  if (shared == nullptr)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("pg_gen_query async requests require pg_gen_query in shared_preload_libraries and pg_gen_query.async_queue_size > 0")));
+  }
+}
+
+/*
+ Looks up a request of the current user in this database, with the lock held
+*/
+static AsyncRequest *lookup_request(int64 id)
+{
+  AsyncRequest *r = find_request((uint64)id);
+  if (r == nullptr || r->dboid != MyDatabaseId)
+  {
+    LWLockRelease(shared->lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("pg_gen_query request " INT64_FORMAT " does not exist", id),
+             errdetail("Finished requests are removed once their result has been returned.")));
+  }
+  if (r->userid != GetUserId() && !superuser())
+  {
+    LWLockRelease(shared->lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+             errmsg("permission denied for pg_gen_query request " INT64_FORMAT, id)));
+  }
+  return r;
+}
+
+/*
+ Worker exit (also on error): fail the request it was running and start workers for
+ whatever is still queued
+*/
+static void async_worker_done(int code, Datum arg)
+{
+  bool started_others = false;
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  Oid dboid = shared->workers[my_worker].dboid;
+  shared->workers[my_worker].state = WORKER_FREE;
+  for (int i = 0; i < shared->nrequests; ++i)
+  {
+    AsyncRequest *r = &shared->requests[i];
+    bool orphaned = r->state == ASYNC_RUNNING && r->worker == my_worker;
+    // nothing could ever serve this database
+    bool unreachable = !my_worker_connected && r->state == ASYNC_QUEUED && r->dboid == dboid;
+    if (!orphaned && !unreachable)
+      continue;
+    r->state = ASYNC_FAILED;
+    r->finished = GetCurrentTimestamp();
+    strlcpy(r->error,
+            orphaned ? "pg_gen_query async worker exited before finishing the request"
+                     : "pg_gen_query async worker could not connect to the database",
+            ASYNC_ERROR_LEN);
+  }
+  for (int i = 0; i < shared->nrequests && !started_others; ++i)
+    started_others = shared->requests[i].state == ASYNC_QUEUED;
+  LWLockRelease(shared->lock);
+
+  ConditionVariableBroadcast(&shared->finished);
+  if (started_others)
+    start_workers();
+}
+
+// Catches C++ exceptions; PostgreSQL errors are caught by the caller
+static bool run_request(const std::string &query, std::string &sql, std::string &error)
+{
+  try
+  {
+    sql = generate_sql(query);
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    error = e.what();
+    return false;
+  }
+}
+
+/*
+ Serves the queued requests of one database, oldest first, and exits when there are none
+*/
+void pg_gen_query_async_worker_main(Datum main_arg)
+{
+  my_worker = DatumGetInt32(main_arg);
+
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  shared->workers[my_worker].state = WORKER_RUNNING;
+  Oid dboid = shared->workers[my_worker].dboid;
+  LWLockRelease(shared->lock);
+  before_shmem_exit(async_worker_done, 0);
+
+  BackgroundWorkerInitializeConnectionByOid(dboid, InvalidOid, 0);
+  my_worker_connected = true;
+
+  MemoryContext context = CurrentMemoryContext;
+  for (;;)
+  {
+    CHECK_FOR_INTERRUPTS();
+
+    AsyncRequest *r = nullptr;
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    for (int i = 0; i < shared->nrequests; ++i)
+    {
+      AsyncRequest *candidate = &shared->requests[i];
+      if (candidate->state == ASYNC_QUEUED && candidate->dboid == MyDatabaseId &&
+          (r == nullptr || candidate->id < r->id))
+        r = candidate;
+    }
+    if (r != nullptr)
+    {
+      r->state = ASYNC_RUNNING;
+      r->worker = my_worker;
+    }
+    LWLockRelease(shared->lock);
+    if (r == nullptr)
+      break;
+
+    // the slot is ours while it is running
+    std::string query(r->query);
+    pg_gen_query_prune_token_budget = r->prune_token_budget;
+    pg_gen_query_prune_fk_hops = r->prune_fk_hops;
+    pg_gen_query_cache_similarity = r->cache_similarity;
+    pg_gen_query_search_path_scope = r->search_path_scope;
+    std::vector<std::string> schemas;
+    for (int32 k = 0; k < r->search_path_len; k += (int32)schemas.back().size() + 1)
+      schemas.emplace_back(r->search_path + k);
+    set_search_path_schemas(&schemas);
+    pgstat_report_activity(STATE_RUNNING, "generating SQL");
+
+    std::string sql, error;
+    volatile bool ok = false;
+    PG_TRY();
+    {
+      ok = run_request(query, sql, error);
+    }
+    PG_CATCH();
+    {
+      MemoryContextSwitchTo(context);
+      ErrorData *edata = CopyErrorData();
+      FlushErrorState();
+      error = edata->message;
+      FreeErrorData(edata);
+    }
+    PG_END_TRY();
+    pgstat_report_activity(STATE_IDLE, NULL);
+
+    if (ok && sql.size() >= ASYNC_SQL_LEN)
+    {
+      ok = false;
+      error = "generated SQL exceeds " + std::to_string(ASYNC_SQL_LEN - 1) + " bytes";
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    r->state = ok ? ASYNC_DONE : ASYNC_FAILED;
+    r->finished = GetCurrentTimestamp();
+    if (ok)
+      strlcpy(r->sql, sql.c_str(), ASYNC_SQL_LEN);
+    else
+      strlcpy(r->error, error.c_str(), ASYNC_ERROR_LEN);
+    LWLockRelease(shared->lock);
+    ConditionVariableBroadcast(&shared->finished);
+  }
+  proc_exit(0);
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_submit);
+
+  /*
+   Queues query for a background worker and returns the request id right away
+  */
+  Datum pg_gen_query_submit(PG_FUNCTION_ARGS)
+  {
+    check_available();
+
+    text *input_text = PG_GETARG_TEXT_PP(0);
+    size_t len = VARSIZE_ANY_EXHDR(input_text);
+    if (len >= ASYNC_QUERY_LEN)
+    {
+      ereport(ERROR,
+              (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+               errmsg("query is too long for an async request (%zu bytes, at most %d)", len, ASYNC_QUERY_LEN - 1)));
+    }
+
+    std::vector<std::string> schemas;
+    search_path_schemas(schemas);
+    std::string search_path;
+    for (const auto &schema : schemas)
+    {
+      search_path += schema;
+      search_path.push_back('\0');
+    }
+    if (search_path.size() > ASYNC_SEARCH_PATH_LEN)
+    {
+      ereport(ERROR,
+              (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+               errmsg("search_path is too long for an async request with pg_gen_query.search_path_scope")));
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    AsyncRequest *slot = nullptr;
+    AsyncRequest *oldest_finished = nullptr;
+    for (int i = 0; i < shared->nrequests && slot == nullptr; ++i)
+    {
+      AsyncRequest *r = &shared->requests[i];
+      if (r->state == ASYNC_FREE)
+        slot = r;
+      else if ((r->state == ASYNC_DONE || r->state == ASYNC_FAILED) &&
+               (oldest_finished == nullptr || r->finished < oldest_finished->finished))
+        oldest_finished = r;
+    }
+    // a full queue drops the oldest result nobody fetched
+    if (slot == nullptr)
+      slot = oldest_finished;
+    if (slot == nullptr)
+    {
+      LWLockRelease(shared->lock);
+      ereport(ERROR,
+              (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+               errmsg("too many pg_gen_query requests in progress"),
+               errhint("Consider increasing pg_gen_query.async_queue_size.")));
+    }
+
+    int64 id = (int64)++shared->next_id;
+    slot->id = (uint64)id;
+    slot->state = ASYNC_QUEUED;
+    slot->dboid = MyDatabaseId;
+    slot->userid = GetUserId();
+    slot->worker = -1;
+    slot->finished = 0;
+    slot->prune_token_budget = pg_gen_query_prune_token_budget;
+    slot->prune_fk_hops = pg_gen_query_prune_fk_hops;
+    slot->cache_similarity = pg_gen_query_cache_similarity;
+    slot->search_path_scope = pg_gen_query_search_path_scope;
+    slot->search_path_len = (int32)search_path.size();
+    memcpy(slot->search_path, search_path.data(), search_path.size());
+    memcpy(slot->query, VARDATA_ANY(input_text), len);
+    slot->query[len] = '\0';
+    slot->sql[0] = '\0';
+    slot->error[0] = '\0';
+    LWLockRelease(shared->lock);
+
+    start_workers();
+    PG_RETURN_INT64(id);
+  }
+
+  PG_FUNCTION_INFO_V1(pg_gen_query_poll);
+
+  /*
+   Returns (status, sql, error) of a request without waiting. Once the request is done
+   or failed its result is returned and the request is removed.
+  */
+  Datum pg_gen_query_poll(PG_FUNCTION_ARGS)
+  {
+    check_available();
+
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    int64 id = PG_GETARG_INT64(0);
+    Datum values[3];
+    bool nulls[3] = {false, true, true};
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    AsyncRequest *r = lookup_request(id);
+    int state = r->state;
+    char *sql = state == ASYNC_DONE ? pstrdup(r->sql) : nullptr;
+    char *error = state == ASYNC_FAILED ? pstrdup(r->error) : nullptr;
+    if (state == ASYNC_DONE || state == ASYNC_FAILED)
+      r->state = ASYNC_FREE;
+    LWLockRelease(shared->lock);
+
+    values[0] = CStringGetTextDatum(async_state_names[state]);
+    if (sql != nullptr)
+    {
+      values[1] = CStringGetTextDatum(sql);
+      nulls[1] = false;
+    }
+    if (error != nullptr)
+    {
+      values[2] = CStringGetTextDatum(error);
+      nulls[2] = false;
+    }
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+  }
+
+  PG_FUNCTION_INFO_V1(pg_gen_query_wait);
+
+  /*
+   Waits for a request and returns its SQL, or NULL if the timeout (NULL = none) passes
+   first; the request then stays queued. A failed request raises its error. The wait
+   is interrupted by query cancel and statement_timeout.
+  */
+  Datum pg_gen_query_wait(PG_FUNCTION_ARGS)
+  {
+    check_available();
+    if (PG_ARGISNULL(0))
+    {
+      PG_RETURN_NULL();
+    }
+
+    int64 id = PG_GETARG_INT64(0);
+    TimestampTz deadline = 0;
+    if (!PG_ARGISNULL(1))
+    {
+      Interval *timeout = PG_GETARG_INTERVAL_P(1);
+      int64 usecs = timeout->time +
+                    ((int64)timeout->month * DAYS_PER_MONTH + timeout->day) * USECS_PER_DAY;
+      deadline = GetCurrentTimestamp() + Max(usecs, 0);
+    }
+
+    char *sql = nullptr;
+    char *error = nullptr;
+    ConditionVariablePrepareToSleep(&shared->finished);
+    for (;;)
+    {
+      LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+      AsyncRequest *r = lookup_request(id);
+      if (r->state == ASYNC_DONE)
+        sql = pstrdup(r->sql);
+      else if (r->state == ASYNC_FAILED)
+        error = pstrdup(r->error);
+      if (sql != nullptr || error != nullptr)
+        r->state = ASYNC_FREE;
+      LWLockRelease(shared->lock);
+      if (sql != nullptr || error != nullptr)
+        break;
+
+      if (deadline == 0)
+      {
+        ConditionVariableSleep(&shared->finished, PG_WAIT_EXTENSION);
+        continue;
+      }
+      long remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+      if (remaining <= 0)
+        break;
+      (void)ConditionVariableTimedSleep(&shared->finished, remaining, PG_WAIT_EXTENSION);
+    }
+    ConditionVariableCancelSleep();
+
+    if (error != nullptr)
+    {
+      ereport(ERROR, (errmsg("pg_gen_query request " INT64_FORMAT " failed: %s", id, error)));
+    }
+    if (sql == nullptr)
+    {
+      PG_RETURN_NULL();
+    }
+    PG_RETURN_TEXT_P(cstring_to_text(sql));
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef ASYNC_REQUEST_H
+#define ASYNC_REQUEST_H
+
+#include <cstddef>
+
+/*
+ Asynchronous generation: pg_gen_query_submit() queues a question in shared memory and
+ returns at once; background workers connected to the submitter's database generate the
+ SQL and leave it in the request slot, where pg_gen_query_poll() / pg_gen_query_wait()
+ pick it up (freeing the slot). At most pg_gen_query.async_workers workers run at a time;
+ they are started on demand and exit when their database has nothing queued.
+ Requires shared_preload_libraries.
+*/
+
+size_t async_request_shmem_size();
+void async_request_shmem_request();
+void async_request_shmem_startup();
+
+#endif
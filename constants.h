@@ -1 +1,2 @@
-static const char *SCHEMA_PATH = "/var/lib/postgresql/pg_gen_query_schema.json";
\ No newline at end of file
+// Per-database schema files, relative to the data directory (see schema_cache_file())
+static const char *SCHEMA_DIR = "pg_gen_query";
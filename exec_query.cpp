@@ -0,0 +1,238 @@
+extern "C"
+{
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/portal.h"
+}
+
+#include <exception>
+#include <string>
+#include "generate_sql.h"
+#include "plan_cache.h"
+#include "schema_cache.h"
+#include "sql_stream.h"
+#include "validate_sql.h"
+
+extern int pg_gen_query_exec_fetch_size;
+
+/*
+ Execute mode: the generated SQL runs in a read-only SPI cursor and its rows are handed
+ out one per call, fetched pg_gen_query.exec_fetch_size at a time, so only one batch is
+ ever held here. (Called in FROM, the executor still collects the rows in its own
+ tuplestore, which spills to disk beyond work_mem; called in the select list, rows
+ stream straight through.)
+*/
+struct ExecState
+{
+  char *portal_name;
+  MemoryContext batch_context; // the current batch, reset on every fetch
+  HeapTuple *tuples;
+  uint64 ntuples;
+  uint64 next;
+  bool done; // the cursor has no more rows
+  bool closed;
+};
+
+/*
+ Runs fn with the transaction marked read-only, as in a READ ONLY transaction: SPI's
+ read_only only covers the statement itself, not the functions it calls, so without
+ this SELECT nextval(...) or a PL/pgSQL function that writes would go through. Side
+ effects outside the database (dblink, pg_terminate_backend, ...) are not prevented.
+ An error restores the flag along with the (sub)transaction.
+*/
+template <typename Fn>
+static void run_read_only(Fn fn)
+{
+  bool read_only = XactReadOnly;
+  XactReadOnly = true;
+  PG_TRY();
+  {
+    fn();
+  }
+  PG_CATCH();
+  {
+    XactReadOnly = read_only;
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  XactReadOnly = read_only;
+}
+
+/*
+ The row type the caller asked for must match the generated query's result
+*/
+static void check_result_type(TupleDesc expected, TupleDesc actual, const std::string &sql)
+{
+  if (expected->natts != actual->natts)
+  {
+    ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+             errmsg("generated query returns %d columns, but the column definition list has %d",
+                    actual->natts, expected->natts),
+             errdetail("Generated SQL: %s", sql.c_str())));
+  }
+  for (int i = 0; i < expected->natts; i++)
+  {
+    Oid want = TupleDescAttr(expected, i)->atttypid;
+    Oid got = TupleDescAttr(actual, i)->atttypid;
+    if (want != got)
+    {
+      ereport(ERROR,
+              (errcode(ERRCODE_DATATYPE_MISMATCH),
+               errmsg("column %d (\"%s\") of the generated query has type %s, but the column definition list says %s",
+                      i + 1, NameStr(TupleDescAttr(actual, i)->attname), format_type_be(got), format_type_be(want)),
+               errdetail("Generated SQL: %s", sql.c_str())));
+    }
+  }
+}
+
+static void close_cursor(ExecState *state)
+{
+  if (state->closed)
+    return;
+  state->closed = true;
+  if (SPI_connect() != SPI_OK_CONNECT)
+    elog(ERROR, "SPI_connect failed");
+  Portal portal = SPI_cursor_find(state->portal_name);
+  if (portal != NULL)
+    SPI_cursor_close(portal);
+  SPI_finish();
+}
+
+// The caller stopped early (e.g. LIMIT): don't keep the cursor until the end of the transaction
+static void exec_shutdown(Datum arg)
+{
+  close_cursor((ExecState *)DatumGetPointer(arg));
+}
+
+static void fetch_batch(ExecState *state)
+{
+  MemoryContextReset(state->batch_context);
+  state->ntuples = 0;
+  state->next = 0;
+
+  // SPI_copytuple copies into the context current at SPI_connect
+  MemoryContext old = MemoryContextSwitchTo(state->batch_context);
+  if (SPI_connect() != SPI_OK_CONNECT)
+    elog(ERROR, "SPI_connect failed");
+  Portal portal = SPI_cursor_find(state->portal_name);
+  if (portal == NULL)
+    elog(ERROR, "cursor \"%s\" does not exist", state->portal_name);
+
+  run_read_only([&]
+                { SPI_cursor_fetch(portal, true, pg_gen_query_exec_fetch_size); });
+  state->tuples = (HeapTuple *)palloc(sizeof(HeapTuple) * Max(SPI_processed, 1));
+  for (uint64 i = 0; i < SPI_processed; i++)
+    state->tuples[i] = SPI_copytuple(SPI_tuptable->vals[i]);
+  state->ntuples = SPI_processed;
+  state->done = SPI_processed < (uint64)pg_gen_query_exec_fetch_size;
+  SPI_freetuptable(SPI_tuptable);
+  SPI_finish();
+  MemoryContextSwitchTo(old);
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_exec);
+
+  /*
+   Generates SQL for the question and returns its rows. With a column definition list
+   the result must match it; in the select list the rows come back as anonymous records.
+  */
+  Datum pg_gen_query_exec(PG_FUNCTION_ARGS)
+  {
+    FuncCallContext *funcctx;
+
+    if (SRF_IS_FIRSTCALL())
+    {
+      funcctx = SRF_FIRSTCALL_INIT();
+
+      text *input_text = PG_GETARG_TEXT_PP(0);
+      std::string input(VARDATA_ANY(input_text), VARSIZE_ANY_EXHDR(input_text));
+      std::string sql;
+      try
+      {
+        // the model's answer may be fenced or followed by an explanation
+        sql = sql_first_statement(generate_validated_sql(input));
+      }
+      catch (const std::exception &e)
+      {
+        CHECK_FOR_INTERRUPTS();
+        ereport(ERROR, (errmsg("C++ exception in pg_gen_query_exec: %s", e.what())));
+      }
+
+      MemoryContext old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+      TupleDesc expected = NULL;
+      if (get_call_result_type(fcinfo, NULL, &expected) != TYPEFUNC_COMPOSITE)
+        expected = NULL;
+
+      if (SPI_connect() != SPI_OK_CONNECT)
+        elog(ERROR, "SPI_connect failed");
+      // a question asked again usually gets the same SQL back: skip parse and plan then
+      std::string normalized = sql_normalize(sql);
+      uint64_t generation = schema_cache_generation();
+      SPIPlanPtr plan = plan_cache_lookup(normalized, generation);
+      if (plan == NULL)
+      {
+        plan = SPI_prepare(sql.c_str(), 0, NULL);
+        if (plan == NULL)
+          elog(ERROR, "SPI_prepare failed for the generated query: %s", SPI_result_code_string(SPI_result));
+        if (!SPI_is_cursor_plan(plan))
+        {
+          ereport(ERROR,
+                  (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                   errmsg("generated query does not return rows"),
+                   errdetail("Generated SQL: %s", sql.c_str())));
+        }
+        plan_cache_store(normalized, generation, plan);
+      }
+      // read-only: writes by the statement or the functions it calls are rejected
+      Portal portal = NULL;
+      run_read_only([&]
+                    { portal = SPI_cursor_open(NULL, plan, NULL, NULL, true); });
+      if (expected != NULL)
+        check_result_type(expected, portal->tupDesc, sql);
+
+      ExecState *state = (ExecState *)palloc0(sizeof(ExecState));
+      state->portal_name = pstrdup(portal->name);
+      state->batch_context = AllocSetContextCreate(funcctx->multi_call_memory_ctx,
+                                                   "pg_gen_query_exec batch",
+                                                   ALLOCSET_DEFAULT_SIZES);
+      funcctx->tuple_desc = BlessTupleDesc(CreateTupleDescCopy(expected != NULL ? expected : portal->tupDesc));
+      funcctx->user_fctx = state;
+      SPI_finish();
+      MemoryContextSwitchTo(old);
+
+      ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+      if (rsinfo != NULL && IsA(rsinfo, ReturnSetInfo) && rsinfo->econtext != NULL)
+        RegisterExprContextCallback(rsinfo->econtext, exec_shutdown, PointerGetDatum(state));
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    ExecState *state = (ExecState *)funcctx->user_fctx;
+
+    if (state->next >= state->ntuples && !state->done)
+      fetch_batch(state);
+    if (state->next < state->ntuples)
+    {
+      HeapTuple tuple = state->tuples[state->next++];
+      SRF_RETURN_NEXT(funcctx, heap_copy_tuple_as_datum(tuple, funcctx->tuple_desc));
+    }
+
+    close_cursor(state);
+    // state goes away with multi_call_memory_ctx
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo != NULL && IsA(rsinfo, ReturnSetInfo) && rsinfo->econtext != NULL)
+      UnregisterExprContextCallback(rsinfo->econtext, exec_shutdown, PointerGetDatum(state));
+    SRF_RETURN_DONE(funcctx);
+  }
+}
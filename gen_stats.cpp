@@ -0,0 +1,385 @@
+extern "C"
+{
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "common/hashfn.h"
+#include "port/atomics.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+}
+
+#include <cstring>
+#include <string>
+#include "gen_stats.h"
+
+#define GEN_STATS_MAX_PROVIDER 16
+#define GEN_STATS_MAX_MODEL 64
+
+struct GenStatsEntry
+{
+  pg_atomic_uint64 key;   // hash of (database, provider, model); 0 = free
+  pg_atomic_uint32 ready; // set once the names below are filled in
+  Oid dbid;
+  char provider[GEN_STATS_MAX_PROVIDER];
+  char model[GEN_STATS_MAX_MODEL];
+
+  pg_atomic_uint64 calls;
+  pg_atomic_uint64 errors;
+  pg_atomic_uint64 cache_hits;
+  pg_atomic_uint64 prompt_bytes;
+  pg_atomic_uint64 response_bytes;
+  pg_atomic_uint64 prompt_tokens;
+  pg_atomic_uint64 completion_tokens;
+  pg_atomic_uint64 phase_us[GEN_PHASES];
+  pg_atomic_uint64 histogram[GEN_PHASES][GEN_STATS_BUCKETS];
+};
+
+struct GenStatsShared
+{
+  pg_atomic_uint64 regens;
+  pg_atomic_uint64 regen_errors;
+  pg_atomic_uint64 regen_us;
+  pg_atomic_uint64 regen_max_us;
+  pg_atomic_uint64 regen_last_us;
+  pg_atomic_uint64 regen_last_at; // TimestampTz
+  pg_atomic_uint64 regen_phase_us[GEN_REGEN_PHASES];
+  pg_atomic_uint64 reset_at;      // TimestampTz
+  GenStatsEntry entries[GEN_STATS_MAX_ENTRIES];
+};
+
+static GenStatsShared *state = nullptr;
+
+// The entry of the last call, so the hot path usually skips the probe
+static GenStatsEntry *last_entry = nullptr;
+static Oid last_dbid = InvalidOid;
+static std::string last_provider;
+static std::string last_model;
+
+static void init_state(GenStatsShared *s)
+{
+  pg_atomic_init_u64(&s->regens, 0);
+  pg_atomic_init_u64(&s->regen_errors, 0);
+  pg_atomic_init_u64(&s->regen_us, 0);
+  pg_atomic_init_u64(&s->regen_max_us, 0);
+  pg_atomic_init_u64(&s->regen_last_us, 0);
+  pg_atomic_init_u64(&s->regen_last_at, 0);
+  for (int p = 0; p < GEN_REGEN_PHASES; p++)
+    pg_atomic_init_u64(&s->regen_phase_us[p], 0);
+  pg_atomic_init_u64(&s->reset_at, (uint64)GetCurrentTimestamp());
+  for (GenStatsEntry &e : s->entries)
+  {
+    pg_atomic_init_u64(&e.key, 0);
+    pg_atomic_init_u32(&e.ready, 0);
+    pg_atomic_init_u64(&e.calls, 0);
+    pg_atomic_init_u64(&e.errors, 0);
+    pg_atomic_init_u64(&e.cache_hits, 0);
+    pg_atomic_init_u64(&e.prompt_bytes, 0);
+    pg_atomic_init_u64(&e.response_bytes, 0);
+    pg_atomic_init_u64(&e.prompt_tokens, 0);
+    pg_atomic_init_u64(&e.completion_tokens, 0);
+    for (int p = 0; p < GEN_PHASES; p++)
+    {
+      pg_atomic_init_u64(&e.phase_us[p], 0);
+      for (int b = 0; b < GEN_STATS_BUCKETS; b++)
+        pg_atomic_init_u64(&e.histogram[p][b], 0);
+    }
+  }
+}
+
+size_t gen_stats_shmem_size()
+{
+  return MAXALIGN(sizeof(GenStatsShared));
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void gen_stats_shmem_startup()
+{
+  bool found;
+  state = (GenStatsShared *)ShmemInitStruct("pg_gen_query stats", sizeof(GenStatsShared), &found);
+  if (!found)
+  {
+    init_state(state);
+  }
+}
+
+static GenStatsShared *get_state()
+{
+  if (state == nullptr)
+  {
+    state = (GenStatsShared *)MemoryContextAllocZero(TopMemoryContext, sizeof(GenStatsShared));
+    init_state(state);
+  }
+  return state;
+}
+
+static bool entry_matches(const GenStatsEntry *e, Oid dbid, std::string_view provider, std::string_view model)
+{
+  return e->dbid == dbid && provider == e->provider && model == e->model;
+}
+
+static void copy_name(char *dst, size_t size, std::string_view name)
+{
+  size_t n = Min(name.size(), size - 1);
+  memcpy(dst, name.data(), n);
+  dst[n] = '\0';
+}
+
+/*
+ Finds or claims the entry for the key by linear probing. A free slot is claimed with a
+ compare-and-swap on its key; whoever wins fills in the names and then marks it ready.
+ Returns nullptr when the table is full.
+*/
+static GenStatsEntry *find_entry(Oid dbid, std::string_view provider, std::string_view model)
+{
+  GenStatsShared *s = get_state();
+  // names are compared truncated to what an entry can hold
+  provider = provider.substr(0, GEN_STATS_MAX_PROVIDER - 1);
+  model = model.substr(0, GEN_STATS_MAX_MODEL - 1);
+  uint64 key = hash_bytes_extended((const unsigned char *)provider.data(), (int)provider.size(), dbid);
+  key = hash_combine64(key, hash_bytes_extended((const unsigned char *)model.data(), (int)model.size(), 0));
+  if (key == 0)
+    key = 1;
+
+  for (int i = 0; i < GEN_STATS_MAX_ENTRIES; i++)
+  {
+    GenStatsEntry *e = &s->entries[(key + i) % GEN_STATS_MAX_ENTRIES];
+    uint64 current = pg_atomic_read_u64(&e->key);
+    if (current == 0)
+    {
+      if (pg_atomic_compare_exchange_u64(&e->key, &current, key))
+      {
+        e->dbid = dbid;
+        copy_name(e->provider, sizeof(e->provider), provider);
+        copy_name(e->model, sizeof(e->model), model);
+        pg_write_barrier();
+        pg_atomic_write_u32(&e->ready, 1);
+        return e;
+      }
+      // lost the race: current now holds the winner's key
+    }
+    if (current != key)
+      continue;
+    // claimed with our hash; the names follow within a few instructions
+    while (pg_atomic_read_u32(&e->ready) == 0)
+      SPIN_DELAY();
+    pg_read_barrier();
+    if (entry_matches(e, dbid, provider, model))
+      return e;
+  }
+  return nullptr;
+}
+
+static int bucket_for(uint64 us)
+{
+  int b = 0;
+  while (us > 1 && b < GEN_STATS_BUCKETS - 1)
+  {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void gen_stats_record(const GenStatsCall &call)
+{
+  GenStatsEntry *e = last_entry;
+  if (e == nullptr || last_dbid != MyDatabaseId || last_provider != call.provider || last_model != call.model)
+  {
+    e = find_entry(MyDatabaseId, call.provider, call.model);
+    if (e == nullptr)
+      return;
+    last_entry = e;
+    last_dbid = MyDatabaseId;
+    last_provider = call.provider;
+    last_model = call.model;
+  }
+
+  pg_atomic_fetch_add_u64(&e->calls, 1);
+  if (call.error)
+    pg_atomic_fetch_add_u64(&e->errors, 1);
+  if (call.cache_hit)
+    pg_atomic_fetch_add_u64(&e->cache_hits, 1);
+  if (call.prompt_bytes > 0)
+    pg_atomic_fetch_add_u64(&e->prompt_bytes, call.prompt_bytes);
+  if (call.response_bytes > 0)
+    pg_atomic_fetch_add_u64(&e->response_bytes, call.response_bytes);
+  if (call.prompt_tokens > 0)
+    pg_atomic_fetch_add_u64(&e->prompt_tokens, call.prompt_tokens);
+  if (call.completion_tokens > 0)
+    pg_atomic_fetch_add_u64(&e->completion_tokens, call.completion_tokens);
+  for (int p = 0; p < GEN_PHASES; p++)
+  {
+    if (call.us[p] < 0)
+      continue;
+    pg_atomic_fetch_add_u64(&e->phase_us[p], (uint64)call.us[p]);
+    pg_atomic_fetch_add_u64(&e->histogram[p][bucket_for((uint64)call.us[p])], 1);
+  }
+}
+
+void gen_stats_record_regen(int64_t us, bool ok, const int64_t phase_us[GEN_REGEN_PHASES])
+{
+  GenStatsShared *s = get_state();
+  uint64 value = (uint64)Max(us, 0);
+  pg_atomic_fetch_add_u64(&s->regens, 1);
+  if (!ok)
+    pg_atomic_fetch_add_u64(&s->regen_errors, 1);
+  pg_atomic_fetch_add_u64(&s->regen_us, value);
+  pg_atomic_write_u64(&s->regen_last_us, value);
+  pg_atomic_write_u64(&s->regen_last_at, (uint64)GetCurrentTimestamp());
+  for (int p = 0; p < GEN_REGEN_PHASES; p++)
+    pg_atomic_fetch_add_u64(&s->regen_phase_us[p], (uint64)Max(phase_us[p], 0));
+
+  uint64 max = pg_atomic_read_u64(&s->regen_max_us);
+  while (value > max && !pg_atomic_compare_exchange_u64(&s->regen_max_us, &max, value))
+    ;
+}
+
+static void reset_counters(GenStatsShared *s)
+{
+  pg_atomic_write_u64(&s->regens, 0);
+  pg_atomic_write_u64(&s->regen_errors, 0);
+  pg_atomic_write_u64(&s->regen_us, 0);
+  pg_atomic_write_u64(&s->regen_max_us, 0);
+  pg_atomic_write_u64(&s->regen_last_us, 0);
+  pg_atomic_write_u64(&s->regen_last_at, 0);
+  for (int p = 0; p < GEN_REGEN_PHASES; p++)
+    pg_atomic_write_u64(&s->regen_phase_us[p], 0);
+  // entries stay claimed (backends cache them), only their counters go back to zero
+  for (GenStatsEntry &e : s->entries)
+  {
+    pg_atomic_write_u64(&e.calls, 0);
+    pg_atomic_write_u64(&e.errors, 0);
+    pg_atomic_write_u64(&e.cache_hits, 0);
+    pg_atomic_write_u64(&e.prompt_bytes, 0);
+    pg_atomic_write_u64(&e.response_bytes, 0);
+    pg_atomic_write_u64(&e.prompt_tokens, 0);
+    pg_atomic_write_u64(&e.completion_tokens, 0);
+    for (int p = 0; p < GEN_PHASES; p++)
+    {
+      pg_atomic_write_u64(&e.phase_us[p], 0);
+      for (int b = 0; b < GEN_STATS_BUCKETS; b++)
+        pg_atomic_write_u64(&e.histogram[p][b], 0);
+    }
+  }
+  pg_atomic_write_u64(&s->reset_at, (uint64)GetCurrentTimestamp());
+}
+
+static Datum histogram_array(GenStatsEntry *e, int phase)
+{
+  Datum elems[GEN_STATS_BUCKETS];
+  for (int b = 0; b < GEN_STATS_BUCKETS; b++)
+    elems[b] = Int64GetDatum((int64)pg_atomic_read_u64(&e->histogram[phase][b]));
+  return PointerGetDatum(construct_array(elems, GEN_STATS_BUCKETS, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, TYPALIGN_DOUBLE));
+}
+
+static Datum timestamp_or_null(uint64 value, bool *isnull)
+{
+  *isnull = value == 0;
+  return TimestampTzGetDatum((TimestampTz)value);
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_stat_gen_query);
+
+  /*
+   One row per (database, provider, model): counters, total milliseconds per phase and
+   the phase histograms as arrays of GEN_STATS_BUCKETS counts
+  */
+  Datum pg_stat_gen_query(PG_FUNCTION_ARGS)
+  {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo == nullptr || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+      ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                      errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    MemoryContext oldcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+    MemoryContextSwitchTo(oldcxt);
+
+    GenStatsShared *s = get_state();
+    for (GenStatsEntry &e : s->entries)
+    {
+      if (pg_atomic_read_u32(&e.ready) == 0)
+        continue;
+      pg_read_barrier();
+
+      Datum values[10 + 2 * GEN_PHASES];
+      bool nulls[10 + 2 * GEN_PHASES];
+      memset(nulls, 0, sizeof(nulls));
+      values[0] = ObjectIdGetDatum(e.dbid);
+      values[1] = CStringGetTextDatum(e.provider);
+      values[2] = CStringGetTextDatum(e.model);
+      values[3] = Int64GetDatum((int64)pg_atomic_read_u64(&e.calls));
+      values[4] = Int64GetDatum((int64)pg_atomic_read_u64(&e.errors));
+      values[5] = Int64GetDatum((int64)pg_atomic_read_u64(&e.cache_hits));
+      values[6] = Int64GetDatum((int64)pg_atomic_read_u64(&e.prompt_bytes));
+      values[7] = Int64GetDatum((int64)pg_atomic_read_u64(&e.response_bytes));
+      values[8] = Int64GetDatum((int64)pg_atomic_read_u64(&e.prompt_tokens));
+      values[9] = Int64GetDatum((int64)pg_atomic_read_u64(&e.completion_tokens));
+      for (int p = 0; p < GEN_PHASES; p++)
+      {
+        values[10 + p] = Float8GetDatum(pg_atomic_read_u64(&e.phase_us[p]) / 1000.0);
+        values[10 + GEN_PHASES + p] = histogram_array(&e, p);
+      }
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+  }
+
+  PG_FUNCTION_INFO_V1(pg_stat_gen_query_regen);
+
+  Datum pg_stat_gen_query_regen(PG_FUNCTION_ARGS)
+  {
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    GenStatsShared *s = get_state();
+    Datum values[7 + GEN_REGEN_PHASES];
+    bool nulls[7 + GEN_REGEN_PHASES];
+    memset(nulls, 0, sizeof(nulls));
+    values[0] = Int64GetDatum((int64)pg_atomic_read_u64(&s->regens));
+    values[1] = Int64GetDatum((int64)pg_atomic_read_u64(&s->regen_errors));
+    values[2] = Float8GetDatum(pg_atomic_read_u64(&s->regen_us) / 1000.0);
+    values[3] = Float8GetDatum(pg_atomic_read_u64(&s->regen_max_us) / 1000.0);
+    values[4] = Float8GetDatum(pg_atomic_read_u64(&s->regen_last_us) / 1000.0);
+    values[5] = timestamp_or_null(pg_atomic_read_u64(&s->regen_last_at), &nulls[5]);
+    values[6] = timestamp_or_null(pg_atomic_read_u64(&s->reset_at), &nulls[6]);
+    for (int p = 0; p < GEN_REGEN_PHASES; p++)
+      values[7 + p] = Float8GetDatum(pg_atomic_read_u64(&s->regen_phase_us[p]) / 1000.0);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+  }
+
+  PG_FUNCTION_INFO_V1(pg_stat_gen_query_reset);
+
+  Datum pg_stat_gen_query_reset(PG_FUNCTION_ARGS)
+  {
+    reset_counters(get_state());
+    PG_RETURN_VOID();
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef GEN_STATS_H
+#define GEN_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ Statistics behind the pg_stat_gen_query views: one entry per (database, provider,
+ model) with call, error and cache-hit counts, prompt and response bytes, the token
+ counts the provider reported and a latency histogram per phase, plus schema
+ regeneration counts and durations.
+ Entries are claimed lock-free and every counter is an atomic, so recording never
+ waits. Shared when preloaded, otherwise per backend. When all GEN_STATS_MAX_ENTRIES
+ entries are taken, calls with a new key are not recorded.
+*/
+
+enum GenStatsPhase
+{
+  GEN_PHASE_SCHEMA_LOAD, // loading and fingerprinting the snapshot, picking the tables
+  GEN_PHASE_PROMPT,      // result cache lookup and prompt assembly
+  GEN_PHASE_PROVIDER,    // provider round trip
+  GEN_PHASE_POST,        // extracting and caching the SQL
+  GEN_PHASES
+};
+
+enum GenRegenPhase
+{
+  GEN_REGEN_CATALOG,   // catalog scans
+  GEN_REGEN_RENDER,    // encoding the tables into fragments
+  GEN_REGEN_SERIALIZE, // building the snapshot image
+  GEN_REGEN_WRITE,     // writing the schema file
+  GEN_REGEN_PUBLISH,   // publishing the new generation
+  GEN_REGEN_HINTS,     // reading the planner statistics for the hints
+  GEN_REGEN_PHASES
+};
+
+// Bucket i counts durations in [2^i, 2^(i+1)) microseconds; the last one is open-ended
+#define GEN_STATS_BUCKETS 26
+#define GEN_STATS_MAX_ENTRIES 256
+
+// One generate_sql call, as measured along the way
+struct GenStatsCall
+{
+  std::string_view provider;
+  std::string_view model;
+  bool error = false;
+  bool cache_hit = false;
+  uint64_t prompt_bytes = 0;
+  uint64_t response_bytes = 0;
+  uint64_t prompt_tokens = 0; // as reported by the provider, 0 if it didn't
+  uint64_t completion_tokens = 0;
+  int64_t us[GEN_PHASES] = {-1, -1, -1, -1}; // -1 = the phase did not run
+};
+
+size_t gen_stats_shmem_size();
+void gen_stats_shmem_startup();
+
+// Counts a call in the current database
+void gen_stats_record(const GenStatsCall &call);
+
+// Counts a schema regeneration, with the microseconds spent in each phase
+void gen_stats_record_regen(int64_t us, bool ok, const int64_t phase_us[GEN_REGEN_PHASES]);
+
+inline int64_t gen_stats_us_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
@@ -0,0 +1,241 @@
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+}
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <ai/core.h>
+#include "gen_stats.h"
+#include "generate_batch.h"
+#include "generate_sql.h"
+#include "provider_client.h"
+#include "query_cache.h"
+#include "worker_thread.h"
+
+extern int pg_gen_query_batch_concurrency;
+extern bool pg_gen_query_log_timing;
+
+/*
+ Shared by the batch threads. Plain C++ state only: prompts and the provider settings are
+ read-only while the threads run, and each result slot is written by the one thread that
+ claimed its index.
+*/
+struct BatchWork
+{
+  std::string provider;
+  std::string key;
+  std::string base_url;
+  std::string model;
+  std::vector<SqlPrompt> prompts;
+  std::vector<size_t> pending; // indexes of the queries that need a provider request
+  std::vector<SqlBatchResult> results;
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> cancelled{false};
+  std::mutex lock;
+  std::condition_variable done;
+  size_t running = 0;
+};
+
+static void batch_thread(BatchWork &work)
+{
+  // every thread gets its own client, reused (and kept alive) for all the requests it claims
+  ai::Client client;
+  bool have_client = false;
+  for (;;)
+  {
+    if (work.cancelled.load(std::memory_order_relaxed))
+    {
+      break;
+    }
+    size_t k = work.next.fetch_add(1);
+    if (k >= work.pending.size())
+    {
+      break;
+    }
+    size_t i = work.pending[k];
+    SqlBatchResult &result = work.results[i];
+
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+      if (!have_client)
+      {
+        client = provider_create_client(work.provider, work.key, work.base_url);
+        have_client = true;
+      }
+      ai::GenerateOptions options;
+      options.model = work.model;
+      options.system = *work.prompts[i].system;
+      options.prompt = work.prompts[i].prompt;
+      auto response = client.generate_text(options);
+      result.prompt_tokens = response.usage.prompt_tokens;
+      result.completion_tokens = response.usage.completion_tokens;
+      if (response.is_success())
+      {
+        result.ok = true;
+        result.sql = response.text;
+      }
+      else
+      {
+        result.error = "AI Error: " + response.error_message();
+      }
+    }
+    catch (const std::exception &e)
+    {
+      result.error = e.what();
+    }
+    catch (...)
+    {
+      result.error = "unknown error";
+    }
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(work.lock);
+    work.running--;
+  }
+  work.done.notify_all();
+}
+
+// Waits for the threads, polling for query cancel so the backend stays responsive
+static void wait_for_batch(BatchWork &work, std::vector<std::thread> &threads)
+{
+  {
+    std::unique_lock<std::mutex> guard(work.lock);
+    while (work.running > 0)
+    {
+      work.done.wait_for(guard, std::chrono::milliseconds(100));
+      if (InterruptPending)
+      {
+        work.cancelled.store(true);
+      }
+    }
+  }
+  for (std::thread &t : threads)
+  {
+    t.join();
+  }
+}
+
+// Counts one query of the batch in pg_stat_gen_query
+static void record_stats(const BatchWork &work, size_t i, int64_t post_us = -1)
+{
+  const SqlPrompt &prompt = work.prompts[i];
+  const SqlBatchResult &result = work.results[i];
+  GenStatsCall stats;
+  stats.provider = work.provider;
+  stats.model = work.model;
+  stats.cache_hit = result.cached;
+  stats.error = !result.ok;
+  stats.us[GEN_PHASE_SCHEMA_LOAD] = Max(prompt.schema_load_us, 0);
+  stats.us[GEN_PHASE_PROMPT] = prompt.prompt_us;
+  if (!result.cached)
+  {
+    stats.prompt_bytes = prompt.system->size() + prompt.prompt.size();
+    stats.prompt_tokens = result.prompt_tokens;
+    stats.completion_tokens = result.completion_tokens;
+    stats.us[GEN_PHASE_PROVIDER] = (int64_t)(result.ms * 1000);
+    stats.us[GEN_PHASE_POST] = post_us;
+  }
+  if (result.ok)
+    stats.response_bytes = result.sql.size();
+  gen_stats_record(stats);
+}
+
+std::vector<SqlBatchResult> generate_sql_batch(const std::vector<std::string> &queries)
+{
+  ProviderClient &pc = provider_client();
+
+  BatchWork work;
+  work.provider = pc.provider;
+  work.key = pc.key;
+  work.base_url = pc.base_url;
+  work.model = pc.model;
+  work.prompts.resize(queries.size());
+  work.results.resize(queries.size());
+
+  uint64_t fingerprint = current_schema_fingerprint();
+  for (size_t i = 0; i < queries.size(); i++)
+  {
+    prepare_sql_prompt(queries[i], work.model, fingerprint, work.prompts[i]);
+    if (work.prompts[i].hit)
+    {
+      work.results[i].ok = true;
+      work.results[i].cached = true;
+      work.results[i].sql = std::move(work.prompts[i].sql);
+      record_stats(work, i);
+    }
+    else
+    {
+      work.pending.push_back(i);
+    }
+  }
+  if (work.pending.empty())
+  {
+    return std::move(work.results);
+  }
+
+  size_t nthreads = std::min(work.pending.size(), (size_t)std::max(pg_gen_query_batch_concurrency, 1));
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads);
+  work.running = nthreads;
+  auto start = std::chrono::steady_clock::now();
+  try
+  {
+    for (size_t t = 0; t < nthreads; t++)
+    {
+      threads.push_back(start_worker_thread([&work]()
+                                            { batch_thread(work); }));
+    }
+  }
+  catch (...)
+  {
+    // stop the threads that did start before giving up
+    work.cancelled.store(true);
+    {
+      std::lock_guard<std::mutex> guard(work.lock);
+      work.running -= nthreads - threads.size();
+    }
+    wait_for_batch(work, threads);
+    throw;
+  }
+  wait_for_batch(work, threads);
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  // only raises the error once every thread is gone
+  CHECK_FOR_INTERRUPTS();
+
+  size_t failed = 0;
+  double sum_ms = 0;
+  for (size_t i : work.pending)
+  {
+    const SqlBatchResult &result = work.results[i];
+    sum_ms += result.ms;
+    if (result.ok)
+    {
+      auto store_start = std::chrono::steady_clock::now();
+      query_cache_store(work.prompts[i].normalized, fingerprint, work.model, result.sql);
+      record_stats(work, i, gen_stats_us_since(store_start));
+    }
+    else
+    {
+      record_stats(work, i);
+      failed++;
+    }
+  }
+  if (pg_gen_query_log_timing)
+  {
+    elog(LOG, "pg_gen_query: batch of %zu %s requests (%zu failed) on %zu threads took %.1f ms, %.1f ms summed",
+         work.pending.size(), work.provider.c_str(), failed, nthreads, ms, sum_ms);
+  }
+  return std::move(work.results);
+}
@@ -0,0 +1,28 @@
+#ifndef GENERATE_BATCH_H
+#define GENERATE_BATCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SqlBatchResult
+{
+  bool ok = false;
+  bool cached = false; // answered from the result cache
+  std::string sql;
+  std::string error;
+  double ms = 0;              // provider request time
+  uint64_t prompt_tokens = 0; // as reported by the provider
+  uint64_t completion_tokens = 0;
+};
+
+/*
+ Generates SQL for every query. Cache lookups and prompts are prepared on the backend
+ thread, then the provider requests run concurrently on up to pg_gen_query.batch_concurrency
+ helper threads (which never call into PostgreSQL) and the results are gathered back here.
+ A failed request is reported in its result instead of aborting the batch; a query cancel
+ stops the threads from starting new requests and waits for the ones in flight.
+*/
+std::vector<SqlBatchResult> generate_sql_batch(const std::vector<std::string> &queries);
+
+#endif
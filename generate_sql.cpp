@@ -1,97 +1,412 @@
 extern "C"
 {
 #include "postgres.h"
+#include "catalog/namespace.h"
+#include "common/hashfn.h"
+#include "nodes/pg_list.h"
 #include "utils/elog.h"
+#include "utils/lsyscache.h"
 }
 
 #include <chrono>
-#include <fstream>
 #include <string>
 #include <stdexcept>
+#include <vector>
 #include <ai/core.h>
-#include <ai/openai.h>
-#include <ai/anthropic.h>
-#include "constants.h"
+#include "gen_stats.h"
+#include "generate_sql.h"
+#include "hedge.h"
+#include "provider_client.h"
+#include "query_cache.h"
 #include "schema_cache.h"
+#include "schema_prune.h"
+#include "schema_snapshot.h"
+#include "sql_stream.h"
 
-extern char *ai_openai_api_key;
-extern char *ai_anthropic_api_key;
+extern bool pg_gen_query_log_timing;
+extern bool pg_gen_query_streaming;
+extern int pg_gen_query_prune_token_budget;
+extern int pg_gen_query_prune_fk_hops;
+extern bool pg_gen_query_search_path_scope;
 
-static std::string get_schema()
+static bool open_snapshot(SchemaSnapshotView &view)
 {
-  if (!schema_cache.empty())
+  std::string_view image = schema_cache_load();
+  if (image.empty())
   {
-    elog(LOG, "Using memcached schema...");
-    return schema_cache;
+    return false;
   }
-  std::ifstream f(SCHEMA_PATH);
-  if (!f.good())
+  if (!view.open(image))
   {
-    return "";
+    elog(WARNING, "Schema file %s has an unknown format, run SELECT regen_schema_cache();", schema_cache_file());
+    return false;
   }
-  schema_cache = std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
-  return schema_cache;
+  return true;
 }
 
-std::string generate_sql(const std::string &query)
+/*
+ Returns the schema document of the current snapshot
+*/
+std::string_view get_schema()
 {
+  SchemaSnapshotView view;
+  if (!open_snapshot(view))
+  {
+    return {};
+  }
+  return view.text();
+}
+
+static uint64_t hash_schema_names(const std::vector<std::string> &schemas)
+{
+  uint64_t scope = 1;
+  for (const auto &schema : schemas)
+  {
+    scope = hash_combine64(scope, hash_bytes_extended((const unsigned char *)schema.data(), (int)schema.size(), 0));
+  }
+  return scope;
+}
+
+// Schemas set with set_search_path_schemas(), used instead of the session's search_path
+static std::vector<std::string> search_path_override;
+static bool search_path_overridden = false;
+
+void set_search_path_schemas(const std::vector<std::string> *schemas)
+{
+  search_path_overridden = schemas != nullptr;
+  search_path_override = schemas ? *schemas : std::vector<std::string>();
+}
+
+/*
+ The schemas on the session's search_path (without pg_catalog and temporary schemas),
+ and a hash of them; 0 when pg_gen_query.search_path_scope is off
+*/
+uint64_t search_path_schemas(std::vector<std::string> &schemas)
+{
+  if (!pg_gen_query_search_path_scope)
+  {
+    return 0;
+  }
+  if (search_path_overridden)
+  {
+    schemas = search_path_override;
+    return hash_schema_names(schemas);
+  }
+  List *path = fetch_search_path(false);
+  ListCell *lc;
+  foreach (lc, path)
+  {
+    char *name = get_namespace_name(lfirst_oid(lc));
+    if (name != nullptr)
+    {
+      schemas.emplace_back(name);
+      pfree(name);
+    }
+  }
+  list_free(path);
+  return hash_schema_names(schemas);
+}
+
+/*
+ Returns the schema document to send along with query: the whole snapshot, the tables
+ of the search_path schemas (with pg_gen_query.search_path_scope), or only the relevant
+ tables when that exceeds pg_gen_query.prune_token_budget. Anything but the whole
+ snapshot is rendered into pruned; result tells which it was. hints gets the statistics
+ hints of the same tables (kept in pruned too when pruned).
+*/
+std::string_view get_schema_for_query(const std::string &query, std::string &pruned, SchemaEncoding *encoding,
+                                      SchemaPruneResult *result, std::string_view *hints)
+{
+  if (result)
+  {
+    *result = SCHEMA_PRUNE_NONE;
+  }
+  SchemaSnapshotView view;
+  if (!open_snapshot(view))
+  {
+    return {};
+  }
+  if (encoding)
+  {
+    *encoding = view.encoding();
+  }
+  SchemaPruneOptions options;
+  options.token_budget = (size_t)pg_gen_query_prune_token_budget;
+  options.fk_hops = pg_gen_query_prune_fk_hops;
+  search_path_schemas(options.schemas);
+  std::string pruned_hints;
+  SchemaPruneResult pruning = prune_schema(view, query, options, pruned, hints ? &pruned_hints : nullptr);
+  if (result)
+  {
+    *result = pruning;
+  }
+  if (pruning == SCHEMA_PRUNE_NONE)
+  {
+    if (hints)
+    {
+      *hints = view.hints();
+    }
+    return view.text();
+  }
+  size_t schema_len = pruned.size();
+  if (hints)
+  {
+    pruned += pruned_hints;
+    *hints = std::string_view(pruned).substr(schema_len);
+  }
+  return std::string_view(pruned).substr(0, schema_len);
+}
+
+/*
+ Fingerprint of the current schema snapshot, the result cache key for a schema. With
+ pg_gen_query.search_path_scope the search_path is part of it, since it decides which
+ tables the model sees.
+*/
+uint64_t current_schema_fingerprint()
+{
+  std::string_view schema = get_schema();
+  uint64_t fingerprint = query_cache_schema_fingerprint(schema, schema_cache_generation());
+  std::vector<std::string> schemas;
+  uint64_t scope = search_path_schemas(schemas);
+  return scope == 0 ? fingerprint : hash_combine64(fingerprint, scope);
+}
+
+/*
+ Looks query up in the result cache and, on a miss, builds the prompt to send.
+ Runs on the backend thread (reads the snapshot, the cache and GUCs).
+*/
+void prepare_sql_prompt(const std::string &query, const std::string &model, uint64_t fingerprint, SqlPrompt &out,
+                        const std::string *feedback)
+{
+  auto start = std::chrono::steady_clock::now();
+  out.fingerprint = fingerprint;
+  out.normalized = query_cache_normalize(query);
+  out.hit = feedback == nullptr && query_cache_lookup(out.normalized, fingerprint, model, out.sql);
+  if (out.hit)
+  {
+    out.prompt_us = gen_stats_us_since(start);
+    return;
+  }
+  int64_t lookup_us = gen_stats_us_since(start);
+
+  start = std::chrono::steady_clock::now();
+  std::string pruned;
+  SchemaEncoding encoding = SCHEMA_ENCODING_FLAT;
+  SchemaPruneResult pruning = SCHEMA_PRUNE_NONE;
+  std::string_view hints;
+  std::string_view prompt_schema = get_schema_for_query(query, pruned, &encoding, &pruning, &hints);
+  out.schema_load_us = gen_stats_us_since(start);
+
+  start = std::chrono::steady_clock::now();
+  // nothing that varies per query may come before the end of the schema
+  if (pruning != SCHEMA_PRUNE_RANKED)
+  {
+    std::vector<std::string> schemas;
+    uint64_t scope = pruning == SCHEMA_PRUNE_SCOPED ? search_path_schemas(schemas) : 0;
+    out.system = prompt_prefix_for_generation(schema_cache_generation(), scope, encoding, prompt_schema, hints);
+  }
+  else
+    out.system = render_prompt_prefix(encoding, prompt_schema, hints);
+  out.prompt.reserve(7 + query.size() + (feedback != nullptr ? 2 + feedback->size() : 0));
+  out.prompt.append("Query: ");
+  out.prompt.append(query);
+  if (feedback != nullptr)
+  {
+    out.prompt.append("\n\n");
+    out.prompt.append(*feedback);
+  }
+  out.prompt_us = lookup_us + gen_stats_us_since(start);
+}
+
+/*
+ Streams the answer and stops reading as soon as the first complete statement has
+ arrived, so explanations the model adds after the SQL are never waited for
+*/
+static bool stream_sql(ai::Client &client, const std::string &model, const SqlPrompt &prepared, std::string &sql,
+                       std::string &error, double &first_token_ms)
+{
+  auto start = std::chrono::steady_clock::now();
+  ai::StreamOptions stream_options;
+  stream_options.model = model;
+  stream_options.system = *prepared.system;
+  stream_options.prompt = prepared.prompt;
+  auto stream = client.stream_text(stream_options);
+
+  SqlStatementScanner scanner;
+  first_token_ms = -1;
+  for (const auto &event : stream)
+  {
+    if (event.is_text_delta())
+    {
+      if (first_token_ms < 0)
+        first_token_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      // leaving the loop drops the stream and with it the rest of the answer
+      if (scanner.feed(event.text_delta))
+        break;
+    }
+    else if (event.is_error())
+    {
+      error = event.error.value_or("stream failed");
+      return false;
+    }
+  }
+  sql = scanner.statement();
+  if (sql.empty())
+  {
+    error = "the model returned no SQL";
+    return false;
+  }
+  return true;
+}
+
+/*
+ Records the call in pg_stat_gen_query; the post-processing phase (caching the
+ answer, unless the caller stores it later) is measured here
+*/
+static std::string finish_call(GenStatsCall &stats, const SqlPrompt &prepared, const std::string &model,
+                               std::string sql, bool *store_later)
+{
+  auto start = std::chrono::steady_clock::now();
+  if (store_later != nullptr)
+    *store_later = true;
+  else
+    query_cache_store(prepared.normalized, prepared.fingerprint, model, sql);
+  stats.us[GEN_PHASE_POST] = gen_stats_us_since(start);
+  stats.response_bytes = sql.size();
+  gen_stats_record(stats);
+  return sql;
+}
+
+/*
+ Records the failed call and leaves generate_sql() with a C++ exception, raised as an
+ ERROR by the SQL function once the prompt (and its shared schema prefix) is released;
+ an elog here would longjmp past their destructors
+*/
+static void fail_call(GenStatsCall &stats, const std::string &error) pg_attribute_noreturn();
+
+static void fail_call(GenStatsCall &stats, const std::string &error)
+{
+  stats.error = true;
+  gen_stats_record(stats);
+  throw std::runtime_error("AI Error: " + error);
+}
+
+std::string generate_sql(const std::string &query, const std::string *feedback, bool *store_later)
+{
+  if (store_later != nullptr)
+    *store_later = false;
+  GenStatsCall stats;
+  std::string hedge_model; // stats.model may point here
   try
   {
-    // auto start = std::chrono::steady_clock::now();
-    std::string full_prompt =
-        "You are an expert SQL generator. "
-        "Given a database schema and a natural language query, "
-        "return ONLY an SQL query satisying ALL the conditions. "
-        "If not mentioned in the schema, assume a column is not the primary key, not unique, nullable, and has no checks.\n"
-        "Schema: `" +
-        get_schema() +
-        "`\nQuery: " +
-        query;
-    // auto end = std::chrono::steady_clock::now();
-    // auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-    // duration = 0ms (maybe because of compiler optimization? but ai call will always be high)
-    // elog(LOG, "FULL PROMPT (took %ld ms): %s", duration, full_prompt.c_str());
-
-    const char *openai = (ai_openai_api_key && ai_openai_api_key[0])
-                             ? ai_openai_api_key
-                             : getenv("OPENAI_API_KEY");
-
-    const char *anthropic = (ai_anthropic_api_key && ai_anthropic_api_key[0])
-                                ? ai_anthropic_api_key
-                                : getenv("ANTHROPIC_API_KEY");
-    ai::Client client;
+    ProviderClient &pc = provider_client();
     ai::GenerateOptions options;
-    if (openai)
+    options.model = pc.model;
+    stats.provider = pc.provider;
+    stats.model = pc.model;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t fingerprint = current_schema_fingerprint();
+    int64_t fingerprint_us = gen_stats_us_since(start);
+
+    SqlPrompt prepared;
+    prepare_sql_prompt(query, options.model, fingerprint, prepared, feedback);
+    stats.us[GEN_PHASE_SCHEMA_LOAD] = fingerprint_us + Max(prepared.schema_load_us, 0);
+    stats.us[GEN_PHASE_PROMPT] = prepared.prompt_us;
+    if (prepared.hit)
     {
-      client = ai::openai::create_client(openai);
-      options.model = "gpt-5-nano-2025-08-07";
+      stats.cache_hit = true;
+      stats.response_bytes = prepared.sql.size();
+      gen_stats_record(stats);
+      return prepared.sql;
     }
-    else if (anthropic)
+    stats.prompt_bytes = prepared.system->size() + prepared.prompt.size();
+
+    if (hedge_enabled())
     {
-      client = ai::anthropic::create_client(anthropic);
-      options.model = ai::anthropic::models::kClaudeSonnet45;
+      // cached under the primary's model, which is what lookups use; counted under the winner's
+      std::string sql, error;
+      start = std::chrono::steady_clock::now();
+      bool ok = hedged_generate(prepared.system, prepared.prompt, sql, hedge_model, error);
+      stats.us[GEN_PHASE_PROVIDER] = gen_stats_us_since(start);
+      stats.provider = "hedged";
+      if (ok)
+      {
+        stats.model = hedge_model;
+        return finish_call(stats, prepared, options.model, std::move(sql), store_later);
+      }
+      fail_call(stats, error);
     }
-    else
+
+    start = std::chrono::steady_clock::now();
+    if (pg_gen_query_streaming)
     {
-      elog(ERROR, "No LLM provider API key is found. Restart postgres service with either OPENAI_API_KEY OR ANTHROPIC_API_KEY set");
+      std::string sql, error;
+      double first_token_ms;
+      bool ok = stream_sql(pc.client, options.model, prepared, sql, error, first_token_ms);
+      stats.us[GEN_PHASE_PROVIDER] = gen_stats_us_since(start);
+      if (pg_gen_query_log_timing)
+      {
+        elog(LOG, "pg_gen_query: %s streamed request took %.1f ms to the SQL (first token %.1f ms)",
+             pc.provider.c_str(), stats.us[GEN_PHASE_PROVIDER] / 1000.0, first_token_ms);
+      }
+      if (!ok)
+      {
+        fail_call(stats, error);
+      }
+      return finish_call(stats, prepared, options.model, std::move(sql), store_later);
     }
 
-    options.prompt = full_prompt;
-    auto response = client.generate_text(options);
+    // the SDK takes its own copy; the only copy of the schema made per call
+    options.system = *prepared.system;
+    options.prompt = prepared.prompt;
+    auto response = pc.client.generate_text(options);
+    stats.us[GEN_PHASE_PROVIDER] = gen_stats_us_since(start);
+    if (pg_gen_query_log_timing)
+    {
+      elog(LOG, "pg_gen_query: %s request took %.1f ms on a %s connection (in total, connection setup not timed separately)",
+           pc.provider.c_str(), stats.us[GEN_PHASE_PROVIDER] / 1000.0, pc.connected ? "reused" : "new");
+    }
     // elog(LOG, "response finish: %s", response.finishReasonToString().c_str());
+    // the SDK's usage has no cached-token count (OpenAI's prompt_tokens_details is dropped)
+    stats.prompt_tokens = response.usage.prompt_tokens;
+    stats.completion_tokens = response.usage.completion_tokens;
     if (response.is_success())
     {
-      return response.text;
+      pc.connected = true;
+      return finish_call(stats, prepared, options.model, response.text, store_later);
     }
 
-    elog(ERROR, "AI Error: %s", response.error_message().c_str());
+    fail_call(stats, response.error_message());
   }
   catch (const std::exception &e)
   {
+    // from fail_call(), already recorded
+    if (stats.error)
+      throw;
+    if (!stats.provider.empty())
+    {
+      stats.error = true;
+      gen_stats_record(stats);
+    }
     throw std::runtime_error(std::string("generate_sql() failed: ") + e.what());
   }
   catch (...)
   {
+    if (!stats.provider.empty())
+    {
+      stats.error = true;
+      gen_stats_record(stats);
+    }
     throw std::runtime_error("generate_sql() failed with unknown error");
   }
 }
+
+/*
+ Caches an answer generate_sql() left to its caller (store_later), under the key
+ generate_sql() would have used
+*/
+void cache_generated_sql(const std::string &query, const std::string &sql)
+{
+  query_cache_store(query_cache_normalize(query), current_schema_fingerprint(), provider_client().model, sql);
+}
@@ -1,4 +1,55 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "prompt_prefix.h"
+#include "schema_encode.h"
+#include "schema_prune.h"
 
-std::string generate_sql(const std::string &prompt);
+std::string_view get_schema();
+std::string_view get_schema_for_query(const std::string &query, std::string &pruned,
+                                      SchemaEncoding *encoding = nullptr, SchemaPruneResult *result = nullptr,
+                                      std::string_view *hints = nullptr);
+/*
+ feedback, when given, is appended to the question (e.g. why an earlier answer was
+ rejected); such calls skip the result cache lookup, and their answer replaces the
+ cached one. With store_later, a generated answer is not cached; *store_later tells
+ whether it was generated (rather than found in the cache), for the caller to hand it
+ to cache_generated_sql() once it has been checked.
+*/
+std::string generate_sql(const std::string &prompt, const std::string *feedback = nullptr,
+                         bool *store_later = nullptr);
+void cache_generated_sql(const std::string &prompt, const std::string &sql);
+
+/*
+ One query prepared on the backend thread: either answered from the result cache
+ (hit, sql set) or carrying the prompt to send to the provider. The prompt is split so
+ providers can cache its prefix: system holds the instructions and the schema, and is
+ the same shared buffer for every query of a schema generation (and search_path scope)
+ as long as the tables are not ranked per question; prompt holds only the question.
+*/
+struct SqlPrompt
+{
+  std::string normalized;
+  uint64_t fingerprint = 0;
+  bool hit = false;
+  std::string sql;
+  PromptPrefix system;
+  std::string prompt;
+  int64_t schema_load_us = -1; // picking the tables for the prompt (-1 = cache hit)
+  int64_t prompt_us = 0;       // cache lookup and prompt assembly
+};
+
+uint64_t current_schema_fingerprint();
+
+/*
+ The schemas pg_gen_query.search_path_scope limits the prompt to, and a hash of them
+ (0 when it is off). Resolved from the session's search_path, unless set with
+ set_search_path_schemas() (nullptr goes back to the search_path); async workers use
+ that to answer with the submitter's search_path.
+*/
+uint64_t search_path_schemas(std::vector<std::string> &schemas);
+void set_search_path_schemas(const std::vector<std::string> *schemas);
+void prepare_sql_prompt(const std::string &query, const std::string &model, uint64_t fingerprint, SqlPrompt &out,
+                        const std::string *feedback = nullptr);
@@ -2,11 +2,106 @@ extern "C"
 {
 #include "postgres.h"
 #include "fmgr.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
 #include "utils/guc.h"
 }
 
+#include <cfloat>
+#include "async_request.h"
+#include "gen_stats.h"
+#include "hedge.h"
+#include "provider_client.h"
+#include "query_cache.h"
+#include "regen_worker.h"
+#include "schema_encode.h"
+#include "schema_cache.h"
+
 char *ai_openai_api_key = nullptr;
 char *ai_anthropic_api_key = nullptr;
+bool pg_gen_query_shared_schema = true;
+int pg_gen_query_schema_cache_memory = 256 * 1024;
+bool pg_gen_query_search_path_scope = false;
+bool pg_gen_query_deferred_regen = true;
+int pg_gen_query_regen_debounce = 1000;
+bool pg_gen_query_stats_hints = false;
+bool pg_gen_query_stats_hints_private_values = false;
+int pg_gen_query_stats_refresh_interval = 3600;
+int pg_gen_query_cache_max_entries = 1024;
+int pg_gen_query_cache_ttl = 3600;
+double pg_gen_query_cache_similarity = 0;
+int pg_gen_query_prune_token_budget = 16000;
+int pg_gen_query_prune_fk_hops = 1;
+int pg_gen_query_schema_encoding = SCHEMA_ENCODING_FLAT;
+bool pg_gen_query_warmup = false;
+bool pg_gen_query_log_timing = false;
+int pg_gen_query_batch_concurrency = 8;
+int pg_gen_query_async_workers = 4;
+int pg_gen_query_async_queue_size = 256;
+bool pg_gen_query_streaming = false;
+int pg_gen_query_exec_fetch_size = 1000;
+int pg_gen_query_exec_plan_cache_size = 64;
+bool pg_gen_query_validate = false;
+double pg_gen_query_max_plan_cost = 0;
+double pg_gen_query_max_seqscan_rows = 0;
+char *pg_gen_query_openai_base_url = nullptr;
+char *pg_gen_query_anthropic_base_url = nullptr;
+bool pg_gen_query_hedge = false;
+int pg_gen_query_hedge_delay = 2000;
+double pg_gen_query_hedge_percentile = 95;
+int pg_gen_query_hedge_primary = 0; // index into hedge_provider_names
+
+static const struct config_enum_entry schema_encoding_options[] = {
+    {"flat", SCHEMA_ENCODING_FLAT, false},
+    {"detailed", SCHEMA_ENCODING_DETAILED, false},
+    {"compact", SCHEMA_ENCODING_COMPACT, false},
+    {NULL, 0, false}};
+
+// in the order of hedge_provider_names
+static const struct config_enum_entry hedge_primary_options[] = {
+    {"openai", 0, false},
+    {"anthropic", 1, false},
+    {NULL, 0, false}};
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ Shared memory is only available when loaded via shared_preload_libraries;
+ otherwise every module falls back to backend-local state.
+*/
+static void pg_gen_query_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+#endif
+  RequestAddinShmemSpace(schema_cache_shmem_size() + regen_worker_shmem_size() + query_cache_shmem_size() +
+                         async_request_shmem_size() + hedge_shmem_size() + gen_stats_shmem_size());
+  schema_cache_shmem_request();
+  regen_worker_shmem_request();
+  query_cache_shmem_request();
+  async_request_shmem_request();
+}
+
+static void pg_gen_query_shmem_startup(void)
+{
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+  schema_cache_shmem_startup();
+  regen_worker_shmem_startup();
+  query_cache_shmem_startup();
+  async_request_shmem_startup();
+  hedge_shmem_startup();
+  gen_stats_shmem_startup();
+  LWLockRelease(AddinShmemInitLock);
+}
 
 extern "C"
 {
@@ -31,5 +126,382 @@ extern "C"
         PGC_SUSET,
         0,
         NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.shared_schema",
+        "Serve the schema snapshot from shared memory.",
+        "Requires pg_gen_query in shared_preload_libraries. When off, every backend keeps a private copy.",
+        &pg_gen_query_shared_schema,
+        true,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.schema_cache_memory",
+        "Shared memory the schema snapshots of all databases may use together.",
+        "When a database publishes a snapshot beyond this, the least recently used databases' snapshots are evicted; they are reloaded from their schema files on next use. 0 means no limit.",
+        &pg_gen_query_schema_cache_memory,
+        256 * 1024,
+        0,
+        INT_MAX,
+        PGC_SIGHUP,
+        GUC_UNIT_KB,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.search_path_scope",
+        "Send the model only the tables in the schemas of the session's search_path.",
+        NULL,
+        &pg_gen_query_search_path_scope,
+        false,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.deferred_regen",
+        "Regenerate the schema in a background worker after DDL commits.",
+        "Requires pg_gen_query in shared_preload_libraries. When off, the event triggers regenerate inside the DDL transaction.",
+        &pg_gen_query_deferred_regen,
+        true,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.regen_debounce",
+        "Quiet period after the last DDL before the schema is regenerated.",
+        NULL,
+        &pg_gen_query_regen_debounce,
+        1000,
+        0,
+        INT_MAX,
+        PGC_SIGHUP,
+        GUC_UNIT_MS,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.stats_hints",
+        "Add planner statistics hints to the schema sent to the model.",
+        "Row counts and sizes of the tables, and per column distinct counts, null fractions and, for columns "
+        "with few distinct values, those values (sent to the model). Takes effect at the next schema "
+        "regeneration or statistics refresh.",
+        &pg_gen_query_stats_hints,
+        false,
+        PGC_SIGHUP,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.stats_hints_private_values",
+        "Also list the common values of columns that PUBLIC cannot read in the statistics hints.",
+        "By default only columns readable by PUBLIC have their values listed. On exposes the data of "
+        "every low-cardinality column to the model provider, and to anyone who can see the schema sent "
+        "to it (pg_gen_query_schema_for).",
+        &pg_gen_query_stats_hints_private_values,
+        false,
+        PGC_SIGHUP,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.stats_refresh_interval",
+        "How often the background worker refreshes the statistics hints.",
+        "Only the hints are rebuilt, and a new schema generation is published only if one changed. "
+        "0 refreshes them only when the schema is regenerated.",
+        &pg_gen_query_stats_refresh_interval,
+        3600,
+        0,
+        INT_MAX / 1000,
+        PGC_SIGHUP,
+        GUC_UNIT_S,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.cache_max_entries",
+        "Number of generated queries kept in the shared result cache.",
+        "Requires pg_gen_query in shared_preload_libraries. 0 disables the cache.",
+        &pg_gen_query_cache_max_entries,
+        1024,
+        0,
+        1000000,
+        PGC_POSTMASTER,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.cache_ttl",
+        "How long a cached generated query is reused.",
+        "0 bypasses the result cache.",
+        &pg_gen_query_cache_ttl,
+        3600,
+        0,
+        INT_MAX,
+        PGC_SUSET,
+        GUC_UNIT_S,
+        NULL, NULL, NULL);
+
+    DefineCustomRealVariable(
+        "pg_gen_query.cache_similarity",
+        "Minimum similarity for reusing the SQL of a differently worded cached query.",
+        "Cosine similarity of the query sketches, between 0 and 1. Numbers and quoted strings must match exactly. 0 only reuses exact matches.",
+        &pg_gen_query_cache_similarity,
+        0,
+        0,
+        1,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.prune_token_budget",
+        "Approximate number of schema tokens sent to the model.",
+        "Larger schemas are pruned to the tables relevant to the query. 0 always sends the whole schema. "
+        "A pruned prompt differs per question, so the provider cannot cache it as a prefix: "
+        "raise this above the schema's size when prefix caching matters more than prompt size.",
+        &pg_gen_query_prune_token_budget,
+        16000,
+        0,
+        INT_MAX / 4,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.prune_fk_hops",
+        "Foreign key hops followed from the relevant tables when pruning the schema.",
+        NULL,
+        &pg_gen_query_prune_fk_hops,
+        1,
+        0,
+        10,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomEnumVariable(
+        "pg_gen_query.schema_encoding",
+        "How tables are rendered in the schema sent to the model.",
+        "flat: JSON with constraints folded into columns; detailed: JSON with separate constraint lists; "
+        "compact: one DDL-like line per table. Takes effect at the next schema regeneration.",
+        &pg_gen_query_schema_encoding,
+        SCHEMA_ENCODING_FLAT,
+        schema_encoding_options,
+        PGC_SIGHUP,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.warmup",
+        "Open the LLM provider connection when a session starts.",
+        "Sends a 1-token request in a background thread so the first query doesn't pay the DNS/TCP/TLS handshake. "
+        "With shared_preload_libraries every new session is warmed up at its first statement (once role and "
+        "database settings apply), otherwise the backend that loads the library.",
+        &pg_gen_query_warmup,
+        false,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.log_timing",
+        "Log the duration of every LLM request and of the connection warm-up.",
+        NULL,
+        &pg_gen_query_log_timing,
+        false,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.batch_concurrency",
+        "Maximum number of provider requests pg_gen_query_batch runs at the same time.",
+        NULL,
+        &pg_gen_query_batch_concurrency,
+        8,
+        1,
+        64,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.async_workers",
+        "Maximum number of background workers serving pg_gen_query_submit requests.",
+        "Workers are started on demand and count against max_worker_processes.",
+        &pg_gen_query_async_workers,
+        4,
+        0,
+        64,
+        PGC_SIGHUP,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.async_queue_size",
+        "Number of pg_gen_query_submit requests kept in shared memory, queued or waiting to be fetched.",
+        "Requires pg_gen_query in shared_preload_libraries. 0 disables async requests.",
+        &pg_gen_query_async_queue_size,
+        256,
+        0,
+        100000,
+        PGC_POSTMASTER,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.streaming",
+        "Stream the model's answer and stop reading once a complete SQL statement has arrived.",
+        "Code fences are stripped and anything after the first top-level semicolon (or the closing fence) is dropped.",
+        &pg_gen_query_streaming,
+        false,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomStringVariable(
+        "pg_gen_query.openai_base_url",
+        "Base URL of the OpenAI API, e.g. to use a proxy or a compatible server.",
+        "Empty uses the default endpoint.",
+        &pg_gen_query_openai_base_url,
+        "",
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomStringVariable(
+        "pg_gen_query.anthropic_base_url",
+        "Base URL of the Anthropic API, e.g. to use a proxy or a compatible server.",
+        "Empty uses the default endpoint.",
+        &pg_gen_query_anthropic_base_url,
+        "",
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.exec_fetch_size",
+        "Rows pg_gen_query_exec fetches from its cursor at a time.",
+        NULL,
+        &pg_gen_query_exec_fetch_size,
+        1000,
+        1,
+        INT_MAX,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.exec_plan_cache_size",
+        "Prepared plans of generated queries that pg_gen_query_exec keeps per backend.",
+        "0 disables the plan cache.",
+        &pg_gen_query_exec_plan_cache_size,
+        64,
+        0,
+        100000,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.validate",
+        "Parse and plan generated SQL before returning it, and ask the model once more if it is rejected.",
+        "Only single read-only SELECT statements within pg_gen_query.max_plan_cost and pg_gen_query.max_seqscan_rows are accepted. Applies to pg_gen_query and pg_gen_query_exec; pg_gen_query_plan always validates.",
+        &pg_gen_query_validate,
+        false,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomRealVariable(
+        "pg_gen_query.max_plan_cost",
+        "Largest estimated total cost of a validated generated query.",
+        "0 means no limit.",
+        &pg_gen_query_max_plan_cost,
+        0,
+        0,
+        DBL_MAX,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomRealVariable(
+        "pg_gen_query.max_seqscan_rows",
+        "Largest relation, in rows, a validated generated query may read with a sequential scan.",
+        "0 means no limit. Uses pg_class.reltuples, as of the last ANALYZE.",
+        &pg_gen_query_max_seqscan_rows,
+        0,
+        0,
+        DBL_MAX,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomBoolVariable(
+        "pg_gen_query.hedge",
+        "Send slow requests to the second provider as well and use the first answer.",
+        "Needs both an OpenAI and an Anthropic key. The provider set by pg_gen_query.hedge_primary is asked first; "
+        "the other one is asked too once the hedge delay passes.",
+        &pg_gen_query_hedge,
+        false,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomIntVariable(
+        "pg_gen_query.hedge_delay",
+        "Minimum wait before a request is hedged.",
+        "Used alone until enough latencies are recorded for pg_gen_query.hedge_percentile.",
+        &pg_gen_query_hedge_delay,
+        2000,
+        0,
+        INT_MAX,
+        PGC_USERSET,
+        GUC_UNIT_MS,
+        NULL, NULL, NULL);
+
+    DefineCustomRealVariable(
+        "pg_gen_query.hedge_percentile",
+        "Percentile of the primary provider's recent latencies after which a request is hedged.",
+        NULL,
+        &pg_gen_query_hedge_percentile,
+        95,
+        50,
+        100,
+        PGC_USERSET,
+        0,
+        NULL, NULL, NULL);
+
+    DefineCustomEnumVariable(
+        "pg_gen_query.hedge_primary",
+        "Provider asked first in hedged requests; the other one serves as the hedge.",
+        NULL,
+        &pg_gen_query_hedge_primary,
+        0,
+        hedge_primary_options,
+        PGC_SUSET,
+        0,
+        NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 150000
+    MarkGUCPrefixReserved("pg_gen_query");
+#endif
+
+    provider_client_init();
+
+    if (!process_shared_preload_libraries_in_progress)
+      return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = pg_gen_query_shmem_request;
+#else
+    pg_gen_query_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = pg_gen_query_shmem_startup;
+
+    regen_worker_register();
   }
 }
@@ -0,0 +1,440 @@
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <ai/core.h>
+#include "hedge.h"
+#include "provider_client.h"
+#include "worker_thread.h"
+
+extern bool pg_gen_query_hedge;
+extern int pg_gen_query_hedge_delay;
+extern double pg_gen_query_hedge_percentile;
+extern int pg_gen_query_hedge_primary;
+extern bool pg_gen_query_log_timing;
+
+#define HEDGE_SAMPLES 128
+// below this many latencies the percentile means little: use pg_gen_query.hedge_delay
+#define HEDGE_MIN_SAMPLES 20
+
+const char *const hedge_provider_names[HEDGE_PROVIDERS] = {"openai", "anthropic"};
+
+struct HedgeProviderState
+{
+  float latencies[HEDGE_SAMPLES]; // ms, ring buffer
+  int next;
+  int count;
+  uint64 requests;
+  uint64 hedged;
+  uint64 hedge_wins;
+  uint64 failures;
+};
+
+struct HedgeShared
+{
+  slock_t mutex;
+  HedgeProviderState providers[HEDGE_PROVIDERS];
+};
+
+static HedgeShared local_state;
+static HedgeShared *state = nullptr;
+
+/*
+ One provider request of a race. The backend fills in client and model before starting
+ the thread and reads the results once finished is set; the thread touches nothing else.
+*/
+struct HedgeAttempt
+{
+  ai::Client client;
+  std::string key;
+  std::string base_url;
+  std::string model;
+  std::thread thread;
+  bool started = false;
+
+  // set by the thread under HedgeRace::lock
+  bool finished = false;
+  bool ok = false;
+  std::string text;
+  std::string error;
+  double ms = 0;
+};
+
+// Shared with the threads, so an abandoned attempt can finish after the backend moved on
+struct HedgeRace
+{
+  std::mutex lock;
+  std::condition_variable changed;
+  PromptPrefix system;
+  std::string prompt;
+  HedgeAttempt attempts[HEDGE_PROVIDERS];
+};
+
+// Clients of finished attempts, kept so their connections are reused
+static std::vector<ai::Client> idle_clients[HEDGE_PROVIDERS];
+static std::string idle_configs[HEDGE_PROVIDERS]; // key and base URL of the idle clients
+
+// Races whose loser was still running; the SDK can't cancel a request in flight
+static std::vector<std::shared_ptr<HedgeRace>> abandoned;
+static bool exit_registered = false;
+
+size_t hedge_shmem_size()
+{
+  return MAXALIGN(sizeof(HedgeShared));
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void hedge_shmem_startup()
+{
+  bool found;
+  state = (HedgeShared *)ShmemInitStruct("pg_gen_query hedge stats", sizeof(HedgeShared), &found);
+  if (!found)
+  {
+    memset(state, 0, sizeof(HedgeShared));
+    SpinLockInit(&state->mutex);
+  }
+}
+
+static HedgeShared *get_state()
+{
+  if (state == nullptr)
+  {
+    memset(&local_state, 0, sizeof(HedgeShared));
+    SpinLockInit(&local_state.mutex);
+    state = &local_state;
+  }
+  return state;
+}
+
+static void record_latency(int provider, double ms)
+{
+  HedgeShared *s = get_state();
+  SpinLockAcquire(&s->mutex);
+  HedgeProviderState *p = &s->providers[provider];
+  p->latencies[p->next] = (float)ms;
+  p->next = (p->next + 1) % HEDGE_SAMPLES;
+  p->count = std::min(p->count + 1, HEDGE_SAMPLES);
+  SpinLockRelease(&s->mutex);
+}
+
+// Copies the recent latencies of provider, sorted
+static std::vector<float> latencies(int provider)
+{
+  HedgeShared *s = get_state();
+  float copy[HEDGE_SAMPLES];
+  SpinLockAcquire(&s->mutex);
+  int n = s->providers[provider].count;
+  memcpy(copy, s->providers[provider].latencies, sizeof(float) * n);
+  SpinLockRelease(&s->mutex);
+
+  std::vector<float> sorted(copy, copy + n);
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+static double percentile(const std::vector<float> &sorted, double pct)
+{
+  size_t k = (size_t)std::ceil(pct / 100.0 * sorted.size());
+  return sorted[k > 0 ? k - 1 : 0];
+}
+
+static double hedge_delay_ms(const std::vector<float> &sorted)
+{
+  double delay = pg_gen_query_hedge_delay;
+  if (sorted.size() >= HEDGE_MIN_SAMPLES)
+  {
+    delay = std::max(delay, percentile(sorted, pg_gen_query_hedge_percentile));
+  }
+  return delay;
+}
+
+bool hedge_enabled()
+{
+  if (!pg_gen_query_hedge)
+  {
+    return false;
+  }
+  std::string key, model;
+  return provider_config_for(hedge_provider_names[0], key, model) &&
+         provider_config_for(hedge_provider_names[1], key, model);
+}
+
+static std::string client_config(const HedgeAttempt &attempt)
+{
+  return attempt.key + '\n' + attempt.base_url;
+}
+
+static ai::Client take_client(int provider, const HedgeAttempt &attempt)
+{
+  if (idle_configs[provider] != client_config(attempt))
+  {
+    idle_clients[provider].clear();
+    idle_configs[provider] = client_config(attempt);
+  }
+  if (idle_clients[provider].empty())
+  {
+    return provider_create_client(hedge_provider_names[provider], attempt.key, attempt.base_url);
+  }
+  ai::Client client = std::move(idle_clients[provider].back());
+  idle_clients[provider].pop_back();
+  return client;
+}
+
+static void run_attempt(std::shared_ptr<HedgeRace> race, int i)
+{
+  HedgeAttempt &attempt = race->attempts[i];
+  auto start = std::chrono::steady_clock::now();
+  bool ok = false;
+  std::string text, error;
+  try
+  {
+    ai::GenerateOptions options;
+    options.model = attempt.model;
+    options.system = *race->system;
+    options.prompt = race->prompt;
+    auto response = attempt.client.generate_text(options);
+    ok = response.is_success();
+    if (ok)
+      text = response.text;
+    else
+      error = response.error_message();
+  }
+  catch (const std::exception &e)
+  {
+    error = e.what();
+  }
+  catch (...)
+  {
+    error = "unknown error";
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  {
+    std::lock_guard<std::mutex> guard(race->lock);
+    attempt.finished = true;
+    attempt.ok = ok;
+    attempt.text = std::move(text);
+    attempt.error = std::move(error);
+    attempt.ms = ms;
+  }
+  race->changed.notify_all();
+}
+
+static bool launch(const std::shared_ptr<HedgeRace> &race, int i)
+{
+  HedgeAttempt &attempt = race->attempts[i];
+  try
+  {
+    attempt.thread = start_worker_thread([race, i]()
+                                         { run_attempt(race, i); });
+  }
+  catch (const std::exception &e)
+  {
+    attempt.finished = true;
+    attempt.error = e.what();
+    return false;
+  }
+  attempt.started = true;
+  return true;
+}
+
+/*
+ Joins the finished attempts of a race, recording the latency of successful ones and
+ keeping their clients. A failure often returns at once (a refused connection, a 429),
+ and its latency would pull the percentile, and with it the hedge delay, down.
+ Returns false if an attempt is still running.
+*/
+static bool collect(HedgeRace &race)
+{
+  bool done = true;
+  for (int i = 0; i < HEDGE_PROVIDERS; ++i)
+  {
+    HedgeAttempt &attempt = race.attempts[i];
+    if (!attempt.started || !attempt.thread.joinable())
+      continue;
+    bool finished;
+    {
+      std::lock_guard<std::mutex> guard(race.lock);
+      finished = attempt.finished;
+    }
+    if (!finished)
+    {
+      done = false;
+      continue;
+    }
+    attempt.thread.join();
+    if (attempt.ok)
+      record_latency(i, attempt.ms);
+    if (idle_configs[i] == client_config(attempt))
+      idle_clients[i].push_back(std::move(attempt.client));
+  }
+  return done;
+}
+
+static void reap_abandoned()
+{
+  abandoned.erase(std::remove_if(abandoned.begin(), abandoned.end(),
+                                 [](const std::shared_ptr<HedgeRace> &race)
+                                 { return collect(*race); }),
+                  abandoned.end());
+}
+
+// The process is going away: let stalled requests die with it
+static void hedge_exit(int code, Datum arg)
+{
+  for (auto &race : abandoned)
+  {
+    for (HedgeAttempt &attempt : race->attempts)
+    {
+      if (attempt.thread.joinable())
+        attempt.thread.detach();
+    }
+  }
+  abandoned.clear();
+}
+
+bool hedged_generate(const PromptPrefix &system, const std::string &prompt, std::string &sql, std::string &model,
+                     std::string &error)
+{
+  reap_abandoned();
+  if (!exit_registered)
+  {
+    on_proc_exit(hedge_exit, 0);
+    exit_registered = true;
+  }
+
+  auto race = std::make_shared<HedgeRace>();
+  race->system = system;
+  race->prompt = prompt;
+  for (int i = 0; i < HEDGE_PROVIDERS; ++i)
+  {
+    HedgeAttempt &attempt = race->attempts[i];
+    provider_config_for(hedge_provider_names[i], attempt.key, attempt.model);
+    attempt.base_url = provider_base_url(hedge_provider_names[i]);
+    attempt.client = take_client(i, attempt);
+  }
+
+  // attempts are indexed by provider; pg_gen_query.hedge_primary picks who goes first
+  const int primary_index = pg_gen_query_hedge_primary;
+  const int secondary_index = 1 - primary_index;
+  double delay = hedge_delay_ms(latencies(primary_index));
+  auto start = std::chrono::steady_clock::now();
+  auto hedge_at = start + std::chrono::microseconds((int64)(delay * 1000));
+  int winner = -1;
+  bool hedged = false;
+  bool interrupted = false;
+
+  if (launch(race, primary_index))
+  {
+    std::unique_lock<std::mutex> guard(race->lock);
+    HedgeAttempt &primary = race->attempts[primary_index];
+    HedgeAttempt &secondary = race->attempts[secondary_index];
+    for (;;)
+    {
+      if (primary.finished && primary.ok)
+        winner = primary_index;
+      else if (secondary.finished && secondary.ok)
+        winner = secondary_index;
+      if (winner >= 0 || (primary.finished && secondary.finished))
+        break;
+
+      auto now = std::chrono::steady_clock::now();
+      // hedge after the delay, or right away if the primary failed
+      if (!hedged && (primary.finished || now >= hedge_at))
+      {
+        hedged = true;
+        launch(race, secondary_index);
+        continue;
+      }
+
+      auto wake = now + std::chrono::milliseconds(100);
+      if (!hedged)
+        wake = std::min(wake, hedge_at);
+      race->changed.wait_until(guard, wake);
+      if (InterruptPending)
+      {
+        interrupted = true;
+        break;
+      }
+    }
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  {
+    // after an interrupt the attempts may still be running
+    std::lock_guard<std::mutex> guard(race->lock);
+    if (winner >= 0)
+    {
+      sql = race->attempts[winner].text;
+      model = race->attempts[winner].model;
+    }
+    else if (interrupted)
+      error = "interrupted";
+    else
+    {
+      error = std::string(hedge_provider_names[primary_index]) + ": " + race->attempts[primary_index].error;
+      if (hedged)
+        error += "; " + std::string(hedge_provider_names[secondary_index]) + ": " +
+                 race->attempts[secondary_index].error;
+    }
+  }
+  if (!collect(*race))
+    abandoned.push_back(race);
+
+  HedgeShared *s = get_state();
+  SpinLockAcquire(&s->mutex);
+  HedgeProviderState *p = &s->providers[primary_index];
+  p->requests++;
+  if (hedged)
+    p->hedged++;
+  if (winner == secondary_index)
+    p->hedge_wins++;
+  if (winner < 0 && !interrupted)
+    p->failures++;
+  SpinLockRelease(&s->mutex);
+
+  // the caller raises the cancel once the C++ objects are gone; a longjmp here would leak the race
+  if (interrupted)
+    return false;
+  if (pg_gen_query_log_timing)
+  {
+    elog(LOG, "pg_gen_query: hedged request took %.1f ms (delay %.0f ms, %s, won by %s)",
+         ms, delay, hedged ? "hedged" : "not hedged",
+         winner >= 0 ? hedge_provider_names[winner] : "neither");
+  }
+  return winner >= 0;
+}
+
+HedgeStats hedge_stats(int provider)
+{
+  HedgeStats stats = {};
+  HedgeShared *s = get_state();
+  SpinLockAcquire(&s->mutex);
+  HedgeProviderState *p = &s->providers[provider];
+  stats.requests = p->requests;
+  stats.hedged = p->hedged;
+  stats.hedge_wins = p->hedge_wins;
+  stats.failures = p->failures;
+  SpinLockRelease(&s->mutex);
+
+  std::vector<float> sorted = latencies(provider);
+  stats.samples = (int)sorted.size();
+  stats.p50_ms = sorted.empty() ? 0 : percentile(sorted, 50);
+  stats.delay_ms = hedge_delay_ms(sorted);
+  return stats;
+}
@@ -0,0 +1,52 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "prompt_prefix.h"
+
+/*
+ Hedged requests: with pg_gen_query.hedge on and both providers configured, the prompt
+ goes to the primary provider (pg_gen_query.hedge_primary, OpenAI by default) and, if no
+ answer arrives within the hedge delay, also to the other one. The first successful
+ answer wins.
+ The delay is the pg_gen_query.hedge_percentile of the primary's recent latencies,
+ never less than pg_gen_query.hedge_delay (which is used alone until enough latencies
+ are recorded). Latencies and win counters live in shared memory when preloaded,
+ otherwise per backend.
+*/
+
+struct HedgeStats
+{
+  uint64_t requests;   // hedging-mode requests with this provider as primary
+  uint64_t hedged;     // ... that also went to the other provider
+  uint64_t hedge_wins; // ... answered by the other provider
+  uint64_t failures;   // ... where both failed
+  int samples;         // recent latencies recorded
+  double p50_ms;
+  double delay_ms; // current hedge delay
+};
+
+#define HEDGE_PROVIDERS 2
+extern const char *const hedge_provider_names[HEDGE_PROVIDERS];
+
+size_t hedge_shmem_size();
+void hedge_shmem_startup();
+
+// True if hedging is on and both providers are configured
+bool hedge_enabled();
+
+/*
+ Sends the prompt (the system prefix and the question) as described above. Returns
+ true with the winning answer in sql, and the model that produced it in model; false
+ with the errors of both providers in error, or "interrupted" when a cancel is pending,
+ which the caller raises (CHECK_FOR_INTERRUPTS) once its C++ objects are released.
+ Runs the requests on helper threads; the backend thread waits and handles interrupts.
+*/
+bool hedged_generate(const PromptPrefix &system, const std::string &prompt, std::string &sql, std::string &model,
+                     std::string &error);
+
+HedgeStats hedge_stats(int provider);
+
+#endif
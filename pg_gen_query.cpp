@@ -2,7 +2,14 @@ extern "C"
 {
 #include "postgres.h"
 #include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 #include "executor/spi.h"
 }
 
@@ -15,10 +22,15 @@ extern "C"
 
 #include <string>
 #include <exception>
+#include <vector>
+#include "generate_batch.h"
 #include "generate_sql.h"
+#include "hedge.h"
+#include "plan_cache.h"
+#include "query_cache.h"
+#include "schema_cache.h"
+#include "validate_sql.h"
 
-// TODO: Add support to return records (maybe in a separate function?)
-// TODO: Add support for multiple queries
 extern "C"
 {
   PG_FUNCTION_INFO_V1(pg_gen_query);
@@ -29,47 +41,18 @@ extern "C"
     {
       PG_RETURN_NULL();
     }
-    // ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
-    // if (rsinfo == nullptr || !IsA(rsinfo, ReturnSetInfo))
-    // {
-    //   ereport(ERROR, (errmsg("set-valued function called in context that cannot accept a set")));
-    // }
-    // rsinfo->returnMode = SFRM_Materialize;
-    // rsinfo->setDesc = nullptr;
-    // Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, 1024);
-    // rsinfo->setResult = tupstore;
     try
     {
       text *input_text = PG_GETARG_TEXT_PP(0);
       std::string input(VARDATA_ANY(input_text), VARSIZE_ANY_EXHDR(input_text));
       // std::string sql_query = "no-op";
-      std::string sql_query = generate_sql(input);
+      std::string sql_query = generate_validated_sql(input);
       PG_RETURN_TEXT_P(cstring_to_text(sql_query.c_str()));
-      // if (SPI_connect() != SPI_OK_CONNECT)
-      // {
-      //   elog(ERROR, "SPI_connect failed");
-      // }
-      // auto ret = SPI_execute(sql_query.c_str(), true, 0);
-      // if (ret != SPI_OK_SELECT && ret != SPI_OK_INSERT && ret != SPI_OK_UPDATE)
-      // {
-      //   elog(WARNING, "SPI_execute returned unexpected code: %d", ret);
-      // }
-
-      // SPITupleTable *tuptable = SPI_tuptable;
-      // TupleDesc tupdesc = tuptable->tupdesc;
-      // rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
-
-      // for (uint64 i = 0; i < SPI_processed; i++)
-      // {
-      //   tuplestore_puttuple(tupstore, tuptable->vals[i]);
-      // }
-
-      // SPI_finish();
-      // tuplestore_donestoring(tupstore);
-      return (Datum)0;
     }
     catch (const std::exception &e)
     {
+      // a cancel that ended a hedged request is reported as such
+      CHECK_FOR_INTERRUPTS();
       ereport(ERROR, (errmsg("C++ exception in hepg_gen_queryllo_cpp: %s", e.what())));
       PG_RETURN_NULL();
     }
@@ -80,4 +63,306 @@ extern "C"
       PG_RETURN_NULL();
     }
   }
-}
\ No newline at end of file
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_plan);
+
+  /*
+   Like pg_gen_query, but the SQL is always validated (see validate_sql.h) and comes
+   with the estimated total cost of its plan
+  */
+  Datum pg_gen_query_plan(PG_FUNCTION_ARGS)
+  {
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    text *input_text = PG_GETARG_TEXT_PP(0);
+    std::string input(VARDATA_ANY(input_text), VARSIZE_ANY_EXHDR(input_text));
+    std::string sql;
+    double cost = -1;
+    try
+    {
+      sql = generate_validated_sql(input, &cost);
+    }
+    catch (const std::exception &e)
+    {
+      CHECK_FOR_INTERRUPTS();
+      ereport(ERROR, (errmsg("C++ exception in pg_gen_query_plan: %s", e.what())));
+    }
+
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    values[0] = PointerGetDatum(cstring_to_text_with_len(sql.data(), (int)sql.size()));
+    values[1] = Float8GetDatum(cost);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+  }
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_schema_info);
+
+  /*
+   Reports the schema snapshot this backend would send to the model
+   (loading it if needed) without calling any provider.
+  */
+  Datum pg_gen_query_schema_info(PG_FUNCTION_ARGS)
+  {
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    size_t bytes = get_schema().size();
+
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+    values[0] = Int64GetDatum((int64)schema_cache_generation());
+    values[1] = Int64GetDatum((int64)bytes);
+    values[2] = BoolGetDatum(schema_cache_is_shared());
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+  }
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_schema_for);
+
+  /*
+   The schema document pg_gen_query would send for this query (limited to the
+   search_path schemas with pg_gen_query.search_path_scope, pruned when it exceeds
+   pg_gen_query.prune_token_budget), followed by the statistics hints of its tables
+  */
+  Datum pg_gen_query_schema_for(PG_FUNCTION_ARGS)
+  {
+    text *input_text = PG_GETARG_TEXT_PP(0);
+    std::string input(VARDATA_ANY(input_text), VARSIZE_ANY_EXHDR(input_text));
+    std::string pruned;
+    std::string_view hints;
+    std::string_view schema = get_schema_for_query(input, pruned, nullptr, nullptr, &hints);
+    if (hints.empty())
+    {
+      PG_RETURN_TEXT_P(cstring_to_text_with_len(schema.data(), (int)schema.size()));
+    }
+    std::string document;
+    document.reserve(schema.size() + 1 + hints.size());
+    document.append(schema);
+    document.push_back('\n');
+    document.append(hints);
+    PG_RETURN_TEXT_P(cstring_to_text_with_len(document.data(), (int)document.size()));
+  }
+
+  PG_FUNCTION_INFO_V1(pg_gen_query_schema_snapshots);
+
+  /*
+   One row per database whose schema snapshot is resident in shared memory, with when
+   a backend last used it (snapshots are evicted least recently used first)
+  */
+  Datum pg_gen_query_schema_snapshots(PG_FUNCTION_ARGS)
+  {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo == nullptr || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+      ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                      errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    MemoryContext oldcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+    MemoryContextSwitchTo(oldcxt);
+
+    for (const SchemaCacheEntry &entry : schema_cache_entries())
+    {
+      Datum values[4];
+      bool nulls[4] = {false, false, false, entry.last_used == 0};
+      values[0] = ObjectIdGetDatum((Oid)entry.dbid);
+      values[1] = Int64GetDatum((int64)entry.generation);
+      values[2] = Int64GetDatum((int64)entry.bytes);
+      values[3] = TimestampTzGetDatum((TimestampTz)entry.last_used);
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+  }
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_cache_stats);
+
+  Datum pg_gen_query_cache_stats(PG_FUNCTION_ARGS)
+  {
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    QueryCacheStats stats = query_cache_stats();
+
+    Datum values[6];
+    bool nulls[6] = {false, false, false, false, false, false};
+    values[0] = Int64GetDatum((int64)stats.hits);
+    values[1] = Int64GetDatum((int64)stats.similar_hits);
+    values[2] = Int64GetDatum((int64)stats.misses);
+    values[3] = Int64GetDatum((int64)stats.evictions);
+    values[4] = Int64GetDatum((int64)stats.entries);
+    values[5] = Int64GetDatum((int64)stats.capacity);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+  }
+
+  PG_FUNCTION_INFO_V1(pg_gen_query_hedge_stats);
+
+  /*
+   One row per provider, as the primary of hedged requests: how often the request was
+   hedged and won by the other provider, plus its recent latencies
+  */
+  Datum pg_gen_query_hedge_stats(PG_FUNCTION_ARGS)
+  {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo == nullptr || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+      ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                      errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    MemoryContext oldcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+    MemoryContextSwitchTo(oldcxt);
+
+    for (int i = 0; i < HEDGE_PROVIDERS; i++)
+    {
+      HedgeStats stats = hedge_stats(i);
+      Datum values[8];
+      bool nulls[8] = {false, false, false, false, false, false, false, false};
+      values[0] = CStringGetTextDatum(hedge_provider_names[i]);
+      values[1] = Int64GetDatum((int64)stats.requests);
+      values[2] = Int64GetDatum((int64)stats.hedged);
+      values[3] = Int64GetDatum((int64)stats.hedge_wins);
+      values[4] = Int64GetDatum((int64)stats.failures);
+      values[5] = Int32GetDatum(stats.samples);
+      values[6] = Float8GetDatum(stats.p50_ms);
+      values[7] = Float8GetDatum(stats.delay_ms);
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+  }
+
+  PG_FUNCTION_INFO_V1(pg_gen_query_cache_reset);
+
+  Datum pg_gen_query_cache_reset(PG_FUNCTION_ARGS)
+  {
+    query_cache_reset();
+    plan_cache_reset();
+    PG_RETURN_VOID();
+  }
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_batch);
+
+  /*
+   Generates SQL for every element of the array, with the provider requests running
+   concurrently. Returns one (ordinal, query, sql, error) row per element, in order;
+   a failed query has a NULL sql and its error message.
+  */
+  Datum pg_gen_query_batch(PG_FUNCTION_ARGS)
+  {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    if (rsinfo == nullptr || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+      ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                      errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+      elog(ERROR, "return type must be a row type");
+    }
+
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+    Datum *elems;
+    bool *elem_nulls;
+    int nelems;
+    deconstruct_array(array, TEXTOID, -1, false, TYPALIGN_INT, &elems, &elem_nulls, &nelems);
+
+    std::vector<std::string> queries;
+    std::vector<size_t> ordinals; // position in the array of each non-NULL query
+    for (int i = 0; i < nelems; i++)
+    {
+      if (elem_nulls[i])
+        continue;
+      text *t = DatumGetTextPP(elems[i]);
+      queries.emplace_back(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+      ordinals.push_back(i);
+    }
+
+    std::vector<SqlBatchResult> results;
+    try
+    {
+      results = generate_sql_batch(queries);
+    }
+    catch (const std::exception &e)
+    {
+      ereport(ERROR, (errmsg("C++ exception in pg_gen_query_batch: %s", e.what())));
+    }
+
+    MemoryContext oldcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    Tuplestorestate *tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+    MemoryContextSwitchTo(oldcxt);
+
+    size_t next = 0;
+    for (int i = 0; i < nelems; i++)
+    {
+      Datum values[4];
+      bool nulls[4] = {false, true, true, true};
+      values[0] = Int32GetDatum(i + 1);
+      if (next < ordinals.size() && ordinals[next] == (size_t)i)
+      {
+        const SqlBatchResult &result = results[next];
+        values[1] = PointerGetDatum(cstring_to_text_with_len(queries[next].data(), (int)queries[next].size()));
+        nulls[1] = false;
+        if (result.ok)
+        {
+          values[2] = PointerGetDatum(cstring_to_text_with_len(result.sql.data(), (int)result.sql.size()));
+          nulls[2] = false;
+        }
+        else
+        {
+          values[3] = PointerGetDatum(cstring_to_text_with_len(result.error.data(), (int)result.error.size()));
+          nulls[3] = false;
+        }
+        next++;
+      }
+      tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+  }
+}
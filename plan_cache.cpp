@@ -0,0 +1,90 @@
+extern "C"
+{
+#include "postgres.h"
+#include "executor/spi.h"
+}
+
+#include <list>
+#include <unordered_map>
+#include "plan_cache.h"
+
+extern int pg_gen_query_exec_plan_cache_size;
+
+struct PlanCacheEntry
+{
+  std::string normalized;
+  SPIPlanPtr plan;
+};
+
+// Most recently used first
+static std::list<PlanCacheEntry> lru;
+static std::unordered_map<std::string, std::list<PlanCacheEntry>::iterator> plans;
+static uint64_t cached_generation = 0;
+static PlanCacheStats stats;
+
+static void drop_entry(std::list<PlanCacheEntry>::iterator it)
+{
+  // an open cursor holds its own reference to the plan, so this is safe mid-scan
+  SPI_freeplan(it->plan);
+  plans.erase(it->normalized);
+  lru.erase(it);
+}
+
+static void drop_all()
+{
+  while (!lru.empty())
+    drop_entry(std::prev(lru.end()));
+}
+
+// Drops every plan prepared against an older schema generation
+static void check_generation(uint64_t generation)
+{
+  if (generation == cached_generation)
+    return;
+  stats.invalidations += lru.size();
+  drop_all();
+  cached_generation = generation;
+}
+
+SPIPlanPtr plan_cache_lookup(const std::string &normalized, uint64_t generation)
+{
+  check_generation(generation);
+  auto found = plans.find(normalized);
+  if (found == plans.end())
+  {
+    stats.misses++;
+    return NULL;
+  }
+  stats.hits++;
+  lru.splice(lru.begin(), lru, found->second);
+  return found->second->plan;
+}
+
+void plan_cache_store(const std::string &normalized, uint64_t generation, SPIPlanPtr plan)
+{
+  check_generation(generation);
+  if (pg_gen_query_exec_plan_cache_size <= 0 || plans.count(normalized) > 0)
+    return;
+  while (!lru.empty() && lru.size() >= (size_t)pg_gen_query_exec_plan_cache_size)
+  {
+    drop_entry(std::prev(lru.end()));
+    stats.evictions++;
+  }
+
+  if (SPI_keepplan(plan) != 0)
+    elog(ERROR, "SPI_keepplan failed");
+  lru.push_front(PlanCacheEntry{normalized, plan});
+  plans.emplace(normalized, lru.begin());
+}
+
+PlanCacheStats plan_cache_stats()
+{
+  PlanCacheStats out = stats;
+  out.entries = lru.size();
+  return out;
+}
+
+void plan_cache_reset()
+{
+  drop_all();
+}
@@ -0,0 +1,35 @@
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+struct _SPI_plan;
+
+/*
+ Per-backend cache of kept SPI plans for pg_gen_query_exec, keyed by the normalized
+ generated SQL (sql_normalize) and the schema generation it was generated against.
+ Holds at most pg_gen_query.exec_plan_cache_size plans, least recently used first out;
+ all of them are dropped once a new schema generation is published. Plans stay valid
+ across DDL on their own: the plan cache of PostgreSQL replans them when needed.
+*/
+
+struct PlanCacheStats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations; // plans dropped for a new schema generation
+  uint64_t entries;
+};
+
+// A cached plan, or NULL
+_SPI_plan *plan_cache_lookup(const std::string &normalized, uint64_t generation);
+
+// Keeps plan (SPI_keepplan) and caches it; must be called while connected to SPI
+void plan_cache_store(const std::string &normalized, uint64_t generation, _SPI_plan *plan);
+
+PlanCacheStats plan_cache_stats();
+void plan_cache_reset();
+
+#endif
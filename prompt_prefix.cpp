@@ -0,0 +1,54 @@
+#include <cstring>
+#include <string>
+#include "prompt_prefix.h"
+
+static const char instructions[] =
+    "You are an expert SQL generator. "
+    "Given a database schema and a natural language query, "
+    "return ONLY an SQL query satisying ALL the conditions. "
+    "If not mentioned in the schema, assume a column is not the primary key, not unique, nullable, and has no checks.\n";
+
+static const char hints_heading[] =
+    "\nTable sizes and value distributions from the planner statistics (approximate, ~ = estimate); "
+    "prefer plans that suit them, e.g. filter and aggregate large tables before joining:\n";
+
+PromptPrefix render_prompt_prefix(SchemaEncoding encoding, std::string_view schema, std::string_view hints)
+{
+  const char *legend = schema_encoding_legend(encoding);
+  size_t legend_len = strlen(legend);
+  auto prefix = std::make_shared<std::string>();
+  prefix->reserve(sizeof(instructions) - 1 + legend_len + schema.size() + 10 +
+                  (hints.empty() ? 0 : sizeof(hints_heading) - 1 + hints.size()));
+  prefix->append(instructions, sizeof(instructions) - 1);
+  prefix->append(legend, legend_len);
+  prefix->append("Schema: `");
+  prefix->append(schema);
+  prefix->push_back('`');
+  if (!hints.empty())
+  {
+    prefix->append(hints_heading, sizeof(hints_heading) - 1);
+    prefix->append(hints);
+  }
+  return prefix;
+}
+
+PromptPrefix prompt_prefix_for_generation(uint64_t generation, uint64_t scope, SchemaEncoding encoding,
+                                          std::string_view schema, std::string_view hints)
+{
+  static uint64_t cached_generation = 0;
+  static uint64_t cached_scope = 0;
+  static SchemaEncoding cached_encoding = SCHEMA_ENCODING_FLAT;
+  static PromptPrefix cached_prefix;
+  if (generation != 0 && generation == cached_generation && scope == cached_scope && encoding == cached_encoding)
+    return cached_prefix;
+
+  PromptPrefix prefix = render_prompt_prefix(encoding, schema, hints);
+  if (generation != 0)
+  {
+    cached_generation = generation;
+    cached_scope = scope;
+    cached_encoding = encoding;
+    cached_prefix = prefix;
+  }
+  return prefix;
+}
@@ -0,0 +1,31 @@
+#ifndef PROMPT_PREFIX_H
+#define PROMPT_PREFIX_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "schema_encode.h"
+
+/*
+ The system prompt sent with every question: the instructions, the encoding legend,
+ the schema and the statistics hints of its tables (if any). For the whole schema it is
+ rendered once per schema generation into an immutable buffer, shared by every call of
+ the backend and by the helper threads of batch and hedged requests (the refcount is
+ atomic, the text is never written again).
+ Tables ranked for a question differ per call and are rendered per call.
+ No PostgreSQL dependencies, so it can be benchmarked standalone.
+*/
+using PromptPrefix = std::shared_ptr<const std::string>;
+
+// Renders the prefix for schema with a single allocation
+PromptPrefix render_prompt_prefix(SchemaEncoding encoding, std::string_view schema, std::string_view hints = {});
+
+/*
+ The prefix for the schema of generation, rendered on the first call and reused until
+ the generation or scope changes (generation 0 is never cached). scope identifies the
+ search_path the tables were picked for, 0 for the whole schema.
+*/
+PromptPrefix prompt_prefix_for_generation(uint64_t generation, uint64_t scope, SchemaEncoding encoding,
+                                          std::string_view schema, std::string_view hints = {});
+
+#endif
@@ -0,0 +1,296 @@
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+#include "parser/analyze.h"
+#include "storage/ipc.h"
+}
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <ai/openai.h>
+#include <ai/anthropic.h>
+#include "provider_client.h"
+#include "worker_thread.h"
+
+extern char *ai_openai_api_key;
+extern char *ai_anthropic_api_key;
+extern char *pg_gen_query_openai_base_url;
+extern char *pg_gen_query_anthropic_base_url;
+extern bool pg_gen_query_warmup;
+extern bool pg_gen_query_log_timing;
+
+// How long the first call waits for a warm-up still in flight before opening its own connection
+#define WARMUP_WAIT_MS 2000
+
+static ProviderClient current;
+static bool have_client = false;
+
+/*
+ State of the warm-up thread, shared with it so a warm-up that is given up on can
+ finish on its own. The thread only touches client, ok, error and ms (and nothing of
+ PostgreSQL), then sets finished under lock.
+*/
+struct ProviderWarmup
+{
+  std::thread thread;
+  std::mutex lock;
+  std::condition_variable changed;
+  bool finished = false;
+  std::string provider;
+  std::string key;
+  std::string base_url;
+  ai::Client client;
+  bool ok = false;
+  std::string error;
+  double ms = 0;
+};
+
+static std::shared_ptr<ProviderWarmup> warmup;
+static bool warmup_exit_registered = false;
+static post_parse_analyze_hook_type prev_post_parse_analyze_hook = NULL;
+static bool warmup_checked = false;
+
+bool provider_config_for(const std::string &provider, std::string &key, std::string &model)
+{
+  const char *value;
+  if (provider == "openai")
+  {
+    value = (ai_openai_api_key && ai_openai_api_key[0]) ? ai_openai_api_key : getenv("OPENAI_API_KEY");
+    model = "gpt-5-nano-2025-08-07";
+  }
+  else
+  {
+    value = (ai_anthropic_api_key && ai_anthropic_api_key[0]) ? ai_anthropic_api_key : getenv("ANTHROPIC_API_KEY");
+    model = ai::anthropic::models::kClaudeSonnet45;
+  }
+  if (!value)
+  {
+    return false;
+  }
+  key = value;
+  return true;
+}
+
+bool provider_config(std::string &provider, std::string &key, std::string &model)
+{
+  for (const char *name : {"openai", "anthropic"})
+  {
+    if (provider_config_for(name, key, model))
+    {
+      provider = name;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string provider_base_url(const std::string &provider)
+{
+  const char *url = provider == "openai" ? pg_gen_query_openai_base_url : pg_gen_query_anthropic_base_url;
+  return url ? url : "";
+}
+
+ai::Client provider_create_client(const std::string &provider, const std::string &key,
+                                  const std::string &base_url)
+{
+  if (provider == "openai")
+  {
+    return base_url.empty() ? ai::openai::create_client(key) : ai::openai::create_client(key, base_url);
+  }
+  return base_url.empty() ? ai::anthropic::create_client(key) : ai::anthropic::create_client(key, base_url);
+}
+
+/*
+ Waits up to WARMUP_WAIT_MS for the warm-up thread and adopts its client if the
+ configuration still matches. A warm-up that hasn't finished by then (a provider that
+ doesn't answer) or a pending cancel is given up on: the thread is detached and its
+ client dropped when it ends, and the call opens its own connection.
+*/
+static void finish_warmup()
+{
+  if (!warmup)
+  {
+    return;
+  }
+  std::shared_ptr<ProviderWarmup> w = std::move(warmup);
+  bool finished;
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WARMUP_WAIT_MS);
+    std::unique_lock<std::mutex> guard(w->lock);
+    while (!w->finished && !InterruptPending && std::chrono::steady_clock::now() < deadline)
+      w->changed.wait_until(guard, std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+    finished = w->finished;
+  }
+  if (!finished)
+  {
+    w->thread.detach();
+    elog(LOG, "pg_gen_query: %s warm-up still running after %d ms, not waiting for it",
+         w->provider.c_str(), WARMUP_WAIT_MS);
+    CHECK_FOR_INTERRUPTS();
+    return;
+  }
+  w->thread.join();
+
+  if (!w->ok)
+  {
+    elog(LOG, "pg_gen_query: %s warm-up failed after %.1f ms: %s",
+         w->provider.c_str(), w->ms, w->error.c_str());
+  }
+  else if (pg_gen_query_log_timing)
+  {
+    elog(LOG, "pg_gen_query: %s connection warmed up in %.1f ms (connection setup and a 1-token request, not timed separately)",
+         w->provider.c_str(), w->ms);
+  }
+
+  std::string provider, key, model;
+  if (!have_client && provider_config(provider, key, model) &&
+      provider == w->provider && key == w->key && provider_base_url(provider) == w->base_url)
+  {
+    current.provider = provider;
+    current.key = key;
+    current.base_url = w->base_url;
+    current.model = model;
+    current.client = std::move(w->client);
+    current.connected = w->ok;
+    have_client = true;
+  }
+}
+
+// The process is going away: let a stalled warm-up die with it
+static void warmup_exit(int code, Datum arg)
+{
+  if (warmup && warmup->thread.joinable())
+  {
+    warmup->thread.detach();
+  }
+  warmup.reset();
+}
+
+ProviderClient &provider_client()
+{
+  finish_warmup();
+
+  std::string provider, key, model;
+  if (!provider_config(provider, key, model))
+  {
+    elog(ERROR, "No LLM provider API key is found. Restart postgres service with either OPENAI_API_KEY OR ANTHROPIC_API_KEY set");
+  }
+
+  std::string base_url = provider_base_url(provider);
+  if (!have_client || current.provider != provider || current.key != key || current.base_url != base_url)
+  {
+    if (have_client)
+    {
+      elog(DEBUG1, "pg_gen_query: provider configuration changed, creating a new %s client", provider.c_str());
+    }
+    current.provider = provider;
+    current.key = key;
+    current.base_url = base_url;
+    current.client = provider_create_client(provider, key, base_url);
+    current.connected = false;
+    have_client = true;
+  }
+  current.model = model;
+  return current;
+}
+
+void provider_client_warmup()
+{
+  if (!pg_gen_query_warmup || have_client || warmup)
+  {
+    return;
+  }
+  std::string provider, key, model;
+  if (!provider_config(provider, key, model))
+  {
+    return;
+  }
+
+  if (!warmup_exit_registered)
+  {
+    on_proc_exit(warmup_exit, 0);
+    warmup_exit_registered = true;
+  }
+  auto w = std::make_shared<ProviderWarmup>();
+  w->provider = provider;
+  w->key = key;
+  w->base_url = provider_base_url(provider);
+  w->thread = start_worker_thread(
+      [w, model]()
+      {
+        auto start = std::chrono::steady_clock::now();
+        ai::Client client;
+        bool ok = false;
+        std::string error;
+        try
+        {
+          client = provider_create_client(w->provider, w->key, w->base_url);
+          ai::GenerateOptions options;
+          options.model = model;
+          options.prompt = "ping";
+          options.max_tokens = 1;
+          auto response = client.generate_text(options);
+          ok = response.is_success();
+          if (!ok)
+            error = response.error_message();
+        }
+        catch (const std::exception &e)
+        {
+          error = e.what();
+        }
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->client = std::move(client);
+        w->ok = ok;
+        w->error = std::move(error);
+        w->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        w->finished = true;
+        w->changed.notify_all();
+      });
+  warmup = std::move(w);
+}
+
+/*
+ Runs at the first statement of every backend: only then are the role's and database's
+ settings (ALTER ROLE/DATABASE ... SET ai.openai_api_key) applied, which decide the
+ provider and key to warm up
+*/
+#if PG_VERSION_NUM >= 140000
+static void warmup_post_parse_analyze(ParseState *pstate, Query *query, JumbleState *jstate)
+#else
+static void warmup_post_parse_analyze(ParseState *pstate, Query *query)
+#endif
+{
+  if (prev_post_parse_analyze_hook)
+  {
+#if PG_VERSION_NUM >= 140000
+    prev_post_parse_analyze_hook(pstate, query, jstate);
+#else
+    prev_post_parse_analyze_hook(pstate, query);
+#endif
+  }
+  if (!warmup_checked && !IsBackgroundWorker)
+  {
+    warmup_checked = true;
+    provider_client_warmup();
+  }
+}
+
+void provider_client_init()
+{
+  if (process_shared_preload_libraries_in_progress)
+  {
+    prev_post_parse_analyze_hook = post_parse_analyze_hook;
+    post_parse_analyze_hook = warmup_post_parse_analyze;
+  }
+  else if (IsUnderPostmaster)
+  {
+    // loaded on demand (CREATE EXTENSION or first call): warm up this backend now
+    provider_client_warmup();
+  }
+}
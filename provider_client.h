@@ -0,0 +1,56 @@
+#ifndef PROVIDER_CLIENT_H
+#define PROVIDER_CLIENT_H
+
+#include <string>
+#include <ai/core.h>
+
+/*
+ Per-backend LLM provider client. Creating an ai::Client and its first request pay
+ DNS, TCP and TLS setup, so the client is kept for the life of the backend and reused;
+ it is only rebuilt when the provider, API key (ai.* GUCs or environment) or base URL
+ changes.
+*/
+
+struct ProviderClient
+{
+  std::string provider; // "openai" or "anthropic"
+  std::string key;
+  std::string model;
+  std::string base_url; // empty = the provider's default endpoint
+  ai::Client client;
+  bool connected = false; // has completed a request, so its connection is open
+};
+
+/*
+ Resolves the configured provider (OpenAI first, then Anthropic) from the GUCs or the
+ environment. Returns false if no key is set. Must run on the backend thread.
+*/
+bool provider_config(std::string &provider, std::string &key, std::string &model);
+
+// Key and model of one provider ("openai" or "anthropic"); false if it has no key
+bool provider_config_for(const std::string &provider, std::string &key, std::string &model);
+
+// pg_gen_query.<provider>_base_url, or empty for the default endpoint
+std::string provider_base_url(const std::string &provider);
+
+// Creates a client for provider/key; safe to call from a worker thread
+ai::Client provider_create_client(const std::string &provider, const std::string &key,
+                                  const std::string &base_url);
+
+/*
+ The backend's client for the configured provider, created or rebuilt as needed.
+ Errors out if no API key is configured.
+*/
+ProviderClient &provider_client();
+
+/*
+ With pg_gen_query.warmup on, opens the provider connection in a background thread
+ (a 1-token request) so the first pg_gen_query call doesn't pay the handshake.
+ provider_client() picks up the warmed client.
+*/
+void provider_client_warmup();
+
+// Installs the hook that warms up new sessions at their first statement (shared_preload_libraries only)
+void provider_client_init();
+
+#endif
@@ -0,0 +1,435 @@
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+#include "common/hashfn.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+}
+
+#include <cctype>
+#include <cstring>
+#include "query_cache.h"
+#include "query_sketch.h"
+
+extern int pg_gen_query_cache_max_entries;
+extern int pg_gen_query_cache_ttl;
+extern double pg_gen_query_cache_similarity;
+
+// Keys and results longer than this are not cached
+#define QUERY_CACHE_MAX_QUERY 1024
+#define QUERY_CACHE_MAX_SQL 4096
+#define QUERY_CACHE_MAX_MODEL 64
+
+struct QueryCacheEntry
+{
+  uint64 hash;
+  int32 next; // next entry in the bucket chain, or the free list; -1 = end
+  bool used;
+  pg_atomic_uint32 referenced; // CLOCK bit, set by readers under the shared lock
+  Oid dboid;
+  uint64 schema_fingerprint;
+  uint64 literals; // QuerySketch::literals of the query
+  TimestampTz created;
+  uint16 query_len;
+  uint16 sql_len;
+  uint16 model_len;
+  char model[QUERY_CACHE_MAX_MODEL];
+  char query[QUERY_CACHE_MAX_QUERY];
+  char sql[QUERY_CACHE_MAX_SQL];
+};
+
+/*
+ Chained hash table over a fixed entry array. The header is followed by
+ nbuckets chain heads, capacity entries and capacity query sketches; the sketches are
+ kept in one contiguous array so approximate lookups can scan them with SIMD.
+ Unused slots have all-zero sketches, which never pass a similarity threshold.
+*/
+struct QueryCacheShared
+{
+  LWLock *lock;
+  int32 capacity;
+  int32 nbuckets; // power of two
+  int32 nentries;
+  int32 free_list;
+  int32 clock_hand;
+  pg_atomic_uint64 hits;
+  pg_atomic_uint64 similar_hits;
+  pg_atomic_uint64 misses;
+  pg_atomic_uint64 evictions;
+};
+
+static QueryCacheShared *shared = nullptr;
+static int32 *buckets = nullptr;
+static QueryCacheEntry *entries = nullptr;
+static int8 *sketches = nullptr;
+
+static int32 bucket_count(int32 capacity)
+{
+  int32 n = 1;
+  while (n < capacity)
+    n <<= 1;
+  return n;
+}
+
+size_t query_cache_shmem_size()
+{
+  if (pg_gen_query_cache_max_entries <= 0)
+    return 0;
+  Size size = MAXALIGN(sizeof(QueryCacheShared));
+  size = add_size(size, MAXALIGN(mul_size(sizeof(int32), bucket_count(pg_gen_query_cache_max_entries))));
+  size = add_size(size, MAXALIGN(mul_size(sizeof(QueryCacheEntry), pg_gen_query_cache_max_entries)));
+  size = add_size(size, mul_size(QUERY_SKETCH_DIM, pg_gen_query_cache_max_entries));
+  return size;
+}
+
+void query_cache_shmem_request()
+{
+  if (pg_gen_query_cache_max_entries > 0)
+    RequestNamedLWLockTranche("pg_gen_query_cache", 1);
+}
+
+static void clear_entries()
+{
+  for (int32 i = 0; i < shared->nbuckets; ++i)
+    buckets[i] = -1;
+  for (int32 i = 0; i < shared->capacity; ++i)
+  {
+    entries[i].used = false;
+    entries[i].next = i + 1 < shared->capacity ? i + 1 : -1;
+    pg_atomic_write_u32(&entries[i].referenced, 0);
+  }
+  memset(sketches, 0, (size_t)shared->capacity * QUERY_SKETCH_DIM);
+  shared->free_list = 0;
+  shared->nentries = 0;
+  shared->clock_hand = 0;
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void query_cache_shmem_startup()
+{
+  if (pg_gen_query_cache_max_entries <= 0)
+    return;
+
+  bool found;
+  char *base = (char *)ShmemInitStruct("pg_gen_query query cache", query_cache_shmem_size(), &found);
+  shared = (QueryCacheShared *)base;
+  int32 nbuckets = bucket_count(pg_gen_query_cache_max_entries);
+  buckets = (int32 *)(base + MAXALIGN(sizeof(QueryCacheShared)));
+  entries = (QueryCacheEntry *)((char *)buckets + MAXALIGN(sizeof(int32) * nbuckets));
+  sketches = (int8 *)((char *)entries + MAXALIGN(sizeof(QueryCacheEntry) * pg_gen_query_cache_max_entries));
+  if (found)
+    return;
+
+  shared->lock = &(GetNamedLWLockTranche("pg_gen_query_cache"))->lock;
+  shared->capacity = pg_gen_query_cache_max_entries;
+  shared->nbuckets = nbuckets;
+  pg_atomic_init_u64(&shared->hits, 0);
+  pg_atomic_init_u64(&shared->similar_hits, 0);
+  pg_atomic_init_u64(&shared->misses, 0);
+  pg_atomic_init_u64(&shared->evictions, 0);
+  for (int32 i = 0; i < shared->capacity; ++i)
+    pg_atomic_init_u32(&entries[i].referenced, 0);
+  clear_entries();
+}
+
+std::string query_cache_normalize(std::string_view query)
+{
+  std::string out;
+  out.reserve(query.size());
+  char quote = 0;
+  bool space = false;
+  for (char c : query)
+  {
+    if (quote)
+    {
+      out.push_back(c);
+      if (c == quote)
+        quote = 0;
+      continue;
+    }
+    if (isspace((unsigned char)c))
+    {
+      space = !out.empty();
+      continue;
+    }
+    if (space)
+    {
+      out.push_back(' ');
+      space = false;
+    }
+    if (c == '\'' || c == '"')
+      quote = c;
+    out.push_back((char)tolower((unsigned char)c));
+  }
+  return out;
+}
+
+uint64_t query_cache_schema_fingerprint(std::string_view schema, uint64_t generation)
+{
+  static uint64_t cached_generation = 0;
+  static uint64_t cached_fingerprint = 0;
+  if (generation != 0 && generation == cached_generation)
+    return cached_fingerprint;
+
+  uint64_t fingerprint = hash_bytes_extended((const unsigned char *)schema.data(), (int)schema.size(), 0);
+  cached_generation = generation;
+  cached_fingerprint = fingerprint;
+  return fingerprint;
+}
+
+static uint64 key_hash(const std::string &normalized, uint64_t schema_fingerprint, const std::string &model)
+{
+  uint64 h = hash_bytes_extended((const unsigned char *)normalized.data(), (int)normalized.size(), 0);
+  h = hash_combine64(h, hash_bytes_extended((const unsigned char *)model.data(), (int)model.size(), 0));
+  h = hash_combine64(h, schema_fingerprint);
+  return hash_combine64(h, MyDatabaseId);
+}
+
+static bool cacheable(const std::string &normalized, const std::string &model)
+{
+  return shared != nullptr && pg_gen_query_cache_ttl > 0 &&
+         normalized.size() <= QUERY_CACHE_MAX_QUERY && model.size() <= QUERY_CACHE_MAX_MODEL;
+}
+
+// Caller holds the lock
+static int32 find_entry(uint64 hash, const std::string &normalized, uint64_t schema_fingerprint, const std::string &model)
+{
+  for (int32 i = buckets[hash & (shared->nbuckets - 1)]; i >= 0; i = entries[i].next)
+  {
+    QueryCacheEntry *e = &entries[i];
+    if (e->hash == hash && e->dboid == MyDatabaseId && e->schema_fingerprint == schema_fingerprint &&
+        e->query_len == normalized.size() && e->model_len == model.size() &&
+        memcmp(e->query, normalized.data(), normalized.size()) == 0 &&
+        memcmp(e->model, model.data(), model.size()) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Approximate matches re-checked under the lock, best first
+#define QUERY_CACHE_SIMILAR_CANDIDATES 8
+
+struct SimilarCandidate
+{
+  int32 index;
+  int32 score;
+};
+
+// Whether entry i may answer a query with this sketch; exact only when the caller holds the lock
+static bool similar_entry_matches(int32 i, const QuerySketch &sketch, uint64_t schema_fingerprint,
+                                  const std::string &model, TimestampTz oldest)
+{
+  QueryCacheEntry *e = &entries[i];
+  return e->used && e->literals == sketch.literals && e->dboid == MyDatabaseId &&
+         e->schema_fingerprint == schema_fingerprint && e->created >= oldest &&
+         e->model_len == model.size() && memcmp(e->model, model.data(), model.size()) == 0;
+}
+
+/*
+ Scans every sketch without holding the lock, so stores don't queue up behind a scan of
+ the whole cache. An entry overwritten meanwhile may score anything; the caller re-checks
+ the returned candidates (best first, at most QUERY_CACHE_SIMILAR_CANDIDATES) under the lock.
+*/
+static int find_similar_candidates(const QuerySketch &sketch, uint64_t schema_fingerprint, const std::string &model,
+                                   TimestampTz oldest, SimilarCandidate *best)
+{
+  static int32 scores[1024];
+  int32 threshold = query_sketch_threshold(pg_gen_query_cache_similarity);
+  int n = 0;
+
+  for (int32 base = 0; base < shared->capacity; base += lengthof(scores))
+  {
+    int32 count = Min((int32)lengthof(scores), shared->capacity - base);
+    query_sketch_scan(sketches + (size_t)base * QUERY_SKETCH_DIM, count, sketch.v, scores);
+    for (int32 k = 0; k < count; ++k)
+    {
+      if (scores[k] < threshold || (n == QUERY_CACHE_SIMILAR_CANDIDATES && scores[k] <= best[n - 1].score))
+        continue;
+      if (!similar_entry_matches(base + k, sketch, schema_fingerprint, model, oldest))
+        continue;
+      int pos = n < QUERY_CACHE_SIMILAR_CANDIDATES ? n++ : n - 1;
+      while (pos > 0 && best[pos - 1].score < scores[k])
+      {
+        best[pos] = best[pos - 1];
+        pos--;
+      }
+      best[pos] = {base + k, scores[k]};
+    }
+  }
+  return n;
+}
+
+// Caller holds the lock. The first candidate that still matches, or -1
+static int32 check_similar_candidates(const SimilarCandidate *candidates, int n, const QuerySketch &sketch,
+                                      uint64_t schema_fingerprint, const std::string &model, TimestampTz oldest)
+{
+  int32 threshold = query_sketch_threshold(pg_gen_query_cache_similarity);
+  for (int c = 0; c < n; ++c)
+  {
+    int32 i = candidates[c].index;
+    if (similar_entry_matches(i, sketch, schema_fingerprint, model, oldest) &&
+        query_sketch_dot(sketches + (size_t)i * QUERY_SKETCH_DIM, sketch.v) >= threshold)
+      return i;
+  }
+  return -1;
+}
+
+bool query_cache_lookup(const std::string &normalized, uint64_t schema_fingerprint,
+                        const std::string &model, std::string &sql)
+{
+  if (!cacheable(normalized, model))
+    return false;
+
+  uint64 hash = key_hash(normalized, schema_fingerprint, model);
+  TimestampTz oldest = GetCurrentTimestamp() - (TimestampTz)pg_gen_query_cache_ttl * USECS_PER_SEC;
+
+  LWLockAcquire(shared->lock, LW_SHARED);
+  int32 i = find_entry(hash, normalized, schema_fingerprint, model);
+  if (i >= 0 && entries[i].created < oldest)
+    i = -1;
+  if (i >= 0)
+  {
+    sql.assign(entries[i].sql, entries[i].sql_len);
+    pg_atomic_write_u32(&entries[i].referenced, 1);
+  }
+  LWLockRelease(shared->lock);
+  if (i >= 0)
+  {
+    pg_atomic_fetch_add_u64(&shared->hits, 1);
+    return true;
+  }
+
+  if (pg_gen_query_cache_similarity > 0)
+  {
+    QuerySketch sketch;
+    query_sketch_build(normalized, sketch);
+    SimilarCandidate candidates[QUERY_CACHE_SIMILAR_CANDIDATES];
+    int n = find_similar_candidates(sketch, schema_fingerprint, model, oldest, candidates);
+    if (n > 0)
+    {
+      LWLockAcquire(shared->lock, LW_SHARED);
+      i = check_similar_candidates(candidates, n, sketch, schema_fingerprint, model, oldest);
+      if (i >= 0)
+      {
+        sql.assign(entries[i].sql, entries[i].sql_len);
+        pg_atomic_write_u32(&entries[i].referenced, 1);
+      }
+      LWLockRelease(shared->lock);
+    }
+  }
+
+  pg_atomic_fetch_add_u64(i >= 0 ? &shared->similar_hits : &shared->misses, 1);
+  return i >= 0;
+}
+
+// Caller holds the lock exclusively
+static void unlink_entry(int32 victim)
+{
+  int32 *link = &buckets[entries[victim].hash & (shared->nbuckets - 1)];
+  while (*link != victim)
+    link = &entries[*link].next;
+  *link = entries[victim].next;
+  entries[victim].used = false;
+  memset(sketches + (size_t)victim * QUERY_SKETCH_DIM, 0, QUERY_SKETCH_DIM);
+  shared->nentries--;
+}
+
+// Caller holds the lock exclusively
+static int32 allocate_entry()
+{
+  if (shared->free_list >= 0)
+  {
+    int32 i = shared->free_list;
+    shared->free_list = entries[i].next;
+    return i;
+  }
+
+  // CLOCK: give referenced entries a second chance, evict the first one that isn't
+  for (;;)
+  {
+    int32 i = shared->clock_hand;
+    shared->clock_hand = (i + 1) % shared->capacity;
+    if (pg_atomic_exchange_u32(&entries[i].referenced, 0) == 0)
+    {
+      unlink_entry(i);
+      pg_atomic_fetch_add_u64(&shared->evictions, 1);
+      return i;
+    }
+  }
+}
+
+void query_cache_store(const std::string &normalized, uint64_t schema_fingerprint,
+                       const std::string &model, const std::string &sql)
+{
+  if (!cacheable(normalized, model) || sql.size() > QUERY_CACHE_MAX_SQL)
+    return;
+
+  uint64 hash = key_hash(normalized, schema_fingerprint, model);
+  TimestampTz now = GetCurrentTimestamp();
+  QuerySketch sketch;
+  query_sketch_build(normalized, sketch);
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  int32 i = find_entry(hash, normalized, schema_fingerprint, model);
+  if (i < 0)
+  {
+    i = allocate_entry();
+    QueryCacheEntry *e = &entries[i];
+    e->hash = hash;
+    e->dboid = MyDatabaseId;
+    e->schema_fingerprint = schema_fingerprint;
+    e->query_len = (uint16)normalized.size();
+    memcpy(e->query, normalized.data(), normalized.size());
+    e->model_len = (uint16)model.size();
+    memcpy(e->model, model.data(), model.size());
+    e->literals = sketch.literals;
+    memcpy(sketches + (size_t)i * QUERY_SKETCH_DIM, sketch.v, QUERY_SKETCH_DIM);
+    e->used = true;
+    int32 *head = &buckets[hash & (shared->nbuckets - 1)];
+    e->next = *head;
+    *head = i;
+    shared->nentries++;
+  }
+  QueryCacheEntry *e = &entries[i];
+  e->created = now;
+  e->sql_len = (uint16)sql.size();
+  memcpy(e->sql, sql.data(), sql.size());
+  pg_atomic_write_u32(&e->referenced, 1);
+  LWLockRelease(shared->lock);
+}
+
+QueryCacheStats query_cache_stats()
+{
+  QueryCacheStats stats = {};
+  if (shared == nullptr)
+    return stats;
+
+  stats.hits = pg_atomic_read_u64(&shared->hits);
+  stats.similar_hits = pg_atomic_read_u64(&shared->similar_hits);
+  stats.misses = pg_atomic_read_u64(&shared->misses);
+  stats.evictions = pg_atomic_read_u64(&shared->evictions);
+  LWLockAcquire(shared->lock, LW_SHARED);
+  stats.entries = shared->nentries;
+  stats.capacity = shared->capacity;
+  LWLockRelease(shared->lock);
+  return stats;
+}
+
+void query_cache_reset()
+{
+  if (shared == nullptr)
+    return;
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  clear_entries();
+  LWLockRelease(shared->lock);
+  pg_atomic_write_u64(&shared->hits, 0);
+  pg_atomic_write_u64(&shared->similar_hits, 0);
+  pg_atomic_write_u64(&shared->misses, 0);
+  pg_atomic_write_u64(&shared->evictions, 0);
+}
@@ -0,0 +1,46 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ Shared-memory cache of generated SQL, keyed by (database, normalized query,
+ schema fingerprint, model). A fixed number of entries (pg_gen_query.cache_max_entries)
+ is evicted CLOCK-style; entries older than pg_gen_query.cache_ttl are ignored.
+ When pg_gen_query.cache_similarity is set, an exact miss falls back to the most
+ similar cached query (see query_sketch.h).
+ Only available with shared_preload_libraries; otherwise every lookup misses.
+*/
+
+struct QueryCacheStats
+{
+  uint64_t hits;
+  uint64_t similar_hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t entries;
+  uint64_t capacity;
+};
+
+size_t query_cache_shmem_size();
+void query_cache_shmem_request();
+void query_cache_shmem_startup();
+
+// Collapses whitespace and folds case outside quoted literals
+std::string query_cache_normalize(std::string_view query);
+
+// Fingerprint of a schema document; cheap to call repeatedly for the same generation
+uint64_t query_cache_schema_fingerprint(std::string_view schema, uint64_t generation);
+
+bool query_cache_lookup(const std::string &normalized, uint64_t schema_fingerprint,
+                        const std::string &model, std::string &sql);
+void query_cache_store(const std::string &normalized, uint64_t schema_fingerprint,
+                       const std::string &model, const std::string &sql);
+
+QueryCacheStats query_cache_stats();
+void query_cache_reset();
+
+#endif
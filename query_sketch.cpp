@@ -0,0 +1,250 @@
+#include "query_sketch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QUERY_SKETCH_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define QUERY_SKETCH_NEON 1
+#endif
+
+// Filler words that carry no meaning for the generated SQL
+static const char *const stop_words[] = {
+    "a", "all", "an", "and", "are", "by", "can", "display", "every", "find", "for", "from",
+    "get", "give", "in", "is", "list", "me", "of", "on", "please", "return", "select",
+    "show", "than", "that", "the", "their", "there", "to", "us", "what", "where", "which", "with"};
+
+/*
+ Comparison words and their symbols map to one token, so "over 20", "more than 20",
+ "above 20" and "> 20" all read the same
+*/
+static const char *const comparison_words[][2] = {
+    {"above", "gt"}, {"below", "lt"}, {"exceeding", "gt"}, {"fewer", "lt"}, {"greater", "gt"},
+    {"less", "lt"}, {"more", "gt"}, {"over", "gt"}, {"under", "lt"}};
+
+static bool is_stop_word(const std::string &word)
+{
+  return std::binary_search(std::begin(stop_words), std::end(stop_words), word,
+                            [](const auto &a, const auto &b)
+                            { return std::string_view(a) < std::string_view(b); });
+}
+
+static std::string canonical_word(std::string word)
+{
+  for (const auto &cw : comparison_words)
+  {
+    if (word == cw[0])
+      return cw[1];
+  }
+  return word;
+}
+
+static uint64_t fnv1a(std::string_view s, uint64_t seed)
+{
+  uint64_t h = 14695981039346656037ULL ^ seed;
+  for (unsigned char c : s)
+  {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Signed feature hashing: the sign bit keeps collisions from only ever adding up
+static void add_feature(std::vector<float> &acc, std::string_view feature, uint64_t seed, float weight)
+{
+  uint64_t h = fnv1a(feature, seed);
+  acc[h % QUERY_SKETCH_DIM] += (h >> 63) ? -weight : weight;
+}
+
+void query_sketch_build(std::string_view query, QuerySketch &out)
+{
+  std::vector<std::string> words;
+  std::vector<std::string> literals;
+
+  size_t i = 0;
+  while (i < query.size())
+  {
+    unsigned char c = (unsigned char)query[i];
+    if (c == '\'' || c == '"')
+    {
+      size_t end = query.find((char)c, i + 1);
+      if (end == std::string_view::npos)
+        end = query.size();
+      literals.emplace_back(query.substr(i, end - i));
+      i = end + 1;
+    }
+    else if (isdigit(c))
+    {
+      std::string number;
+      for (; i < query.size() && (isdigit((unsigned char)query[i]) || query[i] == '.' || query[i] == ','); ++i)
+      {
+        if (query[i] != ',')
+          number.push_back(query[i]);
+      }
+      while (!number.empty() && number.back() == '.')
+        number.pop_back();
+      literals.push_back(number);
+    }
+    else if (isalpha(c) || c == '_')
+    {
+      std::string word;
+      for (; i < query.size() && (isalnum((unsigned char)query[i]) || query[i] == '_'); ++i)
+        word.push_back((char)tolower((unsigned char)query[i]));
+      if (!is_stop_word(word))
+        words.push_back(canonical_word(std::move(word)));
+    }
+    else if (c == '>' || c == '<')
+    {
+      bool equal = i + 1 < query.size() && query[i + 1] == '=';
+      words.push_back(c == '>' ? (equal ? "gte" : "gt") : (equal ? "lte" : "lt"));
+      i += equal ? 2 : 1;
+    }
+    else if (c == '$' && i + 1 < query.size() && isdigit((unsigned char)query[i + 1]))
+    {
+      // an amount of money is almost always compared to a price column
+      words.push_back("price");
+      ++i;
+    }
+    else
+    {
+      ++i;
+    }
+  }
+
+  std::vector<float> acc(QUERY_SKETCH_DIM, 0.0f);
+  for (size_t w = 0; w < words.size(); ++w)
+  {
+    add_feature(acc, words[w], 1, 1.0f);
+    if (w + 1 < words.size())
+      add_feature(acc, words[w] + " " + words[w + 1], 2, 1.0f);
+
+    // character trigrams make plurals and inflections ("product"/"products") overlap
+    std::string padded = "^" + words[w] + "$";
+    for (size_t k = 0; k + 3 <= padded.size(); ++k)
+      add_feature(acc, std::string_view(padded).substr(k, 3), 3, 0.5f);
+  }
+
+  double norm = 0;
+  for (float x : acc)
+    norm += (double)x * x;
+  norm = std::sqrt(norm);
+  for (int d = 0; d < QUERY_SKETCH_DIM; ++d)
+  {
+    double x = norm > 0 ? acc[d] / norm * QUERY_SKETCH_SCALE : 0;
+    out.v[d] = (int8_t)std::clamp((long)std::lround(x), -(long)QUERY_SKETCH_SCALE, (long)QUERY_SKETCH_SCALE);
+  }
+
+  std::sort(literals.begin(), literals.end());
+  uint64_t h = 0;
+  for (const auto &lit : literals)
+    h = fnv1a(lit, h + 4);
+  out.literals = h;
+}
+
+int32_t query_sketch_threshold(double similarity)
+{
+  return (int32_t)std::ceil(similarity * QUERY_SKETCH_SCALE * QUERY_SKETCH_SCALE);
+}
+
+int32_t query_sketch_dot(const int8_t *a, const int8_t *b)
+{
+  int32_t sum = 0;
+  for (int d = 0; d < QUERY_SKETCH_DIM; ++d)
+    sum += (int32_t)a[d] * b[d];
+  return sum;
+}
+
+static void scan_scalar(const int8_t *vectors, size_t n, const int8_t *q, int32_t *scores)
+{
+  for (size_t i = 0; i < n; ++i)
+    scores[i] = query_sketch_dot(vectors + i * QUERY_SKETCH_DIM, q);
+}
+
+#ifdef QUERY_SKETCH_X86
+/*
+ Widens 16 int8 lanes to int16 and multiply-adds pairs into int32 (vpmaddwd).
+ Built with a target attribute so the rest of the extension needs no -mavx2;
+ only called after a runtime CPU check.
+*/
+__attribute__((target("avx2"))) static void scan_avx2(const int8_t *vectors, size_t n, const int8_t *q, int32_t *scores)
+{
+  __m256i qv[QUERY_SKETCH_DIM / 16];
+  for (int j = 0; j < QUERY_SKETCH_DIM / 16; ++j)
+    qv[j] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(q + 16 * j)));
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    const int8_t *v = vectors + i * QUERY_SKETCH_DIM;
+    __m256i acc = _mm256_setzero_si256();
+    for (int j = 0; j < QUERY_SKETCH_DIM / 16; ++j)
+    {
+      __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(v + 16 * j)));
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, qv[j]));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    scores[i] = _mm_cvtsi128_si32(s);
+  }
+}
+#endif
+
+#ifdef QUERY_SKETCH_NEON
+static void scan_neon(const int8_t *vectors, size_t n, const int8_t *q, int32_t *scores)
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    const int8_t *v = vectors + i * QUERY_SKETCH_DIM;
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int j = 0; j < QUERY_SKETCH_DIM; j += 16)
+    {
+      int8x16_t a = vld1q_s8(v + j);
+      int8x16_t b = vld1q_s8(q + j);
+      acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(a), vget_low_s8(b)));
+      acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(a), vget_high_s8(b)));
+    }
+    scores[i] = vaddvq_s32(acc);
+  }
+}
+#endif
+
+typedef void (*scan_fn)(const int8_t *, size_t, const int8_t *, int32_t *);
+
+static scan_fn resolve_scan(const char **name)
+{
+#if defined(QUERY_SKETCH_X86)
+  // runs from a static initializer, possibly before libgcc has probed the CPU
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    *name = "avx2";
+    return scan_avx2;
+  }
+#elif defined(QUERY_SKETCH_NEON)
+  *name = "neon";
+  return scan_neon;
+#endif
+  *name = "scalar";
+  return scan_scalar;
+}
+
+static const char *kernel_name = nullptr;
+static scan_fn scan_impl = resolve_scan(&kernel_name);
+
+void query_sketch_scan(const int8_t *vectors, size_t n, const int8_t *q, int32_t *scores)
+{
+  scan_impl(vectors, n, q, scores);
+}
+
+const char *query_sketch_kernel()
+{
+  return kernel_name;
+}
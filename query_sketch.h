@@ -0,0 +1,44 @@
+#ifndef QUERY_SKETCH_H
+#define QUERY_SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ Fixed-width sketches of natural language queries for approximate cache matching.
+ Words, word bigrams and character trigrams are feature-hashed into QUERY_SKETCH_DIM
+ signed buckets, L2-normalized and quantized to int8, so the dot product of two
+ sketches approximates their cosine similarity (scaled by QUERY_SKETCH_SCALE^2).
+ Numbers and quoted strings don't go into the vector; they are hashed separately
+ into literals, and two queries only match when their literals are identical
+ ("over $20" must not reuse the SQL for "over $30").
+ No PostgreSQL dependencies, so it can be benchmarked standalone.
+*/
+
+#define QUERY_SKETCH_DIM 256
+#define QUERY_SKETCH_SCALE 127
+
+struct QuerySketch
+{
+  int8_t v[QUERY_SKETCH_DIM];
+  uint64_t literals;
+};
+
+void query_sketch_build(std::string_view query, QuerySketch &out);
+
+// Minimum dot product for a cosine similarity in [0, 1]
+int32_t query_sketch_threshold(double similarity);
+
+int32_t query_sketch_dot(const int8_t *a, const int8_t *b);
+
+/*
+ Dot products of q against n contiguous sketches (n * QUERY_SKETCH_DIM bytes),
+ written to scores. Uses AVX2 or NEON when the CPU has them.
+*/
+void query_sketch_scan(const int8_t *vectors, size_t n, const int8_t *q, int32_t *scores);
+
+// Name of the kernel query_sketch_scan() uses on this CPU
+const char *query_sketch_kernel();
+
+#endif
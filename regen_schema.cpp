@@ -3,599 +3,812 @@ extern "C"
 #include "postgres.h"
 #include "fmgr.h"
 #include "miscadmin.h"
-#include "access/xact.h"
-#include "executor/spi.h"
-#include "utils/builtins.h"
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "access/table.h"
+#include "catalog/pg_attrdef.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_constraint.h"
+#include "catalog/pg_description.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_namespace.h"
+#include "catalog/pg_statistic.h"
 #include "catalog/pg_type.h"
+#include "nodes/parsenodes.h"
+#include "storage/fd.h"
+#include "storage/lock.h"
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
 }
 
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <sstream>
-#include <nlohmann/json.hpp>
+#include <unistd.h>
 #include "constants.h"
+#include "gen_stats.h"
+#include "regen_schema.h"
 #include "schema_cache.h"
+#include "schema_encode.h"
+#include "schema_model.h"
+#include "schema_prune.h"
+#include "schema_snapshot.h"
 
-// TODO: optimize the schema result with abbreviations to reduce token size (explain abbreviations in the system prompt)
-
-using json = nlohmann::json;
+extern int pg_gen_query_schema_encoding;
+extern bool pg_gen_query_stats_hints;
+extern bool pg_gen_query_stats_hints_private_values;
 
-/*
- Helper utility: safely get SPI string column value
- returns empty std::string if null
-*/
-static std::string spi_get_str(HeapTuple tuple, TupleDesc tupdesc, int colno)
+static const char *fk_action(char action)
 {
-  char *val = SPI_getvalue(tuple, tupdesc, colno);
-  std::string s;
-  if (val)
+  switch (action)
   {
-    s = std::string(val);
-    pfree(val);
+  case FKCONSTR_ACTION_NOACTION:
+    return "NO ACTION";
+  case FKCONSTR_ACTION_RESTRICT:
+    return "RESTRICT";
+  case FKCONSTR_ACTION_CASCADE:
+    return "CASCADE";
+  case FKCONSTR_ACTION_SETNULL:
+    return "SET NULL";
+  case FKCONSTR_ACTION_SETDEFAULT:
+    return "SET DEFAULT";
   }
-  return s;
+  return "";
+}
+
+static std::string text_datum_to_string(Datum d)
+{
+  text *t = DatumGetTextPP(d);
+  return std::string(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
 }
 
 /*
- Key type used in maps: "schema.table"
+ Reads an int2[] catalog column (conkey, confkey)
 */
-static inline std::string table_key(const std::string &schema, const std::string &table)
+static std::vector<int16> int2_array(HeapTuple tuple, TupleDesc tupdesc, AttrNumber attno)
 {
-  return schema + "." + table;
+  std::vector<int16> out;
+  bool isnull;
+  Datum d = heap_getattr(tuple, attno, tupdesc, &isnull);
+  if (isnull)
+    return out;
+  ArrayType *arr = DatumGetArrayTypeP(d);
+  Datum *elems;
+  int nelems;
+  deconstruct_array(arr, INT2OID, sizeof(int16), true, 's', &elems, NULL, &nelems);
+  for (int i = 0; i < nelems; ++i)
+    out.push_back(DatumGetInt16(elems[i]));
+  return out;
 }
 
 /*
- Run a query and ensure it's SPI_OK_SELECT; returns SPI_processed
+ Calls fn(tuple, tupdesc) for every row of a system catalog.
+ With a valid key, the scan uses the catalog index whose leading column is keyattno;
+ otherwise the whole catalog is read once.
+ fn runs in a scratch context that is reset after every row, so deparse calls don't pile up.
 */
-static uint64 run_select_or_throw(const char *query)
+template <typename Fn>
+static void scan_catalog(Oid catalog, Oid index, AttrNumber keyattno, Oid key, MemoryContext scratch, Fn fn)
 {
-  int rc = SPI_execute(query, true, 0);
-  if (rc != SPI_OK_SELECT)
+  Relation rel = table_open(catalog, AccessShareLock);
+  TupleDesc tupdesc = RelationGetDescr(rel);
+  ScanKeyData skey;
+  int nkeys = 0;
+  if (OidIsValid(key))
   {
-    elog(ERROR, "SPI_execute failed: rc=%d query=%s", rc, query);
+    ScanKeyInit(&skey, keyattno, BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(key));
+    nkeys = 1;
   }
-  return SPI_processed;
+
+  SysScanDesc scan = systable_beginscan(rel, index, nkeys > 0, NULL, nkeys, &skey);
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+  {
+    MemoryContext old = MemoryContextSwitchTo(scratch);
+    fn(tuple, tupdesc);
+    MemoryContextSwitchTo(old);
+    MemoryContextReset(scratch);
+  }
+  systable_endscan(scan);
+  table_close(rel, AccessShareLock);
 }
 
 /*
-  create_detailed_schema_json()
-  - Produces fully structured JSON per table (Option B style)
+ best-effort column list of an index definition
+ indexdef looks like: "CREATE INDEX idxname ON schema.table USING btree (col1, (lower(col2::text)))"
+ We'll not perfectly parse all expressions, but we can attempt to capture the (...) contents.
 */
-static std::string create_detailed_schema_json()
+static std::vector<std::string> index_columns(const std::string &indexdef)
 {
-  elog(LOG, "Creating detailed schema cache...");
-
-  if (SPI_connect() != SPI_OK_CONNECT)
+  std::vector<std::string> colarr;
+  size_t pos = indexdef.find('(');
+  size_t pos2 = indexdef.rfind(')');
+  if (pos == std::string::npos || pos2 == std::string::npos || pos2 <= pos)
+    return colarr;
+
+  std::string cols_str = indexdef.substr(pos + 1, pos2 - pos - 1);
+  // split on commas (simple)
+  std::istringstream ss(cols_str);
+  std::string tok;
+  while (std::getline(ss, tok, ','))
   {
-    elog(ERROR, "SPI_connect failed");
+    // trim spaces
+    size_t a = tok.find_first_not_of(" \t\n\r");
+    size_t b = tok.find_last_not_of(" \t\n\r");
+    if (a != std::string::npos && b != std::string::npos && b >= a)
+      colarr.push_back(tok.substr(a, b - a + 1));
+    else
+      colarr.push_back(tok);
   }
+  return colarr;
+}
 
-  // 1) Columns (with nullability, default, ordinal_position, data_type)
-  const char *columns_q =
-      "SELECT table_schema, table_name, column_name, data_type, is_nullable, "
-      "       column_default, ordinal_position "
-      "FROM information_schema.columns "
-      "WHERE table_schema NOT IN ('pg_catalog', 'information_schema', 'pg_toast') "
-      "  AND table_schema NOT LIKE 'pg_%' "
-      "ORDER BY table_schema, table_name, ordinal_position;";
-
-  run_select_or_throw(columns_q);
-  std::unordered_map<std::string, json> tables;
+/*
+  introspect_schema()
+  - Builds the typed schema model (schema_model.h) in a single pass over the catalogs
+  - relids restricts the introspection to those relations (nullptr = whole database)
+  - Reads pg_class/pg_attribute/pg_attrdef/pg_constraint/pg_index/pg_description directly
+    with systable scans: no SPI, no information_schema views, no text round-trip.
+    Unlike information_schema, this ignores column privileges (the cache is database-wide).
+*/
+static void introspect_schema(const std::vector<Oid> *relids, SchemaModel &model)
+{
+  elog(LOG, "Introspecting schema...");
 
-  TupleDesc tupdesc = SPI_tuptable->tupdesc;
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
+  MemoryContext scratch = AllocSetContextCreate(CurrentMemoryContext,
+                                                "pg_gen_query introspection",
+                                                ALLOCSET_DEFAULT_SIZES);
 
-    std::string schema = spi_get_str(tuple, tupdesc, 1);
-    std::string table = spi_get_str(tuple, tupdesc, 2);
-    std::string column = spi_get_str(tuple, tupdesc, 3);
-    std::string dtype = spi_get_str(tuple, tupdesc, 4);
-    std::string is_nullable = spi_get_str(tuple, tupdesc, 5);
-    std::string column_default = spi_get_str(tuple, tupdesc, 6);
-    std::string ordinal_pos = spi_get_str(tuple, tupdesc, 7);
+  // 1) Relations: user tables, partitioned tables, views and foreign tables
+  std::unordered_map<Oid, std::string> nspnames; // "" = system namespace
+  std::vector<Oid> found;
 
-    std::string key = table_key(schema, table);
+  auto add_relation = [&](Oid relid, Form_pg_class cls)
+  {
+    if (cls->relkind != RELKIND_RELATION && cls->relkind != RELKIND_PARTITIONED_TABLE &&
+        cls->relkind != RELKIND_VIEW && cls->relkind != RELKIND_FOREIGN_TABLE)
+      return;
 
-    if (!tables.count(key))
+    auto ns = nspnames.find(cls->relnamespace);
+    if (ns == nspnames.end())
     {
-      json j;
-      j["schema"] = schema;
-      j["table"] = table;
-      j["columns"] = json::array();
-      j["primary_key"] = nullptr;
-      j["unique_constraints"] = json::array();
-      j["foreign_keys"] = json::array();
-      j["checks"] = json::array();
-      j["indexes"] = json::array();
-      j["table_comment"] = nullptr; // NEW: placeholder
-      tables.emplace(key, std::move(j));
+      char *name = get_namespace_name(cls->relnamespace);
+      std::string nspname = name ? name : "";
+      if (nspname == "information_schema" || nspname.compare(0, 3, "pg_") == 0)
+        nspname.clear();
+      ns = nspnames.emplace(cls->relnamespace, nspname).first;
     }
+    if (ns->second.empty())
+      return;
 
-    json col;
-    col["name"] = column;
-    col["type"] = dtype;
-    col["nullable"] = (is_nullable == "YES");
-    if (!column_default.empty())
-      col["default"] = column_default;
-    col["ordinal_position"] = std::stoi(ordinal_pos.empty() ? "0" : ordinal_pos);
-    col["comment"] = nullptr; // NEW: placeholder
+    TableModel &tbl = model.tables[relid];
+    tbl.oid = relid;
+    tbl.schema = ns->second;
+    tbl.table = NameStr(cls->relname);
+    found.push_back(relid);
+  };
 
-    tables[key]["columns"].push_back(col);
+  if (relids == nullptr)
+  {
+    scan_catalog(RelationRelationId, ClassOidIndexId, Anum_pg_class_oid, InvalidOid, scratch,
+                 [&](HeapTuple tuple, TupleDesc)
+                 {
+                   Form_pg_class cls = (Form_pg_class)GETSTRUCT(tuple);
+                   add_relation(cls->oid, cls);
+                 });
   }
-
-  // 2) Primary keys (use information_schema.table_constraints + key_column_usage)
-  const char *pk_q =
-      "SELECT kcu.table_schema, kcu.table_name, tc.constraint_name, kcu.column_name, kcu.ordinal_position "
-      "FROM information_schema.table_constraints tc "
-      "JOIN information_schema.key_column_usage kcu "
-      "  ON tc.constraint_name = kcu.constraint_name AND tc.table_schema = kcu.table_schema AND tc.table_name = kcu.table_name "
-      "WHERE tc.constraint_type = 'PRIMARY KEY' "
-      "ORDER BY kcu.table_schema, kcu.table_name, tc.constraint_name, kcu.ordinal_position;";
-
-  run_select_or_throw(pk_q);
-  tupdesc = SPI_tuptable->tupdesc;
-  std::unordered_map<std::string, json> pk_map; // key -> {name, columns}
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
-    std::string schema = spi_get_str(tuple, tupdesc, 1);
-    std::string table = spi_get_str(tuple, tupdesc, 2);
-    std::string constraint_name = spi_get_str(tuple, tupdesc, 3);
-    std::string column_name = spi_get_str(tuple, tupdesc, 4);
-
-    std::string key = table_key(schema, table);
-    if (!pk_map.count(key))
+  else
+  {
+    for (Oid relid : *relids)
     {
-      json pkj;
-      pkj["name"] = constraint_name;
-      pkj["columns"] = json::array();
-      pk_map.emplace(key, pkj);
+      HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+      if (!HeapTupleIsValid(tuple))
+        continue; // dropped: it just disappears from the snapshot
+      add_relation(relid, (Form_pg_class)GETSTRUCT(tuple));
+      ReleaseSysCache(tuple);
     }
-    pk_map[key]["columns"].push_back(column_name);
-  }
-  // attach pks to tables
-  for (auto &kv : pk_map)
-  {
-    if (tables.count(kv.first))
-      tables[kv.first]["primary_key"] = kv.second;
   }
 
-  // 3) Unique constraints
-  const char *uniq_q =
-      "SELECT tc.table_schema, tc.table_name, tc.constraint_name, kcu.column_name "
-      "FROM information_schema.table_constraints tc "
-      "JOIN information_schema.key_column_usage kcu "
-      "  ON tc.constraint_name = kcu.constraint_name AND tc.table_schema = kcu.table_schema AND tc.table_name = kcu.table_name "
-      "WHERE tc.constraint_type = 'UNIQUE' "
-      "ORDER BY tc.table_schema, tc.table_name, tc.constraint_name, kcu.ordinal_position;";
-
-  run_select_or_throw(uniq_q);
-  tupdesc = SPI_tuptable->tupdesc;
-  std::unordered_map<std::string, json> uniq_map;
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
-    std::string schema = spi_get_str(tuple, tupdesc, 1);
-    std::string table = spi_get_str(tuple, tupdesc, 2);
-    std::string constraint_name = spi_get_str(tuple, tupdesc, 3);
-    std::string column_name = spi_get_str(tuple, tupdesc, 4);
-
-    std::string key = table_key(schema, table);
-    if (!uniq_map.count(key))
-    {
-      uniq_map.emplace(key, json::array());
-    }
-    // find or create constraint object
-    bool found = false;
-    for (auto &cobj : uniq_map[key])
-    {
-      if (cobj["name"] == constraint_name)
-      {
-        cobj["columns"].push_back(column_name);
-        found = true;
-        break;
-      }
-    }
-    if (!found)
+  // For a full rebuild, every catalog is read once; otherwise one index scan per relation
+  auto scan_relations = [&](Oid catalog, Oid index, AttrNumber keyattno, auto fn)
+  {
+    if (relids == nullptr)
     {
-      json c;
-      c["name"] = constraint_name;
-      c["columns"] = json::array();
-      c["columns"].push_back(column_name);
-      uniq_map[key].push_back(c);
+      scan_catalog(catalog, index, keyattno, InvalidOid, scratch, fn);
+      return;
     }
+    for (Oid relid : found)
+      scan_catalog(catalog, index, keyattno, relid, scratch, fn);
+  };
+
+  // 2) Columns (with nullability and data_type)
+  std::unordered_map<Oid, std::string> typnames;
+  scan_relations(AttributeRelationId, AttributeRelidNumIndexId, Anum_pg_attribute_attrelid,
+                 [&](HeapTuple tuple, TupleDesc)
+                 {
+                   Form_pg_attribute att = (Form_pg_attribute)GETSTRUCT(tuple);
+                   if (att->attnum <= 0 || att->attisdropped)
+                     return;
+                   TableModel *tbl = model.table(att->attrelid);
+                   if (tbl == nullptr)
+                     return;
+
+                   auto typ = typnames.find(att->atttypid);
+                   if (typ == typnames.end())
+                     typ = typnames.emplace(att->atttypid, format_type_be(att->atttypid)).first;
+
+                   ColumnModel &col = tbl->add_column(att->attnum);
+                   col.name = NameStr(att->attname);
+                   col.type = typ->second;
+                   col.nullable = !att->attnotnull;
+                 });
+
+  // 3) Column defaults (pg_attrdef, deparsed like information_schema.columns.column_default)
+  scan_relations(AttrDefaultRelationId, AttrDefaultIndexId, Anum_pg_attrdef_adrelid,
+                 [&](HeapTuple tuple, TupleDesc tupdesc)
+                 {
+                   Form_pg_attrdef def = (Form_pg_attrdef)GETSTRUCT(tuple);
+                   TableModel *tbl = model.table(def->adrelid);
+                   ColumnModel *col = tbl ? tbl->column(def->adnum) : nullptr;
+                   if (col == nullptr)
+                     return;
+
+                   bool isnull;
+                   Datum adbin = heap_getattr(tuple, Anum_pg_attrdef_adbin, tupdesc, &isnull);
+                   if (isnull)
+                     return;
+                   col->has_default = true;
+                   col->default_expr = text_datum_to_string(
+                       DirectFunctionCall2(pg_get_expr, adbin, ObjectIdGetDatum(def->adrelid)));
+                 });
+
+  // 4) Constraints: primary key, unique, foreign keys with actions, checks
+  scan_relations(ConstraintRelationId, ConstraintRelidTypidNameIndexId, Anum_pg_constraint_conrelid,
+                 [&](HeapTuple tuple, TupleDesc tupdesc)
+                 {
+                   Form_pg_constraint con = (Form_pg_constraint)GETSTRUCT(tuple);
+                   TableModel *tbl = model.table(con->conrelid);
+                   if (tbl == nullptr)
+                     return;
+
+                   switch (con->contype)
+                   {
+                   case CONSTRAINT_PRIMARY:
+                     tbl->has_primary_key = true;
+                     tbl->primary_key.name = NameStr(con->conname);
+                     tbl->primary_key.attnums = int2_array(tuple, tupdesc, Anum_pg_constraint_conkey);
+                     break;
+                   case CONSTRAINT_UNIQUE:
+                     tbl->unique_constraints.push_back({NameStr(con->conname),
+                                                        int2_array(tuple, tupdesc, Anum_pg_constraint_conkey)});
+                     break;
+                   case CONSTRAINT_FOREIGN:
+                   {
+                     ForeignKeyModel fk;
+                     fk.name = NameStr(con->conname);
+                     fk.attnums = int2_array(tuple, tupdesc, Anum_pg_constraint_conkey);
+                     fk.ref_oid = con->confrelid;
+                     fk.ref_schema = get_namespace_name(get_rel_namespace(con->confrelid));
+                     fk.ref_table = get_rel_name(con->confrelid);
+                     for (int16 attnum : int2_array(tuple, tupdesc, Anum_pg_constraint_confkey))
+                       fk.ref_columns.push_back(get_attname(con->confrelid, attnum, false));
+                     fk.on_update = fk_action(con->confupdtype);
+                     fk.on_delete = fk_action(con->confdeltype);
+                     tbl->foreign_keys.push_back(std::move(fk));
+                     break;
+                   }
+                   case CONSTRAINT_CHECK:
+                     tbl->checks.push_back({NameStr(con->conname),
+                                            text_datum_to_string(DirectFunctionCall1(pg_get_constraintdef, ObjectIdGetDatum(con->oid))),
+                                            int2_array(tuple, tupdesc, Anum_pg_constraint_conkey)});
+                     break;
+                   default:
+                     break;
+                   }
+                 });
+
+  // 5) Indexes (pg_get_indexdef, the same text pg_indexes shows)
+  scan_relations(IndexRelationId, IndexIndrelidIndexId, Anum_pg_index_indrelid,
+                 [&](HeapTuple tuple, TupleDesc)
+                 {
+                   Form_pg_index index = (Form_pg_index)GETSTRUCT(tuple);
+                   TableModel *tbl = model.table(index->indrelid);
+                   if (tbl == nullptr)
+                     return;
+
+                   IndexModel idx;
+                   idx.name = get_rel_name(index->indexrelid);
+                   idx.definition = text_datum_to_string(
+                       DirectFunctionCall1(pg_get_indexdef, ObjectIdGetDatum(index->indexrelid)));
+                   idx.columns = index_columns(idx.definition);
+                   tbl->indexes.push_back(std::move(idx));
+                 });
+
+  // 6) NEW: Table + Column Comments (pg_description)
+  scan_relations(DescriptionRelationId, DescriptionObjIndexId, Anum_pg_description_objoid,
+                 [&](HeapTuple tuple, TupleDesc tupdesc)
+                 {
+                   Form_pg_description desc = (Form_pg_description)GETSTRUCT(tuple);
+                   if (desc->classoid != RelationRelationId)
+                     return;
+                   TableModel *tbl = model.table(desc->objoid);
+                   if (tbl == nullptr)
+                     return;
+
+                   bool isnull;
+                   Datum d = heap_getattr(tuple, Anum_pg_description_description, tupdesc, &isnull);
+                   if (isnull)
+                     return;
+                   std::string comment = text_datum_to_string(d);
+                   if (comment.empty())
+                     return;
+
+                   if (desc->objsubid == 0)
+                   {
+                     // Table-level comment
+                     tbl->has_comment = true;
+                     tbl->comment = std::move(comment);
+                     return;
+                   }
+                   // Column-level comment
+                   ColumnModel *col = tbl->column((int16)desc->objsubid);
+                   if (col != nullptr)
+                   {
+                     col->has_comment = true;
+                     col->comment = std::move(comment);
+                   }
+                 });
+
+  MemoryContextDelete(scratch);
+
+  for (auto &kv : model.tables)
+    kv.second.finalize();
+}
+
+// Time spent in each phase of the regeneration in progress, for pg_stat_gen_query_regen
+static int64_t phase_us[GEN_REGEN_PHASES];
+
+// Key of the lock that serializes this database's regenerations ("pggq")
+#define SCHEMA_REGEN_LOCK_KEY 0x70676771
+
+/*
+  collect_table_stats()
+  - Fills in the planner statistics of the tables in stats (keyed by relation oid, with
+    schema and table set): row count and size from pg_class, and per column the null
+    fraction, distinct count and, for columns with few distinct values, the most common
+    values from pg_statistic (read in one pass)
+  - The cache is database-wide, so values are only taken from columns PUBLIC may read
+    and, as in the pg_stats view, not from tables with row-level security, whose
+    policies may hide them (unless pg_gen_query.stats_hints_private_values); other
+    columns keep their counts
+*/
+static void collect_table_stats(std::unordered_map<uint32, TableStatsModel> &stats)
+{
+  std::unordered_set<uint32> partitioned;
+  std::unordered_set<uint32> public_tables; // SELECT granted to PUBLIC on the whole table
+  std::unordered_set<uint32> rls_tables;    // row-level security enabled
+  for (auto &kv : stats)
+  {
+    if (pg_class_aclcheck(kv.first, ACL_ID_PUBLIC, ACL_SELECT) == ACLCHECK_OK)
+      public_tables.insert(kv.first);
+    HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(kv.first));
+    if (!HeapTupleIsValid(tuple))
+      continue;
+    Form_pg_class cls = (Form_pg_class)GETSTRUCT(tuple);
+    if (cls->relrowsecurity)
+      rls_tables.insert(kv.first);
+    kv.second.rows = cls->reltuples;
+    kv.second.bytes = (uint64_t)cls->relpages * BLCKSZ;
+    if (cls->relkind == RELKIND_PARTITIONED_TABLE)
+      partitioned.insert(kv.first);
+    ReleaseSysCache(tuple);
   }
-  for (auto &kv : uniq_map)
+
+  MemoryContext scratch = AllocSetContextCreate(CurrentMemoryContext,
+                                                "pg_gen_query statistics",
+                                                ALLOCSET_DEFAULT_SIZES);
+  scan_catalog(StatisticRelationId, InvalidOid, 0, InvalidOid, scratch,
+               [&](HeapTuple tuple, TupleDesc tupdesc)
+               {
+                 Form_pg_statistic st = (Form_pg_statistic)GETSTRUCT(tuple);
+                 auto it = stats.find(st->starelid);
+                 // partitioned tables only have statistics over their partitions
+                 if (it == stats.end() || st->stainherit != (partitioned.count(st->starelid) > 0))
+                   return;
+                 char *name = get_attname(st->starelid, st->staattnum, true);
+                 if (name == nullptr)
+                   return;
+
+                 ColumnStatsModel col;
+                 col.attnum = st->staattnum;
+                 col.name = name;
+                 col.null_frac = st->stanullfrac;
+                 col.n_distinct = st->stadistinct;
+                 bool readable = pg_gen_query_stats_hints_private_values ||
+                                 (rls_tables.count(st->starelid) == 0 &&
+                                  (public_tables.count(st->starelid) > 0 ||
+                                   pg_attribute_aclcheck(st->starelid, st->staattnum, ACL_ID_PUBLIC, ACL_SELECT) ==
+                                       ACLCHECK_OK));
+                 AttStatsSlot sslot;
+                 if (readable && col.n_distinct > 0 && col.n_distinct <= SCHEMA_HINT_MAX_VALUES &&
+                     get_attstatsslot(&sslot, tuple, STATISTIC_KIND_MCV, InvalidOid,
+                                      ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS))
+                 {
+                   Oid output;
+                   bool varlena;
+                   getTypeOutputInfo(sslot.valuetype, &output, &varlena);
+                   for (int i = 0; i < sslot.nvalues; ++i)
+                     col.common_values.emplace_back(OidOutputFunctionCall(output, sslot.values[i]));
+                   for (int i = 0; i < sslot.nnumbers; ++i)
+                     col.common_freq += sslot.numbers[i];
+                   free_attstatsslot(&sslot);
+                 }
+                 it->second.columns.push_back(std::move(col));
+               });
+  MemoryContextDelete(scratch);
+
+  for (auto &kv : stats)
   {
-    if (tables.count(kv.first))
-      tables[kv.first]["unique_constraints"] = kv.second;
+    std::sort(kv.second.columns.begin(), kv.second.columns.end(),
+              [](const ColumnStatsModel &a, const ColumnStatsModel &b)
+              { return a.attnum < b.attnum; });
   }
+}
 
-  // 4) Foreign keys with actions (use information_schema.referential_constraints + key_column_usage + constraint_column_usage)
-  const char *fk_q =
-      "SELECT con.conname AS constraint_name, "
-      "rel_ns.nspname AS table_schema, "
-      "rel.relname AS table_name, "
-      "att2.attname AS column_name, "
-      "frel_ns.nspname AS foreign_table_schema, "
-      "frel.relname AS foreign_table_name, "
-      "att.attname AS foreign_column_name, "
-      "CASE con.confupdtype WHEN 'a' THEN 'NO ACTION' WHEN 'r' THEN 'RESTRICT' WHEN 'c' THEN 'CASCADE' WHEN 'n' THEN 'SET NULL' WHEN 'd' THEN 'SET DEFAULT' END AS on_update, "
-      "CASE con.confdeltype WHEN 'a' THEN 'NO ACTION' WHEN 'r' THEN 'RESTRICT' WHEN 'c' THEN 'CASCADE' WHEN 'n' THEN 'SET NULL' WHEN 'd' THEN 'SET DEFAULT' END AS on_delete "
-      "FROM pg_constraint con "
-      "JOIN pg_class rel ON rel.oid = con.conrelid "
-      "JOIN pg_namespace rel_ns ON rel_ns.oid = rel.relnamespace "
-      "JOIN pg_class frel ON frel.oid = con.confrelid "
-      "JOIN pg_namespace frel_ns ON frel_ns.oid = frel.relnamespace "
-      "JOIN unnest(con.conkey) WITH ORDINALITY AS cols(attnum, ord) ON true "
-      "JOIN pg_attribute att2 ON att2.attrelid = rel.oid AND att2.attnum = cols.attnum "
-      "JOIN unnest(con.confkey) WITH ORDINALITY AS fcols(attnum, ord) ON fcols.ord = cols.ord "
-      "JOIN pg_attribute att ON att.attrelid = frel.oid AND att.attnum = fcols.attnum "
-      "WHERE con.contype = 'f' "
-      "ORDER BY table_schema, table_name, constraint_name, cols.ord;";
-
-  run_select_or_throw(fk_q);
-  tupdesc = SPI_tuptable->tupdesc;
-  std::unordered_map<std::string, json> fk_map;
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
-    std::string constraint_name = spi_get_str(tuple, tupdesc, 1);
-    std::string schema = spi_get_str(tuple, tupdesc, 2);
-    std::string table = spi_get_str(tuple, tupdesc, 3);
-    std::string column_name = spi_get_str(tuple, tupdesc, 4);
-    std::string ref_schema = spi_get_str(tuple, tupdesc, 5);
-    std::string ref_table = spi_get_str(tuple, tupdesc, 6);
-    std::string ref_col = spi_get_str(tuple, tupdesc, 7);
-    std::string on_update = spi_get_str(tuple, tupdesc, 8);
-    std::string on_delete = spi_get_str(tuple, tupdesc, 9);
-
-    std::string key = table_key(schema, table);
-    if (!fk_map.count(key))
-      fk_map.emplace(key, json::array());
-
-    // find existing fk entry with same name or create new
-    bool found = false;
-    for (auto &fk : fk_map[key])
-    {
-      if (fk["name"] == constraint_name)
-      {
-        // append column pair
-        fk["columns"].push_back(column_name);
-        fk["references"]["columns"].push_back(ref_col);
-        found = true;
-        break;
-      }
-    }
-    if (!found)
+/*
+  add_schema_tables()
+  - Renders every table of the model straight into the snapshot builder as its own
+    fragment in the builder's encoding (pg_gen_query.schema_encoding), keyed by
+    relation oid, together with its terms for the relevance index and, with
+    pg_gen_query.stats_hints, its statistics hints
+*/
+static void add_schema_tables(const std::vector<Oid> *relids, SchemaEncoding encoding, SchemaSnapshotBuilder &builder)
+{
+  SchemaModel model;
+  auto start = std::chrono::steady_clock::now();
+  introspect_schema(relids, model);
+  phase_us[GEN_REGEN_CATALOG] += gen_stats_us_since(start);
+
+  std::unordered_map<uint32, TableStatsModel> stats;
+  if (pg_gen_query_stats_hints)
+  {
+    start = std::chrono::steady_clock::now();
+    for (auto &kv : model.tables)
     {
-      json fk;
-      fk["name"] = constraint_name;
-      fk["columns"] = json::array();
-      fk["columns"].push_back(column_name);
-      fk["references"] = {
-          {"schema", ref_schema},
-          {"table", ref_table},
-          {"columns", json::array({ref_col})}};
-      if (!on_update.empty())
-        fk["on_update"] = on_update;
-      if (!on_delete.empty())
-        fk["on_delete"] = on_delete;
-      fk_map[key].push_back(fk);
+      TableStatsModel &ts = stats[kv.first];
+      ts.schema = kv.second.schema;
+      ts.table = kv.second.table;
     }
+    collect_table_stats(stats);
+    phase_us[GEN_REGEN_HINTS] += gen_stats_us_since(start);
   }
-  for (auto &kv : fk_map)
+
+  start = std::chrono::steady_clock::now();
+  size_t bytes = 0;
+  for (auto &kv : model.tables)
   {
-    if (tables.count(kv.first))
-      tables[kv.first]["foreign_keys"] = kv.second;
+    const TableModel &tbl = kv.second;
+    std::string fragment;
+    encode_table(encoding, tbl, fragment);
+    bytes += fragment.size();
+    std::string hints;
+    auto ts = stats.find(kv.first);
+    if (ts != stats.end())
+      encode_table_hints(ts->second, hints);
+    builder.add_table(tbl.oid, tbl.schema, tbl.table, std::move(fragment), schema_table_terms(tbl), std::move(hints));
   }
+  phase_us[GEN_REGEN_RENDER] += gen_stats_us_since(start);
+  elog(LOG, "Rendered %zu table(s), %zu bytes", model.tables.size(), bytes);
+}
 
-  // 5) Check constraints (from pg_constraint)
-  // We'll query using pg_catalog to get name and definition
-  const char *checks_q =
-      "SELECT ns.nspname AS table_schema, rel.relname AS table_name, con.conname AS constraint_name, pg_get_constraintdef(con.oid) AS definition "
-      "FROM pg_constraint con "
-      "JOIN pg_class rel ON rel.oid = con.conrelid "
-      "JOIN pg_namespace ns ON ns.oid = rel.relnamespace "
-      "WHERE con.contype = 'c' "
-      "  AND ns.nspname NOT IN ('pg_catalog', 'information_schema') "
-      "  AND ns.nspname NOT LIKE 'pg_%' "
-      "ORDER BY ns.nspname, rel.relname, con.conname;";
-
-  run_select_or_throw(checks_q);
-  tupdesc = SPI_tuptable->tupdesc;
-  std::unordered_map<std::string, json> checks_map;
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
-    std::string schema = spi_get_str(tuple, tupdesc, 1);
-    std::string table = spi_get_str(tuple, tupdesc, 2);
-    std::string constraint_name = spi_get_str(tuple, tupdesc, 3);
-    std::string definition = spi_get_str(tuple, tupdesc, 4);
-
-    std::string key = table_key(schema, table);
-    if (!checks_map.count(key))
-      checks_map.emplace(key, json::array());
-    json c;
-    c["name"] = constraint_name;
-    c["definition"] = definition;
-    checks_map[key].push_back(c);
+/*
+ Replaces the database's schema file atomically: the image goes to a temporary file
+ that is synced and renamed over the old one, so a backend loading the file at the same
+ time sees either the old or the new snapshot, never a partial one
+*/
+static void write_schema_file(const std::string &image)
+{
+  if (MakePGDirectory(SCHEMA_DIR) < 0 && errno != EEXIST)
+  {
+    elog(ERROR, "Unable to create directory %s: %m", SCHEMA_DIR);
   }
-  for (auto &kv : checks_map)
+  const char *file = schema_cache_file();
+  char path[MAXPGPATH];
+  snprintf(path, sizeof(path), "%s.tmp.%d", file, MyProcPid);
+  int fd = OpenTransientFile(path, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+  if (fd < 0)
   {
-    if (tables.count(kv.first))
-      tables[kv.first]["checks"] = kv.second;
+    elog(ERROR, "Unable to write schema cache file %s: %m", path);
   }
 
-  // 6) Indexes (pg_indexes provides indexdef text)
-  const char *indexes_q =
-      "SELECT schemaname, tablename, indexname, indexdef "
-      "FROM pg_indexes "
-      "WHERE schemaname NOT IN ('pg_catalog', 'information_schema') "
-      "  AND schemaname NOT LIKE 'pg_%' "
-      "ORDER BY schemaname, tablename, indexname;";
-
-  run_select_or_throw(indexes_q);
-  tupdesc = SPI_tuptable->tupdesc;
-  std::unordered_map<std::string, json> idx_map;
-  for (uint64 i = 0; i < SPI_processed; ++i)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
-    std::string schemaname = spi_get_str(tuple, tupdesc, 1);
-    std::string tablename = spi_get_str(tuple, tupdesc, 2);
-    std::string indexname = spi_get_str(tuple, tupdesc, 3);
-    std::string indexdef = spi_get_str(tuple, tupdesc, 4);
-
-    std::string key = table_key(schemaname, tablename);
-    if (!idx_map.count(key))
-      idx_map.emplace(key, json::array());
-
-    // try to extract column list from indexdef (best-effort)
-    // indexdef looks like: "CREATE INDEX idxname ON schema.table USING btree (col1, (lower(col2::text)))"
-    // We'll not perfectly parse all expressions, but we can attempt to capture the (...) contents.
-    std::string cols_str;
-    size_t pos = indexdef.find('(');
-    size_t pos2 = indexdef.rfind(')');
-    if (pos != std::string::npos && pos2 != std::string::npos && pos2 > pos)
-    {
-      cols_str = indexdef.substr(pos + 1, pos2 - pos - 1);
-    }
-
-    json idx;
-    idx["name"] = indexname;
-    idx["definition"] = indexdef;
-    if (!cols_str.empty())
+  size_t done = 0;
+  while (done < image.size())
+  {
+    ssize_t n = write(fd, image.data() + done, image.size() - done);
+    if (n < 0 && errno == EINTR)
     {
-      // split on commas (simple)
-      json colarr = json::array();
-      std::istringstream ss(cols_str);
-      std::string tok;
-      while (std::getline(ss, tok, ','))
-      {
-        // trim spaces
-        size_t a = tok.find_first_not_of(" \t\n\r");
-        size_t b = tok.find_last_not_of(" \t\n\r");
-        if (a != std::string::npos && b != std::string::npos && b >= a)
-        {
-          colarr.push_back(tok.substr(a, b - a + 1));
-        }
-        else
-        {
-          colarr.push_back(tok);
-        }
-      }
-      idx["columns"] = colarr;
+      continue;
     }
-    else
+    if (n <= 0)
     {
-      idx["columns"] = json::array();
+      int save_errno = n < 0 ? errno : ENOSPC;
+      CloseTransientFile(fd);
+      unlink(path);
+      errno = save_errno;
+      elog(ERROR, "Unable to write schema cache file %s: %m", path);
     }
-    idx_map[key].push_back(idx);
+    done += (size_t)n;
   }
-  for (auto &kv : idx_map)
+  if (pg_fsync(fd) != 0)
   {
-    if (tables.count(kv.first))
-      tables[kv.first]["indexes"] = kv.second;
+    int save_errno = errno;
+    CloseTransientFile(fd);
+    unlink(path);
+    errno = save_errno;
+    elog(ERROR, "Unable to sync schema cache file %s: %m", path);
   }
+  CloseTransientFile(fd);
+  durable_rename(path, file, ERROR);
+}
 
-  // 7) NEW: Table + Column Comments (pg_description + pg_class)
-  const char *comments_q =
-      "SELECT n.nspname AS schema, c.relname AS table_name, "
-      "       a.attname AS column_name, d.description "
-      "FROM pg_description d "
-      "JOIN pg_class c ON c.oid = d.objoid "
-      "JOIN pg_namespace n ON n.oid = c.relnamespace "
-      "LEFT JOIN pg_attribute a ON a.attrelid = c.oid AND a.attnum = d.objsubid "
-      "WHERE n.nspname NOT IN ('pg_catalog','information_schema') "
-      "  AND n.nspname NOT LIKE 'pg_%';";
-
-  run_select_or_throw(comments_q);
-  tupdesc = SPI_tuptable->tupdesc;
-
-  for (uint64 i = 0; i < SPI_processed; i++)
-  {
-    HeapTuple tuple = SPI_tuptable->vals[i];
+/*
+ Writes the snapshot image to the database's schema file, stamped with a new
+ generation, and then publishes it as that generation; in-flight readers keep the
+ generation they pinned
+*/
+static void store_snapshot(std::string image)
+{
+  // durable first: a snapshot that failed to reach the file is never published
+  auto start = std::chrono::steady_clock::now();
+  uint64_t generation = schema_cache_reserve_generation();
+  schema_snapshot_set_generation(image, generation);
+  write_schema_file(image);
+  phase_us[GEN_REGEN_WRITE] += gen_stats_us_since(start);
+
+  start = std::chrono::steady_clock::now();
+  schema_cache_publish(image, false, generation);
+  phase_us[GEN_REGEN_PUBLISH] += gen_stats_us_since(start);
+
+  elog(LOG, "Schema file refreshed: %s (generation %lu)", schema_cache_file(), (unsigned long)generation);
+}
 
-    std::string schema = spi_get_str(tuple, tupdesc, 1);
-    std::string table = spi_get_str(tuple, tupdesc, 2);
-    std::string column = spi_get_str(tuple, tupdesc, 3);
-    std::string comment = spi_get_str(tuple, tupdesc, 4);
+static std::string finish_snapshot(SchemaSnapshotBuilder &builder)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::string image = builder.finish();
+  phase_us[GEN_REGEN_SERIALIZE] += gen_stats_us_since(start);
+  return image;
+}
 
-    std::string key = table_key(schema, table);
+static std::string build_full_snapshot()
+{
+  SchemaEncoding encoding = (SchemaEncoding)pg_gen_query_schema_encoding;
+  SchemaSnapshotBuilder builder(encoding);
+  add_schema_tables(nullptr, encoding, builder);
+  return finish_snapshot(builder);
+}
 
-    if (!tables.count(key))
-      continue;
+/*
+ changed plus the relations with foreign keys to them: their fragments embed the
+ referenced table and column names (->users.id), which a rename would leave stale.
+ There is no index on confrelid, so pg_constraint is read once.
+*/
+static std::vector<Oid> with_referencing_relations(const std::vector<Oid> &changed)
+{
+  std::unordered_set<Oid> wanted(changed.begin(), changed.end());
+  std::vector<Oid> relids(changed);
+  MemoryContext scratch = AllocSetContextCreate(CurrentMemoryContext,
+                                                "pg_gen_query referencing relations",
+                                                ALLOCSET_SMALL_SIZES);
+  scan_catalog(ConstraintRelationId, ConstraintOidIndexId, Anum_pg_constraint_oid, InvalidOid, scratch,
+               [&](HeapTuple tuple, TupleDesc)
+               {
+                 Form_pg_constraint con = (Form_pg_constraint)GETSTRUCT(tuple);
+                 if (con->contype == CONSTRAINT_FOREIGN && wanted.count(con->confrelid) &&
+                     wanted.insert(con->conrelid).second)
+                   relids.push_back(con->conrelid);
+               });
+  MemoryContextDelete(scratch);
+  return relids;
+}
 
-    if (column.empty())
-    {
-      // Table-level comment
-      if (!comment.empty())
-        tables[key]["table_comment"] = comment;
-    }
-    else
-    {
-      // Column-level comment
-      auto &cols = tables[key]["columns"];
-      for (auto &c : cols)
-      {
-        if (c["name"] == column)
-        {
-          if (!comment.empty())
-            c["comment"] = comment;
-          break;
-        }
-      }
-    }
+/*
+ Re-introspects only the changed relations, and those referencing them, and splices
+ them into the current snapshot. Relations that no longer exist simply drop out.
+*/
+static std::string build_spliced_snapshot(const std::vector<Oid> &changed)
+{
+  SchemaSnapshotView prev;
+  std::string_view image = schema_cache_load();
+  if (image.empty() || !prev.open(image))
+  {
+    elog(LOG, "No usable schema snapshot to update, regenerating all tables");
+    return build_full_snapshot();
+  }
+  SchemaEncoding encoding = (SchemaEncoding)pg_gen_query_schema_encoding;
+  if (prev.encoding() != encoding)
+  {
+    elog(LOG, "Schema encoding changed, regenerating all tables");
+    return build_full_snapshot();
   }
 
-  // All assembled - convert to JSON array
-  json out;
-  out["tables"] = json::array();
-  for (auto &kv : tables)
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Oid> relids = with_referencing_relations(changed);
+  phase_us[GEN_REGEN_CATALOG] += gen_stats_us_since(start);
+
+  // carrying over the unchanged fragments counts as rendering
+  start = std::chrono::steady_clock::now();
+  std::unordered_set<uint32> affected(relids.begin(), relids.end());
+  SchemaSnapshotBuilder builder(encoding);
+  for (size_t i = 0; i < prev.table_count(); ++i)
   {
-    // option: sort columns by ordinal_position
-    auto &tbl = kv.second;
-    if (tbl.contains("columns"))
-    {
-      std::sort(tbl["columns"].begin(), tbl["columns"].end(),
-                [](const json &a, const json &b)
-                {
-                  return a.value("ordinal_position", 0) < b.value("ordinal_position", 0);
-                });
-      // drop ordinal_position field from final output (it was internal); keep if you want it
-      for (auto &c : tbl["columns"])
-      {
-        c.erase("ordinal_position");
-      }
-    }
-    out["tables"].push_back(tbl);
+    if (affected.count(prev.table_oid(i)))
+      continue;
+    builder.add_table(prev.table_oid(i),
+                      std::string(prev.table_schema(i)),
+                      std::string(prev.table_name(i)),
+                      std::string(prev.table_fragment(i)),
+                      prev.table_terms(i),
+                      pg_gen_query_stats_hints ? std::string(prev.table_hints(i)) : std::string());
   }
+  phase_us[GEN_REGEN_RENDER] += gen_stats_us_since(start);
 
-  SPI_finish();
-  std::string s = out.dump();
-  elog(LOG, "Detailed schema JSON length=%zu", s.size());
-  return s;
+  add_schema_tables(&relids, encoding, builder);
+  elog(LOG, "Spliced %zu relation(s) into a schema snapshot of %zu tables", relids.size(), prev.table_count());
+  return finish_snapshot(builder);
 }
 
 /*
-  create_flat_schema_json()
-  - Produces flattened per-column JSON (user requested style)
-  - We'll call the detailed generator internally and transform it.
+ Serializes the regenerations and statistics refreshes of this database until the end
+ of the transaction. Each reads the current snapshot, builds on it and publishes: two at
+ once would drop each other's changes, and their schema files could be renamed in
+ another order than they were published. An advisory lock tag with a field4 the SQL
+ advisory lock functions never use (they use 1 and 2), so no user lock collides.
 */
-static std::string create_flat_schema_json()
+static void lock_schema_regeneration()
 {
-  elog(LOG, "Creating flat schema cache...");
+  LOCKTAG tag;
+  SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, SCHEMA_REGEN_LOCK_KEY, 0, 3);
+  (void)LockAcquire(&tag, ExclusiveLock, false, false);
+}
 
-  std::string detailed = create_detailed_schema_json();
-  json det = json::parse(detailed);
+void regenerate_schema(const std::vector<Oid> *relids)
+{
+  if (relids != nullptr && relids->empty())
+  {
+    return;
+  }
+  lock_schema_regeneration();
+
+  // counted in pg_stat_gen_query_regen, failures included
+  auto start = std::chrono::steady_clock::now();
+  memset(phase_us, 0, sizeof(phase_us));
+  PG_TRY();
+  {
+    store_snapshot(relids == nullptr ? build_full_snapshot() : build_spliced_snapshot(*relids));
+  }
+  PG_CATCH();
+  {
+    gen_stats_record_regen(gen_stats_us_since(start), false, phase_us);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  gen_stats_record_regen(gen_stats_us_since(start), true, phase_us);
+}
 
-  json out;
-  out["tables"] = json::array();
+/*
+ The current snapshot with freshly collected statistics hints, in image. Returns false,
+ leaving image empty, when there is no snapshot or no hint changed.
+*/
+static bool build_stats_snapshot(std::string &image)
+{
+  SchemaSnapshotView view;
+  std::string_view current = schema_cache_load();
+  if (current.empty() || !view.open(current))
+  {
+    elog(LOG, "No usable schema snapshot, statistics hints not refreshed");
+    return false;
+  }
 
-  for (auto &tbl : det["tables"])
+  std::vector<std::string> hints(view.table_count());
+  if (pg_gen_query_stats_hints)
   {
-    json flat;
-    flat["schema"] = tbl.value("schema", "");
-    flat["table"] = tbl.value("table", "");
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_map<uint32, TableStatsModel> stats;
+    for (size_t i = 0; i < view.table_count(); ++i)
+    {
+      TableStatsModel &ts = stats[view.table_oid(i)];
+      ts.schema = view.table_schema(i);
+      ts.table = view.table_name(i);
+    }
+    collect_table_stats(stats);
+    phase_us[GEN_REGEN_HINTS] += gen_stats_us_since(start);
 
-    if (!tbl["table_comment"].is_null())
-      flat["table_comment"] = tbl["table_comment"];
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < view.table_count(); ++i)
+      encode_table_hints(stats[view.table_oid(i)], hints[i]);
+    phase_us[GEN_REGEN_RENDER] += gen_stats_us_since(start);
+  }
 
-    flat["columns"] = json::array();
+  size_t changed = 0;
+  for (size_t i = 0; i < view.table_count(); ++i)
+  {
+    if (view.table_hints(i) != hints[i])
+      changed++;
+  }
+  if (changed == 0)
+  {
+    elog(DEBUG1, "Statistics hints unchanged");
+    return false;
+  }
 
-    flat["indexes"] = tbl.value("indexes", json::array());
+  auto start = std::chrono::steady_clock::now();
+  image = schema_snapshot_with_hints(view, hints);
+  phase_us[GEN_REGEN_SERIALIZE] += gen_stats_us_since(start);
+  elog(LOG, "Statistics hints of %zu table(s) changed", changed);
+  return true;
+}
 
-    // Process columns
-    for (auto &col : tbl["columns"])
-    {
-      json c;
-      c["name"] = col.value("name", "");
-      c["type"] = col.value("type", "");
-
-      if (col.contains("default") && !col["default"].is_null())
-        c["default"] = col["default"];
-
-      if (!col.value("nullable", true))
-        c["nullable"] = false;
-
-      if (col.contains("comment") && !col["comment"].is_null())
-        c["comment"] = col["comment"];
-
-      if (tbl.contains("primary_key") && !tbl["primary_key"].is_null())
-      {
-        for (auto &pkcol : tbl["primary_key"]["columns"])
-        {
-          if (pkcol == col["name"])
-          {
-            c["primary_key"] = true;
-            break;
-          }
-        }
-      }
-
-      // unique constraints
-      bool is_unique = false;
-      if (tbl.contains("unique_constraints"))
-      {
-        for (auto &uc : tbl["unique_constraints"])
-        {
-          for (auto &u : uc["columns"])
-          {
-            if (u == col["name"])
-            {
-              is_unique = true;
-              break;
-            }
-          }
-        }
-      }
-      if (is_unique)
-        c["unique"] = true;
-
-      std::vector<std::string> fks;
-      if (tbl.contains("foreign_keys"))
-      {
-        std::string colName = col["name"].get<std::string>();
-        for (auto &fk : tbl["foreign_keys"])
-        {
-          const auto &cols = fk["columns"].get<std::vector<std::string>>();
-          if (std::find(cols.begin(), cols.end(), colName) != cols.end())
-          {
-            std::string ref =
-                fk["references"]["schema"].get<std::string>() + "." +
-                fk["references"]["table"].get<std::string>() + "." +
-                colName;
-
-            fks.push_back(ref);
-          }
-        }
-      }
-      if (!fks.empty())
-        c["foreign_keys"] = fks;
-
-      std::vector<std::string> checks;
-      if (tbl.contains("checks"))
-      {
-        for (auto &chk : tbl["checks"])
-        {
-          if (chk["name"] == col["name"])
-          {
-            checks.push_back(chk["definition"]);
-          }
-        }
-      }
-      if (!checks.empty())
-        c["checks"] = checks;
-
-      flat["columns"].push_back(c);
-    }
+/*
+ Rebuilds only the statistics hints of the current snapshot, without the catalog scans
+ and rendering of a regeneration. Publishes a new generation only if a hint changed (the
+ figures are rounded, so most ANALYZE runs change nothing), which keeps the prompt
+ prefix the providers have cached. Holds the regeneration lock like
+ regenerate_schema(), so a splice can't be overwritten by an older image with new
+ hints. Must run inside a transaction.
+*/
+void refresh_schema_stats()
+{
+  lock_schema_regeneration();
+  auto start = std::chrono::steady_clock::now();
+  memset(phase_us, 0, sizeof(phase_us));
+  volatile bool changed = false;
+  PG_TRY();
+  {
+    std::string image;
+    changed = build_stats_snapshot(image);
+    if (changed)
+      store_snapshot(std::move(image));
+  }
+  PG_CATCH();
+  {
+    gen_stats_record_regen(gen_stats_us_since(start), false, phase_us);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+  // counted in pg_stat_gen_query_regen only when a new generation was published
+  if (changed)
+    gen_stats_record_regen(gen_stats_us_since(start), true, phase_us);
+}
 
-    out["tables"].push_back(flat);
+std::vector<Oid> relids_from_array(Datum array)
+{
+  ArrayType *arr = DatumGetArrayTypeP(array);
+  Datum *elems;
+  bool *nulls;
+  int nelems;
+  deconstruct_array(arr, OIDOID, sizeof(Oid), true, 'i', &elems, &nulls, &nelems);
+
+  std::vector<Oid> relids;
+  for (int i = 0; i < nelems; ++i)
+  {
+    if (!nulls[i])
+      relids.push_back(DatumGetObjectId(elems[i]));
   }
-  return out.dump();
+  return relids;
 }
 
 extern "C"
@@ -603,20 +816,35 @@ extern "C"
   PG_FUNCTION_INFO_V1(regen_schema_cache);
   Datum regen_schema_cache(PG_FUNCTION_ARGS)
   {
-    std::string json = create_flat_schema_json();
-    // std::string json = create_detailed_schema_json();
-    std::ofstream f(SCHEMA_PATH, std::ios::out | std::ios::trunc);
-    if (!f.is_open())
+    regenerate_schema(nullptr);
+    PG_RETURN_VOID();
+  }
+
+  PG_FUNCTION_INFO_V1(regen_schema_cache_relations);
+
+  /*
+   Regenerates only the given relations, spliced into the current snapshot
+   (NULL regenerates everything)
+  */
+  Datum regen_schema_cache_relations(PG_FUNCTION_ARGS)
+  {
+    if (PG_ARGISNULL(0))
     {
-      elog(ERROR, "Unable to write schema cache file: %s", SCHEMA_PATH);
+      regenerate_schema(nullptr);
+      PG_RETURN_VOID();
     }
 
-    schema_cache.clear();
+    std::vector<Oid> relids = relids_from_array(PG_GETARG_DATUM(0));
+    regenerate_schema(&relids);
+    PG_RETURN_VOID();
+  }
 
-    f << json;
-    f.close();
+  PG_FUNCTION_INFO_V1(regen_schema_stats);
 
-    elog(LOG, "Schema file refreshed: %s", SCHEMA_PATH);
+  // Refreshes the statistics hints of the current snapshot
+  Datum regen_schema_stats(PG_FUNCTION_ARGS)
+  {
+    refresh_schema_stats();
     PG_RETURN_VOID();
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+extern "C"
+{
+#include "postgres.h"
+}
+
+#include <vector>
+
+/*
+ Regenerates the schema snapshot and publishes it. relids limits the work to those
+ relations (spliced into the current snapshot); nullptr rebuilds everything.
+ Must run inside a transaction.
+*/
+void regenerate_schema(const std::vector<Oid> *relids);
+
+/*
+ Refreshes only the statistics hints (pg_gen_query.stats_hints) of the current snapshot,
+ publishing a new generation if they changed. Must run inside a transaction.
+*/
+void refresh_schema_stats();
+
+// Non-null elements of an oid[] datum
+std::vector<Oid> relids_from_array(Datum array);
@@ -0,0 +1,561 @@
+extern "C"
+{
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "catalog/pg_database.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+}
+
+#include <algorithm>
+#include <vector>
+#include "regen_schema.h"
+#include "regen_worker.h"
+#include "schema_cache.h"
+
+extern int pg_gen_query_regen_debounce;
+extern bool pg_gen_query_deferred_regen;
+extern int pg_gen_query_stats_refresh_interval;
+extern bool pg_gen_query_stats_hints;
+
+#define REGEN_MAX_DATABASES 64
+#define REGEN_MAX_RELIDS 512
+// Wait before retrying a regeneration that failed
+#define REGEN_RETRY_DELAY_MS 10000
+
+/*
+ Changes committed in one database and not yet regenerated, or a due refresh of its
+ statistics hints. A worker copies the changes but leaves them in the slot until its
+ transaction has committed, and clears them only if nothing was added meanwhile
+ (change_count unchanged); so a failed or crashed worker loses nothing, and changes
+ committed while it runs are picked up in the next round.
+*/
+struct RegenSlot
+{
+  Oid dboid; // InvalidOid = free
+  bool pending;
+  bool stats; // only the statistics hints are due (any regeneration refreshes them too)
+  bool full;  // NULL relids, or more than REGEN_MAX_RELIDS relations
+  bool in_progress;
+  uint64 change_count;     // bumped whenever changes are added
+  TimestampTz last_change;
+  TimestampTz retry_after; // after a failed regeneration
+  int nrelids;
+  Oid relids[REGEN_MAX_RELIDS];
+};
+
+struct RegenShared
+{
+  LWLock *lock;
+  Latch *launcher_latch;
+  RegenSlot slots[REGEN_MAX_DATABASES];
+};
+
+static RegenShared *shared = nullptr;
+
+// Changes recorded by the current transaction, handed over at commit
+static std::vector<Oid> pending_relids;
+static bool pending_full = false;
+static bool pending_any = false;
+// a transaction with changes was prepared: rebuild everything at this backend's next commit
+static bool prepared_changes = false;
+static bool xact_callback_registered = false;
+
+// Set by the worker once its regeneration has committed
+static bool worker_succeeded = false;
+
+extern "C"
+{
+  PGDLLEXPORT void pg_gen_query_regen_launcher_main(Datum main_arg);
+  PGDLLEXPORT void pg_gen_query_regen_worker_main(Datum main_arg);
+}
+
+size_t regen_worker_shmem_size()
+{
+  return MAXALIGN(sizeof(RegenShared));
+}
+
+void regen_worker_shmem_request()
+{
+  RequestNamedLWLockTranche("pg_gen_query_regen", 1);
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void regen_worker_shmem_startup()
+{
+  bool found;
+  shared = (RegenShared *)ShmemInitStruct("pg_gen_query regen queue", sizeof(RegenShared), &found);
+  if (!found)
+  {
+    memset(shared, 0, sizeof(RegenShared));
+    shared->lock = &(GetNamedLWLockTranche("pg_gen_query_regen"))->lock;
+  }
+}
+
+void regen_worker_register()
+{
+  BackgroundWorker worker;
+  memset(&worker, 0, sizeof(worker));
+  // connected to no database, to read pg_database
+  worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = 10;
+  strlcpy(worker.bgw_library_name, "pg_gen_query", BGW_MAXLEN);
+  strlcpy(worker.bgw_function_name, "pg_gen_query_regen_launcher_main", BGW_MAXLEN);
+  strlcpy(worker.bgw_name, "pg_gen_query regen launcher", BGW_MAXLEN);
+  strlcpy(worker.bgw_type, "pg_gen_query regen launcher", BGW_MAXLEN);
+  RegisterBackgroundWorker(&worker);
+}
+
+/*
+ Moves this transaction's changes into the database's slot and wakes the launcher.
+ Runs in the commit callback, after the catalog changes became visible.
+*/
+static void enqueue_pending()
+{
+  TimestampTz now = GetCurrentTimestamp();
+  RegenSlot *slot = nullptr;
+  RegenSlot *free_slot = nullptr;
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  for (int i = 0; i < REGEN_MAX_DATABASES; ++i)
+  {
+    if (shared->slots[i].dboid == MyDatabaseId)
+    {
+      slot = &shared->slots[i];
+      break;
+    }
+    if (free_slot == nullptr && shared->slots[i].dboid == InvalidOid)
+      free_slot = &shared->slots[i];
+  }
+  if (slot == nullptr && free_slot != nullptr)
+  {
+    slot = free_slot;
+    slot->dboid = MyDatabaseId;
+    slot->pending = false;
+    slot->stats = false;
+    slot->full = false;
+    slot->in_progress = false;
+    slot->change_count = 0;
+    slot->retry_after = 0;
+    slot->nrelids = 0;
+  }
+
+  if (slot != nullptr)
+  {
+    if (!slot->pending)
+    {
+      slot->full = false;
+      slot->nrelids = 0;
+    }
+    slot->pending = true;
+    slot->stats = false;
+    slot->change_count++;
+    slot->last_change = now;
+    if (pending_full)
+      slot->full = true;
+    for (size_t i = 0; i < pending_relids.size() && !slot->full; ++i)
+    {
+      Oid *end = slot->relids + slot->nrelids;
+      if (std::find(slot->relids, end, pending_relids[i]) != end)
+        continue;
+      if (slot->nrelids == REGEN_MAX_RELIDS)
+        slot->full = true;
+      else
+        slot->relids[slot->nrelids++] = pending_relids[i];
+    }
+  }
+  Latch *latch = shared->launcher_latch;
+  LWLockRelease(shared->lock);
+
+  if (slot == nullptr)
+    elog(WARNING, "pg_gen_query: too many databases waiting for schema regeneration, run SELECT regen_schema_cache(); in database %u", MyDatabaseId);
+  else if (latch != nullptr)
+    SetLatch(latch);
+}
+
+static void regen_xact_callback(XactEvent event, void *arg)
+{
+  switch (event)
+  {
+  case XACT_EVENT_COMMIT:
+    if (prepared_changes)
+    {
+      pending_any = true;
+      pending_full = true;
+      prepared_changes = false;
+    }
+    if (pending_any)
+      enqueue_pending();
+    break;
+  case XACT_EVENT_PREPARE:
+    /*
+     The changes only become visible at COMMIT PREPARED, which may never come or come
+     from another session; regenerating now would read the old catalogs. The next
+     commit in this backend (such as COMMIT PREPARED itself) rebuilds everything.
+    */
+    if (pending_any)
+    {
+      prepared_changes = true;
+      ereport(NOTICE,
+              (errmsg("pg_gen_query: the schema is not regenerated for the changes of a prepared transaction until this session commits again"),
+               errhint("Run SELECT regen_schema_cache(); after COMMIT PREPARED in another session.")));
+    }
+    break;
+  case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_COMMIT:
+  case XACT_EVENT_PARALLEL_ABORT:
+    break;
+  default:
+    return;
+  }
+  pending_relids.clear();
+  pending_full = false;
+  pending_any = false;
+}
+
+/*
+ Worker exit (also on error): release the slot once nothing is pending; after a failure
+ the changes are still in the slot and are retried after REGEN_RETRY_DELAY_MS
+*/
+static void regen_worker_done(int code, Datum arg)
+{
+  RegenSlot *slot = &shared->slots[DatumGetInt32(arg)];
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  slot->in_progress = false;
+  if (!worker_succeeded)
+    slot->retry_after = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), REGEN_RETRY_DELAY_MS);
+  if (!slot->pending)
+    slot->dboid = InvalidOid;
+  Latch *latch = shared->launcher_latch;
+  LWLockRelease(shared->lock);
+
+  if (latch != nullptr)
+    SetLatch(latch);
+}
+
+void pg_gen_query_regen_worker_main(Datum main_arg)
+{
+  int slotno = DatumGetInt32(main_arg);
+  RegenSlot *slot = &shared->slots[slotno];
+
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+
+  before_shmem_exit(regen_worker_done, Int32GetDatum(slotno));
+
+  // the slot's database can't change while it is in progress
+  BackgroundWorkerInitializeConnectionByOid(slot->dboid, InvalidOid, 0);
+
+  // copy the accumulated changes; they stay in the slot until the regeneration committed
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  bool stats = slot->stats;
+  bool full = slot->full;
+  uint64 change_count = slot->change_count;
+  std::vector<Oid> relids(slot->relids, slot->relids + slot->nrelids);
+  LWLockRelease(shared->lock);
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  PushActiveSnapshot(GetTransactionSnapshot());
+  pgstat_report_activity(STATE_RUNNING, stats ? "refreshing pg_gen_query statistics hints"
+                                               : "regenerating pg_gen_query schema");
+
+  if (stats)
+    refresh_schema_stats();
+  else
+    regenerate_schema(full ? nullptr : &relids);
+
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+  pgstat_report_activity(STATE_IDLE, NULL);
+
+  // anything committed while this ran is still pending for the next round
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  if (slot->change_count == change_count)
+  {
+    slot->pending = false;
+    slot->stats = false;
+    slot->full = false;
+    slot->nrelids = 0;
+  }
+  slot->retry_after = 0;
+  worker_succeeded = true;
+  LWLockRelease(shared->lock);
+
+  if (stats)
+    elog(DEBUG1, "pg_gen_query: refreshed the statistics hints of database %u", MyDatabaseId);
+  else if (full)
+    elog(LOG, "pg_gen_query: regenerated the schema of database %u", MyDatabaseId);
+  else
+    elog(LOG, "pg_gen_query: regenerated %zu relation(s) in database %u", relids.size(), MyDatabaseId);
+  proc_exit(0);
+}
+
+static bool start_regen_worker(int slotno, BackgroundWorkerHandle **handle)
+{
+  BackgroundWorker worker;
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = BGW_NEVER_RESTART;
+  strlcpy(worker.bgw_library_name, "pg_gen_query", BGW_MAXLEN);
+  strlcpy(worker.bgw_function_name, "pg_gen_query_regen_worker_main", BGW_MAXLEN);
+  strlcpy(worker.bgw_name, "pg_gen_query regen worker", BGW_MAXLEN);
+  strlcpy(worker.bgw_type, "pg_gen_query regen worker", BGW_MAXLEN);
+  worker.bgw_main_arg = Int32GetDatum(slotno);
+  worker.bgw_notify_pid = MyProcPid;
+  return RegisterDynamicBackgroundWorker(&worker, handle);
+}
+
+/*
+ Whether the database still exists. DROP DATABASE fires no event trigger, so the
+ launcher finds out about it here, before connecting a worker that would fail.
+*/
+static bool database_exists(Oid dboid)
+{
+  StartTransactionCommand();
+  bool exists = SearchSysCacheExists1(DATABASEOID, ObjectIdGetDatum(dboid));
+  CommitTransactionCommand();
+  return exists;
+}
+
+/*
+ Queues a refresh of the statistics hints for every database whose snapshot is resident
+ in shared memory and that has nothing else queued (a regeneration refreshes them anyway).
+ Databases whose snapshot was evicted are refreshed when they are next loaded and due;
+ snapshots of dropped databases are dropped.
+*/
+static void enqueue_stats_refresh()
+{
+  std::vector<SchemaCacheEntry> entries = schema_cache_entries();
+  std::vector<SchemaCacheEntry> live;
+  for (const SchemaCacheEntry &entry : entries)
+  {
+    if (database_exists(entry.dbid))
+      live.push_back(entry);
+    else
+      schema_cache_forget(entry.dbid);
+  }
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  for (const SchemaCacheEntry &entry : live)
+  {
+    RegenSlot *slot = nullptr;
+    for (int i = 0; i < REGEN_MAX_DATABASES; ++i)
+    {
+      if (shared->slots[i].dboid == entry.dbid)
+      {
+        slot = &shared->slots[i];
+        break;
+      }
+      if (slot == nullptr && shared->slots[i].dboid == InvalidOid)
+        slot = &shared->slots[i];
+    }
+    if (slot == nullptr || (slot->dboid == entry.dbid && slot->pending))
+      continue;
+    if (slot->dboid != entry.dbid)
+    {
+      slot->dboid = entry.dbid;
+      slot->in_progress = false;
+      slot->full = false;
+      slot->change_count = 0;
+      slot->retry_after = 0;
+      slot->nrelids = 0;
+    }
+    slot->pending = true;
+    slot->stats = true;
+    slot->change_count++;
+    slot->last_change = 0;
+  }
+  LWLockRelease(shared->lock);
+}
+
+static void regen_launcher_detach(int code, Datum arg)
+{
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  shared->launcher_latch = NULL;
+  LWLockRelease(shared->lock);
+}
+
+/*
+ Launcher: waits for committed changes and starts one worker per database once the
+ database has been quiet for pg_gen_query.regen_debounce
+*/
+void pg_gen_query_regen_launcher_main(Datum main_arg)
+{
+  BackgroundWorkerHandle *handles[REGEN_MAX_DATABASES] = {};
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+  BackgroundWorkerInitializeConnection(NULL, NULL, 0);
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  shared->launcher_latch = MyLatch;
+  // workers started by a previous launcher can't be tracked anymore
+  for (int i = 0; i < REGEN_MAX_DATABASES; ++i)
+    shared->slots[i].in_progress = false;
+  LWLockRelease(shared->lock);
+  before_shmem_exit(regen_launcher_detach, 0);
+
+  TimestampTz next_stats_refresh = 0;
+  for (;;)
+  {
+    CHECK_FOR_INTERRUPTS();
+    if (ConfigReloadPending)
+    {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+    }
+
+    // a worker that died without running its exit callback leaves its slot in progress
+    for (int i = 0; i < REGEN_MAX_DATABASES; ++i)
+    {
+      pid_t pid;
+      if (handles[i] == nullptr || GetBackgroundWorkerPid(handles[i], &pid) != BGWH_STOPPED)
+        continue;
+      pfree(handles[i]);
+      handles[i] = nullptr;
+      LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+      if (shared->slots[i].in_progress)
+      {
+        shared->slots[i].in_progress = false;
+        shared->slots[i].retry_after = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), REGEN_RETRY_DELAY_MS);
+        if (!shared->slots[i].pending)
+          shared->slots[i].dboid = InvalidOid;
+      }
+      LWLockRelease(shared->lock);
+    }
+
+    TimestampTz now = GetCurrentTimestamp();
+    long timeout = -1;
+    int due[REGEN_MAX_DATABASES];
+    int ndue = 0;
+
+    // without hints there is nothing to refresh
+    if (pg_gen_query_stats_hints && pg_gen_query_stats_refresh_interval > 0)
+    {
+      TimestampTz interval_end = TimestampTzPlusMilliseconds(now, pg_gen_query_stats_refresh_interval * 1000L);
+      // the first refresh is one interval after start; a shorter interval takes effect right away
+      if (next_stats_refresh == 0 || next_stats_refresh > interval_end)
+        next_stats_refresh = interval_end;
+      if (next_stats_refresh <= now)
+      {
+        enqueue_stats_refresh();
+        next_stats_refresh = interval_end;
+      }
+      timeout = (long)((next_stats_refresh - now) / 1000) + 1;
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    for (int i = 0; i < REGEN_MAX_DATABASES; ++i)
+    {
+      RegenSlot *slot = &shared->slots[i];
+      if (slot->dboid == InvalidOid || !slot->pending || slot->in_progress)
+        continue;
+      TimestampTz quiet_until = Max(TimestampTzPlusMilliseconds(slot->last_change, pg_gen_query_regen_debounce),
+                                    slot->retry_after);
+      if (quiet_until > now)
+      {
+        long wait_ms = (long)((quiet_until - now) / 1000) + 1;
+        timeout = timeout < 0 ? wait_ms : std::min(timeout, wait_ms);
+        continue;
+      }
+      slot->in_progress = true;
+      due[ndue++] = i;
+    }
+    LWLockRelease(shared->lock);
+
+    for (int n = 0; n < ndue; ++n)
+    {
+      int i = due[n];
+      // a dropped database: its worker would fail to connect, again every REGEN_RETRY_DELAY_MS
+      Oid dboid = shared->slots[i].dboid;
+      if (!database_exists(dboid))
+      {
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+        RegenSlot *slot = &shared->slots[i];
+        slot->dboid = InvalidOid;
+        slot->pending = false;
+        slot->stats = false;
+        slot->full = false;
+        slot->in_progress = false;
+        slot->nrelids = 0;
+        LWLockRelease(shared->lock);
+        schema_cache_forget(dboid);
+        elog(LOG, "pg_gen_query: database %u no longer exists, dropped its pending regeneration", dboid);
+        continue;
+      }
+      if (handles[i] != nullptr)
+      {
+        pfree(handles[i]);
+        handles[i] = nullptr;
+      }
+      if (!start_regen_worker(i, &handles[i]))
+      {
+        // out of background worker slots: retry shortly
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+        shared->slots[i].in_progress = false;
+        LWLockRelease(shared->lock);
+        timeout = timeout < 0 ? 1000 : std::min(timeout, 1000L);
+      }
+    }
+
+    (void)WaitLatch(MyLatch,
+                    WL_LATCH_SET | WL_EXIT_ON_PM_DEATH | (timeout >= 0 ? WL_TIMEOUT : 0),
+                    timeout, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+}
+
+extern "C"
+{
+  PG_FUNCTION_INFO_V1(pg_gen_query_schema_changed);
+
+  /*
+   Called by the event triggers with the affected relations (NULL = everything).
+   With the background worker, the regeneration is deferred until after commit and
+   coalesced with other changes; otherwise it runs right away, inside the DDL transaction.
+  */
+  Datum pg_gen_query_schema_changed(PG_FUNCTION_ARGS)
+  {
+    std::vector<Oid> relids;
+    if (!PG_ARGISNULL(0))
+      relids = relids_from_array(PG_GETARG_DATUM(0));
+
+    if (shared == nullptr || !pg_gen_query_deferred_regen)
+    {
+      regenerate_schema(PG_ARGISNULL(0) ? nullptr : &relids);
+      PG_RETURN_VOID();
+    }
+
+    if (!xact_callback_registered)
+    {
+      RegisterXactCallback(regen_xact_callback, NULL);
+      xact_callback_registered = true;
+    }
+    pending_any = true;
+    if (PG_ARGISNULL(0))
+      pending_full = true;
+    else
+      pending_relids.insert(pending_relids.end(), relids.begin(), relids.end());
+    PG_RETURN_VOID();
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef REGEN_WORKER_H
+#define REGEN_WORKER_H
+
+#include <cstddef>
+
+/*
+ Deferred schema regeneration: event triggers only record which relations changed,
+ and after commit a background worker rebuilds the snapshot once per quiet period
+ (pg_gen_query.regen_debounce). Requires shared_preload_libraries; otherwise the
+ triggers regenerate synchronously as before.
+*/
+
+size_t regen_worker_shmem_size();
+void regen_worker_shmem_request();
+void regen_worker_shmem_startup();
+
+// Registers the launcher background worker (from _PG_init)
+void regen_worker_register();
+
+#endif
@@ -1,11 +1,539 @@
+extern "C"
+{
+#include "postgres.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/dsm.h"
+#include "storage/fd.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+}
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constants.h"
 #include "schema_cache.h"
+#include "schema_snapshot.h"
+
+extern bool pg_gen_query_shared_schema;
+extern int pg_gen_query_schema_cache_memory;
 
-// Use pg shared memory (with lockless reads) as a cache (might result in better performance)
-// Initial tests show accessing this results in a ~20% performance penalty (when compared to not reading schema at all)
-// Need more testing
 std::string schema_cache;
 
+/*
+ One database's published snapshot. A slot is in use while generation != 0; generations
+ come from one cluster-wide counter, so a backend that still sees the generation it
+ pinned knows the slot was neither replaced nor handed to another database.
+*/
+struct SchemaCacheSlot
+{
+  pg_atomic_uint64 generation;
+  pg_atomic_uint64 last_used; // TimestampTz of the last read, updated at most once a second
+  Oid dbid;
+  dsm_handle handle;
+  uint64 size;
+  bool from_file; // published by a lazy load of the schema file, not a regeneration
+};
+
+/*
+ Shared control block: the snapshots resident in shared memory, one slot per database.
+ Readers only take the lock when their generation changed; publishers take it
+ exclusively and evict the least recently used databases when the snapshots exceed
+ pg_gen_query.schema_cache_memory.
+*/
+struct SchemaCacheShared
+{
+  LWLock *lock;
+  uint64 next_generation;
+  SchemaCacheSlot slots[SCHEMA_CACHE_MAX_DATABASES];
+};
+
+/*
+ Header at the start of every snapshot segment, followed by the schema bytes.
+ Segments are immutable once published.
+*/
+struct SchemaSnapshotHeader
+{
+  uint64 generation;
+  uint64 size;
+};
+
+static SchemaCacheShared *shared = nullptr;
+
+// Snapshot segment currently mapped by this backend, and the slot it came from
+static dsm_segment *pinned_segment = nullptr;
+static uint64 pinned_generation = 0;
+static int pinned_slot = -1;
+static TimestampTz last_touch = 0;
+
+// Generation counter for the per-backend fallback copy
+static uint64 local_generation = 0;
+static uint64 last_generation = 0;
+
+// Read-only mapping of this database's schema file, the per-backend snapshot until this backend publishes one
+static const char *mapped_image = nullptr;
+static size_t mapped_size = 0;
+
+size_t schema_cache_shmem_size()
+{
+  return MAXALIGN(sizeof(SchemaCacheShared));
+}
+
+void schema_cache_shmem_request()
+{
+  RequestNamedLWLockTranche("pg_gen_query_schema", 1);
+}
+
+/*
+ Called from the shmem startup hook with AddinShmemInitLock held
+*/
+void schema_cache_shmem_startup()
+{
+  bool found;
+  shared = (SchemaCacheShared *)ShmemInitStruct("pg_gen_query schema cache",
+                                                sizeof(SchemaCacheShared), &found);
+  if (!found)
+  {
+    shared->lock = &(GetNamedLWLockTranche("pg_gen_query_schema"))->lock;
+    shared->next_generation = 0;
+    for (SchemaCacheSlot &slot : shared->slots)
+    {
+      pg_atomic_init_u64(&slot.generation, 0);
+      pg_atomic_init_u64(&slot.last_used, 0);
+      slot.dbid = InvalidOid;
+      slot.handle = DSM_HANDLE_INVALID;
+      slot.size = 0;
+      slot.from_file = false;
+    }
+  }
+}
+
+bool schema_cache_is_shared()
+{
+  return shared != nullptr && pg_gen_query_shared_schema;
+}
+
+const char *schema_cache_file()
+{
+  static char path[MAXPGPATH];
+  snprintf(path, sizeof(path), "%s/schema_%u.snap", SCHEMA_DIR, MyDatabaseId);
+  return path;
+}
+
+static std::string_view pinned_view()
+{
+  if (pinned_segment == nullptr)
+  {
+    return {};
+  }
+  auto *hdr = (SchemaSnapshotHeader *)dsm_segment_address(pinned_segment);
+  return std::string_view((const char *)(hdr + 1), hdr->size);
+}
+
+// Swaps the backend's mapping to seg (already attached and pinned, or nullptr)
+static void pin_segment(dsm_segment *seg, uint64 generation, int slot)
+{
+  if (pinned_segment != nullptr)
+  {
+    dsm_detach(pinned_segment);
+  }
+  pinned_segment = seg;
+  pinned_generation = generation;
+  pinned_slot = slot;
+}
+
+// Records a read for the LRU order, at most once a second per backend
+static void touch_slot(SchemaCacheSlot *slot)
+{
+  TimestampTz now = GetCurrentTimestamp();
+  if (now - last_touch >= USECS_PER_SEC)
+  {
+    pg_atomic_write_u64(&slot->last_used, (uint64)now);
+    last_touch = now;
+  }
+}
+
+static int find_slot(Oid dbid)
+{
+  for (int i = 0; i < SCHEMA_CACHE_MAX_DATABASES; ++i)
+  {
+    if (shared->slots[i].dbid == dbid && pg_atomic_read_u64(&shared->slots[i].generation) != 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void unmap_schema_file()
+{
+  if (mapped_image != nullptr)
+  {
+    munmap((void *)mapped_image, mapped_size);
+    mapped_image = nullptr;
+    mapped_size = 0;
+  }
+}
+
+/*
+ Maps this database's schema file read-only, so backends share its page cache pages
+ instead of each reading a private copy. The writer replaces the file by rename(), never
+ in place, so the mapping stays intact when a new snapshot is written. Returns an empty
+ view if there is no file or it fails verification.
+*/
+static std::string_view map_schema_file()
+{
+  const char *file = schema_cache_file();
+  int fd = OpenTransientFile(file, O_RDONLY | PG_BINARY);
+  if (fd < 0)
+  {
+    return {};
+  }
+  struct stat st;
+  size_t size = 0;
+  void *p = MAP_FAILED;
+  int save_errno = 0;
+  if (fstat(fd, &st) == 0 && st.st_size >= SCHEMA_SNAPSHOT_HEADER_SIZE)
+  {
+    size = (size_t)st.st_size;
+    p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    save_errno = errno;
+  }
+  CloseTransientFile(fd);
+  if (size == 0)
+  {
+    elog(WARNING, "Schema file %s is damaged or has an older format, run SELECT regen_schema_cache();", file);
+    return {};
+  }
+  if (p == MAP_FAILED)
+  {
+    errno = save_errno;
+    elog(WARNING, "pg_gen_query: could not map schema file %s: %m", file);
+    return {};
+  }
+
+  std::string_view image((const char *)p, size);
+  if (!schema_snapshot_verify(image))
+  {
+    munmap(p, size);
+    elog(WARNING, "Schema file %s is damaged or has an older format, run SELECT regen_schema_cache();", file);
+    return {};
+  }
+  elog(LOG, "Loading schema file: %s (generation %lu)", file, (unsigned long)schema_snapshot_generation(image));
+  return image;
+}
+
+std::string_view schema_cache_get()
+{
+  if (!schema_cache_is_shared())
+  {
+    if (!schema_cache.empty())
+    {
+      last_generation = local_generation;
+      return schema_cache;
+    }
+    last_generation = mapped_image == nullptr ? 0 : local_generation;
+    return std::string_view(mapped_image, mapped_size);
+  }
+
+  // common case: nothing new was published for this database since our last call
+  if (pinned_slot >= 0)
+  {
+    SchemaCacheSlot *slot = &shared->slots[pinned_slot];
+    if (pg_atomic_read_u64(&slot->generation) == pinned_generation)
+    {
+      touch_slot(slot);
+      last_generation = pinned_generation;
+      return pinned_view();
+    }
+  }
+
+  for (;;)
+  {
+    LWLockAcquire(shared->lock, LW_SHARED);
+    int i = find_slot(MyDatabaseId);
+    uint64 generation = i < 0 ? 0 : pg_atomic_read_u64(&shared->slots[i].generation);
+    dsm_handle handle = i < 0 ? DSM_HANDLE_INVALID : shared->slots[i].handle;
+    LWLockRelease(shared->lock);
+
+    if (i < 0)
+    {
+      // not resident (never loaded, or evicted): let go of the old generation
+      pin_segment(nullptr, 0, -1);
+      last_generation = 0;
+      return {};
+    }
+    if (generation == pinned_generation)
+    {
+      pinned_slot = i;
+      last_generation = generation;
+      return pinned_view();
+    }
+
+    // the segment may already be superseded and destroyed; in that case retry
+    dsm_segment *seg = dsm_attach(handle);
+    if (seg == nullptr)
+    {
+      continue;
+    }
+    auto *hdr = (SchemaSnapshotHeader *)dsm_segment_address(seg);
+    if (hdr->generation != generation)
+    {
+      dsm_detach(seg);
+      continue;
+    }
+
+    // keep the mapping beyond the current resource owner (i.e. across transactions)
+    dsm_pin_mapping(seg);
+    pin_segment(seg, generation, i);
+    last_touch = 0;
+    touch_slot(&shared->slots[i]);
+    last_generation = generation;
+    return pinned_view();
+  }
+}
+
+std::string_view schema_cache_load()
+{
+  std::string_view image = schema_cache_get();
+  if (!image.empty())
+  {
+    return image;
+  }
+  std::string_view file = map_schema_file();
+  if (file.empty())
+  {
+    return {};
+  }
+  if (!schema_cache_is_shared())
+  {
+    // the mapping is the snapshot
+    mapped_image = file.data();
+    mapped_size = file.size();
+    last_generation = ++local_generation;
+    return file;
+  }
+  schema_cache_publish(file, true);
+  munmap((void *)file.data(), file.size());
+  return schema_cache_get();
+}
+
+uint64_t schema_cache_generation()
+{
+  return last_generation;
+}
+
+/*
+ Frees the slot of the least recently used other database, adding its segment to
+ retired. Returns the slot, or -1 if no other database has one. Called with the lock
+ held exclusively.
+*/
+static int evict_lru(dsm_handle *retired, int &nretired, uint64 &resident)
+{
+  int victim = -1;
+  uint64 oldest = 0;
+  for (int i = 0; i < SCHEMA_CACHE_MAX_DATABASES; ++i)
+  {
+    SchemaCacheSlot &slot = shared->slots[i];
+    if (pg_atomic_read_u64(&slot.generation) == 0 || slot.dbid == MyDatabaseId)
+      continue;
+    uint64 used = pg_atomic_read_u64(&slot.last_used);
+    if (victim < 0 || used < oldest)
+    {
+      victim = i;
+      oldest = used;
+    }
+  }
+  if (victim >= 0)
+  {
+    SchemaCacheSlot &slot = shared->slots[victim];
+    pg_atomic_write_u64(&slot.generation, 0);
+    retired[nretired++] = slot.handle;
+    resident -= slot.size;
+    slot.dbid = InvalidOid;
+    slot.handle = DSM_HANDLE_INVALID;
+    slot.size = 0;
+  }
+  return victim;
+}
+
+uint64_t schema_cache_reserve_generation()
+{
+  if (!schema_cache_is_shared())
+  {
+    return ++local_generation;
+  }
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  uint64 generation = ++shared->next_generation;
+  LWLockRelease(shared->lock);
+  return generation;
+}
+
+void schema_cache_publish(std::string_view schema, bool only_if_empty, uint64_t reserved)
+{
+  if (!schema_cache_is_shared())
+  {
+    if (only_if_empty && (!schema_cache.empty() || mapped_image != nullptr))
+    {
+      return;
+    }
+    schema_cache.assign(schema);
+    unmap_schema_file();
+    last_generation = reserved != 0 ? reserved : ++local_generation;
+    return;
+  }
+
+  dsm_segment *seg = dsm_create(sizeof(SchemaSnapshotHeader) + schema.size(),
+                                DSM_CREATE_NULL_IF_MAXSEGMENTS);
+  if (seg == nullptr)
+  {
+    elog(WARNING, "pg_gen_query: out of dynamic shared memory segments, schema snapshot not published");
+    return;
+  }
+
+  auto *hdr = (SchemaSnapshotHeader *)dsm_segment_address(seg);
+  hdr->size = schema.size();
+  memcpy(hdr + 1, schema.data(), schema.size());
+
+  // the segment outlives this backend until a newer generation replaces it or it is evicted
+  dsm_pin_segment(seg);
+  dsm_pin_mapping(seg);
+
+  uint64 budget = (uint64)pg_gen_query_schema_cache_memory * 1024;
+  dsm_handle retired[SCHEMA_CACHE_MAX_DATABASES + 1];
+  int nretired = 0;
+  int evicted = 0;
+  uint64 generation = 0;
+  int i;
+
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  i = find_slot(MyDatabaseId);
+  /*
+   Regenerations reserve their generation under the regeneration lock, so a resident one
+   at least as new means this snapshot was superseded; a lazily loaded file can't be newer
+  */
+  uint64 resident_generation = i < 0 ? 0 : pg_atomic_read_u64(&shared->slots[i].generation);
+  bool stale = reserved != 0 && i >= 0 && !shared->slots[i].from_file && resident_generation >= reserved;
+  if (!stale && (!only_if_empty || i < 0))
+  {
+    uint64 resident = 0;
+    for (SchemaCacheSlot &slot : shared->slots)
+    {
+      if (pg_atomic_read_u64(&slot.generation) != 0 && slot.dbid != MyDatabaseId)
+        resident += slot.size;
+    }
+    if (i >= 0)
+    {
+      retired[nretired++] = shared->slots[i].handle;
+    }
+    for (int k = 0; k < SCHEMA_CACHE_MAX_DATABASES && i < 0; ++k)
+    {
+      if (pg_atomic_read_u64(&shared->slots[k].generation) == 0)
+        i = k;
+    }
+    // a snapshot larger than the whole budget still gets in, alone
+    while (i < 0 || (budget > 0 && resident + schema.size() > budget))
+    {
+      int victim = evict_lru(retired, nretired, resident);
+      if (victim < 0)
+        break;
+      evicted++;
+      if (i < 0)
+        i = victim;
+    }
+
+    if (i >= 0)
+    {
+      SchemaCacheSlot &slot = shared->slots[i];
+      generation = reserved != 0 ? reserved : ++shared->next_generation;
+      hdr->generation = generation;
+      slot.dbid = MyDatabaseId;
+      slot.handle = dsm_segment_handle(seg);
+      slot.size = schema.size();
+      slot.from_file = only_if_empty;
+      pg_atomic_write_u64(&slot.last_used, (uint64)GetCurrentTimestamp());
+      pg_write_barrier();
+      pg_atomic_write_u64(&slot.generation, generation);
+    }
+  }
+  LWLockRelease(shared->lock);
+
+  if (generation == 0)
+  {
+    dsm_unpin_segment(dsm_segment_handle(seg));
+    dsm_detach(seg);
+    if (stale)
+    {
+      elog(WARNING, "pg_gen_query: schema generation %lu not published, generation %lu is newer",
+           (unsigned long)reserved, (unsigned long)resident_generation);
+    }
+    return;
+  }
+
+  // RCU-style retirement: replaced and evicted generations are destroyed once their last reader detaches
+  for (int k = 0; k < nretired; ++k)
+  {
+    dsm_unpin_segment(retired[k]);
+  }
+  if (evicted > 0)
+  {
+    elog(LOG, "pg_gen_query: evicted the schema snapshots of %d database(s) to stay within pg_gen_query.schema_cache_memory",
+         evicted);
+  }
+  pin_segment(seg, generation, i);
+  last_generation = generation;
+}
+
+std::vector<SchemaCacheEntry> schema_cache_entries()
+{
+  std::vector<SchemaCacheEntry> entries;
+  if (shared == nullptr)
+  {
+    return entries;
+  }
+  entries.reserve(SCHEMA_CACHE_MAX_DATABASES); // no allocation while holding the lock
+  LWLockAcquire(shared->lock, LW_SHARED);
+  for (SchemaCacheSlot &slot : shared->slots)
+  {
+    uint64 generation = pg_atomic_read_u64(&slot.generation);
+    if (generation != 0)
+      entries.push_back({slot.dbid, generation, slot.size, (int64_t)pg_atomic_read_u64(&slot.last_used)});
+  }
+  LWLockRelease(shared->lock);
+  return entries;
+}
+
+void schema_cache_forget(uint32_t dbid)
+{
+  if (shared == nullptr)
+  {
+    return;
+  }
+  dsm_handle retired = DSM_HANDLE_INVALID;
+  LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+  int i = find_slot(dbid);
+  if (i >= 0)
+  {
+    SchemaCacheSlot &slot = shared->slots[i];
+    pg_atomic_write_u64(&slot.generation, 0);
+    retired = slot.handle;
+    slot.dbid = InvalidOid;
+    slot.handle = DSM_HANDLE_INVALID;
+    slot.size = 0;
+  }
+  LWLockRelease(shared->lock);
+  if (retired != DSM_HANDLE_INVALID)
+  {
+    dsm_unpin_segment(retired);
+  }
+}
+
 void clear_schema_cache()
 {
   schema_cache.clear();
+  unmap_schema_file();
+  pin_segment(nullptr, 0, -1);
 }
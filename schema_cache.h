@@ -1,10 +1,81 @@
 #ifndef SCHEMA_CACHE_H
 #define SCHEMA_CACHE_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
+/*
+  Schema snapshots are kept per database: each database has its own schema file and,
+  when shared, its own slot in shared memory. A backend only ever sees the snapshot of
+  the database it is connected to.
+*/
+
+// Databases whose snapshots can be resident in shared memory at the same time
+#define SCHEMA_CACHE_MAX_DATABASES 1024
+
+// Per-backend fallback copy, used when the library is not in shared_preload_libraries
+// (or pg_gen_query.shared_schema is off)
 extern std::string schema_cache;
 
+// Shared-memory setup (only valid while loading via shared_preload_libraries)
+size_t schema_cache_shmem_size();
+void schema_cache_shmem_request();
+void schema_cache_shmem_startup();
+
+// True when schema snapshots are served from shared memory in this backend
+bool schema_cache_is_shared();
+
+// Schema file of the current database, relative to the data directory
+const char *schema_cache_file();
+
+/*
+  Returns the current database's schema snapshot image (empty if none is resident).
+  The view pins its generation and stays valid until the next call in this backend.
+*/
+std::string_view schema_cache_get();
+
+/*
+  Like schema_cache_get(), but when the database has no resident snapshot (after a
+  restart, or evicted to stay within pg_gen_query.schema_cache_memory) the first caller
+  loads it from the schema file and publishes it for everyone else. Without shared
+  memory the backend maps the file and uses the mapping as its snapshot.
+*/
+std::string_view schema_cache_load();
+
+// Generation of the snapshot returned by the last schema_cache_get() (0 = none); unique across databases
+uint64_t schema_cache_generation();
+
+/*
+  Publishes a new immutable schema generation for the current database, evicting the
+  least recently used other databases when the resident snapshots would exceed
+  pg_gen_query.schema_cache_memory.
+  With only_if_empty, the snapshot is discarded if another backend already published one
+  (used when lazily loading the schema file). generation, if not 0, was taken from
+  schema_cache_reserve_generation() so the schema file could be stamped before publishing;
+  the snapshot is then discarded if a generation at least as new was already published.
+*/
+void schema_cache_publish(std::string_view schema, bool only_if_empty = false, uint64_t generation = 0);
+
+// Takes the generation number for a snapshot that is published later
+uint64_t schema_cache_reserve_generation();
+
+// A snapshot resident in shared memory
+struct SchemaCacheEntry
+{
+  uint32_t dbid;
+  uint64_t generation;
+  uint64_t bytes;
+  int64_t last_used; // TimestampTz
+};
+
+std::vector<SchemaCacheEntry> schema_cache_entries();
+
+// Drops the snapshot of a database from shared memory (e.g. the database was dropped)
+void schema_cache_forget(uint32_t dbid);
+
 void clear_schema_cache();
 
 #endif
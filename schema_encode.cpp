@@ -0,0 +1,775 @@
+#include "schema_encode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+void JsonWriter::separator()
+{
+  if (after_key_)
+  {
+    after_key_ = false;
+    return;
+  }
+  if (!first_.empty())
+  {
+    if (!first_.back())
+    {
+      out_.push_back(',');
+    }
+    first_.back() = false;
+  }
+}
+
+void JsonWriter::string(std::string_view s)
+{
+  out_.push_back('"');
+  size_t run = 0; // start of the current run of bytes that need no escaping
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    unsigned char c = (unsigned char)s[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+    {
+      continue;
+    }
+    out_.append(s.data() + run, i - run);
+    run = i + 1;
+    switch (c)
+    {
+    case '"':
+      out_.append("\\\"");
+      break;
+    case '\\':
+      out_.append("\\\\");
+      break;
+    case '\n':
+      out_.append("\\n");
+      break;
+    case '\r':
+      out_.append("\\r");
+      break;
+    case '\t':
+      out_.append("\\t");
+      break;
+    default:
+    {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out_.append(buf);
+    }
+    }
+  }
+  out_.append(s.data() + run, s.size() - run);
+  out_.push_back('"');
+}
+
+void JsonWriter::begin_object()
+{
+  separator();
+  out_.push_back('{');
+  first_.push_back(true);
+}
+
+void JsonWriter::end_object()
+{
+  first_.pop_back();
+  out_.push_back('}');
+}
+
+void JsonWriter::begin_array()
+{
+  separator();
+  out_.push_back('[');
+  first_.push_back(true);
+}
+
+void JsonWriter::end_array()
+{
+  first_.pop_back();
+  out_.push_back(']');
+}
+
+void JsonWriter::key(std::string_view k)
+{
+  separator();
+  string(k);
+  out_.push_back(':');
+  after_key_ = true;
+}
+
+void JsonWriter::value(std::string_view v)
+{
+  separator();
+  string(v);
+}
+
+void JsonWriter::value(bool v)
+{
+  separator();
+  out_.append(v ? "true" : "false");
+}
+
+void JsonWriter::value(int64_t v)
+{
+  separator();
+  out_.append(std::to_string(v));
+}
+
+void JsonWriter::null()
+{
+  separator();
+  out_.append("null");
+}
+
+static void write_string_array(JsonWriter &w, const std::vector<std::string> &values)
+{
+  w.begin_array();
+  for (const auto &v : values)
+  {
+    w.value(v);
+  }
+  w.end_array();
+}
+
+static void write_column_names(JsonWriter &w, const TableModel &table, const std::vector<int16_t> &attnums)
+{
+  w.begin_array();
+  for (int16_t attnum : attnums)
+  {
+    const ColumnModel *col = table.column(attnum);
+    w.value(col ? std::string_view(col->name) : std::string_view());
+  }
+  w.end_array();
+}
+
+static void write_indexes(JsonWriter &w, const TableModel &table)
+{
+  w.key("indexes");
+  w.begin_array();
+  for (const auto &idx : table.indexes)
+  {
+    w.begin_object();
+    w.field("name", idx.name);
+    w.field("definition", idx.definition);
+    w.key("columns");
+    write_string_array(w, idx.columns);
+    w.end_object();
+  }
+  w.end_array();
+}
+
+void encode_detailed_table(const TableModel &table, std::string &out)
+{
+  JsonWriter w(out);
+  w.begin_object();
+  w.field("schema", table.schema);
+  w.field("table", table.table);
+
+  w.key("columns");
+  w.begin_array();
+  for (const auto &col : table.columns)
+  {
+    w.begin_object();
+    w.field("name", col.name);
+    w.field("type", col.type);
+    w.field("nullable", col.nullable);
+    if (col.has_default)
+    {
+      w.field("default", col.default_expr);
+    }
+    w.key("comment");
+    if (col.has_comment)
+      w.value(col.comment);
+    else
+      w.null();
+    w.end_object();
+  }
+  w.end_array();
+
+  w.key("primary_key");
+  if (table.has_primary_key)
+  {
+    w.begin_object();
+    w.field("name", table.primary_key.name);
+    w.key("columns");
+    write_column_names(w, table, table.primary_key.attnums);
+    w.end_object();
+  }
+  else
+  {
+    w.null();
+  }
+
+  w.key("unique_constraints");
+  w.begin_array();
+  for (const auto &uc : table.unique_constraints)
+  {
+    w.begin_object();
+    w.field("name", uc.name);
+    w.key("columns");
+    write_column_names(w, table, uc.attnums);
+    w.end_object();
+  }
+  w.end_array();
+
+  w.key("foreign_keys");
+  w.begin_array();
+  for (const auto &fk : table.foreign_keys)
+  {
+    w.begin_object();
+    w.field("name", fk.name);
+    w.key("columns");
+    write_column_names(w, table, fk.attnums);
+    w.key("references");
+    w.begin_object();
+    w.field("schema", fk.ref_schema);
+    w.field("table", fk.ref_table);
+    w.key("columns");
+    write_string_array(w, fk.ref_columns);
+    w.end_object();
+    w.field("on_update", fk.on_update);
+    w.field("on_delete", fk.on_delete);
+    w.end_object();
+  }
+  w.end_array();
+
+  w.key("checks");
+  w.begin_array();
+  for (const auto &chk : table.checks)
+  {
+    w.begin_object();
+    w.field("name", chk.name);
+    w.field("definition", chk.definition);
+    w.end_object();
+  }
+  w.end_array();
+
+  write_indexes(w, table);
+
+  w.key("table_comment");
+  if (table.has_comment)
+    w.value(table.comment);
+  else
+    w.null();
+  w.end_object();
+}
+
+/*
+ Per-column facts folded in from the table's constraints, computed in one pass
+ over the constraints instead of one pass per column
+*/
+struct FlatColumnFacts
+{
+  bool primary_key = false;
+  bool unique = false;
+  std::vector<std::string> foreign_keys; // "schema.table.column"
+  std::vector<const std::string *> checks;
+};
+
+void encode_flat_table(const TableModel &table, std::string &out)
+{
+  std::vector<FlatColumnFacts> facts(table.columns.size());
+  std::vector<const CheckModel *> table_checks; // checks spanning several columns
+
+  if (table.has_primary_key)
+  {
+    for (int16_t attnum : table.primary_key.attnums)
+    {
+      int pos = table.position(attnum);
+      if (pos >= 0)
+        facts[pos].primary_key = true;
+    }
+  }
+  for (const auto &uc : table.unique_constraints)
+  {
+    for (int16_t attnum : uc.attnums)
+    {
+      int pos = table.position(attnum);
+      if (pos >= 0)
+        facts[pos].unique = true;
+    }
+  }
+  for (const auto &fk : table.foreign_keys)
+  {
+    for (size_t i = 0; i < fk.attnums.size() && i < fk.ref_columns.size(); ++i)
+    {
+      int pos = table.position(fk.attnums[i]);
+      if (pos >= 0)
+        facts[pos].foreign_keys.push_back(fk.ref_schema + "." + fk.ref_table + "." + fk.ref_columns[i]);
+    }
+  }
+  for (const auto &chk : table.checks)
+  {
+    int pos = chk.attnums.size() == 1 ? table.position(chk.attnums[0]) : -1;
+    if (pos >= 0)
+      facts[pos].checks.push_back(&chk.definition);
+    else
+      table_checks.push_back(&chk);
+  }
+
+  JsonWriter w(out);
+  w.begin_object();
+  w.field("schema", table.schema);
+  w.field("table", table.table);
+  if (table.has_comment)
+  {
+    w.field("table_comment", table.comment);
+  }
+
+  w.key("columns");
+  w.begin_array();
+  for (size_t i = 0; i < table.columns.size(); ++i)
+  {
+    const auto &col = table.columns[i];
+    const auto &f = facts[i];
+    w.begin_object();
+    w.field("name", col.name);
+    w.field("type", col.type);
+    if (col.has_default)
+      w.field("default", col.default_expr);
+    if (!col.nullable)
+      w.field("nullable", false);
+    if (col.has_comment)
+      w.field("comment", col.comment);
+    if (f.primary_key)
+      w.field("primary_key", true);
+    if (f.unique)
+      w.field("unique", true);
+    if (!f.foreign_keys.empty())
+    {
+      w.key("foreign_keys");
+      write_string_array(w, f.foreign_keys);
+    }
+    if (!f.checks.empty())
+    {
+      w.key("checks");
+      w.begin_array();
+      for (const std::string *def : f.checks)
+        w.value(*def);
+      w.end_array();
+    }
+    w.end_object();
+  }
+  w.end_array();
+
+  if (!table_checks.empty())
+  {
+    w.key("checks");
+    w.begin_array();
+    for (const CheckModel *chk : table_checks)
+      w.value(chk->definition);
+    w.end_array();
+  }
+
+  write_indexes(w, table);
+  w.end_object();
+}
+
+// Shorter spellings of the most common type names
+static const char *const type_abbreviations[][2] = {
+    {"character varying", "varchar"},
+    {"timestamp without time zone", "timestamp"},
+    {"timestamp with time zone", "timestamptz"},
+    {"time without time zone", "time"},
+    {"integer", "int"},
+    {"boolean", "bool"},
+    {"character", "char"},
+    {"double precision", "float8"},
+};
+
+static void append_type(std::string &out, const std::string &type)
+{
+  for (const auto &abbr : type_abbreviations)
+  {
+    size_t len = strlen(abbr[0]);
+    if (type.compare(0, len, abbr[0]) == 0 && (type.size() == len || type[len] == '(' || type[len] == '['))
+    {
+      out += abbr[1];
+      out.append(type, len, std::string::npos);
+      return;
+    }
+  }
+  out += type;
+}
+
+static void append_quoted(std::string &out, const std::string &text)
+{
+  out.push_back('"');
+  for (char c : text)
+  {
+    if (c == '\n' || c == '\r')
+      out.push_back(' ');
+    else if (c == '"')
+      out += "\\\"";
+    else
+      out.push_back(c);
+  }
+  out.push_back('"');
+}
+
+static void append_column_list(std::string &out, const TableModel &table, const std::vector<int16_t> &attnums)
+{
+  out.push_back('(');
+  for (size_t i = 0; i < attnums.size(); ++i)
+  {
+    if (i > 0)
+      out.push_back(',');
+    const ColumnModel *col = table.column(attnums[i]);
+    out += col ? col->name : "?";
+  }
+  out.push_back(')');
+}
+
+static void append_names(std::string &out, const std::vector<std::string> &names)
+{
+  out.push_back('(');
+  for (size_t i = 0; i < names.size(); ++i)
+  {
+    if (i > 0)
+      out.push_back(',');
+    out += names[i];
+  }
+  out.push_back(')');
+}
+
+// Referenced table, schema-qualified only when it lives in another schema
+static void append_ref_table(std::string &out, const TableModel &table, const ForeignKeyModel &fk)
+{
+  if (fk.ref_schema != table.schema)
+  {
+    out += fk.ref_schema;
+    out.push_back('.');
+  }
+  out += fk.ref_table;
+}
+
+/*
+ Per-column flags of the compact encoding, collected in one pass over the constraints
+ and indexes like the flat encoding does
+*/
+struct CompactColumnFacts
+{
+  bool primary_key = false;
+  bool unique = false;
+  bool indexed = false;
+  const ForeignKeyModel *foreign_key = nullptr;
+  size_t fk_column = 0;
+  std::vector<const std::string *> checks;
+};
+
+void encode_compact_table(const TableModel &table, std::string &out)
+{
+  std::vector<CompactColumnFacts> facts(table.columns.size());
+  std::string notes; // table-level constraints that span several columns
+
+  if (table.has_primary_key)
+  {
+    if (table.primary_key.attnums.size() == 1 && table.position(table.primary_key.attnums[0]) >= 0)
+    {
+      facts[table.position(table.primary_key.attnums[0])].primary_key = true;
+    }
+    else
+    {
+      notes += " PK";
+      append_column_list(notes, table, table.primary_key.attnums);
+    }
+  }
+  for (const auto &uc : table.unique_constraints)
+  {
+    if (uc.attnums.size() == 1 && table.position(uc.attnums[0]) >= 0)
+    {
+      facts[table.position(uc.attnums[0])].unique = true;
+    }
+    else
+    {
+      notes += " UQ";
+      append_column_list(notes, table, uc.attnums);
+    }
+  }
+  for (const auto &fk : table.foreign_keys)
+  {
+    if (fk.attnums.size() == 1 && fk.ref_columns.size() == 1 && table.position(fk.attnums[0]) >= 0)
+    {
+      auto &f = facts[table.position(fk.attnums[0])];
+      f.foreign_key = &fk;
+      f.fk_column = 0;
+    }
+    else
+    {
+      notes.push_back(' ');
+      append_column_list(notes, table, fk.attnums);
+      notes += "->";
+      append_ref_table(notes, table, fk);
+      append_names(notes, fk.ref_columns);
+    }
+  }
+  for (const auto &chk : table.checks)
+  {
+    int pos = chk.attnums.size() == 1 ? table.position(chk.attnums[0]) : -1;
+    if (pos >= 0)
+    {
+      facts[pos].checks.push_back(&chk.definition);
+    }
+    else
+    {
+      notes.push_back(' ');
+      notes += chk.definition;
+    }
+  }
+  for (const auto &idx : table.indexes)
+  {
+    // indexes backing a primary key or unique constraint add nothing
+    if ((table.has_primary_key && idx.name == table.primary_key.name) ||
+        std::any_of(table.unique_constraints.begin(), table.unique_constraints.end(),
+                    [&](const KeyModel &uc)
+                    { return uc.name == idx.name; }))
+      continue;
+
+    bool unique = idx.definition.find("UNIQUE") != std::string::npos;
+    int pos = -1;
+    if (idx.columns.size() == 1)
+    {
+      for (size_t i = 0; i < table.columns.size(); ++i)
+      {
+        if (table.columns[i].name == idx.columns[0])
+          pos = (int)i;
+      }
+    }
+    if (pos >= 0)
+    {
+      if (unique)
+        facts[pos].unique = true;
+      else
+        facts[pos].indexed = true;
+    }
+    else
+    {
+      notes += unique ? " UQ" : " idx";
+      append_names(notes, idx.columns);
+    }
+  }
+
+  if (table.schema != "public")
+  {
+    out += table.schema;
+    out.push_back('.');
+  }
+  out += table.table;
+  out.push_back('(');
+  for (size_t i = 0; i < table.columns.size(); ++i)
+  {
+    const auto &col = table.columns[i];
+    const auto &f = facts[i];
+    if (i > 0)
+      out += ", ";
+    out += col.name;
+    out.push_back(' ');
+    append_type(out, col.type);
+    if (f.primary_key)
+      out += " PK";
+    else if (!col.nullable)
+      out += " NN";
+    if (f.unique)
+      out += " UQ";
+    if (col.has_default)
+    {
+      // sequence defaults (serial, identity-like) are just noise for the model
+      if (col.default_expr.compare(0, 8, "nextval(") == 0)
+      {
+        out += " AUTO";
+      }
+      else
+      {
+        out += " =";
+        out += col.default_expr;
+      }
+    }
+    if (f.foreign_key)
+    {
+      out += " ->";
+      append_ref_table(out, table, *f.foreign_key);
+      out.push_back('.');
+      out += f.foreign_key->ref_columns[f.fk_column];
+    }
+    for (const std::string *def : f.checks)
+    {
+      out.push_back(' ');
+      out += *def;
+    }
+    if (f.indexed)
+      out += " idx";
+    if (col.has_comment)
+    {
+      out.push_back(' ');
+      append_quoted(out, col.comment);
+    }
+  }
+  out.push_back(')');
+  out += notes;
+  if (table.has_comment)
+  {
+    out.push_back(' ');
+    append_quoted(out, table.comment);
+  }
+}
+
+void encode_table(SchemaEncoding encoding, const TableModel &table, std::string &out)
+{
+  switch (encoding)
+  {
+  case SCHEMA_ENCODING_DETAILED:
+    encode_detailed_table(table, out);
+    break;
+  case SCHEMA_ENCODING_COMPACT:
+    encode_compact_table(table, out);
+    break;
+  case SCHEMA_ENCODING_FLAT:
+  default:
+    encode_flat_table(table, out);
+    break;
+  }
+}
+
+static constexpr size_t kHintValueLength = 24;
+// Distinct counts are only worth mentioning on tables of at least this many rows
+static constexpr double kHintMinRows = 1000;
+
+// n rounded to two significant digits, with a k/M/G suffix from 1000 on
+static void append_count(std::string &out, double n)
+{
+  static const char *const suffixes[] = {"", "k", "M", "G", "T"};
+  size_t unit = 0;
+  while (n >= 999.5 && unit + 1 < sizeof(suffixes) / sizeof(suffixes[0]))
+  {
+    n /= 1000;
+    unit++;
+  }
+  char buf[32];
+  if (unit == 0)
+    snprintf(buf, sizeof(buf), "%.0f", n);
+  else if (n < 9.95)
+    snprintf(buf, sizeof(buf), "%.1f%s", n, suffixes[unit]);
+  else
+    snprintf(buf, sizeof(buf), "%.0f%s", n < 99.5 ? n : std::round(n / 10) * 10, suffixes[unit]);
+  out += buf;
+}
+
+static void append_bytes(std::string &out, uint64_t bytes)
+{
+  static const char *const units[] = {"kB", "MB", "GB", "TB"};
+  double n = bytes / 1024.0;
+  size_t unit = 0;
+  while (n >= 1023.5 && unit + 1 < sizeof(units) / sizeof(units[0]))
+  {
+    n /= 1024;
+    unit++;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), n < 9.95 ? "%.1f%s" : "%.0f%s", n < 99.5 ? n : std::round(n / 10) * 10, units[unit]);
+  out += buf;
+}
+
+static void append_value(std::string &out, const std::string &value)
+{
+  out.push_back('\'');
+  size_t len = 0;
+  for (char c : value)
+  {
+    if (len == kHintValueLength)
+    {
+      out += "...";
+      break;
+    }
+    if (c == '\n' || c == '\r')
+      c = ' ';
+    if (c == '\'')
+      out.push_back('\'');
+    out.push_back(c);
+    len++;
+  }
+  out.push_back('\'');
+}
+
+void encode_table_hints(const TableStatsModel &stats, std::string &out)
+{
+  if (stats.rows < 0)
+    return;
+  if (stats.schema != "public")
+  {
+    out += stats.schema;
+    out.push_back('.');
+  }
+  out += stats.table;
+  out += " ~";
+  append_count(out, stats.rows);
+  out += stats.rows >= 0.5 && stats.rows < 1.5 ? " row" : " rows";
+  if (stats.bytes > 0)
+  {
+    out.push_back(' ');
+    append_bytes(out, stats.bytes);
+  }
+
+  bool first = true;
+  for (const ColumnStatsModel &col : stats.columns)
+  {
+    double distinct = col.n_distinct >= 0 ? col.n_distinct : -col.n_distinct * stats.rows;
+    bool values = !col.common_values.empty() && col.common_values.size() <= SCHEMA_HINT_MAX_VALUES &&
+                  col.n_distinct > 0 && col.n_distinct <= col.common_values.size() &&
+                  col.common_freq >= 0.95 * (1 - col.null_frac); // the values cover the non-null rows
+    bool few = distinct > 0 && stats.rows >= kHintMinRows && distinct <= stats.rows / 2;
+    bool nulls = col.null_frac >= 0.5;
+    if (!values && !few && !nulls)
+      continue;
+
+    out += first ? ": " : "; ";
+    first = false;
+    out += col.name;
+    if (values)
+    {
+      out.push_back(' ');
+      out += std::to_string(col.common_values.size());
+      out += col.common_values.size() == 1 ? " value (" : " values (";
+      for (size_t i = 0; i < col.common_values.size(); ++i)
+      {
+        if (i > 0)
+          out.push_back(',');
+        append_value(out, col.common_values[i]);
+      }
+      out.push_back(')');
+    }
+    else if (few)
+    {
+      out += " ~";
+      append_count(out, distinct);
+      out += " distinct";
+    }
+    if (nulls)
+    {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%s%.0f%% null", values || few ? ", " : " ", std::round(col.null_frac * 10) * 10);
+      out += buf;
+    }
+  }
+  out.push_back('\n');
+}
+
+const SchemaDocumentFormat &schema_document_format(SchemaEncoding encoding)
+{
+  static const SchemaDocumentFormat json = {"{\"tables\":[", ",", "]}"};
+  static const SchemaDocumentFormat lines = {"", "\n", ""};
+  return encoding == SCHEMA_ENCODING_COMPACT ? lines : json;
+}
+
+const char *schema_encoding_legend(SchemaEncoding encoding)
+{
+  if (encoding != SCHEMA_ENCODING_COMPACT)
+    return "";
+  return "The schema lists one table per line as [schema.]table(column type flags, ...), "
+         "the schema is omitted for public. "
+         "Column flags: PK primary key, NN not null, UQ unique, AUTO generated by a sequence, =expr default, "
+         "->table.column foreign key, CHECK (...) check constraint, idx indexed, \"...\" comment. "
+         "After the column list: PK(...) composite primary key, UQ(...) composite unique, "
+         "(cols)->table(cols) composite foreign key, idx(...) multi-column index, CHECK (...) table check, "
+         "and the table comment in quotes.\n";
+}
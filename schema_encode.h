@@ -0,0 +1,92 @@
+#ifndef SCHEMA_ENCODE_H
+#define SCHEMA_ENCODE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "schema_model.h"
+
+/*
+ Minimal streaming JSON writer: appends directly to a string, no DOM in between
+*/
+class JsonWriter
+{
+public:
+  explicit JsonWriter(std::string &out) : out_(out) {}
+
+  void begin_object();
+  void end_object();
+  void begin_array();
+  void end_array();
+  void key(std::string_view k);
+
+  void value(std::string_view v);
+  void value(const char *v) { value(std::string_view(v)); }
+  void value(bool v);
+  void value(int64_t v);
+  void null();
+
+  // Shorthand for key(k) + value(v)
+  template <typename T>
+  void field(std::string_view k, const T &v)
+  {
+    key(k);
+    value(v);
+  }
+
+private:
+  void separator();
+  void string(std::string_view s);
+
+  std::string &out_;
+  std::vector<bool> first_; // per open container: no element written yet
+  bool after_key_ = false;
+};
+
+/*
+ Per-table encoders; each appends one table to out.
+ detailed: JSON, constraints as separate lists (like the catalogs)
+ flat: JSON, constraints folded into the columns they apply to (the default)
+ compact: one DDL-like line per table, e.g.
+   orders(order_id int PK AUTO, user_id int NN ->users.user_id, order_date date idx)
+   The model needs compact_schema_legend() to read it.
+*/
+enum SchemaEncoding
+{
+  SCHEMA_ENCODING_FLAT = 0,
+  SCHEMA_ENCODING_DETAILED = 1,
+  SCHEMA_ENCODING_COMPACT = 2,
+};
+
+void encode_detailed_table(const TableModel &table, std::string &out);
+void encode_flat_table(const TableModel &table, std::string &out);
+void encode_compact_table(const TableModel &table, std::string &out);
+void encode_table(SchemaEncoding encoding, const TableModel &table, std::string &out);
+
+// Columns with at most this many distinct values are listed with their values in the hints
+#define SCHEMA_HINT_MAX_VALUES 10
+
+/*
+ Planner statistics of a table as one hint line, the same for every encoding, e.g.
+   orders ~2.1M rows 180MB: status 4 values ('paid','pending','shipped','void'); customer_id ~85k distinct
+ Only columns with something useful to say are listed: few distinct values (with the
+ values), a distinct count well below the row count, or mostly nulls. Figures are rounded
+ to two significant digits, so small changes after ANALYZE leave the line unchanged.
+ Appends nothing for a table that was never analyzed.
+*/
+void encode_table_hints(const TableStatsModel &stats, std::string &out);
+
+// How table fragments are joined into a whole document
+struct SchemaDocumentFormat
+{
+  const char *open;
+  const char *separator;
+  const char *close;
+};
+const SchemaDocumentFormat &schema_document_format(SchemaEncoding encoding);
+
+// Explanation of the notation for the system prompt (empty for the JSON encodings)
+const char *schema_encoding_legend(SchemaEncoding encoding);
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef SCHEMA_MODEL_H
+#define SCHEMA_MODEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ Typed schema model built once per regeneration from the catalogs.
+ Tables are keyed by relation oid and columns by attnum, so attaching constraints,
+ defaults and comments is a hash lookup instead of a scan. Encoders (schema_encode.h)
+ stream their output straight from it.
+*/
+
+struct ColumnModel
+{
+  int16_t attnum = 0;
+  std::string name;
+  std::string type;
+  bool nullable = true;
+  bool has_default = false;
+  std::string default_expr;
+  bool has_comment = false;
+  std::string comment;
+};
+
+// Primary key or unique constraint
+struct KeyModel
+{
+  std::string name;
+  std::vector<int16_t> attnums;
+};
+
+struct ForeignKeyModel
+{
+  std::string name;
+  std::vector<int16_t> attnums;
+  uint32_t ref_oid = 0;
+  std::string ref_schema;
+  std::string ref_table;
+  std::vector<std::string> ref_columns; // same order as attnums
+  std::string on_update;
+  std::string on_delete;
+};
+
+struct CheckModel
+{
+  std::string name;
+  std::string definition;
+  std::vector<int16_t> attnums;
+};
+
+struct IndexModel
+{
+  std::string name;
+  std::string definition;
+  std::vector<std::string> columns; // best-effort split of the definition
+};
+
+struct TableModel
+{
+  uint32_t oid = 0;
+  std::string schema;
+  std::string table;
+  bool has_comment = false;
+  std::string comment;
+
+  std::vector<ColumnModel> columns;
+  bool has_primary_key = false;
+  KeyModel primary_key;
+  std::vector<KeyModel> unique_constraints;
+  std::vector<ForeignKeyModel> foreign_keys;
+  std::vector<CheckModel> checks;
+  std::vector<IndexModel> indexes;
+
+  ColumnModel &add_column(int16_t attnum)
+  {
+    column_index_[attnum] = columns.size();
+    columns.emplace_back();
+    columns.back().attnum = attnum;
+    return columns.back();
+  }
+
+  ColumnModel *column(int16_t attnum)
+  {
+    auto it = column_index_.find(attnum);
+    return it == column_index_.end() ? nullptr : &columns[it->second];
+  }
+
+  const ColumnModel *column(int16_t attnum) const
+  {
+    auto it = column_index_.find(attnum);
+    return it == column_index_.end() ? nullptr : &columns[it->second];
+  }
+
+  // position of attnum in columns, or -1
+  int position(int16_t attnum) const
+  {
+    auto it = column_index_.find(attnum);
+    return it == column_index_.end() ? -1 : (int)it->second;
+  }
+
+  // Orders columns by attnum and indexes by name once everything is attached
+  void finalize()
+  {
+    std::sort(columns.begin(), columns.end(),
+              [](const ColumnModel &a, const ColumnModel &b)
+              { return a.attnum < b.attnum; });
+    std::sort(indexes.begin(), indexes.end(),
+              [](const IndexModel &a, const IndexModel &b)
+              { return a.name < b.name; });
+    column_index_.clear();
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+      column_index_[columns[i].attnum] = i;
+    }
+  }
+
+private:
+  std::unordered_map<int16_t, size_t> column_index_;
+};
+
+// Planner statistics of one column (pg_statistic), for the hints
+struct ColumnStatsModel
+{
+  int16_t attnum = 0;
+  std::string name;
+  double null_frac = 0;
+  double n_distinct = 0;                  // as in pg_statistic: > 0 a count, < 0 minus a fraction of the rows, 0 unknown
+  std::vector<std::string> common_values; // most common values, most frequent first
+  double common_freq = 0;                 // fraction of the rows they cover
+};
+
+// Planner statistics of one table (pg_class and pg_statistic), for the hints
+struct TableStatsModel
+{
+  std::string schema;
+  std::string table;
+  double rows = -1;   // reltuples, -1 if never vacuumed or analyzed
+  uint64_t bytes = 0; // relpages * BLCKSZ
+  std::vector<ColumnStatsModel> columns;
+};
+
+struct SchemaModel
+{
+  std::unordered_map<uint32_t, TableModel> tables;
+
+  TableModel *table(uint32_t oid)
+  {
+    auto it = tables.find(oid);
+    return it == tables.end() ? nullptr : &it->second;
+  }
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "schema_prune.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+
+// Rough size of a token in the rendered JSON, used to turn the token budget into bytes
+static constexpr size_t kBytesPerToken = 4;
+
+// BM25 parameters (the usual defaults)
+static constexpr double kK1 = 1.2;
+static constexpr double kB = 0.75;
+
+// Share of a table's relevance passed on to each foreign key neighbour per hop
+static constexpr double kHopDecay = 0.5;
+
+// Matches scoring below this share of the best match only come from common words
+static constexpr double kMinRelativeScore = 0.1;
+
+// Index weights per source of a term
+static constexpr float kTableNameWeight = 3.0f;
+static constexpr float kColumnNameWeight = 1.5f;
+static constexpr float kTableCommentWeight = 1.0f;
+static constexpr float kColumnCommentWeight = 0.5f;
+
+static const char *const stop_words[] = {
+    "about", "all", "and", "any", "are", "been", "but", "can", "did", "does", "each", "for",
+    "from", "get", "give", "had", "has", "have", "her", "his", "how", "into", "its", "list",
+    "many", "me", "more", "most", "much", "not", "of", "on", "or", "our", "show", "than",
+    "that", "the", "their", "them", "then", "there", "these", "they", "this", "those", "to",
+    "was", "were", "what", "when", "where", "which", "who", "whose", "why", "will", "with", "you"};
+
+static bool is_stop_word(const std::string &word)
+{
+  return std::binary_search(std::begin(stop_words), std::end(stop_words), word,
+                            [](const auto &a, const auto &b)
+                            { return std::string_view(a) < std::string_view(b); });
+}
+
+// Folds plurals so "orders" finds the orders table and "categories" finds category
+static void stem(std::string &w)
+{
+  size_t n = w.size();
+  if (n > 4 && w.compare(n - 3, 3, "ies") == 0)
+  {
+    w.replace(n - 3, 3, "y");
+  }
+  else if (n > 4 && (w.compare(n - 4, 4, "sses") == 0 || w.compare(n - 4, 4, "ches") == 0 ||
+                     w.compare(n - 4, 4, "shes") == 0 || w.compare(n - 3, 3, "xes") == 0))
+  {
+    w.resize(n - 2);
+  }
+  else if (n > 3 && w[n - 1] == 's' && w[n - 2] != 's' && w[n - 2] != 'u' && w[n - 2] != 'i')
+  {
+    w.resize(n - 1);
+  }
+}
+
+static void emit_word(std::string &word, std::vector<std::string> &out)
+{
+  if (word.size() >= 2 && !std::all_of(word.begin(), word.end(), [](char c)
+                                       { return isdigit((unsigned char)c); }))
+  {
+    if (!is_stop_word(word))
+    {
+      stem(word);
+      out.push_back(word);
+    }
+  }
+  word.clear();
+}
+
+void schema_words(std::string_view text, std::vector<std::string> &out)
+{
+  std::string word;
+  for (size_t i = 0; i < text.size(); ++i)
+  {
+    unsigned char c = (unsigned char)text[i];
+    if (!isalnum(c))
+    {
+      emit_word(word, out);
+      continue;
+    }
+    // camelCase boundary
+    if (isupper(c) && !word.empty() && islower((unsigned char)text[i - 1]))
+      emit_word(word, out);
+    word.push_back((char)tolower(c));
+  }
+  emit_word(word, out);
+}
+
+static void add_terms(std::unordered_map<std::string, float> &acc, std::string_view text, float weight)
+{
+  std::vector<std::string> words;
+  schema_words(text, words);
+  for (auto &w : words)
+    acc[w] += weight;
+}
+
+SchemaTableTerms schema_table_terms(const TableModel &table)
+{
+  std::unordered_map<std::string, float> acc;
+  add_terms(acc, table.table, kTableNameWeight);
+  if (table.has_comment)
+    add_terms(acc, table.comment, kTableCommentWeight);
+  for (const auto &col : table.columns)
+  {
+    add_terms(acc, col.name, kColumnNameWeight);
+    if (col.has_comment)
+      add_terms(acc, col.comment, kColumnCommentWeight);
+  }
+
+  SchemaTableTerms out;
+  out.terms.assign(acc.begin(), acc.end());
+  std::sort(out.terms.begin(), out.terms.end());
+  for (const auto &fk : table.foreign_keys)
+  {
+    if (std::find(out.refs.begin(), out.refs.end(), fk.ref_oid) == out.refs.end())
+      out.refs.push_back(fk.ref_oid);
+  }
+  return out;
+}
+
+/*
+ Renders the selected tables of view into out, as a schema document of about size bytes,
+ and their hints into hints
+*/
+static void render_tables(const SchemaSnapshotView &view, const std::vector<bool> &selected, size_t size,
+                          std::string &out, std::string *hints)
+{
+  const SchemaDocumentFormat &format = schema_document_format(view.encoding());
+  out.clear();
+  out.reserve(size + 16);
+  out += format.open;
+  bool first = true;
+  for (size_t i = 0; i < selected.size(); ++i)
+  {
+    if (!selected[i])
+      continue;
+    if (!first)
+      out += format.separator;
+    out += view.table_fragment(i);
+    first = false;
+  }
+  out += format.close;
+
+  if (hints != nullptr)
+  {
+    hints->clear();
+    for (size_t i = 0; i < selected.size(); ++i)
+    {
+      if (selected[i])
+        *hints += view.table_hints(i);
+    }
+  }
+}
+
+SchemaPruneResult prune_schema(const SchemaSnapshotView &view, std::string_view query,
+                               const SchemaPruneOptions &options, std::string &out, std::string *hints)
+{
+  size_t ntables = view.table_count();
+  size_t budget = options.token_budget * kBytesPerToken;
+  std::vector<bool> allowed(ntables, true);
+  size_t allowed_bytes = view.text().size();
+  if (!options.schemas.empty())
+  {
+    allowed_bytes = 0;
+    for (size_t i = 0; i < ntables; ++i)
+    {
+      std::string_view schema = view.table_schema(i);
+      allowed[i] = std::find(options.schemas.begin(), options.schemas.end(), schema) != options.schemas.end();
+      if (allowed[i])
+        allowed_bytes += view.table_fragment(i).size() + 1;
+    }
+  }
+  else if (options.token_budget == 0 || view.text().size() <= budget || ntables == 0)
+  {
+    return SCHEMA_PRUNE_NONE;
+  }
+  if (options.token_budget == 0 || allowed_bytes <= budget)
+  {
+    render_tables(view, allowed, allowed_bytes, out, hints);
+    return SCHEMA_PRUNE_SCOPED;
+  }
+
+  std::vector<std::string> words;
+  schema_words(query, words);
+  std::sort(words.begin(), words.end());
+  words.erase(std::unique(words.begin(), words.end()), words.end());
+
+  // BM25 over the inverted index
+  std::vector<double> score(ntables, 0.0);
+  double avgdl = view.avg_doc_length() > 0 ? view.avg_doc_length() : 1.0;
+  for (const auto &w : words)
+  {
+    size_t first;
+    size_t df = view.find_term(w, first);
+    if (df == 0)
+      continue;
+    double idf = std::log(1.0 + (ntables - df + 0.5) / (df + 0.5));
+    for (size_t k = first; k < first + df; ++k)
+    {
+      SchemaPosting p = view.posting(k);
+      double norm = kK1 * (1.0 - kB + kB * view.doc_length(p.table) / avgdl);
+      score[p.table] += idf * p.tf * (kK1 + 1.0) / (p.tf + norm);
+    }
+  }
+
+  // Best first: matching tables by score, their foreign key neighbours with a decayed score
+  using Candidate = std::tuple<double, int, uint32_t>; // priority, hops, table
+  std::priority_queue<Candidate> queue;
+  double cutoff = *std::max_element(score.begin(), score.end()) * kMinRelativeScore;
+  for (size_t i = 0; i < ntables; ++i)
+  {
+    if (allowed[i] && score[i] > 0 && score[i] >= cutoff)
+      queue.emplace(score[i], 0, (uint32_t)i);
+  }
+
+  std::vector<bool> selected(ntables, false);
+  size_t used = 0;
+  bool any = false;
+  while (!queue.empty())
+  {
+    auto [priority, hops, table] = queue.top();
+    queue.pop();
+    size_t size = view.table_fragment(table).size() + 1;
+    if (selected[table] || used + size > budget)
+      continue;
+    selected[table] = true;
+    used += size;
+    any = true;
+    if (hops >= options.fk_hops)
+      continue;
+    size_t first;
+    size_t count = view.neighbours(table, first);
+    for (size_t k = first; k < first + count; ++k)
+    {
+      uint32_t n = view.neighbour(k);
+      if (allowed[n] && !selected[n])
+        queue.emplace(priority * kHopDecay, hops + 1, n);
+    }
+  }
+
+  // nothing in the query matched: keep as much of the schema as fits
+  if (!any)
+  {
+    for (size_t i = 0; i < ntables; ++i)
+    {
+      if (!allowed[i])
+        continue;
+      size_t size = view.table_fragment(i).size() + 1;
+      if (used + size > budget)
+        break;
+      selected[i] = true;
+      used += size;
+    }
+  }
+
+  render_tables(view, selected, used, out, hints);
+  return SCHEMA_PRUNE_RANKED;
+}
@@ -0,0 +1,48 @@
+#ifndef SCHEMA_PRUNE_H
+#define SCHEMA_PRUNE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "schema_model.h"
+#include "schema_snapshot.h"
+
+/*
+ Query-aware schema pruning. At regeneration time every table is indexed by the words
+ of its name, column names and comments (schema_table_terms). Per call, tables are
+ ranked with BM25 against the natural language query, expanded along foreign keys so
+ join paths survive, and emitted until the token budget is spent.
+*/
+
+struct SchemaPruneOptions
+{
+  size_t token_budget = 0; // estimated tokens; 0 disables pruning
+  int fk_hops = 1;
+  std::vector<std::string> schemas; // when not empty, only tables in these schemas are sent
+};
+
+enum SchemaPruneResult
+{
+  SCHEMA_PRUNE_NONE,   // the whole schema
+  SCHEMA_PRUNE_SCOPED, // every table of options.schemas, whatever the query
+  SCHEMA_PRUNE_RANKED  // the tables relevant to the query
+};
+
+// Index terms for one table, computed when the snapshot is built
+SchemaTableTerms schema_table_terms(const TableModel &table);
+
+// Lower-cased, stemmed words of an identifier or text, as used for the index
+void schema_words(std::string_view text, std::vector<std::string> &out);
+
+/*
+ Renders the tables of view relevant to query into out, as a schema document: the tables
+ of options.schemas (all when empty), ranked against query when they exceed the budget.
+ With hints, the statistics hints of the same tables go there.
+ Returns SCHEMA_PRUNE_NONE (leaving both untouched) when that is the whole schema; the
+ caller then uses view.text() and view.hints() as is.
+*/
+SchemaPruneResult prune_schema(const SchemaSnapshotView &view, std::string_view query,
+                               const SchemaPruneOptions &options, std::string &out, std::string *hints = nullptr);
+
+#endif
@@ -0,0 +1,549 @@
+#include "schema_snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+static constexpr char kMagic[4] = {'P', 'G', 'Q', 'S'};
+static constexpr size_t kGenerationOffset = 8;
+static constexpr size_t kChecksumOffset = 16;
+static constexpr size_t kChecksummedFrom = kChecksumOffset + sizeof(uint32_t);
+static constexpr size_t kEncodingOffset = 20;
+static constexpr size_t kTablesOffset = 24;
+static constexpr size_t kSectionCountOffset = 28;
+static constexpr size_t kSectionsOffset = 32;
+static constexpr uint32_t kSections = 6; // dir, names, terms, index, text, hints
+static_assert(kSectionsOffset + kSections * 2 * sizeof(uint32_t) == SCHEMA_SNAPSHOT_HEADER_SIZE,
+              "snapshot header layout");
+static constexpr size_t kDirFields = 8;
+static constexpr size_t kDirEntrySize = kDirFields * sizeof(uint32_t);
+static constexpr size_t kIndexHeaderSize = 4 * sizeof(uint32_t);
+static constexpr size_t kTermDirEntrySize = 4 * sizeof(uint32_t);
+static constexpr size_t kPostingSize = 2 * sizeof(uint32_t);
+static constexpr size_t kHintEntrySize = 2 * sizeof(uint32_t);
+
+static void put_u32(std::string &out, uint32_t v)
+{
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void put_float(std::string &out, float v)
+{
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static uint32_t get_u32(const char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static float get_float(const char *p)
+{
+  float v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// CRC-32C (Castagnoli), bytewise; only run when an image is loaded from disk
+static uint32_t crc32c(const char *data, size_t len)
+{
+  static uint32_t table[256];
+  static bool initialized = false;
+  if (!initialized)
+  {
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+      table[i] = c;
+    }
+    initialized = true;
+  }
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < len; ++i)
+    crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+static void encode_terms(const SchemaTableTerms &terms, std::string &out)
+{
+  put_u32(out, (uint32_t)terms.refs.size());
+  for (uint32_t ref : terms.refs)
+  {
+    put_u32(out, ref);
+  }
+  put_u32(out, (uint32_t)terms.terms.size());
+  for (const auto &t : terms.terms)
+  {
+    put_float(out, t.second);
+    put_u32(out, (uint32_t)t.first.size());
+    out += t.first;
+  }
+}
+
+void SchemaSnapshotBuilder::add_table(uint32_t oid, std::string schema, std::string table, std::string fragment,
+                                      SchemaTableTerms terms, std::string hints)
+{
+  tables_.push_back({oid, std::move(schema), std::move(table), std::move(fragment), std::move(terms), std::move(hints)});
+}
+
+// The hints section: per table offset and length, then the hint bytes in table order
+template <typename Hints>
+static std::string build_hints(size_t ntables, Hints hint)
+{
+  std::string section;
+  size_t bytes = 0;
+  for (size_t i = 0; i < ntables; ++i)
+    bytes += hint(i).size();
+  section.reserve(ntables * kHintEntrySize + bytes);
+  uint32_t off = 0;
+  for (size_t i = 0; i < ntables; ++i)
+  {
+    put_u32(section, off);
+    put_u32(section, (uint32_t)hint(i).size());
+    off += (uint32_t)hint(i).size();
+  }
+  for (size_t i = 0; i < ntables; ++i)
+    section += hint(i);
+  return section;
+}
+
+/*
+ Header followed by the sections, in the order of the section table, with the checksum
+ filled in
+*/
+static std::string assemble_image(SchemaEncoding encoding, size_t ntables, const std::string_view (&sections)[kSections])
+{
+  size_t size = SCHEMA_SNAPSHOT_HEADER_SIZE;
+  for (std::string_view section : sections)
+    size += section.size();
+  std::string image;
+  image.reserve(size);
+  image.append(kMagic, sizeof(kMagic));
+  put_u32(image, SCHEMA_SNAPSHOT_FORMAT_VERSION);
+  image.append(sizeof(uint64_t), '\0'); // generation, stamped when written to disk
+  put_u32(image, 0);                    // checksum, below
+  put_u32(image, (uint32_t)encoding);
+  put_u32(image, (uint32_t)ntables);
+  put_u32(image, kSections);
+  size_t off = SCHEMA_SNAPSHOT_HEADER_SIZE;
+  for (std::string_view section : sections)
+  {
+    put_u32(image, (uint32_t)off);
+    put_u32(image, (uint32_t)section.size());
+    off += section.size();
+  }
+  for (std::string_view section : sections)
+    image += section;
+
+  uint32_t checksum = crc32c(image.data() + kChecksummedFrom, image.size() - kChecksummedFrom);
+  memcpy(&image[kChecksumOffset], &checksum, sizeof(checksum));
+  return image;
+}
+
+/*
+ Inverted index over all tables' terms plus the foreign key graph, addressed by
+ position in the sorted table list
+*/
+static std::string build_index(const std::vector<SchemaTableEntry> &tables)
+{
+  std::unordered_map<uint32_t, uint32_t> position;
+  for (size_t i = 0; i < tables.size(); ++i)
+  {
+    position[tables[i].oid] = (uint32_t)i;
+  }
+
+  std::map<std::string_view, std::vector<SchemaPosting>> postings;
+  std::vector<float> doc_lengths(tables.size(), 0.0f);
+  std::vector<std::vector<uint32_t>> edges(tables.size());
+  double total_length = 0;
+  size_t npostings = 0;
+
+  for (size_t i = 0; i < tables.size(); ++i)
+  {
+    for (const auto &t : tables[i].terms.terms)
+    {
+      postings[t.first].push_back({(uint32_t)i, t.second});
+      doc_lengths[i] += t.second;
+      ++npostings;
+    }
+    total_length += doc_lengths[i];
+
+    // references to tables outside the snapshot (system catalogs, dropped tables) are ignored
+    for (uint32_t ref : tables[i].terms.refs)
+    {
+      auto it = position.find(ref);
+      if (it == position.end() || it->second == i)
+        continue;
+      edges[i].push_back(it->second);
+      edges[it->second].push_back((uint32_t)i);
+    }
+  }
+
+  size_t nedges = 0;
+  for (auto &e : edges)
+  {
+    std::sort(e.begin(), e.end());
+    e.erase(std::unique(e.begin(), e.end()), e.end());
+    nedges += e.size();
+  }
+
+  std::string index;
+  put_u32(index, (uint32_t)postings.size());
+  put_u32(index, (uint32_t)npostings);
+  put_u32(index, (uint32_t)nedges);
+  put_float(index, tables.empty() ? 0.0f : (float)(total_length / tables.size()));
+
+  uint32_t term_off = 0;
+  uint32_t posting_off = 0;
+  for (const auto &kv : postings)
+  {
+    put_u32(index, term_off);
+    put_u32(index, (uint32_t)kv.first.size());
+    put_u32(index, posting_off);
+    put_u32(index, (uint32_t)kv.second.size());
+    term_off += (uint32_t)kv.first.size();
+    posting_off += (uint32_t)kv.second.size();
+  }
+  for (float len : doc_lengths)
+  {
+    put_float(index, len);
+  }
+  uint32_t edge_off = 0;
+  for (const auto &e : edges)
+  {
+    put_u32(index, edge_off);
+    edge_off += (uint32_t)e.size();
+  }
+  put_u32(index, edge_off);
+  for (const auto &e : edges)
+  {
+    for (uint32_t n : e)
+      put_u32(index, n);
+  }
+  for (const auto &kv : postings)
+  {
+    for (const auto &p : kv.second)
+    {
+      put_u32(index, p.table);
+      put_float(index, p.tf);
+    }
+  }
+  for (const auto &kv : postings)
+  {
+    index += kv.first;
+  }
+  return index;
+}
+
+std::string SchemaSnapshotBuilder::finish()
+{
+  // stable order keeps the rendered document identical across regenerations
+  std::sort(tables_.begin(), tables_.end(),
+            [](const SchemaTableEntry &a, const SchemaTableEntry &b)
+            {
+              return a.schema != b.schema ? a.schema < b.schema : a.table < b.table;
+            });
+
+  const SchemaDocumentFormat &format = schema_document_format(encoding_);
+  std::string names;
+  std::string terms;
+  std::string text = format.open;
+  std::vector<uint32_t> dir;
+  dir.reserve(tables_.size() * kDirFields);
+
+  for (size_t i = 0; i < tables_.size(); ++i)
+  {
+    const auto &t = tables_[i];
+    if (i > 0)
+    {
+      text += format.separator;
+    }
+    size_t terms_off = terms.size();
+    encode_terms(t.terms, terms);
+    dir.push_back(t.oid);
+    dir.push_back((uint32_t)text.size());
+    dir.push_back((uint32_t)t.fragment.size());
+    dir.push_back((uint32_t)names.size());
+    dir.push_back((uint32_t)t.schema.size());
+    dir.push_back((uint32_t)t.table.size());
+    dir.push_back((uint32_t)terms_off);
+    dir.push_back((uint32_t)(terms.size() - terms_off));
+    text += t.fragment;
+    names += t.schema;
+    names += t.table;
+  }
+  text += format.close;
+
+  std::string index = build_index(tables_);
+  std::string hints = build_hints(tables_.size(), [&](size_t i) -> const std::string & { return tables_[i].hints; });
+
+  const std::string_view sections[kSections] = {
+      std::string_view((const char *)dir.data(), dir.size() * sizeof(uint32_t)), names, terms, index, text, hints};
+  return assemble_image(encoding_, tables_.size(), sections);
+}
+
+std::string schema_snapshot_with_hints(const SchemaSnapshotView &view, const std::vector<std::string> &hints)
+{
+  size_t ntables = view.table_count();
+  std::string section = build_hints(ntables, [&](size_t i) -> std::string_view
+                                    { return i < hints.size() ? std::string_view(hints[i]) : std::string_view(); });
+  std::string_view sections[kSections];
+  for (size_t k = 0; k + 1 < kSections; ++k)
+  {
+    size_t off = get_u32(view.image_.data() + kSectionsOffset + k * 2 * sizeof(uint32_t));
+    size_t len = get_u32(view.image_.data() + kSectionsOffset + (k * 2 + 1) * sizeof(uint32_t));
+    sections[k] = view.image_.substr(off, len);
+  }
+  sections[kSections - 1] = section;
+  return assemble_image(view.encoding(), ntables, sections);
+}
+
+// Magic and version only: what tells a snapshot of this format from anything else
+static bool has_current_format(std::string_view image)
+{
+  return image.size() >= SCHEMA_SNAPSHOT_HEADER_SIZE && memcmp(image.data(), kMagic, sizeof(kMagic)) == 0 &&
+         get_u32(image.data() + sizeof(kMagic)) == SCHEMA_SNAPSHOT_FORMAT_VERSION;
+}
+
+bool schema_snapshot_verify(std::string_view image)
+{
+  if (!has_current_format(image))
+  {
+    return false;
+  }
+  return get_u32(image.data() + kChecksumOffset) ==
+         crc32c(image.data() + kChecksummedFrom, image.size() - kChecksummedFrom);
+}
+
+uint64_t schema_snapshot_generation(std::string_view image)
+{
+  if (!has_current_format(image))
+  {
+    return 0;
+  }
+  uint64_t generation;
+  memcpy(&generation, image.data() + kGenerationOffset, sizeof(generation));
+  return generation;
+}
+
+void schema_snapshot_set_generation(std::string &image, uint64_t generation)
+{
+  if (has_current_format(image))
+  {
+    memcpy(&image[kGenerationOffset], &generation, sizeof(generation));
+  }
+}
+
+bool SchemaSnapshotView::open(std::string_view image)
+{
+  ntables_ = 0;
+  if (!has_current_format(image))
+  {
+    return false;
+  }
+  uint32_t encoding = get_u32(image.data() + kEncodingOffset);
+  size_t ntables = get_u32(image.data() + kTablesOffset);
+  if (encoding > SCHEMA_ENCODING_COMPACT || get_u32(image.data() + kSectionCountOffset) != kSections)
+  {
+    return false;
+  }
+
+  std::string_view sections[kSections];
+  for (size_t k = 0; k < kSections; ++k)
+  {
+    size_t off = get_u32(image.data() + kSectionsOffset + k * 2 * sizeof(uint32_t));
+    size_t len = get_u32(image.data() + kSectionsOffset + (k * 2 + 1) * sizeof(uint32_t));
+    if (off < SCHEMA_SNAPSHOT_HEADER_SIZE || off > image.size() || len > image.size() - off)
+    {
+      return false;
+    }
+    sections[k] = image.substr(off, len);
+  }
+  if (sections[0].size() != ntables * kDirEntrySize)
+  {
+    return false;
+  }
+
+  if (sections[5].size() < ntables * kHintEntrySize)
+  {
+    return false;
+  }
+
+  dir_ = sections[0].data();
+  names_ = sections[1];
+  terms_ = sections[2];
+  index_ = sections[3];
+  text_ = sections[4];
+  hint_dir_ = sections[5].data();
+  hint_text_ = sections[5].substr(ntables * kHintEntrySize);
+
+  for (size_t i = 0; i < ntables; ++i)
+  {
+    if ((size_t)field(i, 1) + field(i, 2) > text_.size() ||
+        (size_t)field(i, 3) + field(i, 4) + field(i, 5) > names_.size() ||
+        (size_t)field(i, 6) + field(i, 7) > terms_.size() ||
+        (size_t)get_u32(hint_dir_ + i * kHintEntrySize) + get_u32(hint_dir_ + i * kHintEntrySize + 4) >
+            hint_text_.size())
+    {
+      return false;
+    }
+  }
+
+  // index sections
+  if (index_.size() < kIndexHeaderSize)
+  {
+    return false;
+  }
+  size_t nterms = get_u32(index_.data());
+  size_t npostings = get_u32(index_.data() + 4);
+  size_t nedges = get_u32(index_.data() + 8);
+  avg_doc_length_ = get_float(index_.data() + 12);
+  term_dir_ = kIndexHeaderSize;
+  doc_lengths_ = term_dir_ + nterms * kTermDirEntrySize;
+  edge_offs_ = doc_lengths_ + ntables * sizeof(float);
+  edges_ = edge_offs_ + (ntables + 1) * sizeof(uint32_t);
+  postings_ = edges_ + nedges * sizeof(uint32_t);
+  term_bytes_ = postings_ + npostings * kPostingSize;
+  if (term_bytes_ > index_.size())
+  {
+    return false;
+  }
+  nterms_ = nterms;
+  ntables_ = ntables;
+  image_ = image;
+  encoding_ = (SchemaEncoding)encoding;
+  const SchemaDocumentFormat &format = schema_document_format(encoding_);
+  return text_.size() >= strlen(format.open) + strlen(format.close);
+}
+
+uint32_t SchemaSnapshotView::field(size_t i, size_t f) const
+{
+  return get_u32(dir_ + i * kDirEntrySize + f * sizeof(uint32_t));
+}
+
+uint32_t SchemaSnapshotView::index_u32(size_t off) const
+{
+  return get_u32(index_.data() + off);
+}
+
+float SchemaSnapshotView::index_float(size_t off) const
+{
+  return get_float(index_.data() + off);
+}
+
+uint32_t SchemaSnapshotView::table_oid(size_t i) const
+{
+  return field(i, 0);
+}
+
+std::string_view SchemaSnapshotView::table_schema(size_t i) const
+{
+  return names_.substr(field(i, 3), field(i, 4));
+}
+
+std::string_view SchemaSnapshotView::table_name(size_t i) const
+{
+  return names_.substr(field(i, 3) + field(i, 4), field(i, 5));
+}
+
+std::string_view SchemaSnapshotView::table_fragment(size_t i) const
+{
+  return text_.substr(field(i, 1), field(i, 2));
+}
+
+std::string_view SchemaSnapshotView::table_hints(size_t i) const
+{
+  return hint_text_.substr(get_u32(hint_dir_ + i * kHintEntrySize), get_u32(hint_dir_ + i * kHintEntrySize + 4));
+}
+
+SchemaTableTerms SchemaSnapshotView::table_terms(size_t i) const
+{
+  SchemaTableTerms out;
+  std::string_view blob = terms_.substr(field(i, 6), field(i, 7));
+  size_t pos = 0;
+  auto read_u32 = [&](uint32_t &v)
+  {
+    if (pos + sizeof(uint32_t) > blob.size())
+      return false;
+    v = get_u32(blob.data() + pos);
+    pos += sizeof(uint32_t);
+    return true;
+  };
+
+  uint32_t n;
+  if (!read_u32(n))
+    return out;
+  for (uint32_t k = 0; k < n; ++k)
+  {
+    uint32_t ref;
+    if (!read_u32(ref))
+      return out;
+    out.refs.push_back(ref);
+  }
+  if (!read_u32(n))
+    return out;
+  for (uint32_t k = 0; k < n; ++k)
+  {
+    uint32_t weight, len;
+    if (!read_u32(weight) || !read_u32(len) || pos + len > blob.size())
+      return out;
+    float w;
+    memcpy(&w, &weight, sizeof(w));
+    out.terms.emplace_back(std::string(blob.substr(pos, len)), w);
+    pos += len;
+  }
+  return out;
+}
+
+size_t SchemaSnapshotView::find_term(std::string_view term, size_t &first) const
+{
+  auto term_at = [&](size_t k)
+  {
+    size_t e = term_dir_ + k * kTermDirEntrySize;
+    return index_.substr(term_bytes_ + index_u32(e), index_u32(e + 4));
+  };
+
+  size_t lo = 0, hi = nterms_;
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (term_at(mid) < term)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == nterms_ || term_at(lo) != term)
+  {
+    return 0;
+  }
+  size_t e = term_dir_ + lo * kTermDirEntrySize;
+  first = index_u32(e + 8);
+  return index_u32(e + 12);
+}
+
+SchemaPosting SchemaSnapshotView::posting(size_t k) const
+{
+  size_t off = postings_ + k * kPostingSize;
+  return {index_u32(off), index_float(off + 4)};
+}
+
+float SchemaSnapshotView::doc_length(size_t i) const
+{
+  return index_float(doc_lengths_ + i * sizeof(float));
+}
+
+size_t SchemaSnapshotView::neighbours(size_t i, size_t &first) const
+{
+  first = index_u32(edge_offs_ + i * sizeof(uint32_t));
+  return index_u32(edge_offs_ + (i + 1) * sizeof(uint32_t)) - first;
+}
+
+uint32_t SchemaSnapshotView::neighbour(size_t k) const
+{
+  return index_u32(edges_ + k * sizeof(uint32_t));
+}
@@ -0,0 +1,158 @@
+#ifndef SCHEMA_SNAPSHOT_H
+#define SCHEMA_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "schema_encode.h"
+
+/*
+ A schema snapshot image is the unit stored on disk (one file per database) and in
+ shared memory. It keeps the rendered schema document together with a per-table
+ directory, so single tables can be replaced without regenerating the rest, and a
+ relevance index used to prune the schema per query (schema_prune.h).
+
+ Layout (native byte order):
+   header (SCHEMA_SNAPSHOT_HEADER_SIZE bytes):
+     char magic[4] "PGQS"; uint32 format version; uint64 generation;
+     uint32 checksum (CRC-32C of every byte after it); uint32 encoding (SchemaEncoding
+     of the fragments), ntables, nsections;
+     nsections x { uint32 offset, length } of the sections below, in this order
+   dir    ntables x { uint32 oid, frag_off, frag_len, name_off, schema_len, table_len, terms_off, terms_len }
+   names  (schema and table names back to back)
+   terms  (per table: referenced tables and weighted search terms, see SchemaTableTerms)
+   index  (derived from terms when the image is built):
+            uint32 nterms, npostings, nedges; float avg_doc_length
+            nterms x { uint32 term_off, term_len, postings_off, npostings } sorted by term
+            ntables x float doc_length
+            ntables + 1 x uint32 edge_off; nedges x uint32 neighbour (foreign keys, both ways)
+            npostings x { uint32 table, float tf }
+            term bytes
+   text   (the whole document, see schema_document_format(); fragments are slices of it)
+   hints  ntables x { uint32 offset, length } into the hint bytes that follow, in table
+          order (planner statistics, see encode_table_hints(); empty without them)
+
+ The hints section is last so a statistics refresh can swap it without touching the
+ rest (schema_snapshot_with_hints). The generation is stamped when the image is written
+ to disk and is not covered by the checksum. The checksum is only verified when an image comes from disk
+ (schema_snapshot_verify); SchemaSnapshotView::open checks the structure, which is cheap
+ enough for every call.
+*/
+
+#define SCHEMA_SNAPSHOT_FORMAT_VERSION 3
+#define SCHEMA_SNAPSHOT_HEADER_SIZE 80
+
+// True if image has the current format and an intact checksum
+bool schema_snapshot_verify(std::string_view image);
+
+// Generation recorded in the header (0 if never stamped or not a snapshot)
+uint64_t schema_snapshot_generation(std::string_view image);
+void schema_snapshot_set_generation(std::string &image, uint64_t generation);
+
+// What the relevance index knows about one table
+struct SchemaTableTerms
+{
+  std::vector<uint32_t> refs;                       // oids of referenced tables
+  std::vector<std::pair<std::string, float>> terms; // unique terms with their summed weights
+};
+
+struct SchemaTableEntry
+{
+  uint32_t oid;
+  std::string schema;
+  std::string table;
+  std::string fragment;
+  SchemaTableTerms terms;
+  std::string hints;
+};
+
+struct SchemaPosting
+{
+  uint32_t table; // position in the snapshot
+  float tf;       // weighted term frequency
+};
+
+class SchemaSnapshotBuilder
+{
+public:
+  explicit SchemaSnapshotBuilder(SchemaEncoding encoding = SCHEMA_ENCODING_FLAT) : encoding_(encoding) {}
+
+  void add_table(uint32_t oid, std::string schema, std::string table, std::string fragment,
+                 SchemaTableTerms terms = {}, std::string hints = {});
+
+  // Sorts tables by name, builds the index and renders the image
+  std::string finish();
+
+private:
+  SchemaEncoding encoding_;
+  std::vector<SchemaTableEntry> tables_;
+};
+
+class SchemaSnapshotView
+{
+public:
+  // Returns false if the image is malformed or has another format version
+  bool open(std::string_view image);
+
+  std::string_view text() const { return text_; }
+  // The hints of all tables back to back, in table order
+  std::string_view hints() const { return hint_text_; }
+  SchemaEncoding encoding() const { return encoding_; }
+  size_t table_count() const { return ntables_; }
+
+  uint32_t table_oid(size_t i) const;
+  std::string_view table_schema(size_t i) const;
+  std::string_view table_name(size_t i) const;
+  std::string_view table_fragment(size_t i) const;
+  SchemaTableTerms table_terms(size_t i) const;
+  std::string_view table_hints(size_t i) const;
+
+  // Postings of term as [first, first + count), or count = 0 if it isn't indexed
+  size_t find_term(std::string_view term, size_t &first) const;
+  SchemaPosting posting(size_t k) const;
+  float doc_length(size_t i) const;
+  float avg_doc_length() const { return avg_doc_length_; }
+
+  // Tables linked to table i by a foreign key in either direction, as [first, first + count)
+  size_t neighbours(size_t i, size_t &first) const;
+  uint32_t neighbour(size_t k) const;
+
+private:
+  friend std::string schema_snapshot_with_hints(const SchemaSnapshotView &view, const std::vector<std::string> &hints);
+
+  uint32_t field(size_t i, size_t f) const;
+  uint32_t index_u32(size_t off) const;
+  float index_float(size_t off) const;
+
+  std::string_view image_;
+  const char *dir_ = nullptr;
+  std::string_view names_;
+  std::string_view terms_;
+  std::string_view index_;
+  std::string_view text_;
+  const char *hint_dir_ = nullptr;
+  std::string_view hint_text_;
+  size_t ntables_ = 0;
+  SchemaEncoding encoding_ = SCHEMA_ENCODING_FLAT;
+
+  // offsets of the index sections within index_
+  size_t nterms_ = 0;
+  size_t term_dir_ = 0;
+  size_t doc_lengths_ = 0;
+  size_t edge_offs_ = 0;
+  size_t edges_ = 0;
+  size_t postings_ = 0;
+  size_t term_bytes_ = 0;
+  float avg_doc_length_ = 0;
+};
+
+/*
+ Copy of the image of view with hints (one entry per table, in table order) in place of
+ its hints section; everything else is carried over byte for byte
+*/
+std::string schema_snapshot_with_hints(const SchemaSnapshotView &view, const std::vector<std::string> &hints);
+
+#endif
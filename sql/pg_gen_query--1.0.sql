@@ -3,18 +3,272 @@ RETURNS TEXT
 AS 'MODULE_PATHNAME', 'pg_gen_query'
 LANGUAGE C STRICT VOLATILE;
 
+-- Generates SQL for the question and returns its rows, read-only, e.g.
+--   SELECT * FROM pg_gen_query_exec('customers older than 30') AS t(id int, name text, age int);
+-- The column definition list must match the generated query's columns
+CREATE FUNCTION pg_gen_query_exec(query text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_gen_query_exec'
+LANGUAGE C STRICT VOLATILE;
+
+-- Generates SQL for the question and validates it (pg_gen_query.validate, regardless of the
+-- setting): total_cost is the estimated total cost of the accepted statement's plan
+CREATE FUNCTION pg_gen_query_plan(
+    query text,
+    OUT sql text,
+    OUT total_cost float8)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_gen_query_plan'
+LANGUAGE C STRICT VOLATILE;
+
+-- Generates SQL for every query, sending the provider requests concurrently
+-- (up to pg_gen_query.batch_concurrency at a time). NULL elements yield NULL rows
+CREATE FUNCTION pg_gen_query_batch(
+    queries text[],
+    OUT ordinal integer,
+    OUT query text,
+    OUT sql text,
+    OUT error text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_gen_query_batch'
+LANGUAGE C STRICT VOLATILE;
+
+-- Async requests (shared_preload_libraries only): submit returns an id at once, a
+-- background worker generates the SQL, poll/wait fetch the result and remove the request
+CREATE FUNCTION pg_gen_query_submit(query text)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'pg_gen_query_submit'
+LANGUAGE C STRICT VOLATILE;
+
+-- status is queued, running, done or failed
+CREATE FUNCTION pg_gen_query_poll(
+    id bigint,
+    OUT status text,
+    OUT sql text,
+    OUT error text)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_gen_query_poll'
+LANGUAGE C STRICT VOLATILE;
+
+-- Returns NULL if the timeout passes first (NULL = wait as long as it takes)
+CREATE FUNCTION pg_gen_query_wait(id bigint, timeout interval DEFAULT NULL)
+RETURNS text
+AS 'MODULE_PATHNAME', 'pg_gen_query_wait'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_gen_query_schema_info(
+    OUT generation bigint,
+    OUT bytes bigint,
+    OUT shared boolean)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_gen_query_schema_info'
+LANGUAGE C STRICT VOLATILE;
+
+-- The schema document pg_gen_query would send for this query
+CREATE FUNCTION pg_gen_query_schema_for(query text)
+RETURNS text
+AS 'MODULE_PATHNAME', 'pg_gen_query_schema_for'
+LANGUAGE C STRICT VOLATILE;
+
+-- Schema snapshots resident in shared memory, one row per database
+-- (none without shared_preload_libraries)
+CREATE FUNCTION pg_gen_query_schema_snapshots(
+    OUT dbid oid,
+    OUT generation bigint,
+    OUT bytes bigint,
+    OUT last_used timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_gen_query_schema_snapshots'
+LANGUAGE C STRICT VOLATILE;
+
+-- Shared result cache counters (all zero without shared_preload_libraries)
+CREATE FUNCTION pg_gen_query_cache_stats(
+    OUT hits bigint,
+    OUT similar_hits bigint,
+    OUT misses bigint,
+    OUT evictions bigint,
+    OUT entries bigint,
+    OUT capacity bigint)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_gen_query_cache_stats'
+LANGUAGE C STRICT VOLATILE;
+
+-- Hedged requests per primary provider (shared with shared_preload_libraries,
+-- otherwise this backend only). hedge_wins counts answers that came from the other provider
+CREATE FUNCTION pg_gen_query_hedge_stats(
+    OUT provider text,
+    OUT requests bigint,
+    OUT hedged bigint,
+    OUT hedge_wins bigint,
+    OUT failures bigint,
+    OUT samples integer,
+    OUT p50_ms float8,
+    OUT hedge_delay_ms float8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_gen_query_hedge_stats'
+LANGUAGE C STRICT VOLATILE;
+
+-- Drops every cached query and zeroes the counters
+CREATE FUNCTION pg_gen_query_cache_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_gen_query_cache_reset'
+LANGUAGE C VOLATILE;
+
+REVOKE EXECUTE ON FUNCTION pg_gen_query_cache_reset() FROM PUBLIC;
+
+-- Per database, provider and model: counters, milliseconds spent per phase and latency
+-- histograms (element i counts durations of 2^(i-1) .. 2^i microseconds, i = 1..26; the
+-- first also holds anything shorter, the last anything longer)
+CREATE FUNCTION pg_stat_gen_query(
+    OUT dbid oid,
+    OUT provider text,
+    OUT model text,
+    OUT calls bigint,
+    OUT errors bigint,
+    OUT cache_hits bigint,
+    OUT prompt_bytes bigint,
+    OUT response_bytes bigint,
+    OUT prompt_tokens bigint,
+    OUT completion_tokens bigint,
+    OUT schema_load_ms float8,
+    OUT prompt_ms float8,
+    OUT provider_ms float8,
+    OUT post_ms float8,
+    OUT schema_load_hist bigint[],
+    OUT prompt_hist bigint[],
+    OUT provider_hist bigint[],
+    OUT post_hist bigint[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_stat_gen_query'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW pg_stat_gen_query AS
+  SELECT d.datname, s.*
+  FROM pg_stat_gen_query() s
+  LEFT JOIN pg_database d ON d.oid = s.dbid;
+
+-- Schema regenerations (regen_schema_cache, the background worker and statistics hint
+-- refreshes that changed a hint), with the total milliseconds spent in each phase
+CREATE FUNCTION pg_stat_gen_query_regen(
+    OUT regens bigint,
+    OUT errors bigint,
+    OUT total_ms float8,
+    OUT max_ms float8,
+    OUT last_ms float8,
+    OUT last_regen timestamptz,
+    OUT stats_reset timestamptz,
+    OUT catalog_ms float8,
+    OUT render_ms float8,
+    OUT serialize_ms float8,
+    OUT write_ms float8,
+    OUT publish_ms float8,
+    OUT hints_ms float8)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_stat_gen_query_regen'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW pg_stat_gen_query_regen AS
+  SELECT * FROM pg_stat_gen_query_regen();
+
+-- Zeroes the statistics of both views
+CREATE FUNCTION pg_stat_gen_query_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_stat_gen_query_reset'
+LANGUAGE C VOLATILE;
+
+REVOKE EXECUTE ON FUNCTION pg_stat_gen_query_reset() FROM PUBLIC;
+
 CREATE FUNCTION regen_schema_cache()
 RETURNS void
 AS 'pg_gen_query', 'regen_schema_cache'
 LANGUAGE C;
 
+-- Re-introspects only the given relations and splices them into the snapshot (NULL = everything)
+CREATE FUNCTION regen_schema_cache(relids oid[])
+RETURNS void
+AS 'pg_gen_query', 'regen_schema_cache_relations'
+LANGUAGE C;
+
+-- Refreshes the statistics hints (pg_gen_query.stats_hints) of the snapshot without
+-- regenerating it; the background worker does this every pg_gen_query.stats_refresh_interval
+CREATE FUNCTION regen_schema_stats()
+RETURNS void
+AS 'pg_gen_query', 'regen_schema_stats'
+LANGUAGE C;
+
+-- Records that the given relations changed (NULL = everything). With the library preloaded
+-- the regeneration runs in a background worker after commit, debounced by
+-- pg_gen_query.regen_debounce; otherwise it runs right away like regen_schema_cache(relids)
+CREATE FUNCTION pg_gen_query_schema_changed(relids oid[])
+RETURNS void
+AS 'pg_gen_query', 'pg_gen_query_schema_changed'
+LANGUAGE C;
+
 -- PL/pgSQL wrapper for the event trigger
+-- Maps the affected objects to their tables; DDL on schemas, types or extensions may
+-- touch many tables at once and falls back to a full rebuild
 CREATE FUNCTION regen_schema_cache_trigger()
 RETURNS event_trigger
 LANGUAGE plpgsql
 AS $$
+DECLARE
+    relids oid[];
 BEGIN
-    PERFORM regen_schema_cache();
+    IF EXISTS (SELECT 1 FROM pg_event_trigger_ddl_commands() cmd
+               WHERE cmd.classid IN ('pg_namespace'::regclass, 'pg_type'::regclass, 'pg_extension'::regclass)) THEN
+        PERFORM pg_gen_query_schema_changed(NULL::oid[]);
+        RETURN;
+    END IF;
+
+    SELECT array_agg(DISTINCT rel) INTO relids
+    FROM (
+        SELECT CASE
+                   WHEN cmd.classid = 'pg_constraint'::regclass
+                       THEN (SELECT con.conrelid FROM pg_constraint con WHERE con.oid = cmd.objid)
+                   ELSE COALESCE((SELECT i.indrelid FROM pg_index i WHERE i.indexrelid = cmd.objid), cmd.objid)
+               END AS rel
+        FROM pg_event_trigger_ddl_commands() cmd
+        WHERE cmd.classid IN ('pg_class'::regclass, 'pg_constraint'::regclass)
+    ) affected
+    WHERE rel IS NOT NULL AND rel <> 0;
+
+    IF relids IS NOT NULL THEN
+        PERFORM pg_gen_query_schema_changed(relids);
+    END IF;
+END;
+$$;
+
+-- DROP commands are not reported by pg_event_trigger_ddl_commands(), only here
+CREATE FUNCTION regen_schema_cache_drop_trigger()
+RETURNS event_trigger
+LANGUAGE plpgsql
+AS $$
+DECLARE
+    relids oid[];
+BEGIN
+    -- a dropped index no longer tells which table it belonged to
+    IF EXISTS (SELECT 1 FROM pg_event_trigger_dropped_objects() obj
+               WHERE obj.original AND obj.object_type = 'index') THEN
+        PERFORM pg_gen_query_schema_changed(NULL::oid[]);
+        RETURN;
+    END IF;
+
+    SELECT array_agg(DISTINCT rel) INTO relids
+    FROM (
+        SELECT CASE
+                   -- e.g. foreign keys dropped by DROP TABLE ... CASCADE on the referencing table
+                   WHEN obj.object_type = 'table constraint'
+                       THEN to_regclass(quote_ident(obj.address_names[1]) || '.' || quote_ident(obj.address_names[2]))::oid
+                   ELSE obj.objid
+               END AS rel
+        FROM pg_event_trigger_dropped_objects() obj
+        WHERE obj.classid IN ('pg_class'::regclass, 'pg_constraint'::regclass)
+    ) affected
+    WHERE rel IS NOT NULL AND rel <> 0;
+
+    IF relids IS NOT NULL THEN
+        PERFORM pg_gen_query_schema_changed(relids);
+    END IF;
 END;
 $$;
 
@@ -23,4 +277,8 @@ CREATE EVENT TRIGGER pg_gen_query_schema_trigger
 ON ddl_command_end
 EXECUTE FUNCTION regen_schema_cache_trigger();
 
+CREATE EVENT TRIGGER pg_gen_query_schema_drop_trigger
+ON sql_drop
+EXECUTE FUNCTION regen_schema_cache_drop_trigger();
+
 SELECT regen_schema_cache();
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include <cctype>
+#include <cstring>
+#include "sql_stream.h"
+
+static bool is_ident_char(char c)
+{
+  return std::isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+static bool is_space(char c)
+{
+  return std::isspace((unsigned char)c);
+}
+
+// Words a line of SQL starts with; a line starting otherwise is prose
+static const char *const statement_keywords[] = {
+    "select", "with", "values", "table", "explain", "insert", "update", "delete", "merge",
+};
+
+#define STATEMENT_KEYWORD_MAX 7
+
+/*
+ Whether the line at text starts a statement: 1 yes, 0 no, -1 undecided until more
+ text arrives
+*/
+static int starts_statement(std::string_view text)
+{
+  if (text[0] == '(')
+    return 1;
+  if (text[0] == '-' || text[0] == '/')
+  {
+    if (text.size() < 2)
+      return -1;
+    return (text[0] == '-' && text[1] == '-') || (text[0] == '/' && text[1] == '*') ? 1 : 0;
+  }
+  size_t len = 0;
+  while (len < text.size() && len <= STATEMENT_KEYWORD_MAX && std::isalpha((unsigned char)text[len]))
+    len++;
+  if (len == text.size() && len <= STATEMENT_KEYWORD_MAX)
+    return -1;
+  if (len == 0 || len > STATEMENT_KEYWORD_MAX || is_ident_char(text[len]))
+    return 0;
+  char word[STATEMENT_KEYWORD_MAX + 1];
+  for (size_t i = 0; i < len; ++i)
+    word[i] = (char)std::tolower((unsigned char)text[i]);
+  word[len] = '\0';
+  for (const char *keyword : statement_keywords)
+  {
+    if (strcmp(word, keyword) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+bool SqlStatementScanner::feed(std::string_view chunk)
+{
+  if (state_ == DONE)
+  {
+    return true;
+  }
+  buf_.append(chunk);
+  scan();
+  return state_ == DONE;
+}
+
+/*
+ Advances pos_ as far as the buffered text allows. Whenever a decision needs a character
+ that hasn't arrived yet, returns with pos_ on the undecided character.
+*/
+void SqlStatementScanner::scan()
+{
+  const size_t n = buf_.size();
+  while (pos_ < n && state_ != DONE)
+  {
+    char c = buf_[pos_];
+    switch (state_)
+    {
+    case START:
+      if (is_space(c))
+      {
+        pos_++;
+        break;
+      }
+      if (c == '`')
+      {
+        if (n - pos_ < 3)
+          return;
+        if (buf_.compare(pos_, 3, "```") == 0)
+        {
+          pos_ += 3;
+          state_ = FENCE_INFO;
+          break;
+        }
+      }
+      switch (starts_statement(std::string_view(buf_).substr(pos_)))
+      {
+      case -1:
+        return;
+      case 1:
+        body_start_ = pos_;
+        state_ = BODY;
+        break;
+      default:
+        state_ = PROSE;
+        break;
+      }
+      break;
+
+    case PROSE:
+      // an apostrophe here is just English; a fence may open mid-line ("Here it is: ```sql")
+      if (c == '\n')
+      {
+        state_ = START;
+        pos_++;
+      }
+      else if (c == '`')
+      {
+        if (n - pos_ < 3)
+          return;
+        if (buf_.compare(pos_, 3, "```") == 0)
+        {
+          pos_ += 3;
+          state_ = FENCE_INFO;
+        }
+        else
+          pos_++;
+      }
+      else
+        pos_++;
+      break;
+
+    case FENCE_INFO:
+      // the language tag of the fence, e.g. ```sql
+      pos_++;
+      if (c == '\n')
+      {
+        body_start_ = pos_;
+        state_ = BODY;
+      }
+      break;
+
+    case BODY:
+      if (c == ';')
+      {
+        body_end_ = ++pos_;
+        state_ = DONE;
+      }
+      else if (c == '\'')
+      {
+        backslash_escapes_ = pos_ > body_start_ && (buf_[pos_ - 1] == 'E' || buf_[pos_ - 1] == 'e') &&
+                             (pos_ - 1 == body_start_ || !is_ident_char(buf_[pos_ - 2]));
+        state_ = SINGLE_QUOTE;
+        pos_++;
+      }
+      else if (c == '"')
+      {
+        state_ = DOUBLE_QUOTE;
+        pos_++;
+      }
+      else if (c == '-' || c == '/')
+      {
+        if (pos_ + 1 >= n)
+          return;
+        if (c == '-' && buf_[pos_ + 1] == '-')
+        {
+          state_ = LINE_COMMENT;
+          pos_ += 2;
+        }
+        else if (c == '/' && buf_[pos_ + 1] == '*')
+        {
+          state_ = BLOCK_COMMENT;
+          comment_depth_ = 1;
+          pos_ += 2;
+        }
+        else
+          pos_++;
+      }
+      else if (c == '$' && (pos_ == body_start_ || !is_ident_char(buf_[pos_ - 1])))
+      {
+        // $tag$ or $$; $1 is a parameter
+        size_t end = pos_ + 1;
+        while (end < n && (std::isalpha((unsigned char)buf_[end]) || buf_[end] == '_' ||
+                           (end > pos_ + 1 && std::isdigit((unsigned char)buf_[end]))))
+          end++;
+        if (end >= n)
+          return;
+        if (buf_[end] == '$')
+        {
+          dollar_tag_ = buf_.substr(pos_, end + 1 - pos_);
+          state_ = DOLLAR_QUOTE;
+          pos_ = end + 1;
+        }
+        else
+          pos_++;
+      }
+      else if (c == '`')
+      {
+        // the closing code fence ends the statement even without a ';'
+        if (n - pos_ < 3)
+          return;
+        if (buf_.compare(pos_, 3, "```") == 0)
+        {
+          body_end_ = pos_;
+          state_ = DONE;
+        }
+        else
+          pos_++;
+      }
+      else
+        pos_++;
+      break;
+
+    case SINGLE_QUOTE:
+      if (c == '\\' && backslash_escapes_)
+      {
+        if (pos_ + 1 >= n)
+          return;
+        pos_ += 2;
+      }
+      else if (c == '\'')
+      {
+        // '' is an escaped quote
+        if (pos_ + 1 >= n)
+          return;
+        if (buf_[pos_ + 1] == '\'')
+          pos_ += 2;
+        else
+        {
+          state_ = BODY;
+          pos_++;
+        }
+      }
+      else
+        pos_++;
+      break;
+
+    case DOUBLE_QUOTE:
+      if (c == '"')
+      {
+        if (pos_ + 1 >= n)
+          return;
+        if (buf_[pos_ + 1] == '"')
+          pos_ += 2;
+        else
+        {
+          state_ = BODY;
+          pos_++;
+        }
+      }
+      else
+        pos_++;
+      break;
+
+    case DOLLAR_QUOTE:
+      if (c == '$')
+      {
+        if (n - pos_ < dollar_tag_.size())
+          return;
+        if (buf_.compare(pos_, dollar_tag_.size(), dollar_tag_) == 0)
+        {
+          pos_ += dollar_tag_.size();
+          state_ = BODY;
+          break;
+        }
+      }
+      pos_++;
+      break;
+
+    case LINE_COMMENT:
+      if (c == '\n')
+        state_ = BODY;
+      pos_++;
+      break;
+
+    case BLOCK_COMMENT:
+      if (c == '*' || c == '/')
+      {
+        if (pos_ + 1 >= n)
+          return;
+        if (c == '*' && buf_[pos_ + 1] == '/')
+        {
+          pos_ += 2;
+          if (--comment_depth_ == 0)
+            state_ = BODY;
+          break;
+        }
+        if (c == '/' && buf_[pos_ + 1] == '*')
+        {
+          pos_ += 2;
+          comment_depth_++;
+          break;
+        }
+      }
+      pos_++;
+      break;
+
+    case DONE:
+      break;
+    }
+  }
+}
+
+std::string SqlStatementScanner::statement() const
+{
+  if (state_ == START || state_ == PROSE || state_ == FENCE_INFO)
+  {
+    return {};
+  }
+  size_t begin = body_start_;
+  size_t end = state_ == DONE ? body_end_ : buf_.size();
+  std::string_view body(buf_.data() + begin, end - begin);
+  if (state_ != DONE)
+  {
+    // the answer ended without ';': drop a closing fence that is still being scanned
+    size_t fence = body.rfind("```");
+    if (fence != std::string_view::npos && body.find_first_not_of(" \t\r\n`", fence) == std::string_view::npos)
+      body = body.substr(0, fence);
+  }
+  while (!body.empty() && is_space(body.front()))
+    body.remove_prefix(1);
+  while (!body.empty() && is_space(body.back()))
+    body.remove_suffix(1);
+  return std::string(body);
+}
+
+std::string sql_first_statement(std::string_view text)
+{
+  SqlStatementScanner scanner;
+  scanner.feed(text);
+  return scanner.statement();
+}
+
+std::string sql_normalize(std::string_view sql)
+{
+  std::string out;
+  out.reserve(sql.size());
+  bool space = false;
+  auto emit = [&](std::string_view text)
+  {
+    if (space && !out.empty())
+      out.push_back(' ');
+    space = false;
+    out.append(text);
+  };
+
+  const size_t n = sql.size();
+  size_t i = 0;
+  while (i < n)
+  {
+    char c = sql[i];
+    if (is_space(c))
+    {
+      space = true;
+      i++;
+    }
+    else if (c == '-' && i + 1 < n && sql[i + 1] == '-')
+    {
+      while (i < n && sql[i] != '\n')
+        i++;
+      space = true;
+    }
+    else if (c == '/' && i + 1 < n && sql[i + 1] == '*')
+    {
+      int depth = 1;
+      i += 2;
+      while (i < n && depth > 0)
+      {
+        if (sql[i] == '*' && i + 1 < n && sql[i + 1] == '/')
+        {
+          depth--;
+          i += 2;
+        }
+        else if (sql[i] == '/' && i + 1 < n && sql[i + 1] == '*')
+        {
+          depth++;
+          i += 2;
+        }
+        else
+          i++;
+      }
+      space = true;
+    }
+    else if (c == '\'' || c == '"')
+    {
+      bool backslash_escapes = c == '\'' && !out.empty() && !space && (out.back() == 'e') &&
+                               (out.size() == 1 || !is_ident_char(out[out.size() - 2]));
+      size_t start = i++;
+      while (i < n)
+      {
+        if (backslash_escapes && sql[i] == '\\' && i + 1 < n)
+          i += 2;
+        else if (sql[i] == c && i + 1 < n && sql[i + 1] == c)
+          i += 2;
+        else if (sql[i++] == c)
+          break;
+      }
+      emit(sql.substr(start, i - start));
+    }
+    else if (c == '$' && (out.empty() || space || !is_ident_char(out.back())))
+    {
+      size_t end = i + 1;
+      while (end < n && (std::isalpha((unsigned char)sql[end]) || sql[end] == '_' ||
+                         (end > i + 1 && std::isdigit((unsigned char)sql[end]))))
+        end++;
+      if (end < n && sql[end] == '$')
+      {
+        std::string_view tag = sql.substr(i, end + 1 - i);
+        size_t close = sql.find(tag, end + 1);
+        size_t stop = close == std::string_view::npos ? n : close + tag.size();
+        emit(sql.substr(i, stop - i));
+        i = stop;
+      }
+      else
+      {
+        emit(sql.substr(i, 1));
+        i++;
+      }
+    }
+    else
+    {
+      char lower = (char)std::tolower((unsigned char)c);
+      emit(std::string_view(&lower, 1));
+      i++;
+    }
+  }
+
+  // the statement terminator (and anything that only looked like layout before it)
+  while (!out.empty() && (out.back() == ';' || out.back() == ' '))
+    out.pop_back();
+  return out;
+}
@@ -0,0 +1,66 @@
+#ifndef SQL_STREAM_H
+#define SQL_STREAM_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+ Incremental scanner for a model's streamed answer. It skips lines of prose before the
+ SQL (such as "Here's the query:") up to a markdown code fence or a line that starts
+ like a statement (a SQL keyword, a comment or '('), skips an opening code fence, and
+ finds where the first SQL statement ends: a top-level ';' (outside quotes,
+ quoted identifiers, dollar quotes and comments) or the closing fence. Chunks may split
+ tokens anywhere; an ambiguous tail is kept until the next chunk arrives.
+ No PostgreSQL dependencies.
+*/
+class SqlStatementScanner
+{
+public:
+  // Appends the next chunk; returns true once a complete statement has been received
+  bool feed(std::string_view chunk);
+
+  bool complete() const { return state_ == DONE; }
+
+  // The statement without code fences and surrounding whitespace (so far, if incomplete)
+  std::string statement() const;
+
+private:
+  enum State
+  {
+    START, // at the start of a line before the statement
+    PROSE, // in a line that isn't SQL, skipped up to its end or a code fence
+    FENCE_INFO,
+    BODY,
+    SINGLE_QUOTE,
+    DOUBLE_QUOTE,
+    DOLLAR_QUOTE,
+    LINE_COMMENT,
+    BLOCK_COMMENT,
+    DONE
+  };
+
+  void scan();
+
+  std::string buf_;
+  size_t pos_ = 0;
+  State state_ = START;
+  size_t body_start_ = 0;
+  size_t body_end_ = 0;
+  bool backslash_escapes_ = false; // E'...' string
+  int comment_depth_ = 0;
+  std::string dollar_tag_;
+};
+
+// The first statement of a complete answer, as the streaming path would return it
+std::string sql_first_statement(std::string_view text);
+
+/*
+ Canonical form of a statement, used to share a prepared plan between texts that differ
+ only in layout: comments and a trailing ';' are dropped, whitespace runs outside quotes
+ collapse to one space and unquoted text is lowercased. Quoted strings, quoted
+ identifiers and dollar quotes are kept verbatim.
+*/
+std::string sql_normalize(std::string_view sql);
+
+#endif
@@ -6,5 +6,8 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 cd "$SCRIPT_DIR"
 
 psql -f init_state.sql postgres
+psql -d benchmark -c "SELECT pg_gen_query_cache_reset();"
 pgbench -c 100 -j 8 -T 180 -f benchmark.sql benchmark > benchmark.log 2>&1
+# the benchmark repeats the same questions: with shared_preload_libraries most calls should be hits
+psql -d benchmark -c "SELECT * FROM pg_gen_query_cache_stats();" | tee -a benchmark.log
 cd "$ORIG_DIR"
\ No newline at end of file
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Compares the shared-memory schema snapshot against the per-backend copy.
+# No provider calls are made: pg_gen_query_schema_info() only loads the schema.
+# Shared mode requires shared_preload_libraries = 'pg_gen_query'.
+# -C reconnects for every transaction, like a pooler recycling backends.
+
+ORIG_DIR="$(pwd)"
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=complex_test
+SYNTHETIC_TABLES=${SYNTHETIC_TABLES:-2000}
+
+psql -f init_state.sql postgres
+
+# Inflate the schema to a few MB so the copy cost is visible
+psql -d $DB -v ON_ERROR_STOP=1 <<SQL
+DO \$\$
+BEGIN
+  FOR i IN 1..$SYNTHETIC_TABLES LOOP
+    EXECUTE format('CREATE TABLE synthetic_%s (id SERIAL PRIMARY KEY, name TEXT NOT NULL, amount NUMERIC, created_at TIMESTAMP DEFAULT NOW(), owner_id INT REFERENCES users)', i);
+    EXECUTE format('COMMENT ON TABLE synthetic_%s IS %L', i, 'Synthetic table number ' || i);
+  END LOOP;
+END
+\$\$;
+SELECT regen_schema_cache();
+SELECT * FROM pg_gen_query_schema_info();
+SQL
+
+for MODE in on off; do
+  echo "=== pg_gen_query.shared_schema = $MODE ==="
+  PGOPTIONS="-c pg_gen_query.shared_schema=$MODE" \
+    pgbench -n -C -c 100 -j 8 -T 60 -f schema_cache_benchmark.sql $DB 2>&1 | tee schema_cache_$MODE.log | grep -E "latency average|tps"
+done
+
+cd "$ORIG_DIR"
@@ -0,0 +1 @@
+SELECT * FROM pg_gen_query_schema_info();
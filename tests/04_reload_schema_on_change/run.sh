@@ -81,6 +81,9 @@ echo ""
 echo "=== Applying schema changes ==="
 psql -v ON_ERROR_STOP=1 -f change_schema.sql postgres
 
+# with shared_preload_libraries the schema is regenerated in the background after the debounce period
+sleep 3
+
 #############################################
 # AFTER-change tests
 #############################################
@@ -159,6 +162,23 @@ for NL in "${!TESTS_AFTER[@]}"; do
   fi
 done
 
+#############################################
+# Renaming a referenced table re-renders the tables referencing it
+#############################################
+
+echo ""
+echo "=== Renaming a referenced table ==="
+psql -v ON_ERROR_STOP=1 -q -d $DB -c "ALTER TABLE coupons RENAME TO vouchers;"
+sleep 3
+STALE=$(psql -d $DB -t -A -c "SET pg_gen_query.prune_token_budget = 0; SELECT pg_gen_query_schema_for('coupons');" | grep -cw coupons)
+if [[ "$STALE" == "0" ]]; then
+  echo "[PASS] no foreign key still names coupons"
+else
+  echo "[FAIL] $STALE line(s) still name coupons"
+  ALL_PASSED=0
+fi
+psql -q -d $DB -c "ALTER TABLE vouchers RENAME TO coupons;"
+
 #############################################
 # Summary
 #############################################
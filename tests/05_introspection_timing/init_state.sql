@@ -0,0 +1,39 @@
+-- ============================================================
+-- Synthetic catalog for introspection timing
+-- Run with: psql -v db=<name> -v n=<tables> -f init_state.sql postgres
+-- ============================================================
+
+DROP DATABASE IF EXISTS :db;
+CREATE DATABASE :db;
+
+\connect :db
+
+SELECT set_config('synthetic.tables', :'n', false);
+
+-- Tables are created before the extension so the event trigger doesn't fire for each one.
+-- Commit in batches to stay within max_locks_per_transaction.
+DO $$
+DECLARE
+  n int := current_setting('synthetic.tables')::int;
+BEGIN
+  FOR i IN 1..n LOOP
+    EXECUTE format(
+      'CREATE TABLE t_%s (
+         id SERIAL PRIMARY KEY,
+         code TEXT UNIQUE NOT NULL,
+         amount NUMERIC CHECK (amount >= 0),
+         status TEXT DEFAULT ''new'',
+         created_at TIMESTAMP DEFAULT NOW(),
+         parent_id INT %s
+       )', i, CASE WHEN i > 1 THEN format('REFERENCES t_%s', i - 1) ELSE '' END);
+    EXECUTE format('CREATE INDEX t_%s_status_idx ON t_%s (status)', i, i);
+    EXECUTE format('COMMENT ON TABLE t_%s IS %L', i, 'Synthetic table ' || i);
+    EXECUTE format('COMMENT ON COLUMN t_%s.amount IS %L', i, 'Amount in cents');
+    IF i % 500 = 0 THEN
+      COMMIT;
+    END IF;
+  END LOOP;
+END
+$$;
+
+CREATE EXTENSION pg_gen_query;
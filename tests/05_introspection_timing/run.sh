@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Times a full regen_schema_cache() on synthetic catalogs of increasing size.
+# Run it once per build (e.g. before and after a change); every run appends to
+# timings.log, and the summary at the end compares all revisions logged so far.
+# Usage: bash run.sh [table counts...]   (default: 1000 10000 50000)
+
+ORIG_DIR="$(pwd)"
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+SIZES=${@:-1000 10000 50000}
+REV=$(git -C "$SCRIPT_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+for N in $SIZES; do
+  DB=introspection_test_$N
+  echo "=== $N tables ($DB) ==="
+
+  psql -q -v ON_ERROR_STOP=1 -v db=$DB -v n=$N -f init_state.sql postgres
+
+  # three full regenerations, the first one also warms the catalog caches
+  RESULT=$(psql -d $DB -X -q -t -A <<SQL
+\timing on
+SELECT regen_schema_cache();
+SELECT regen_schema_cache();
+SELECT regen_schema_cache();
+SQL
+)
+  TIMES=$(echo "$RESULT" | grep -oE 'Time: [0-9.]+' | awk '{print $2}' | paste -sd' ')
+  echo "regen_schema_cache() ms: $TIMES"
+  echo "$REV tables=$N regen_ms=$TIMES" >> timings.log
+
+  psql -q -c "DROP DATABASE $DB;" postgres
+done
+
+# best of the warm runs (all but the first) per revision and table count
+echo ""
+echo "=== best warm regen_schema_cache() ms per revision ==="
+awk '{
+  split($2, t, "="); n = t[2]; sub(/^regen_ms=/, "", $3);
+  best = "";
+  for (i = 4; i <= NF; i++) if (best == "" || $i + 0 < best + 0) best = $i;
+  if (best == "") next;
+  key = $1 " " n;
+  if (!(key in min) || best + 0 < min[key] + 0) min[key] = best;
+}
+END { for (key in min) print key, min[key] }' timings.log | sort -k2,2n -k1,1 |
+  awk '{printf "%-12s tables=%-7s %s ms\n", $1, $2, $3}'
+
+cd "$ORIG_DIR"
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Microbenchmark for the approximate-match cache: lookup latency at 100k entries
+# (sketch the query, scan every cached sketch, pick the best), scalar vs SIMD.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+ENTRIES=${ENTRIES:-100000}
+
+${CXX:-g++} -std=c++17 -O2 -I../.. -o sketch_bench sketch_bench.cpp ../../query_sketch.cpp || exit 1
+./sketch_bench $ENTRIES | tee sketch_bench.log
+
+cd "$ORIG_DIR"
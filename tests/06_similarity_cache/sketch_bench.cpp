@@ -0,0 +1,91 @@
+// Lookup latency of the approximate-match cache scan at 100k cached entries.
+// Builds against query_sketch.cpp only; no server needed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "query_sketch.h"
+
+static const char *subjects[] = {"products", "orders", "customers", "users", "invoices", "shipments", "warehouses", "suppliers"};
+static const char *filters[] = {"priced over", "created after", "with more than", "shipped before", "with fewer than", "ordered in"};
+static const char *extras[] = {"sorted by name", "grouped by region", "with their owner", "per month", "including status", ""};
+
+static double similarity(const std::string &a, const std::string &b)
+{
+  QuerySketch x, y;
+  query_sketch_build(a, x);
+  query_sketch_build(b, y);
+  return (double)query_sketch_dot(x.v, y.v) / (QUERY_SKETCH_SCALE * QUERY_SKETCH_SCALE);
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  const int lookups = 1000;
+
+  std::vector<int8_t> vectors(n * QUERY_SKETCH_DIM);
+  std::vector<std::string> queries;
+  srand(42);
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i)
+  {
+    std::string q = std::string("show ") + subjects[rand() % 8] + " " + filters[rand() % 6] + " " +
+                    std::to_string(rand() % 1000) + " " + extras[rand() % 6] + " v" + std::to_string(i);
+    QuerySketch s;
+    query_sketch_build(q, s);
+    std::copy(s.v, s.v + QUERY_SKETCH_DIM, vectors.begin() + i * QUERY_SKETCH_DIM);
+    if (i < (size_t)lookups)
+      queries.push_back(q);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  printf("entries: %zu (%zu KB of sketches), kernel: %s\n", n, vectors.size() / 1024, query_sketch_kernel());
+  printf("sketch build: %.2f us/query\n", std::chrono::duration<double, std::micro>(t1 - t0).count() / n);
+
+  std::vector<int32_t> scores(n);
+  volatile int32_t sink = 0;
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int l = 0; l < lookups; ++l)
+    {
+      QuerySketch q;
+      query_sketch_build(queries[l], q);
+      if (pass == 0)
+      {
+        for (size_t i = 0; i < n; ++i)
+          scores[i] = query_sketch_dot(vectors.data() + i * QUERY_SKETCH_DIM, q.v);
+      }
+      else
+      {
+        query_sketch_scan(vectors.data(), n, q.v, scores.data());
+      }
+      int32_t best = 0;
+      for (size_t i = 0; i < n; ++i)
+        best = scores[i] > best ? scores[i] : best;
+      sink = sink + best;
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("lookup (%s): %.1f us\n", pass == 0 ? "scalar" : query_sketch_kernel(),
+           std::chrono::duration<double, std::micro>(end - start).count() / lookups);
+  }
+
+  printf("\nsimilarity examples:\n");
+  const char *pairs[][2] = {
+      {"show products over $20", "list products where price > 20"},
+      {"show products over $20", "show products over $30"},
+      {"List all users", "list all the users"},
+      {"Get orders for user 1", "orders of user 1"},
+      {"Show all coupons", "List coupons applied to each order"},
+  };
+  for (auto &p : pairs)
+  {
+    QuerySketch a, b;
+    query_sketch_build(p[0], a);
+    query_sketch_build(p[1], b);
+    printf("  %.3f%s  \"%s\" / \"%s\"\n", similarity(p[0], p[1]),
+           a.literals == b.literals ? "" : " (literals differ)", p[0], p[1]);
+  }
+  return 0;
+}
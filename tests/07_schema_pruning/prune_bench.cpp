@@ -0,0 +1,93 @@
+// Per-call cost of schema pruning on a synthetic 3k-table snapshot.
+// Builds against schema_snapshot.cpp, schema_encode.cpp and schema_prune.cpp only; no server needed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "schema_encode.h"
+#include "schema_prune.h"
+#include "schema_snapshot.h"
+
+static const char *domains[] = {"sales", "billing", "inventory", "shipping", "hr", "marketing", "support", "analytics"};
+static const char *nouns[] = {"order", "invoice", "customer", "product", "warehouse", "employee", "campaign", "ticket",
+                              "payment", "shipment", "supplier", "region", "account", "contract", "refund", "coupon"};
+
+int main(int argc, char **argv)
+{
+  size_t ntables = argc > 1 ? strtoul(argv[1], nullptr, 10) : 3000;
+  const int calls = 2000;
+
+  SchemaSnapshotBuilder builder;
+  srand(7);
+  for (size_t i = 0; i < ntables; ++i)
+  {
+    TableModel t;
+    t.oid = 16384 + (uint32_t)i;
+    t.schema = domains[i % 8];
+    t.table = std::string(nouns[i % 16]) + "_" + nouns[(i / 16) % 16] + "_" + std::to_string(i);
+    t.has_comment = true;
+    t.comment = std::string("Records of ") + nouns[i % 16] + " data for the " + domains[i % 8] + " team";
+    const char *cols[] = {"id", "name", "amount", "created_at", "status", "owner_id"};
+    for (int c = 0; c < 6; ++c)
+    {
+      ColumnModel &col = t.add_column((int16_t)(c + 1));
+      col.name = cols[c];
+      col.type = c == 2 ? "numeric" : "text";
+    }
+    t.add_column(7).name = std::string(nouns[(i + 3) % 16]) + "_id";
+    t.has_primary_key = true;
+    t.primary_key = {"pk", {1}};
+    if (i > 0)
+    {
+      ForeignKeyModel fk;
+      fk.name = "fk";
+      fk.attnums = {7};
+      fk.ref_oid = 16384 + (uint32_t)(rand() % i);
+      fk.ref_schema = "x";
+      fk.ref_table = "y";
+      fk.ref_columns = {"id"};
+      t.foreign_keys.push_back(fk);
+    }
+    t.finalize();
+    std::string fragment;
+    encode_flat_table(t, fragment);
+    builder.add_table(t.oid, t.schema, t.table, fragment, schema_table_terms(t));
+  }
+  std::string image = builder.finish();
+
+  SchemaSnapshotView view;
+  if (!view.open(image))
+  {
+    fprintf(stderr, "snapshot does not open\n");
+    return 1;
+  }
+  printf("tables: %zu, full schema: %zu bytes (~%zu tokens)\n", view.table_count(), view.text().size(), view.text().size() / 4);
+
+  const char *queries[] = {
+      "total refund amount per customer last month",
+      "Which warehouses shipped the most products?",
+      "list open support tickets with their owner",
+      "campaign performance by region",
+  };
+  SchemaPruneOptions options;
+  options.token_budget = 16000;
+  options.fk_hops = 1;
+
+  for (const char *q : queries)
+  {
+    std::string out;
+    prune_schema(view, q, options, out);
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < calls; ++k)
+      prune_schema(view, q, options, out);
+    auto end = std::chrono::steady_clock::now();
+    size_t kept = 0;
+    for (size_t p = out.find("\"table\":"); p != std::string::npos; p = out.find("\"table\":", p + 1))
+      ++kept;
+    printf("%7.1f us  %4zu tables, %7zu bytes  \"%s\"\n",
+           std::chrono::duration<double, std::micro>(end - start).count() / calls, kept, out.size(), q);
+  }
+  return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Microbenchmark for query-aware schema pruning: time per call and tables kept
+# for a few queries against a synthetic 3k-table snapshot (budget 16000 tokens, 1 hop).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+TABLES=${TABLES:-3000}
+
+${CXX:-g++} -std=c++17 -O2 -I../.. -o prune_bench prune_bench.cpp \
+  ../../schema_snapshot.cpp ../../schema_encode.cpp ../../schema_prune.cpp || exit 1
+./prune_bench $TABLES | tee prune_bench.log
+
+cd "$ORIG_DIR"
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# Size of the schema sent to the model in each pg_gen_query.schema_encoding,
+# on the tests/03_complex database. No AI calls are made.
+# Tokens are approximated by counting words, numbers and punctuation marks,
+# which tracks BPE tokenizers far better than bytes / 4 for this kind of text.
+# Needs superuser (ALTER SYSTEM); the original setting is restored at the end.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=complex_test
+
+psql -v ON_ERROR_STOP=1 -f ../03_complex/init_state.sql postgres > /dev/null
+
+ORIGINAL=$(psql -d $DB -t -A -c "SHOW pg_gen_query.schema_encoding;")
+
+printf "%-10s %10s %10s\n" "encoding" "bytes" "~tokens" | tee encodings.log
+for ENCODING in flat detailed compact; do
+  psql -d $DB -q -c "ALTER SYSTEM SET pg_gen_query.schema_encoding = '$ENCODING';" -c "SELECT pg_reload_conf();" > /dev/null
+  sleep 1
+  psql -d $DB -q -c "SELECT regen_schema_cache();" > /dev/null
+  PGOPTIONS="-c pg_gen_query.prune_token_budget=0" psql -d $DB -t -A -F ' ' -c "
+    SELECT octet_length(s),
+           (SELECT count(*) FROM regexp_matches(s, '[A-Za-z]+|[0-9]+|[^[:space:][:alnum:]]', 'g'))
+    FROM pg_gen_query_schema_for('') AS s;" |
+    while read BYTES TOKENS; do
+      printf "%-10s %10s %10s\n" "$ENCODING" "$BYTES" "$TOKENS"
+    done | tee -a encodings.log
+done
+
+echo ""
+echo "=== compact encoding ==="
+PGOPTIONS="-c pg_gen_query.prune_token_budget=0" psql -d $DB -t -A -c "SELECT pg_gen_query_schema_for('');"
+
+psql -d $DB -q -c "ALTER SYSTEM SET pg_gen_query.schema_encoding = '$ORIGINAL';" -c "SELECT pg_reload_conf();" > /dev/null
+sleep 1
+psql -d $DB -q -c "SELECT regen_schema_cache();" > /dev/null
+
+cd "$ORIG_DIR"
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Compares 50 questions sent one by one through pg_gen_query with the same questions
+# sent at once through pg_gen_query_batch, on the tests/02_simple database.
+# The result cache is reset before each run so every question reaches the provider.
+
+# Warning: makes 100 AI calls.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+N=50
+
+psql -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null
+
+# distinct questions, so neither run benefits from the exact-match cache
+QUESTIONS="SELECT 'Show customers older than ' || i FROM generate_series(1, $N) AS i"
+
+psql -d $DB -q -c "SELECT pg_gen_query_cache_reset();" > /dev/null
+START=$(date +%s.%N)
+psql -d $DB -q -t -A -c "SELECT count(pg_gen_query(q)) FROM ($QUESTIONS) AS t(q);" > /dev/null
+SEQUENTIAL=$(echo "$(date +%s.%N) - $START" | bc)
+
+psql -d $DB -q -c "SELECT pg_gen_query_cache_reset();" > /dev/null
+START=$(date +%s.%N)
+psql -d $DB -t -A -F $'\t' -c "SELECT ordinal, error, sql FROM pg_gen_query_batch(ARRAY($QUESTIONS));" > batch.log
+BATCH=$(echo "$(date +%s.%N) - $START" | bc)
+
+echo "sequential: ${SEQUENTIAL}s"
+echo "batch     : ${BATCH}s (results in batch.log)"
+echo "errors    : $(awk -F'\t' '/^[0-9]+\t/ && $2 != ""' batch.log | wc -l)"
+
+cd "$ORIG_DIR"
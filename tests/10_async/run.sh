@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Async requests on the tests/02_simple database: submits a few questions without
+# waiting, collects them with poll and wait, and checks that a wait is interrupted
+# by statement_timeout. Needs pg_gen_query in shared_preload_libraries.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+
+psql -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null
+psql -d $DB -q -c "SELECT pg_gen_query_cache_reset();" > /dev/null
+
+echo "=== submit ==="
+START=$(date +%s.%N)
+IDS=$(psql -d $DB -t -A -c "
+  SELECT pg_gen_query_submit(q)
+  FROM unnest(ARRAY['List all customers', 'Show customers older than 30',
+                    'Find all orders for Alice', 'What items did Bob buy?']) AS q;")
+echo "submitted $(echo "$IDS" | wc -l) requests in $(echo "$(date +%s.%N) - $START" | bc)s"
+
+echo ""
+echo "=== poll (first id) ==="
+FIRST=$(echo "$IDS" | head -1)
+psql -d $DB -c "SELECT * FROM pg_gen_query_poll($FIRST);"
+
+echo "=== wait ==="
+PASSED=1
+for ID in $IDS; do
+  SQL=$(psql -d $DB -t -A -c "SELECT pg_gen_query_wait($ID, interval '2 minutes');" 2>&1)
+  # the first id may already have been fetched by the poll above
+  echo "$ID: $SQL"
+done
+
+echo ""
+echo "=== statement_timeout interrupts a wait ==="
+ID=$(psql -d $DB -t -A -c "SELECT pg_gen_query_submit('Count the orders of every customer');")
+OUT=$(psql -d $DB -t -A -c "SET statement_timeout = '10ms'; SELECT pg_gen_query_wait($ID);" 2>&1)
+if echo "$OUT" | grep -q "statement timeout"; then
+  echo "[PASS] wait was cancelled"
+else
+  echo "[FAIL] $OUT"
+  PASSED=0
+fi
+psql -d $DB -t -A -c "SELECT pg_gen_query_wait($ID);" > /dev/null
+
+echo ""
+if [[ $PASSED -eq 1 ]]; then
+  echo "=== ALL TESTS PASSED ==="
+else
+  echo "=== SOME TESTS FAILED ==="
+fi
+
+cd "$ORIG_DIR"
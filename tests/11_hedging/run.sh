@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Hedged requests on the tests/02_simple database: runs distinct questions with
+# pg_gen_query.hedge on and reports the latency percentiles and how often the hedge won.
+# Needs both OPENAI_API_KEY and ANTHROPIC_API_KEY. Makes up to 2 AI calls per question.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+N=${N:-100}
+
+psql -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null
+psql -d $DB -q -c "SELECT pg_gen_query_cache_reset();" > /dev/null
+
+# one session, so the per-backend statistics also work without shared_preload_libraries
+psql -d $DB -q -t -A > hedging.log <<SQL
+SET pg_gen_query.hedge = on;
+SET pg_gen_query.hedge_delay = '${HEDGE_DELAY:-2s}';
+CREATE TEMP TABLE timings (ms float8);
+DO \$\$
+DECLARE
+  started timestamptz;
+BEGIN
+  FOR i IN 1..$N LOOP
+    started := clock_timestamp();
+    PERFORM pg_gen_query('Show customers older than ' || i);
+    INSERT INTO timings VALUES (extract(epoch FROM clock_timestamp() - started) * 1000);
+  END LOOP;
+END
+\$\$;
+SELECT 'p50 ' || round(percentile_cont(0.5) WITHIN GROUP (ORDER BY ms)::numeric, 1) || ' ms, ' ||
+       'p99 ' || round(percentile_cont(0.99) WITHIN GROUP (ORDER BY ms)::numeric, 1) || ' ms'
+FROM timings;
+SQL
+cat hedging.log
+psql -d $DB -c "SELECT * FROM pg_gen_query_hedge_stats();"
+
+cd "$ORIG_DIR"
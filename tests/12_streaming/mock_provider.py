@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the OpenAI chat completions and Anthropic messages APIs, with
+provider-like timing, so pg_gen_query can be tested and benchmarked without network
+access or AI credits.
+
+Every answer is a fenced SQL statement followed by an explanation, sent as tokens of
+about 4 characters: the first after the time to first token (--latency), then one
+every --token-ms ms. Blocking requests get the whole answer at the end; streaming
+requests get server-sent events as the tokens are "generated", and a client that
+hangs up early stops the generation.
+
+  python3 mock_provider.py --port 8089
+  SET pg_gen_query.openai_base_url = 'http://127.0.0.1:8089';     -- or
+  SET pg_gen_query.anthropic_base_url = 'http://127.0.0.1:8089';
+
+Latency distributions (--latency, milliseconds to the first token):
+  300                 constant (same as --ttft 300)
+  uniform:100:500     uniform between 100 and 500
+  normal:300:50       normal, mean 300, standard deviation 50 (never below 0)
+  lognormal:300:0.5   log-normal with median 300 and sigma 0.5 (a long tail)
+  exp:300             exponential with mean 300
+
+--error-rate 0.05 fails 5% of the requests with --error-status (default 500; 429 is
+reported as a rate limit). --seed makes latencies and failures repeatable.
+
+Answers come from --responses FILE when given: a JSON list of
+  {"match": "<regular expression>", "answer": "<the model's answer>"}
+tried in order against the question (the text after "Query: " in the prompt); the
+built-in answer "SELECT * FROM customers WHERE age > N;" is used otherwise.
+With --record FILE and --upstream URL, requests are forwarded (without streaming) to
+the real provider instead, and each answer is appended to FILE in the same format, so
+a recorded session can be replayed offline with --responses FILE.
+"""
+
+import argparse
+import json
+import math
+import os
+import random
+import re
+import threading
+import time
+import urllib.error
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+EXPLANATION = (
+    "This query selects the requested rows. It filters on the condition from the "
+    "question and returns every column of the table, so the result can be inspected "
+    "directly. If you only need some of the columns, list them instead of using *. "
+    "An index on the filtered column would make the query faster on large tables, "
+    "and ordering the result makes it easier to read. Let me know if you want the "
+    "query extended with joins to the related tables or aggregated per group."
+)
+
+
+def builtin_answer(question):
+    match = re.search(r"older than (\d+)", question)
+    age = match.group(1) if match else "30"
+    return "```sql\nSELECT * FROM customers WHERE age > %s;\n```\n\n%s" % (age, EXPLANATION)
+
+
+def question_of(prompt):
+    match = re.search(r"Query: (.*)\Z", prompt, re.S)
+    return (match.group(1) if match else prompt).strip()
+
+
+def tokens(text):
+    # roughly 4 characters per token
+    return [text[i : i + 4] for i in range(0, len(text), 4)]
+
+
+def parse_latency(spec):
+    """Returns a function drawing one time to first token, in ms"""
+    kind, _, args = spec.partition(":")
+    if not args:
+        value = float(kind)
+        return lambda rng: value
+    params = [float(x) for x in args.split(":")]
+    if kind == "uniform":
+        low, high = params
+        return lambda rng: rng.uniform(low, high)
+    if kind == "normal":
+        mean, sd = params
+        return lambda rng: max(0.0, rng.gauss(mean, sd))
+    if kind == "lognormal":
+        median, sigma = params
+        return lambda rng: rng.lognormvariate(math.log(median), sigma)
+    if kind == "exp":
+        (mean,) = params
+        return lambda rng: rng.expovariate(1.0 / mean)
+    raise ValueError("unknown latency distribution: %s" % spec)
+
+
+def message_text(content):
+    # Anthropic content may be a string or a list of blocks
+    if isinstance(content, list):
+        return "".join(block.get("text", "") for block in content if isinstance(block, dict))
+    return str(content)
+
+
+class Responses:
+    """Canned answers, and the file recorded answers are appended to"""
+
+    def __init__(self, path, record_path):
+        self.entries = []
+        if path:
+            with open(path) as f:
+                self.entries = [(re.compile(e["match"], re.S), e["answer"]) for e in json.load(f)]
+        self.record_path = record_path
+        self.recorded = []
+        if record_path and os.path.exists(record_path):
+            with open(record_path) as f:
+                self.recorded = json.load(f)
+        self.lock = threading.Lock()
+
+    def answer(self, question):
+        for pattern, answer in self.entries:
+            if pattern.search(question):
+                return answer
+        return builtin_answer(question)
+
+    def record(self, question, answer):
+        with self.lock:
+            self.recorded.append({"match": "^" + re.escape(question) + "$", "answer": answer})
+            with open(self.record_path, "w") as f:
+                json.dump(self.recorded, f, indent=2)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def do_POST(self):
+        path = self.path.rstrip("/")
+        if path.endswith("chat/completions"):
+            api = "openai"
+        elif path.endswith("messages"):
+            api = "anthropic"
+        else:
+            self.send_error(404)
+            return
+        raw = self.rfile.read(int(self.headers.get("Content-Length", 0))) or b"{}"
+        body = json.loads(raw)
+        if api == "openai":
+            prompt = "\n".join(message_text(m.get("content", "")) for m in body.get("messages", []))
+        else:
+            prompt = message_text(body.get("system", "")) + "\n" + "\n".join(
+                message_text(m.get("content", "")) for m in body.get("messages", []))
+        model = body.get("model", "mock")
+        server = self.server
+
+        if server.upstream:
+            answer = self.forward(api, body, prompt)
+            if answer is None:
+                return
+            delay = 0
+        else:
+            with server.rng_lock:
+                failed = server.rng.random() < server.error_rate
+                delay = server.latency(server.rng)
+            if failed:
+                time.sleep(delay / 1000.0)
+                self.fail(api, server.error_status, "mock provider: injected failure")
+                return
+            answer = server.responses.answer(question_of(prompt))
+
+        parts = tokens(answer)
+        token_ms = 0 if server.upstream else server.token_ms
+        if body.get("stream"):
+            self.stream(api, parts, model, len(prompt) // 4, delay, token_ms)
+            return
+        time.sleep((delay + token_ms * (len(parts) - 1)) / 1000.0)
+        if api == "openai":
+            payload = {
+                "id": "chatcmpl-mock",
+                "object": "chat.completion",
+                "created": int(time.time()),
+                "model": model,
+                "choices": [
+                    {"index": 0, "message": {"role": "assistant", "content": answer}, "finish_reason": "stop"}
+                ],
+                "usage": {"prompt_tokens": len(prompt) // 4, "completion_tokens": len(parts),
+                          "total_tokens": len(prompt) // 4 + len(parts)},
+            }
+        else:
+            payload = {
+                "id": "msg_mock",
+                "type": "message",
+                "role": "assistant",
+                "model": model,
+                "content": [{"type": "text", "text": answer}],
+                "stop_reason": "end_turn",
+                "stop_sequence": None,
+                "usage": {"input_tokens": len(prompt) // 4, "output_tokens": len(parts)},
+            }
+        self.send_json(200, payload)
+
+    def send_json(self, status, payload):
+        data = json.dumps(payload).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def fail(self, api, status, message):
+        if api == "openai":
+            kind = "rate_limit_exceeded" if status == 429 else "server_error"
+            self.send_json(status, {"error": {"message": message, "type": kind, "code": None}})
+        else:
+            kind = "rate_limit_error" if status == 429 else "api_error"
+            self.send_json(status, {"type": "error", "error": {"type": kind, "message": message}})
+
+    def forward(self, api, body, prompt):
+        """Sends the request to the real provider; returns its answer, recorded"""
+        body = dict(body, stream=False)
+        headers = {"Content-Type": "application/json"}
+        for name in ("Authorization", "x-api-key", "anthropic-version"):
+            if self.headers.get(name):
+                headers[name] = self.headers[name]
+        request = urllib.request.Request(self.server.upstream + self.path, data=json.dumps(body).encode(),
+                                         headers=headers, method="POST")
+        try:
+            with urllib.request.urlopen(request, timeout=120) as response:
+                reply = json.loads(response.read())
+        except urllib.error.HTTPError as e:
+            self.fail(api, e.code, "upstream: %s" % e.read().decode(errors="replace"))
+            return None
+        except (urllib.error.URLError, OSError) as e:
+            self.fail(api, 502, "upstream: %s" % e)
+            return None
+        if api == "openai":
+            answer = reply["choices"][0]["message"]["content"]
+        else:
+            answer = "".join(b.get("text", "") for b in reply.get("content", []) if b.get("type") == "text")
+        self.server.responses.record(question_of(prompt), answer)
+        return answer
+
+    def chunk(self, data):
+        self.wfile.write(b"%x\r\n%s\r\n" % (len(data), data))
+        self.wfile.flush()
+
+    def event(self, api, payload):
+        data = json.dumps(payload).encode()
+        if api == "anthropic":
+            self.chunk(b"event: " + payload["type"].encode() + b"\ndata: " + data + b"\n\n")
+        else:
+            self.chunk(b"data: " + data + b"\n\n")
+
+    def stream(self, api, parts, model, prompt_tokens, delay, token_ms):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        try:
+            if api == "anthropic":
+                self.event(api, {"type": "message_start",
+                                 "message": {"id": "msg_mock", "type": "message", "role": "assistant",
+                                             "model": model, "content": [], "stop_reason": None,
+                                             "usage": {"input_tokens": prompt_tokens, "output_tokens": 0}}})
+                self.event(api, {"type": "content_block_start", "index": 0,
+                                 "content_block": {"type": "text", "text": ""}})
+            time.sleep(delay / 1000.0)
+            for i, part in enumerate(parts):
+                if i > 0:
+                    time.sleep(token_ms / 1000.0)
+                if api == "anthropic":
+                    self.event(api, {"type": "content_block_delta", "index": 0,
+                                     "delta": {"type": "text_delta", "text": part}})
+                else:
+                    self.event(api, {"id": "chatcmpl-mock", "object": "chat.completion.chunk",
+                                     "created": int(time.time()), "model": model,
+                                     "choices": [{"index": 0, "delta": {"content": part}, "finish_reason": None}]})
+            if api == "anthropic":
+                self.event(api, {"type": "content_block_stop", "index": 0})
+                self.event(api, {"type": "message_delta", "delta": {"stop_reason": "end_turn"},
+                                 "usage": {"output_tokens": len(parts)}})
+                self.event(api, {"type": "message_stop"})
+            else:
+                self.chunk(b"data: [DONE]\n\n")
+            self.chunk(b"")
+        except (BrokenPipeError, ConnectionResetError):
+            # the client stopped reading once it had the SQL
+            self.close_connection = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8089)
+    parser.add_argument("--ttft", type=float, default=300, help="constant time to first token, ms")
+    parser.add_argument("--latency", help="time to first token distribution (overrides --ttft)")
+    parser.add_argument("--token-ms", type=float, default=20, help="time per further token, ms")
+    parser.add_argument("--error-rate", type=float, default=0, help="fraction of requests that fail")
+    parser.add_argument("--error-status", type=int, default=500, help="HTTP status of failed requests")
+    parser.add_argument("--seed", type=int, help="seed for latencies and failures")
+    parser.add_argument("--responses", help="JSON file of canned answers")
+    parser.add_argument("--record", help="append the upstream answers to this JSON file")
+    parser.add_argument("--upstream", help="real provider base URL to forward to (with --record)")
+    args = parser.parse_args()
+    if bool(args.record) != bool(args.upstream):
+        parser.error("--record and --upstream go together")
+
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), Handler)
+    server.daemon_threads = True
+    server.latency = parse_latency(args.latency or str(args.ttft))
+    server.token_ms = args.token_ms
+    server.error_rate = args.error_rate
+    server.error_status = args.error_status
+    server.rng = random.Random(args.seed)
+    server.rng_lock = threading.Lock()
+    server.responses = Responses(args.responses, args.record)
+    server.upstream = args.upstream.rstrip("/") if args.upstream else None
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Streaming generation: checks the statement scanner on chunked answers (no server
+# needed), then measures time-to-SQL of the blocking and the streaming path against
+# mock_provider.py on the tests/02_simple database. No real AI calls.
+# Needs superuser (pg_gen_query.openai_base_url).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+N=${N:-20}
+PORT=${PORT:-8089}
+
+echo "=== statement scanner ==="
+${CXX:-g++} -std=c++17 -O2 -I../.. -o scanner_check scanner_check.cpp ../../sql_stream.cpp || exit 1
+./scanner_check || exit 1
+
+echo ""
+echo "=== time to SQL, $N questions (mock: 300 ms to first token, 20 ms per token) ==="
+python3 mock_provider.py --port $PORT &
+MOCK_PID=$!
+trap "kill $MOCK_PID 2>/dev/null" EXIT
+sleep 1
+
+psql -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null
+
+for STREAMING in off on; do
+  # cache_ttl = 0 bypasses the result cache, so every call reaches the mock
+  PGOPTIONS="-c ai.openai_api_key=mock -c pg_gen_query.openai_base_url=http://127.0.0.1:$PORT \
+             -c pg_gen_query.cache_ttl=0 -c pg_gen_query.streaming=$STREAMING" \
+    psql -d $DB -q -t -A <<SQL | tee streaming_$STREAMING.log
+CREATE TEMP TABLE timings (ms float8, answer text);
+DO \$\$
+DECLARE
+  started timestamptz;
+  answer text;
+BEGIN
+  FOR i IN 1..$N LOOP
+    started := clock_timestamp();
+    answer := pg_gen_query('Show customers older than ' || i);
+    INSERT INTO timings VALUES (extract(epoch FROM clock_timestamp() - started) * 1000, answer);
+  END LOOP;
+END
+\$\$;
+SELECT 'streaming $STREAMING: p50 ' || round(percentile_cont(0.5) WITHIN GROUP (ORDER BY ms)::numeric, 1) ||
+       ' ms, max ' || round(max(ms)::numeric, 1) || ' ms, answer bytes ' || round(avg(octet_length(answer)))
+FROM timings;
+SQL
+done
+
+cd "$ORIG_DIR"
@@ -0,0 +1,75 @@
+// Feeds model answers to SqlStatementScanner in every possible 1..8 byte chunking and
+// checks where the first statement ends, then checks sql_normalize. No server needed.
+
+#include <cstdio>
+#include <string>
+#include "sql_stream.h"
+
+struct Case
+{
+  const char *answer;
+  const char *expected;
+};
+
+static const Case cases[] = {
+    {"SELECT * FROM customers;", "SELECT * FROM customers;"},
+    {"```sql\nSELECT * FROM customers WHERE age > 30;\n```\n\nThis query returns...", "SELECT * FROM customers WHERE age > 30;"},
+    {"```\nSELECT 1\n```\nExplanation; with a semicolon", "SELECT 1"},
+    {"SELECT 'a;b', 'it''s; here' FROM t; trailing", "SELECT 'a;b', 'it''s; here' FROM t;"},
+    {"SELECT E'\\'; still a string' FROM t;", "SELECT E'\\'; still a string' FROM t;"},
+    {"SELECT \"odd;\"\"name\" FROM t;", "SELECT \"odd;\"\"name\" FROM t;"},
+    {"SELECT $$ ; $$, $fn$ a $$ ; $fn$ FROM t; x", "SELECT $$ ; $$, $fn$ a $$ ; $fn$ FROM t;"},
+    {"SELECT $1, a$b FROM t; x", "SELECT $1, a$b FROM t;"},
+    {"SELECT 1 -- comment; here\n + 2; x", "SELECT 1 -- comment; here\n + 2;"},
+    {"SELECT /* a /* nested; */ ; */ 1; x", "SELECT /* a /* nested; */ ; */ 1;"},
+    {"SELECT 10 / 2, 3 - 1; x", "SELECT 10 / 2, 3 - 1;"},
+    {"Here's the SQL:\n\nSELECT name FROM customers WHERE city = 'Paris';", "SELECT name FROM customers WHERE city = 'Paris';"},
+    {"Here's the query you asked for:\n```sql\nSELECT 1;\n```", "SELECT 1;"},
+    {"Sure, here it is: ```sql\nselect 2\n```", "select 2"},
+    {"It's simple; select everything:\n-- all rows\nSELECT * FROM t; x", "-- all rows\nSELECT * FROM t;"},
+    {"Selecting it won't work;\n(SELECT 1) UNION (SELECT 2); x", "(SELECT 1) UNION (SELECT 2);"},
+    {"WITH x AS (SELECT 1) SELECT * FROM x; y", "WITH x AS (SELECT 1) SELECT * FROM x;"},
+    {"I can't answer that; the schema has no such table.", ""},
+};
+
+static const Case normalize_cases[] = {
+    {"SELECT *\n  FROM Customers\n WHERE age > 30;\n", "select * from customers where age > 30"},
+    {"select * from customers where age > 30", "select * from customers where age > 30"},
+    {"SELECT 'Mixed  Case;' AS \"Col  A\" FROM t", "select 'Mixed  Case;' as \"Col  A\" from t"},
+    {"SELECT E'\\'  X' FROM t", "select e'\\'  X' from t"},
+    {"SELECT $Fn$ A  B $Fn$, $1 FROM t", "select $Fn$ A  B $Fn$, $1 from t"},
+    {"SELECT 1 -- Comment\n + 2 /* a /* b */ */ FROM t ;", "select 1 + 2 from t"},
+    {"SELECT a-b, 10/2 FROM t", "select a-b, 10/2 from t"},
+};
+
+int main()
+{
+  int failures = 0;
+  for (const Case &c : cases)
+  {
+    std::string answer = c.answer;
+    for (size_t chunk = 1; chunk <= 8; ++chunk)
+    {
+      SqlStatementScanner scanner;
+      for (size_t i = 0; i < answer.size() && !scanner.complete(); i += chunk)
+        scanner.feed(std::string_view(answer).substr(i, chunk));
+      std::string got = scanner.statement();
+      if (got != c.expected)
+      {
+        printf("[FAIL] chunk %zu: %s\n  expected: %s\n  got     : %s\n", chunk, c.answer, c.expected, got.c_str());
+        failures++;
+      }
+    }
+  }
+  for (const Case &c : normalize_cases)
+  {
+    std::string got = sql_normalize(c.answer);
+    if (got != c.expected)
+    {
+      printf("[FAIL] normalize: %s\n  expected: %s\n  got     : %s\n", c.answer, c.expected, got.c_str());
+      failures++;
+    }
+  }
+  printf(failures == 0 ? "=== ALL TESTS PASSED ===\n" : "=== SOME TESTS FAILED ===\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#!/bin/bash
+
+# Execute mode: runs pg_gen_query_exec against tests/12_streaming/mock_provider.py,
+# which answers "SELECT * FROM customers WHERE age > N;" in a code fence with an
+# explanation after it. Checks the column definition list, the plan cache, that writes
+# made by called functions are rejected, then streams a large result. No real AI calls.
+# Needs superuser (pg_gen_query.openai_base_url).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=exec_test
+ROWS=${ROWS:-200000}
+PORT=${PORT:-8089}
+RESPONSES=$(mktemp)
+
+# anything else gets the mock's built-in answer
+cat > $RESPONSES <<'JSON'
+[
+  {"match": "^next customer id$", "answer": "SELECT nextval('customer_ids')::int AS id;"}
+]
+JSON
+
+python3 ../12_streaming/mock_provider.py --port $PORT --ttft 10 --token-ms 0 --responses $RESPONSES &
+MOCK_PID=$!
+trap "kill $MOCK_PID 2>/dev/null; rm -f $RESPONSES" EXIT
+sleep 1
+
+psql -q postgres <<SQL
+DROP DATABASE IF EXISTS $DB;
+CREATE DATABASE $DB;
+SQL
+
+export PGOPTIONS="-c ai.openai_api_key=mock -c pg_gen_query.openai_base_url=http://127.0.0.1:$PORT"
+
+psql -d $DB -q -v ON_ERROR_STOP=1 <<SQL
+CREATE EXTENSION pg_gen_query;
+CREATE TABLE customers (id int PRIMARY KEY, name text, age int);
+INSERT INTO customers SELECT i, 'customer ' || i, i % 100 FROM generate_series(1, $ROWS) i;
+ANALYZE customers;
+CREATE SEQUENCE customer_ids;
+SQL
+
+PASSED=0
+FAILED=0
+check()
+{
+  local name="$1" expected="$2" got="$3"
+  if [ "$got" == "$expected" ]; then
+    echo "[PASS] $name"
+    PASSED=$((PASSED + 1))
+  else
+    echo "[FAIL] $name: expected '$expected', got '$got'"
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+got=$(psql -d $DB -t -A -c "SELECT count(*) FROM pg_gen_query_exec('customers older than 90') AS t(id int, name text, age int)")
+check "column list matches" "$((ROWS * 9 / 100))" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT count(*) FROM pg_gen_query_exec('customers older than 90') AS t(id int, name text)" 2>&1 | grep -c "2 columns")
+check "column count mismatch is reported" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT count(*) FROM pg_gen_query_exec('customers older than 90') AS t(id int, name int, age int)" 2>&1 | grep -c "has type text")
+check "column type mismatch is reported" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT * FROM pg_gen_query_exec('next customer id') AS t(id int)" 2>&1 |
+  grep -c "cannot execute nextval() in a read-only transaction")
+check "writes by called functions are rejected" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT count(*) FROM (SELECT pg_gen_query_exec('customers older than 0')) s")
+check "select list streams the rows" "$((ROWS * 99 / 100))" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.exec_fetch_size = 10; SELECT count(*) FROM (SELECT pg_gen_query_exec('customers older than 0') LIMIT 25) s")
+check "early LIMIT" "25" "$got"
+
+# the second run reuses the cached plan; after DDL PostgreSQL replans it, so SELECT *
+# picks up the new column and the old column list no longer matches
+got=$(psql -d $DB -t -A <<SQL
+SELECT count(*) FROM pg_gen_query_exec('customers older than 95') AS t(id int, name text, age int);
+SELECT count(*) FROM pg_gen_query_exec('customers older than 95') AS t(id int, name text, age int);
+SQL
+)
+check "cached plan" "$((ROWS * 4 / 100))
+$((ROWS * 4 / 100))" "$got"
+
+got=$(psql -d $DB -t -A 2>&1 <<SQL | grep -c "4 columns"
+SELECT count(*) FROM pg_gen_query_exec('customers older than 95') AS t(id int, name text, age int);
+ALTER TABLE customers ADD COLUMN note text;
+SELECT count(*) FROM pg_gen_query_exec('customers older than 95') AS t(id int, name text, age int);
+SQL
+)
+check "cached plan after DDL" "1" "$got"
+
+echo ""
+echo "=== select list, $ROWS rows ==="
+psql -d $DB -c "EXPLAIN (ANALYZE, TIMING OFF, SUMMARY ON) SELECT pg_gen_query_exec('customers older than 0')" | grep -E "ProjectSet|Execution"
+
+echo ""
+[ $FAILED -eq 0 ] && echo "=== ALL TESTS PASSED ===" || echo "=== $FAILED TESTS FAILED ==="
+cd "$ORIG_DIR"
@@ -0,0 +1,75 @@
+#!/bin/bash
+
+# pg_stat_gen_query: runs questions against tests/12_streaming/mock_provider.py and
+# checks the counters, histograms and reset. No real AI calls.
+# Needs shared_preload_libraries (per-backend statistics end with each psql call) and
+# superuser (pg_gen_query.openai_base_url, pg_stat_gen_query_reset).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+N=${N:-10}
+PORT=${PORT:-8089}
+
+python3 ../12_streaming/mock_provider.py --port $PORT --ttft 50 --token-ms 0 &
+MOCK_PID=$!
+trap "kill $MOCK_PID 2>/dev/null" EXIT
+sleep 1
+
+psql -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null
+export PGOPTIONS="-c ai.openai_api_key=mock -c pg_gen_query.openai_base_url=http://127.0.0.1:$PORT"
+
+PASSED=0
+FAILED=0
+check()
+{
+  local name="$1" expected="$2" got="$3"
+  if [ "$got" == "$expected" ]; then
+    echo "[PASS] $name"
+    PASSED=$((PASSED + 1))
+  else
+    echo "[FAIL] $name: expected '$expected', got '$got'"
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+psql -d $DB -q -c "SELECT pg_stat_gen_query_reset(); SELECT pg_gen_query_cache_reset();"
+
+# N distinct questions, each asked twice: the second round is answered from the result cache
+psql -d $DB -q -t -A > /dev/null <<SQL
+SELECT pg_gen_query('Show customers older than ' || i) FROM generate_series(1, $N) i;
+SELECT pg_gen_query('Show customers older than ' || i) FROM generate_series(1, $N) i;
+SQL
+
+stats="SELECT * FROM pg_stat_gen_query WHERE datname = current_database() AND provider = 'openai'"
+got=$(psql -d $DB -t -A -c "SELECT calls, errors FROM ($stats) s")
+check "calls counted" "$((2 * N))|0" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT cache_hits FROM ($stats) s")
+check "cache hits counted" "$N" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT (SELECT sum(x) FROM unnest(schema_load_hist) x) = calls AND
+                                   (SELECT sum(x) FROM unnest(provider_hist) x) = calls - cache_hits
+                            FROM ($stats) s")
+check "histograms add up to the calls" "t" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT provider_ms / (calls - cache_hits) >= 50 AND prompt_bytes > 0 AND response_bytes > 0 FROM ($stats) s")
+check "provider latency and bytes" "t" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT prompt_tokens > 0 AND completion_tokens > 0 FROM ($stats) s")
+check "provider token counts" "t" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT regen_schema_cache(); SELECT regens >= 1, errors, last_ms > 0 FROM pg_stat_gen_query_regen")
+check "regeneration counted" "
+t|0|t" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT pg_stat_gen_query_reset(); SELECT coalesce(sum(calls), 0) FROM pg_stat_gen_query; SELECT regens FROM pg_stat_gen_query_regen")
+check "reset" "
+0
+0" "$got"
+
+echo ""
+[ $FAILED -eq 0 ] && echo "=== ALL TESTS PASSED ===" || echo "=== $FAILED TESTS FAILED ==="
+cd "$ORIG_DIR"
@@ -0,0 +1,86 @@
+-- ============================================================
+-- Synthetic catalog for the schema pipeline benchmark
+-- Run with: psql -v db=<name> -v tables=<n> -v columns=<n> -v fks=<n> -v indexes=<n>
+--                -v comments=<n> -v wide=<n> -v wide_columns=<n> -f init_state.sql postgres
+--   tables        regular tables
+--   columns       extra columns per table (besides id and the FK columns)
+--   fks           foreign keys per table, each to one of the previous tables
+--   indexes       indexes per table, on the extra columns
+--   comments      column comments per table (plus one table comment when > 0)
+--   wide          additional wide tables with wide_columns columns each (max 1600)
+-- ============================================================
+
+DROP DATABASE IF EXISTS :db;
+CREATE DATABASE :db;
+
+\connect :db
+
+SELECT set_config('synthetic.tables', :'tables', false),
+       set_config('synthetic.columns', :'columns', false),
+       set_config('synthetic.fks', :'fks', false),
+       set_config('synthetic.indexes', :'indexes', false),
+       set_config('synthetic.comments', :'comments', false),
+       set_config('synthetic.wide', :'wide', false),
+       set_config('synthetic.wide_columns', :'wide_columns', false);
+
+-- Tables are created before the extension so the event trigger doesn't fire for each one.
+-- Commit in batches to stay within max_locks_per_transaction.
+DO $$
+DECLARE
+  n int := current_setting('synthetic.tables')::int;
+  ncols int := current_setting('synthetic.columns')::int;
+  nfks int := current_setting('synthetic.fks')::int;
+  nindexes int := current_setting('synthetic.indexes')::int;
+  ncomments int := current_setting('synthetic.comments')::int;
+  types text[] := ARRAY['int', 'bigint', 'text', 'numeric(12,2)', 'timestamptz', 'boolean', 'varchar(64)', 'date'];
+  cols text;
+BEGIN
+  FOR i IN 1..n LOOP
+    cols := 'id bigserial PRIMARY KEY';
+    FOR c IN 1..ncols LOOP
+      cols := cols || format(', c%s %s%s', c, types[1 + (i + c) % array_length(types, 1)],
+                             CASE WHEN c % 3 = 0 THEN ' NOT NULL DEFAULT ' ||
+                               CASE types[1 + (i + c) % array_length(types, 1)]
+                                 WHEN 'text' THEN '''''' WHEN 'varchar(64)' THEN ''''''
+                                 WHEN 'timestamptz' THEN 'now()' WHEN 'date' THEN 'current_date'
+                                 WHEN 'boolean' THEN 'false' ELSE '0' END
+                             ELSE '' END);
+    END LOOP;
+    FOR f IN 1..LEAST(nfks, i - 1) LOOP
+      cols := cols || format(', ref%s_id bigint REFERENCES t_%s', f, 1 + (i * 7 + f * 13) % (i - 1));
+    END LOOP;
+    EXECUTE format('CREATE TABLE t_%s (%s)', i, cols);
+
+    FOR x IN 1..LEAST(nindexes, ncols) LOOP
+      EXECUTE format('CREATE INDEX ON t_%s (c%s)', i, x);
+    END LOOP;
+    IF ncomments > 0 THEN
+      EXECUTE format('COMMENT ON TABLE t_%s IS %L', i, 'Synthetic table number ' || i || ' of the benchmark catalog');
+    END IF;
+    FOR x IN 1..LEAST(ncomments, ncols) LOOP
+      EXECUTE format('COMMENT ON COLUMN t_%s.c%s IS %L', i, x, 'Synthetic column ' || x || ', kept for reporting');
+    END LOOP;
+    IF i % 500 = 0 THEN
+      COMMIT;
+    END IF;
+  END LOOP;
+END
+$$;
+
+DO $$
+DECLARE
+  n int := current_setting('synthetic.wide')::int;
+  ncols int := LEAST(current_setting('synthetic.wide_columns')::int, 1599);
+  cols text;
+BEGIN
+  FOR i IN 1..n LOOP
+    SELECT 'id bigserial PRIMARY KEY' || string_agg(format(', w%s %s', c, CASE WHEN c % 2 = 0 THEN 'int' ELSE 'text' END), '')
+    INTO cols
+    FROM generate_series(1, ncols) c;
+    EXECUTE format('CREATE TABLE wide_%s (%s)', i, cols);
+    COMMIT;
+  END LOOP;
+END
+$$;
+
+CREATE EXTENSION pg_gen_query;
@@ -0,0 +1,83 @@
+#!/bin/bash
+
+# Schema pipeline benchmark: builds synthetic catalogs (see init_state.sql), times each
+# phase of a full regen_schema_cache() from pg_stat_gen_query_regen, the schema load of
+# a new backend, and the backend's memory high-water mark. No AI calls.
+# Needs superuser (pg_stat_gen_query_reset, pg_read_file of /proc for VmHWM) and a
+# server on this machine for the memory numbers (reported as null otherwise).
+#
+# Usage: bash run.sh [config...]   or   make bench [BENCH_CONFIGS="..."]
+# A config is a comma-separated list overriding the defaults below, e.g.
+#   tables=5000,columns=20,fks=3   wide=20,wide_columns=1500,tables=100
+# Every run appends one JSON object per line to results.jsonl (tagged with the commit,
+# ignored by git), so results of different commits can be compared; RESULTS=<file>
+# writes them elsewhere.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+CONFIGS=${@:-"tables=1000 tables=10000 tables=1000,columns=40,fks=4,indexes=4,comments=10 tables=200,wide=20,wide_columns=1500"}
+RUNS=${RUNS:-3}
+DB=${DB:-schema_bench}
+REV=$(git -C "$SCRIPT_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+RESULTS=${RESULTS:-$SCRIPT_DIR/results.jsonl}
+
+for CONFIG in $CONFIGS; do
+  tables=1000 columns=6 fks=1 indexes=1 comments=1 wide=0 wide_columns=1000
+  for kv in ${CONFIG//,/ }; do
+    case "${kv%%=*}" in
+      tables | columns | fks | indexes | comments | wide | wide_columns) declare "${kv%%=*}=${kv#*=}" ;;
+      *) echo "unknown setting: $kv" >&2; exit 1 ;;
+    esac
+  done
+  echo "=== tables=$tables columns=$columns fks=$fks indexes=$indexes comments=$comments wide=$wide wide_columns=$wide_columns ==="
+
+  psql -q -v ON_ERROR_STOP=1 -v db=$DB -v tables=$tables -v columns=$columns -v fks=$fks -v indexes=$indexes \
+    -v comments=$comments -v wide=$wide -v wide_columns=$wide_columns -f init_state.sql postgres > /dev/null || exit 1
+
+  CONFIG_JSON="{\"tables\": $tables, \"columns\": $columns, \"fks\": $fks, \"indexes\": $indexes, \"comments\": $comments, \"wide\": $wide, \"wide_columns\": $wide_columns}"
+
+  for RUN in $(seq 1 $RUNS); do
+    # a new backend per run: cold catalog caches, and its own memory high-water mark
+    REGEN=$(psql -d $DB -X -q -t -A -v ON_ERROR_STOP=1 <<SQL
+-- VmHWM of this backend, NULL where /proc can't be read
+CREATE FUNCTION pg_temp.hwm_kb() RETURNS bigint LANGUAGE plpgsql AS \$\$
+BEGIN
+  RETURN (regexp_match(pg_read_file('/proc/' || pg_backend_pid() || '/status'), 'VmHWM:\s+(\d+)'))[1]::bigint;
+EXCEPTION WHEN OTHERS THEN
+  RETURN NULL;
+END
+\$\$;
+SELECT pg_stat_gen_query_reset();
+SELECT coalesce(pg_temp.hwm_kb()::text, 'null') AS hwm_before \gset
+SELECT regen_schema_cache();
+SELECT json_build_object('total_ms', r.total_ms, 'catalog_ms', r.catalog_ms, 'render_ms', r.render_ms,
+                         'serialize_ms', r.serialize_ms, 'write_ms', r.write_ms, 'publish_ms', r.publish_ms,
+                         'hints_ms', r.hints_ms,
+                         'schema_bytes', i.bytes, 'hwm_before_kb', :hwm_before::bigint, 'hwm_after_kb', pg_temp.hwm_kb())
+FROM pg_stat_gen_query_regen r, pg_gen_query_schema_info() i;
+SQL
+) || exit 1
+    REGEN=$(echo "$REGEN" | grep '^{')
+
+    # schema load in a new backend: the first call loads (or attaches) the snapshot
+    LOAD=$(psql -d $DB -X -q -t -A <<SQL | grep -oE 'Time: [0-9.]+' | awk '{print $2}' | paste -sd' '
+\timing on
+SELECT bytes FROM pg_gen_query_schema_info();
+SELECT bytes FROM pg_gen_query_schema_info();
+SQL
+)
+    read -r LOAD_COLD LOAD_WARM <<< "$LOAD"
+
+    LINE="{\"rev\": \"$REV\", \"at\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\", \"config\": $CONFIG_JSON, \"run\": $RUN, \"regen\": $REGEN, \"load_cold_ms\": ${LOAD_COLD:-null}, \"load_warm_ms\": ${LOAD_WARM:-null}}"
+    echo "$LINE" >> "$RESULTS"
+    echo "run $RUN: regen $REGEN, schema load ${LOAD_COLD:-?} ms cold / ${LOAD_WARM:-?} ms warm"
+  done
+
+  psql -q -c "DROP DATABASE $DB;" postgres
+done
+
+echo ""
+echo "results appended to $RESULTS"
+cd "$ORIG_DIR"
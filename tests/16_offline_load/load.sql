@@ -0,0 +1,4 @@
+-- One question per transaction, drawn from :questions distinct ones (the mock provider
+-- answers each with its own SQL). Failed calls count as transactions, not aborts.
+\set n random(1, :questions)
+SELECT offline_load_ask('Show customers older than ' || :n);
@@ -0,0 +1,128 @@
+#!/bin/bash
+
+# Offline end-to-end load: pgbench drives pg_gen_query against the local mock provider
+# (tests/12_streaming/mock_provider.py) at increasing client counts and reports
+# throughput, latency percentiles and the per-phase breakdown from pg_stat_gen_query.
+# No network or AI credits needed, so the extension's own overhead shows up clearly:
+# it is the transaction latency minus the provider phase.
+# Needs superuser, shared_preload_libraries (for the shared statistics) and
+# max_connections above the largest client count.
+#
+# Settings (environment):
+#   CLIENTS="1 10 50 100 200"  client counts to run
+#   DURATION=30                seconds per client count
+#   PROVIDER=openai            or anthropic (the server must then have no OpenAI key)
+#   LATENCY=lognormal:300:0.5  time to first token (see mock_provider.py)
+#   TOKEN_MS=0                 time per further token
+#   ERROR_RATE=0               fraction of failed provider requests
+#   STREAMING=off              pg_gen_query.streaming
+#   CACHE=off                  on: repeated questions are answered from the result cache
+#   QUESTIONS=1000             distinct questions
+# Every client count appends one JSON object to results.jsonl, tagged with the commit.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=simple_test
+PORT=${PORT:-8089}
+CLIENTS=${CLIENTS:-"1 10 50 100 200"}
+DURATION=${DURATION:-30}
+PROVIDER=${PROVIDER:-openai}
+LATENCY=${LATENCY:-lognormal:300:0.5}
+TOKEN_MS=${TOKEN_MS:-0}
+ERROR_RATE=${ERROR_RATE:-0}
+STREAMING=${STREAMING:-off}
+CACHE=${CACHE:-off}
+QUESTIONS=${QUESTIONS:-1000}
+REV=$(git -C "$SCRIPT_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+RESULTS=${RESULTS:-$SCRIPT_DIR/results.jsonl}
+LOGDIR=$(mktemp -d)
+
+python3 ../12_streaming/mock_provider.py --port $PORT --latency $LATENCY --token-ms $TOKEN_MS \
+  --error-rate $ERROR_RATE --seed 1 &
+MOCK_PID=$!
+trap "kill $MOCK_PID 2>/dev/null; rm -rf $LOGDIR" EXIT
+sleep 1
+
+psql -q -v ON_ERROR_STOP=1 -f ../02_simple/init_state.sql postgres > /dev/null || exit 1
+psql -q -v ON_ERROR_STOP=1 -d $DB <<'SQL' || exit 1
+CREATE FUNCTION offline_load_ask(question text) RETURNS boolean
+LANGUAGE plpgsql AS $$
+BEGIN
+  PERFORM pg_gen_query(question);
+  RETURN true;
+EXCEPTION WHEN OTHERS THEN
+  RETURN false;
+END
+$$;
+SQL
+
+if [ "$PROVIDER" == "anthropic" ]; then
+  SETTINGS="-c ai.anthropic_api_key=mock -c pg_gen_query.anthropic_base_url=http://127.0.0.1:$PORT"
+else
+  SETTINGS="-c ai.openai_api_key=mock -c pg_gen_query.openai_base_url=http://127.0.0.1:$PORT"
+fi
+SETTINGS="$SETTINGS -c pg_gen_query.streaming=$STREAMING"
+[ "$CACHE" == "off" ] && SETTINGS="$SETTINGS -c pg_gen_query.cache_ttl=0"
+export PGOPTIONS="$SETTINGS"
+
+printf "%8s %10s %9s %9s %9s %9s | %11s %9s %9s %9s %9s\n" clients tps p50_ms p95_ms p99_ms errors \
+  schema_ms prompt_ms provider_ms post_ms overhead_ms
+for C in $CLIENTS; do
+  J=$(( C < $(nproc) ? C : $(nproc) ))
+  psql -q -d $DB -c "SELECT pg_stat_gen_query_reset(); SELECT pg_gen_query_cache_reset();" > /dev/null
+  rm -f $LOGDIR/pgbench_log.*
+
+  pgbench -n -c $C -j $J -T $DURATION -D questions=$QUESTIONS -f load.sql \
+    -l --log-prefix=$LOGDIR/pgbench_log $DB > $LOGDIR/pgbench.out 2>&1
+  TPS=$(grep -oE 'tps = [0-9.]+' $LOGDIR/pgbench.out | tail -1 | awk '{print $3}')
+
+  # per-transaction latencies (third field, microseconds) from the pgbench logs
+  LATENCIES=$(cat $LOGDIR/pgbench_log.* | python3 -c '
+import sys, json
+lat = sorted(int(line.split()[2]) / 1000.0 for line in sys.stdin if line.strip())
+def pct(p):
+    return round(lat[min(len(lat) - 1, int(p / 100.0 * len(lat)))], 1) if lat else None
+print(json.dumps({"transactions": len(lat), "mean_ms": round(sum(lat) / len(lat), 1) if lat else None,
+                  "p50_ms": pct(50), "p95_ms": pct(95), "p99_ms": pct(99)}))')
+
+  PHASES=$(psql -d $DB -X -t -A <<SQL
+SELECT json_build_object(
+  'calls', coalesce(sum(calls), 0), 'errors', coalesce(sum(errors), 0), 'cache_hits', coalesce(sum(cache_hits), 0),
+  'schema_load_ms', round((sum(schema_load_ms) / nullif(sum(calls), 0))::numeric, 3),
+  'prompt_ms', round((sum(prompt_ms) / nullif(sum(calls), 0))::numeric, 3),
+  'provider_ms', round((sum(provider_ms) / nullif(sum(calls - cache_hits), 0))::numeric, 1),
+  'post_ms', round((sum(post_ms) / nullif(sum(calls - cache_hits), 0))::numeric, 3),
+  'provider_ms_per_call', round((sum(provider_ms) / nullif(sum(calls), 0))::numeric, 3))
+FROM pg_stat_gen_query WHERE datname = current_database();
+SQL
+)
+
+  LINE=$(python3 -c '
+import sys, json
+lat, ph = json.loads(sys.argv[1]), json.loads(sys.argv[2])
+overhead = None
+if lat["mean_ms"] is not None and ph.get("provider_ms_per_call") is not None:
+    overhead = round(lat["mean_ms"] - ph["provider_ms_per_call"], 2)
+print(json.dumps({"rev": sys.argv[3], "at": sys.argv[4], "clients": int(sys.argv[5]), "duration_s": int(sys.argv[6]),
+                  "provider": sys.argv[7], "latency": sys.argv[8], "error_rate": float(sys.argv[9]),
+                  "streaming": sys.argv[10], "cache": sys.argv[11],
+                  "tps": float(sys.argv[12]) if sys.argv[12] else None,
+                  "latency_ms": lat, "phases": ph, "overhead_ms": overhead}))' \
+    "$LATENCIES" "$PHASES" "$REV" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" $C $DURATION $PROVIDER $LATENCY $ERROR_RATE \
+    $STREAMING $CACHE "$TPS")
+  echo "$LINE" >> "$RESULTS"
+
+  echo "$LINE" | python3 -c '
+import sys, json
+r = json.loads(sys.stdin.read()); l = r["latency_ms"]; p = r["phases"]
+f = lambda v: "-" if v is None else v
+print("%8d %10s %9s %9s %9s %9s | %11s %9s %9s %9s %9s" % (r["clients"], f(r["tps"]), f(l["p50_ms"]), f(l["p95_ms"]),
+      f(l["p99_ms"]), f(p.get("errors")), f(p.get("schema_load_ms")), f(p.get("prompt_ms")), f(p.get("provider_ms")),
+      f(p.get("post_ms")), f(r["overhead_ms"])))'
+done
+
+echo ""
+echo "results appended to $RESULTS"
+cd "$ORIG_DIR"
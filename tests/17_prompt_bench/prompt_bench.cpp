@@ -0,0 +1,125 @@
+// Per-call cost of assembling the prompt for a large schema: allocations and bytes
+// allocated (every copy of the schema lands in a new allocation) per call, and time.
+// Builds against prompt_prefix.cpp and schema_encode.cpp only; no server needed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include "prompt_prefix.h"
+
+static size_t allocs = 0;
+static size_t alloc_bytes = 0;
+
+void *operator new(size_t size)
+{
+  allocs++;
+  alloc_bytes += size;
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+// Stand-in for ai::GenerateOptions, which takes the prompt by value
+struct Options
+{
+  std::string model;
+  std::string prompt;
+  std::optional<std::string> system;
+};
+
+static std::string schema_cache;
+
+static std::string get_schema_by_value()
+{
+  return schema_cache;
+}
+
+// The original assembly: the schema returned by value, chained operator+, then copied
+static size_t before(const std::string &query)
+{
+  std::string full_prompt =
+      "You are an expert SQL generator. "
+      "Given a database schema and a natural language query, "
+      "return ONLY an SQL query satisying ALL the conditions. "
+      "If not mentioned in the schema, assume a column is not the primary key, not unique, nullable, and has no checks.\n"
+      "Schema: `" +
+      get_schema_by_value() +
+      "`\nQuery: " +
+      query;
+  Options options;
+  options.prompt = full_prompt;
+  return options.prompt.size();
+}
+
+// The prefix rendered per call with one allocation, as for a pruned schema
+static size_t rendered(const std::string &query)
+{
+  PromptPrefix system = render_prompt_prefix(SCHEMA_ENCODING_FLAT, schema_cache);
+  std::string prompt;
+  prompt.reserve(7 + query.size());
+  prompt.append("Query: ");
+  prompt.append(query);
+  Options options;
+  options.system = *system;
+  options.prompt = prompt;
+  return options.system->size() + options.prompt.size();
+}
+
+// The prefix shared across calls of a generation: only the copy the SDK needs is left
+static size_t shared(const std::string &query)
+{
+  PromptPrefix system = prompt_prefix_for_generation(1, 0, SCHEMA_ENCODING_FLAT, schema_cache);
+  std::string prompt;
+  prompt.reserve(7 + query.size());
+  prompt.append("Query: ");
+  prompt.append(query);
+  Options options;
+  options.system = *system;
+  options.prompt = prompt;
+  return options.system->size() + options.prompt.size();
+}
+
+static void run(const char *name, size_t (*assemble)(const std::string &), int calls)
+{
+  const std::string query = "total refund amount per customer last month, excluding cancelled orders";
+  size_t sink = assemble(query); // warm-up (and the shared prefix's one rendering)
+  size_t a0 = allocs, b0 = alloc_bytes;
+  auto start = std::chrono::steady_clock::now();
+  for (int k = 0; k < calls; ++k)
+    sink += assemble(query);
+  auto end = std::chrono::steady_clock::now();
+  printf("%-10s %6.1f allocs/call  %9.2f MB allocated/call  %8.1f us/call  (%zu)\n", name,
+         (double)(allocs - a0) / calls, (double)(alloc_bytes - b0) / calls / (1 << 20),
+         std::chrono::duration<double, std::micro>(end - start).count() / calls, sink % 10);
+}
+
+int main(int argc, char **argv)
+{
+  size_t mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5;
+  const int calls = 200;
+
+  schema_cache.reserve(mb << 20);
+  for (size_t i = 0; schema_cache.size() < (mb << 20); ++i)
+    schema_cache.append("{\"schema\":\"public\",\"table\":\"table_" + std::to_string(i) +
+                        "\",\"columns\":[{\"name\":\"id\",\"type\":\"integer\",\"pk\":true},"
+                        "{\"name\":\"amount\",\"type\":\"numeric\"},{\"name\":\"created_at\",\"type\":\"timestamptz\"}]}\n");
+  printf("schema: %zu bytes, %d calls\n", schema_cache.size(), calls);
+
+  run("before", before, calls);
+  run("rendered", rendered, calls);
+  run("shared", shared, calls);
+  return 0;
+}
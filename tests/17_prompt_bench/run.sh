@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Microbenchmark for prompt assembly on a 5 MB schema: allocations, bytes allocated and
+# time per call for the original assembly, a per-call rendered prefix and the shared one.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+MB=${MB:-5}
+
+${CXX:-g++} -std=c++17 -O2 -I../.. -o prompt_bench prompt_bench.cpp ../../prompt_prefix.cpp ../../schema_encode.cpp || exit 1
+./prompt_bench $MB | tee prompt_bench.log
+
+cd "$ORIG_DIR"
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Snapshot file format: header, sections, checksum and generation stamp, and rejection
+# of damaged, truncated and old-format images. No server needed.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+${CXX:-g++} -std=c++17 -O2 -I../.. -o snapshot_check snapshot_check.cpp \
+  ../../schema_snapshot.cpp ../../schema_encode.cpp ../../schema_prune.cpp || exit 1
+./snapshot_check
+STATUS=$?
+
+cd "$ORIG_DIR"
+exit $STATUS
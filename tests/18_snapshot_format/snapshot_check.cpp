@@ -0,0 +1,108 @@
+// Checks of the snapshot image format: header, sections, checksum and generation stamp,
+// statistics hints and swapping them, and that damaged, truncated and old-format images
+// are rejected.
+// Builds against schema_snapshot.cpp, schema_encode.cpp and schema_prune.cpp only; no server needed.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "schema_encode.h"
+#include "schema_prune.h"
+#include "schema_snapshot.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  printf("[%s] %s\n", ok ? "PASS" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static std::string build_image()
+{
+  SchemaSnapshotBuilder builder(SCHEMA_ENCODING_COMPACT);
+  const char *tables[] = {"orders", "customers", "products"};
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    TableModel t;
+    t.oid = 16384 + i;
+    t.schema = "public";
+    t.table = tables[i];
+    ColumnModel &col = t.add_column(1);
+    col.name = "id";
+    col.type = "integer";
+    t.finalize();
+    std::string fragment;
+    encode_table(SCHEMA_ENCODING_COMPACT, t, fragment);
+    std::string hints = i == 0 ? "orders ~2.1M rows\n" : "";
+    builder.add_table(t.oid, t.schema, t.table, fragment, schema_table_terms(t), hints);
+  }
+  return builder.finish();
+}
+
+int main()
+{
+  std::string image = build_image();
+  SchemaSnapshotView view;
+
+  check(image.compare(0, 4, "PGQS") == 0, "image starts with the magic");
+  check(schema_snapshot_verify(image), "fresh image verifies");
+  check(view.open(image) && view.table_count() == 3, "fresh image opens with its tables");
+  check(view.table_name(0) == "customers" && view.table_fragment(0).find("customers") != std::string_view::npos,
+        "sections point at the right bytes");
+  check(view.encoding() == SCHEMA_ENCODING_COMPACT, "encoding recorded");
+  check(schema_snapshot_generation(image) == 0, "generation unset until written");
+
+  schema_snapshot_set_generation(image, 42);
+  check(schema_snapshot_generation(image) == 42, "generation stamped");
+  check(schema_snapshot_verify(image), "stamping keeps the checksum valid");
+
+  std::string damaged = image;
+  damaged[damaged.size() / 2] ^= 0x20;
+  check(!schema_snapshot_verify(damaged), "flipped bit fails the checksum");
+
+  damaged = image;
+  damaged[SCHEMA_SNAPSHOT_HEADER_SIZE - 1] ^= 0x01;
+  check(!schema_snapshot_verify(damaged), "changed section table fails the checksum");
+
+  std::string truncated = image.substr(0, image.size() - 10);
+  check(!schema_snapshot_verify(truncated), "truncated image fails the checksum");
+  truncated = image.substr(0, SCHEMA_SNAPSHOT_HEADER_SIZE + 8);
+  check(!view.open(truncated), "image cut inside a section does not open");
+  check(!view.open(image.substr(0, 10)), "image cut inside the header does not open");
+
+  check(view.open(image) && view.table_hints(1) == "orders ~2.1M rows\n" && view.table_hints(0).empty() &&
+            view.hints() == "orders ~2.1M rows\n",
+        "hints follow their tables");
+  std::vector<std::string> hints = {"customers ~90k rows\n", "orders ~2.2M rows\n", ""};
+  std::string refreshed = schema_snapshot_with_hints(view, hints);
+  SchemaSnapshotView refreshed_view;
+  check(schema_snapshot_verify(refreshed) && refreshed_view.open(refreshed) &&
+            refreshed_view.hints() == "customers ~90k rows\norders ~2.2M rows\n" &&
+            refreshed_view.table_hints(1) == "orders ~2.2M rows\n",
+        "hints swapped");
+  size_t first;
+  check(refreshed_view.text() == view.text() && refreshed_view.table_name(1) == view.table_name(1) &&
+            refreshed_view.find_term("orders", first) == view.find_term("orders", first) &&
+            refreshed.size() - image.size() == hints[0].size(),
+        "swapping hints keeps the schema");
+
+  std::string old_version = image;
+  old_version[4] = 1;
+  check(!schema_snapshot_verify(old_version) && !view.open(old_version), "other format version rejected");
+
+  // the previous format started with the table count
+  std::string legacy(12, '\0');
+  legacy[0] = 3;
+  legacy += "{\"tables\":[]}";
+  check(!schema_snapshot_verify(legacy) && !view.open(legacy), "pre-header image rejected");
+
+  printf("\n");
+  if (failures == 0)
+    printf("=== ALL TESTS PASSED ===\n");
+  else
+    printf("=== %d TESTS FAILED ===\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# Per-database schema snapshots: two databases with different schemas each get their own
+# snapshot, a small pg_gen_query.schema_cache_memory evicts the least recently used one
+# (and it is reloaded from its file on the next use), and pg_gen_query.search_path_scope
+# limits the schema to the search_path. No AI calls.
+# Needs shared_preload_libraries and superuser (ALTER SYSTEM).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB1=multi_db_test_1
+DB2=multi_db_test_2
+
+psql -v ON_ERROR_STOP=1 -q postgres <<SQL
+DROP DATABASE IF EXISTS $DB1;
+DROP DATABASE IF EXISTS $DB2;
+CREATE DATABASE $DB1;
+CREATE DATABASE $DB2;
+SQL
+psql -v ON_ERROR_STOP=1 -q -d $DB1 <<SQL
+CREATE EXTENSION pg_gen_query;
+CREATE TABLE invoices (id serial PRIMARY KEY, amount numeric);
+CREATE SCHEMA archive;
+CREATE TABLE archive.old_invoices (id serial PRIMARY KEY, amount numeric);
+SELECT regen_schema_cache();
+SQL
+psql -v ON_ERROR_STOP=1 -q -d $DB2 <<SQL
+CREATE EXTENSION pg_gen_query;
+CREATE TABLE shipments (id serial PRIMARY KEY, carrier text);
+SELECT regen_schema_cache();
+SQL
+
+PASSED=0
+FAILED=0
+check()
+{
+  local name="$1" expected="$2" got="$3"
+  if [ "$got" == "$expected" ]; then
+    echo "[PASS] $name"
+    PASSED=$((PASSED + 1))
+  else
+    echo "[FAIL] $name: expected '$expected', got '$got'"
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+has()
+{
+  psql -d "$1" -t -A -c "SELECT position('$2' in pg_gen_query_schema_for('invoices')) > 0"
+}
+
+check "first database sees its tables" "t" "$(has $DB1 invoices)"
+check "first database does not see the second's" "f" "$(has $DB1 shipments)"
+check "second database sees its tables" "t" "$(has $DB2 shipments)"
+check "second database does not see the first's" "f" "$(has $DB2 invoices)"
+
+got=$(psql -d postgres -t -A -c "SELECT count(*) FROM pg_gen_query_schema_snapshots() s
+  JOIN pg_database d ON d.oid = s.dbid WHERE d.datname IN ('$DB1', '$DB2')")
+check "both snapshots resident" "2" "$got"
+
+# a budget smaller than both snapshots keeps only the most recently published or used one
+psql -q -d postgres -c "ALTER SYSTEM SET pg_gen_query.schema_cache_memory = 1; SELECT pg_reload_conf();" > /dev/null
+sleep 1
+psql -q -d $DB1 -c "SELECT regen_schema_cache();" > /dev/null
+got=$(psql -d postgres -t -A -c "SELECT d.datname FROM pg_gen_query_schema_snapshots() s
+  JOIN pg_database d ON d.oid = s.dbid WHERE d.datname IN ('$DB1', '$DB2')")
+check "least recently used snapshot evicted" "$DB1" "$got"
+check "evicted database reloads from its file" "t" "$(has $DB2 shipments)"
+psql -q -d postgres -c "ALTER SYSTEM RESET pg_gen_query.schema_cache_memory; SELECT pg_reload_conf();" > /dev/null
+
+# search_path scope
+got=$(PGOPTIONS="-c pg_gen_query.search_path_scope=on -c search_path=public" has $DB1 old_invoices)
+check "scope leaves out schemas off the search_path" "f" "$got"
+got=$(PGOPTIONS="-c pg_gen_query.search_path_scope=on -c search_path=public,archive" has $DB1 old_invoices)
+check "scope follows the search_path" "t" "$got"
+check "without scope every schema is sent" "t" "$(has $DB1 old_invoices)"
+
+echo ""
+[ $FAILED -eq 0 ] && echo "=== ALL TESTS PASSED ===" || echo "=== $FAILED TESTS FAILED ==="
+cd "$ORIG_DIR"
@@ -0,0 +1,84 @@
+#!/bin/bash
+
+# Planner statistics hints: row counts and value distributions appear in the schema sent
+# to the model, values only for columns PUBLIC may read, regen_schema_stats() refreshes them without a regeneration, and a refresh
+# that changes no hint keeps the schema generation. No AI calls.
+# Needs superuser (ALTER SYSTEM).
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=stats_hints_test
+
+psql -v ON_ERROR_STOP=1 -q postgres <<SQL
+DROP DATABASE IF EXISTS $DB;
+CREATE DATABASE $DB;
+ALTER SYSTEM SET pg_gen_query.stats_hints = on;
+SELECT pg_reload_conf();
+SQL
+sleep 1
+psql -v ON_ERROR_STOP=1 -q -d $DB <<SQL
+CREATE EXTENSION pg_gen_query;
+CREATE TABLE orders (id serial PRIMARY KEY, status text, customer_id int, coupon text);
+INSERT INTO orders (status, customer_id, coupon)
+  SELECT (ARRAY['paid', 'pending', 'shipped'])[1 + i % 3], i % 500, CASE WHEN i % 10 = 0 THEN 'SAVE10' END
+  FROM generate_series(1, 50000) i;
+ANALYZE orders;
+SELECT regen_schema_cache();
+SQL
+
+PASSED=0
+FAILED=0
+check()
+{
+  local name="$1" expected="$2" got="$3"
+  if [ "$got" == "$expected" ]; then
+    echo "[PASS] $name"
+    PASSED=$((PASSED + 1))
+  else
+    echo "[FAIL] $name: expected '$expected', got '$got'"
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+hints()
+{
+  psql -d $DB -t -A -c "SELECT pg_gen_query_schema_for('orders by status')" | grep '^orders '
+}
+generation()
+{
+  psql -d $DB -t -A -c "SELECT generation FROM pg_gen_query_schema_info()"
+}
+
+echo "Hints: $(hints)"
+check "no values of a column PUBLIC cannot read" "t" "$(hints | grep -q 'status ~3 distinct' && echo t || echo f)"
+check "no values of a mostly null column PUBLIC cannot read" "f" "$(hints | grep -q 'SAVE10' && echo t || echo f)"
+
+psql -q -d $DB -c "GRANT SELECT ON orders TO PUBLIC; ALTER TABLE orders ENABLE ROW LEVEL SECURITY;
+  SELECT regen_schema_stats();" > /dev/null
+check "no values of a table with row-level security" "t" "$(hints | grep -q 'status ~3 distinct' && echo t || echo f)"
+
+psql -q -d $DB -c "ALTER TABLE orders DISABLE ROW LEVEL SECURITY; SELECT regen_schema_stats();" > /dev/null
+echo "Hints: $(hints)"
+check "row count" "t" "$(hints | grep -q '^orders ~50k rows' && echo t || echo f)"
+check "values of a low-cardinality column" "t" "$(hints | grep -q "status 3 values ('[a-z]*','[a-z]*','[a-z]*')" && echo t || echo f)"
+check "distinct count" "t" "$(hints | grep -q 'customer_id ~500 distinct' && echo t || echo f)"
+check "mostly null column" "t" "$(hints | grep -q 'coupon 1 value (.SAVE10.), 90% null' && echo t || echo f)"
+
+# unchanged statistics: no new generation
+before=$(generation)
+psql -q -d $DB -c "ANALYZE orders; SELECT regen_schema_stats();" > /dev/null
+check "refresh without changes keeps the generation" "$before" "$(generation)"
+
+# changed statistics: only the hints are replaced
+psql -q -d $DB -c "INSERT INTO orders (status, customer_id) SELECT 'refunded', i FROM generate_series(1, 150000) i;
+  ANALYZE orders; SELECT regen_schema_stats();" > /dev/null
+check "refresh publishes a new generation" "t" "$([ "$(generation)" != "$before" ] && echo t || echo f)"
+check "refreshed row count" "t" "$(hints | grep -q '^orders ~200k rows' && echo t || echo f)"
+
+psql -q -d postgres -c "ALTER SYSTEM RESET pg_gen_query.stats_hints; SELECT pg_reload_conf();" > /dev/null
+
+echo ""
+[ $FAILED -eq 0 ] && echo "=== ALL TESTS PASSED ===" || echo "=== $FAILED TESTS FAILED ==="
+cd "$ORIG_DIR"
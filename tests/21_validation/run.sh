@@ -0,0 +1,120 @@
+#!/bin/bash
+
+# Validation of generated SQL (pg_gen_query.validate) against canned answers of
+# tests/12_streaming/mock_provider.py: a cross join and a large sequential scan are
+# regenerated once within the thresholds (the mock answers any question carrying the
+# rejection with a primary key lookup), a DELETE, a nextval() call and a query that
+# does not plan are rejected twice, a rejected answer is not cached, and pg_gen_query_plan returns the accepted plan's cost.
+# Needs superuser (the pg_gen_query.validate settings). No real AI calls.
+
+ORIG_DIR="$(pwd)"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR"
+
+DB=validation_test
+ROWS=${ROWS:-200000}
+PORT=${PORT:-8089}
+RESPONSES=$(mktemp)
+
+# tried in order; anchored questions no longer match once the rejection is appended
+cat > $RESPONSES <<'JSON'
+[
+  {"match": "^pairs of orders$", "answer": "SELECT a.id, b.id FROM orders a, orders b;"},
+  {"match": "^big orders$", "answer": "SELECT * FROM orders WHERE amount > 990;"},
+  {"match": "^delete old orders", "answer": "DELETE FROM orders WHERE id < 10;"},
+  {"match": "^broken", "answer": "SELECT nosuch FROM orders;"},
+  {"match": "^next order id", "answer": "SELECT nextval('order_ids');"},
+  {"match": "^tiny orders$", "answer": "SELECT * FROM orders WHERE amount < 10;"},
+  {"match": "^fenced$", "answer": "```sql\nSELECT count(*) FROM orders WHERE id < 100;\n```\n\nThis counts the first orders."},
+  {"match": "rejected", "answer": "SELECT id, amount FROM orders WHERE id = 42;"}
+]
+JSON
+
+python3 ../12_streaming/mock_provider.py --port $PORT --ttft 10 --token-ms 0 --responses $RESPONSES &
+MOCK_PID=$!
+trap "kill $MOCK_PID 2>/dev/null; rm -f $RESPONSES" EXIT
+sleep 1
+
+psql -q postgres <<SQL
+DROP DATABASE IF EXISTS $DB;
+CREATE DATABASE $DB;
+SQL
+
+export PGOPTIONS="-c ai.openai_api_key=mock -c pg_gen_query.openai_base_url=http://127.0.0.1:$PORT"
+
+psql -d $DB -q -v ON_ERROR_STOP=1 <<SQL
+CREATE EXTENSION pg_gen_query;
+CREATE TABLE orders (id int PRIMARY KEY, amount int);
+CREATE SEQUENCE order_ids;
+INSERT INTO orders SELECT i, i % 1000 FROM generate_series(1, $ROWS) i;
+ANALYZE orders;
+SQL
+
+PASSED=0
+FAILED=0
+check()
+{
+  local name="$1" expected="$2" got="$3"
+  if [ "$got" == "$expected" ]; then
+    echo "[PASS] $name"
+    PASSED=$((PASSED + 1))
+  else
+    echo "[FAIL] $name: expected '$expected', got '$got'"
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+CHEAP="SELECT id, amount FROM orders WHERE id = 42;"
+
+got=$(psql -d $DB -t -A -c "SELECT pg_gen_query('pairs of orders')")
+check "not validated by default" "SELECT a.id, b.id FROM orders a, orders b;" "$got"
+
+# the cross join is cached now: the cached answer is validated too
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SET pg_gen_query.max_plan_cost = 1e6;
+  SELECT pg_gen_query('pairs of orders')")
+check "cross join over max_plan_cost is regenerated" "$CHEAP" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SELECT pg_gen_query('big orders')")
+check "sequential scan without a limit" "SELECT * FROM orders WHERE amount > 990;" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SET pg_gen_query.max_seqscan_rows = 10000;
+  SELECT pg_gen_query('big orders')")
+check "sequential scan over max_seqscan_rows is regenerated" "$CHEAP" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SELECT pg_gen_query('delete old orders')" 2>&1 |
+  grep -c "generated query rejected: it is not a SELECT")
+check "DELETE is rejected twice" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SELECT pg_gen_query('broken')" 2>&1 |
+  grep -c 'generated query rejected: column "nosuch" does not exist')
+check "planning error is rejected twice" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SELECT pg_gen_query('next order id')" 2>&1 |
+  grep -c "generated query rejected: it calls the volatile function nextval()")
+check "volatile function is rejected twice" "1" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT nextval('order_ids')")
+check "the rejected nextval() never ran" "1" "$got"
+
+# rejected (sequential scan) and regenerated: only the accepted answer is cached
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SET pg_gen_query.max_seqscan_rows = 10000;
+  SELECT pg_gen_query('tiny orders')")
+check "tiny orders regenerated" "$CHEAP" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT pg_gen_query('tiny orders')")
+check "only the accepted answer is cached" "$CHEAP" "$got"
+
+got=$(psql -d $DB -t -A -c "SELECT sql, total_cost > 0 FROM pg_gen_query_plan('fenced')")
+check "pg_gen_query_plan strips the fence and returns the cost" "SELECT count(*) FROM orders WHERE id < 100;|t" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.max_plan_cost = 1e6;
+  SELECT sql, total_cost < 1e6 FROM pg_gen_query_plan('pairs of orders')")
+check "pg_gen_query_plan returns the accepted plan's cost" "$CHEAP|t" "$got"
+
+got=$(psql -d $DB -t -A -c "SET pg_gen_query.validate = on; SET pg_gen_query.max_plan_cost = 1e6;
+  SELECT count(*) FROM pg_gen_query_exec('pairs of orders') AS t(id int, amount int)")
+check "pg_gen_query_exec runs the accepted query" "1" "$got"
+
+echo ""
+[ $FAILED -eq 0 ] && echo "=== ALL TESTS PASSED ===" || echo "=== $FAILED TESTS FAILED ==="
+cd "$ORIG_DIR"
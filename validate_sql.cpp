@@ -0,0 +1,510 @@
+extern "C"
+{
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_namespace.h"
+#include "catalog/pg_proc.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/parsenodes.h"
+#include "nodes/plannodes.h"
+#include "parser/parser.h"
+#include "parser/parsetree.h"
+#include "tcop/tcopprot.h"
+#include "utils/elog.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/syscache.h"
+}
+
+#include <string>
+#include "generate_sql.h"
+#include "sql_stream.h"
+#include "validate_sql.h"
+
+extern bool pg_gen_query_validate;
+extern double pg_gen_query_max_plan_cost;
+extern double pg_gen_query_max_seqscan_rows;
+
+// Plan nodes listed in the outline sent back to the model; the rest are counted
+#define VALIDATE_PLAN_MAX_LINES 40
+
+struct PlanWalk
+{
+  const PlannedStmt *stmt;
+  std::string outline;
+  int lines = 0;
+  int omitted = 0;
+  // the largest relation read sequentially beyond pg_gen_query.max_seqscan_rows
+  std::string seqscan_relation;
+  double seqscan_rows = 0;
+  int seqscans = 0;
+};
+
+/*
+ Why the parse tree is not a single read-only SELECT, or NULL. Locking clauses and
+ data-modifying WITH are checked again on the analyzed query, which also sees rules.
+*/
+static const char *raw_statement_problem(List *stmts)
+{
+  if (list_length(stmts) != 1)
+    return "it is not a single statement";
+  Node *stmt = linitial_node(RawStmt, stmts)->stmt;
+  if (!IsA(stmt, SelectStmt))
+    return "it is not a SELECT";
+  SelectStmt *select = (SelectStmt *)stmt;
+  if (select->intoClause != NULL)
+    return "SELECT INTO creates a table";
+  if (select->lockingClause != NIL)
+    return "it locks rows (FOR UPDATE/SHARE)";
+  if (select->withClause != NULL)
+  {
+    ListCell *lc;
+    foreach (lc, select->withClause->ctes)
+    {
+      CommonTableExpr *cte = lfirst_node(CommonTableExpr, lc);
+      if (!IsA(cte->ctequery, SelectStmt))
+        return "a WITH query modifies data";
+    }
+  }
+  return NULL;
+}
+
+static const char *plan_node_name(const Plan *plan)
+{
+  switch (nodeTag(plan))
+  {
+  case T_SeqScan:
+    return plan->parallel_aware ? "Parallel Seq Scan" : "Seq Scan";
+  case T_SampleScan:
+    return "Sample Scan";
+  case T_IndexScan:
+    return "Index Scan";
+  case T_IndexOnlyScan:
+    return "Index Only Scan";
+  case T_BitmapIndexScan:
+    return "Bitmap Index Scan";
+  case T_BitmapHeapScan:
+    return "Bitmap Heap Scan";
+  case T_BitmapAnd:
+    return "BitmapAnd";
+  case T_BitmapOr:
+    return "BitmapOr";
+  case T_TidScan:
+    return "Tid Scan";
+  case T_SubqueryScan:
+    return "Subquery Scan";
+  case T_FunctionScan:
+    return "Function Scan";
+  case T_ValuesScan:
+    return "Values Scan";
+  case T_CteScan:
+    return "CTE Scan";
+  case T_WorkTableScan:
+    return "WorkTable Scan";
+  case T_ForeignScan:
+    return "Foreign Scan";
+  case T_CustomScan:
+    return "Custom Scan";
+  case T_NestLoop:
+    return "Nested Loop";
+  case T_MergeJoin:
+    return "Merge Join";
+  case T_HashJoin:
+    return "Hash Join";
+  case T_Hash:
+    return "Hash";
+  case T_Material:
+    return "Materialize";
+#if PG_VERSION_NUM >= 140000
+  case T_Memoize:
+    return "Memoize";
+#endif
+  case T_Sort:
+    return "Sort";
+#if PG_VERSION_NUM >= 130000
+  case T_IncrementalSort:
+    return "Incremental Sort";
+#endif
+  case T_Group:
+    return "Group";
+  case T_Agg:
+    return "Aggregate";
+  case T_WindowAgg:
+    return "WindowAgg";
+  case T_Unique:
+    return "Unique";
+  case T_SetOp:
+    return "SetOp";
+  case T_Limit:
+    return "Limit";
+  case T_Result:
+    return "Result";
+  case T_ProjectSet:
+    return "ProjectSet";
+  case T_Append:
+    return "Append";
+  case T_MergeAppend:
+    return "Merge Append";
+  case T_RecursiveUnion:
+    return "Recursive Union";
+  case T_Gather:
+    return "Gather";
+  case T_GatherMerge:
+    return "Gather Merge";
+  default:
+    return "Plan";
+  }
+}
+
+// The table a scan reads, or InvalidOid
+static Oid plan_node_relation(const PlanWalk &walk, const Plan *plan)
+{
+  switch (nodeTag(plan))
+  {
+  case T_SeqScan:
+  case T_SampleScan:
+  case T_IndexScan:
+  case T_IndexOnlyScan:
+  case T_BitmapHeapScan:
+  case T_TidScan:
+  case T_ForeignScan:
+  {
+    Index scanrelid = ((const Scan *)plan)->scanrelid;
+    if (scanrelid == 0)
+      return InvalidOid;
+    RangeTblEntry *rte = rt_fetch(scanrelid, walk.stmt->rtable);
+    return rte->rtekind == RTE_RELATION ? rte->relid : InvalidOid;
+  }
+  default:
+    return InvalidOid;
+  }
+}
+
+// pg_class.reltuples, or the planner's estimate of the scan's rows if never analyzed
+static double relation_rows(Oid relid, const Plan *plan)
+{
+  double rows = -1;
+  HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+  if (HeapTupleIsValid(tuple))
+  {
+    rows = ((Form_pg_class)GETSTRUCT(tuple))->reltuples;
+    ReleaseSysCache(tuple);
+  }
+  return Max(rows, plan->plan_rows);
+}
+
+static void walk_plan(PlanWalk &walk, const Plan *plan, int depth);
+
+static void walk_plans(PlanWalk &walk, List *plans, int depth)
+{
+  ListCell *lc;
+  foreach (lc, plans)
+    walk_plan(walk, (const Plan *)lfirst(lc), depth);
+}
+
+/*
+ Adds plan and its children to the outline, one line per node like EXPLAIN's
+ (costs and rows only), and records sequential scans of large relations
+*/
+static void walk_plan(PlanWalk &walk, const Plan *plan, int depth)
+{
+  if (plan == NULL)
+    return;
+
+  Oid relid = plan_node_relation(walk, plan);
+  char *relname = OidIsValid(relid) ? get_rel_name(relid) : NULL;
+  if (IsA(plan, SeqScan) && relname != NULL && pg_gen_query_max_seqscan_rows > 0)
+  {
+    double rows = relation_rows(relid, plan);
+    if (rows > pg_gen_query_max_seqscan_rows)
+    {
+      walk.seqscans++;
+      if (rows > walk.seqscan_rows)
+      {
+        walk.seqscan_rows = rows;
+        walk.seqscan_relation = relname;
+      }
+    }
+  }
+
+  if (walk.lines < VALIDATE_PLAN_MAX_LINES)
+  {
+    if (depth > 0)
+      walk.outline.append(depth * 6 - 4, ' ').append("->  ");
+    walk.outline.append(plan_node_name(plan));
+    if (relname != NULL)
+      walk.outline.append(" on ").append(relname);
+    // the accidental cross join this stage is mostly here for
+    if (IsA(plan, NestLoop) && ((const Join *)plan)->joinqual == NIL && plan->qual == NIL &&
+        ((const NestLoop *)plan)->nestParams == NIL)
+      walk.outline.append(" (no join condition)");
+    char costs[128];
+    snprintf(costs, sizeof(costs), "  (cost=%.2f..%.2f rows=%.0f)\n", plan->startup_cost, plan->total_cost,
+             plan->plan_rows);
+    walk.outline.append(costs);
+    walk.lines++;
+  }
+  else
+    walk.omitted++;
+
+  walk_plan(walk, plan->lefttree, depth + 1);
+  walk_plan(walk, plan->righttree, depth + 1);
+  switch (nodeTag(plan))
+  {
+  case T_Append:
+    walk_plans(walk, ((const Append *)plan)->appendplans, depth + 1);
+    break;
+  case T_MergeAppend:
+    walk_plans(walk, ((const MergeAppend *)plan)->mergeplans, depth + 1);
+    break;
+  case T_BitmapAnd:
+    walk_plans(walk, ((const BitmapAnd *)plan)->bitmapplans, depth + 1);
+    break;
+  case T_BitmapOr:
+    walk_plans(walk, ((const BitmapOr *)plan)->bitmapplans, depth + 1);
+    break;
+  case T_SubqueryScan:
+    walk_plan(walk, ((const SubqueryScan *)plan)->subplan, depth + 1);
+    break;
+  case T_CustomScan:
+    walk_plans(walk, ((const CustomScan *)plan)->custom_plans, depth + 1);
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ Volatile built-ins that only read the clock or draw random numbers; any other volatile
+ function may change something (nextval, setval, pg_advisory_lock, dblink_exec,
+ pg_terminate_backend, a user function writing a table) and is rejected
+*/
+static const char *const harmless_volatile_functions[] = {
+    "random", "random_normal", "clock_timestamp", "timeofday", "gen_random_uuid", "uuidv4", "uuidv7",
+};
+
+static bool harmless_volatile_function(Oid funcid)
+{
+  if (get_func_namespace(funcid) != PG_CATALOG_NAMESPACE)
+    return false;
+  char *name = get_func_name(funcid);
+  if (name == NULL)
+    return false;
+  for (const char *harmless : harmless_volatile_functions)
+  {
+    if (strcmp(name, harmless) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool volatile_function_checker(Oid funcid, void *context)
+{
+  if (func_volatile(funcid) != PROVOLATILE_VOLATILE || harmless_volatile_function(funcid))
+    return false;
+  *(Oid *)context = funcid;
+  return true;
+}
+
+// Finds a call of a volatile function anywhere in the query, subqueries included
+static bool volatile_function_walker(Node *node, void *context)
+{
+  if (node == NULL)
+    return false;
+  if (check_functions_in_node(node, volatile_function_checker, context))
+    return true;
+  if (IsA(node, Query))
+    return query_tree_walker((Query *)node, volatile_function_walker, context, 0);
+  return expression_tree_walker(node, volatile_function_walker, context);
+}
+
+// Everything after the parse: checks the analyzed query, plans it and applies the thresholds
+static void check_plan(RawStmt *raw, const char *sql, SqlValidation &out)
+{
+#if PG_VERSION_NUM >= 150000
+  List *queries = pg_analyze_and_rewrite_fixedparams(raw, sql, NULL, 0, NULL);
+#else
+  List *queries = pg_analyze_and_rewrite(raw, sql, NULL, 0, NULL);
+#endif
+  Query *query = list_length(queries) == 1 ? linitial_node(Query, queries) : NULL;
+  if (query == NULL || query->commandType != CMD_SELECT || query->utilityStmt != NULL)
+  {
+    out.sqlerrcode = ERRCODE_WRONG_OBJECT_TYPE;
+    out.reason = "it is not a SELECT";
+    return;
+  }
+  if (query->hasModifyingCTE || query->rowMarks != NIL)
+  {
+    out.sqlerrcode = ERRCODE_WRONG_OBJECT_TYPE;
+    out.reason = query->hasModifyingCTE ? "a WITH query modifies data" : "it locks rows (FOR UPDATE/SHARE)";
+    return;
+  }
+  // views are expanded by now, so functions they call are found too
+  Oid funcid = InvalidOid;
+  if (query_tree_walker(query, volatile_function_walker, &funcid, 0))
+  {
+    char *name = get_func_name(funcid);
+    out.sqlerrcode = ERRCODE_WRONG_OBJECT_TYPE;
+    out.reason = std::string("it calls the volatile function ").append(name != NULL ? name : "?").append("()");
+    return;
+  }
+
+  // the same plan a plain EXPLAIN shows
+#if PG_VERSION_NUM >= 130000
+  PlannedStmt *stmt = pg_plan_query(query, sql, CURSOR_OPT_PARALLEL_OK, NULL);
+#else
+  PlannedStmt *stmt = pg_plan_query(query, CURSOR_OPT_PARALLEL_OK, NULL);
+#endif
+  PlanWalk walk;
+  walk.stmt = stmt;
+  walk_plan(walk, stmt->planTree, 0);
+  ListCell *lc;
+  int n = 1;
+  foreach (lc, stmt->subplans)
+  {
+    if (walk.lines < VALIDATE_PLAN_MAX_LINES)
+    {
+      walk.outline.append("SubPlan ").append(std::to_string(n)).append("\n");
+      walk.lines++;
+    }
+    walk_plan(walk, (const Plan *)lfirst(lc), 1);
+    n++;
+  }
+  if (walk.omitted > 0)
+    walk.outline.append("(").append(std::to_string(walk.omitted)).append(" more nodes)\n");
+  out.plan = std::move(walk.outline);
+  out.total_cost = stmt->planTree->total_cost;
+
+  char reason[NAMEDATALEN + 200];
+  if (pg_gen_query_max_plan_cost > 0 && out.total_cost > pg_gen_query_max_plan_cost)
+  {
+    snprintf(reason, sizeof(reason), "its estimated cost %.0f exceeds pg_gen_query.max_plan_cost (%.0f)",
+             out.total_cost, pg_gen_query_max_plan_cost);
+    out.sqlerrcode = ERRCODE_PROGRAM_LIMIT_EXCEEDED;
+    out.reason = reason;
+    return;
+  }
+  if (walk.seqscans > 0)
+  {
+    snprintf(reason, sizeof(reason),
+             "it reads all %.0f rows of %s sequentially (pg_gen_query.max_seqscan_rows is %.0f)",
+             walk.seqscan_rows, walk.seqscan_relation.c_str(), pg_gen_query_max_seqscan_rows);
+    out.sqlerrcode = ERRCODE_PROGRAM_LIMIT_EXCEEDED;
+    out.reason = reason;
+    if (walk.seqscans > 1)
+      out.reason.append(", and ").append(std::to_string(walk.seqscans - 1)).append(" more large relations too");
+    return;
+  }
+  out.ok = true;
+}
+
+void validate_sql(const std::string &sql, SqlValidation &out)
+{
+  out = SqlValidation();
+  if (!IsTransactionState())
+    elog(ERROR, "validating generated SQL needs a transaction");
+
+  MemoryContext oldcontext = CurrentMemoryContext;
+  ResourceOwner oldowner = CurrentResourceOwner;
+  MemoryContext work = AllocSetContextCreate(oldcontext, "pg_gen_query validate", ALLOCSET_DEFAULT_SIZES);
+
+  // like a PL/pgSQL exception block: errors are caught, locks taken for planning released
+  BeginInternalSubTransaction(NULL);
+  MemoryContextSwitchTo(work);
+  PG_TRY();
+  {
+#if PG_VERSION_NUM >= 140000
+    List *stmts = raw_parser(sql.c_str(), RAW_PARSE_DEFAULT);
+#else
+    List *stmts = raw_parser(sql.c_str());
+#endif
+    const char *problem = raw_statement_problem(stmts);
+    if (problem != NULL)
+    {
+      out.sqlerrcode = ERRCODE_WRONG_OBJECT_TYPE;
+      out.reason = problem;
+    }
+    else
+      check_plan(linitial_node(RawStmt, stmts), sql.c_str(), out);
+
+    MemoryContextSwitchTo(oldcontext);
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(oldcontext);
+    CurrentResourceOwner = oldowner;
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(oldcontext);
+    ErrorData *edata = CopyErrorData();
+    FlushErrorState();
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(oldcontext);
+    CurrentResourceOwner = oldowner;
+    // a cancel is not the statement's fault
+    if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+      ReThrowError(edata);
+    out.ok = false;
+    out.sqlerrcode = edata->sqlerrcode;
+    out.reason = edata->message != NULL ? edata->message : "it could not be planned";
+    out.plan.clear();
+    out.total_cost = -1;
+    FreeErrorData(edata);
+  }
+  PG_END_TRY();
+  MemoryContextDelete(work);
+}
+
+// What the model gets told about its rejected answer, after the question
+static std::string rejection_feedback(const std::string &sql, const SqlValidation &validation)
+{
+  std::string feedback;
+  feedback.reserve(256 + sql.size() + validation.plan.size());
+  feedback.append("Your previous answer was rejected because ").append(validation.reason).append(":\n");
+  feedback.append(sql).append("\n");
+  if (!validation.plan.empty())
+    feedback.append("Its plan:\n").append(validation.plan);
+  feedback.append("Write a cheaper formulation as a single read-only SELECT that answers the same question, "
+                  "without cross joins or full scans of large tables where an index or a tighter filter can be used.");
+  return feedback;
+}
+
+std::string generate_validated_sql(const std::string &query, double *cost)
+{
+  if (!pg_gen_query_validate && cost == nullptr)
+    return generate_sql(query);
+
+  // a rejected answer must not be cached, or every later call would get it again
+  bool store = false;
+  std::string answer = generate_sql(query, nullptr, &store);
+
+  // checked and returned as the streaming path returns it: the first statement, unfenced
+  std::string sql = sql_first_statement(answer);
+
+  SqlValidation validation;
+  validate_sql(sql, validation);
+  if (!validation.ok)
+  {
+    std::string feedback = rejection_feedback(sql, validation);
+    ereport(DEBUG1, (errmsg("pg_gen_query: generated query rejected, asking again: %s", validation.reason.c_str()),
+                     errdetail("Generated SQL: %s", sql.c_str())));
+    sql = sql_first_statement(generate_sql(query, &feedback, &store));
+    validate_sql(sql, validation);
+    if (!validation.ok)
+    {
+      ereport(ERROR,
+              (errcode(validation.sqlerrcode != 0 ? validation.sqlerrcode : ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+               errmsg("generated query rejected: %s", validation.reason.c_str()),
+               errdetail("Generated SQL: %s", sql.c_str()),
+               errhint("It was generated again once already. Rephrase the question, or raise "
+                       "pg_gen_query.max_plan_cost or pg_gen_query.max_seqscan_rows.")));
+    }
+  }
+  if (store)
+    cache_generated_sql(query, sql);
+  if (cost != nullptr)
+    *cost = validation.total_cost;
+  return sql;
+}
@@ -0,0 +1,39 @@
+#ifndef VALIDATE_SQL_H
+#define VALIDATE_SQL_H
+
+#include <string>
+
+/*
+ Validation of generated SQL before it is handed out (pg_gen_query.validate): the text
+ must parse as a single read-only SELECT (no SELECT INTO, FOR UPDATE/SHARE,
+ data-modifying WITH or volatile functions other than random() and the clock ones),
+ and its plan, made as a plain EXPLAIN would without running
+ anything, must stay within pg_gen_query.max_plan_cost and must not read a relation
+ with more than pg_gen_query.max_seqscan_rows rows sequentially.
+ Parsing and planning run in a subtransaction, so a statement that fails to parse or
+ plan is rejected with the error's message rather than raising it.
+ Needs a transaction; not used by the batch and async functions, which answer outside one.
+*/
+
+struct SqlValidation
+{
+  bool ok = false;
+  int sqlerrcode = 0;      // why it was rejected
+  std::string reason;      // e.g. "its estimated cost 2400000 exceeds pg_gen_query.max_plan_cost (100000)"
+  std::string plan;        // EXPLAIN-style outline of the plan, empty if it could not be planned
+  double total_cost = -1;  // the plan's estimated total cost, -1 if it could not be planned
+};
+
+void validate_sql(const std::string &sql, SqlValidation &out);
+
+/*
+ generate_sql() followed by validate_sql() when pg_gen_query.validate is on or cost is
+ requested; the answer is then reduced to its first statement (sql_first_statement),
+ so code fences and anything after the statement are dropped. A rejected statement is
+ sent back to the model once, with the reason and the plan, asking for a cheaper
+ formulation; raises an ERROR if that is rejected too. Only the accepted statement is
+ stored in the result cache. cost gets the accepted plan's estimated total cost.
+*/
+std::string generate_validated_sql(const std::string &query, double *cost = nullptr);
+
+#endif
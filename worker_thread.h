@@ -0,0 +1,36 @@
+#ifndef WORKER_THREAD_H
+#define WORKER_THREAD_H
+
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#include <utility>
+
+/*
+ Starts a helper thread inside a backend with every signal blocked, so PostgreSQL's
+ signal handlers (which assume the main thread) always run on the backend thread.
+ The thread inherits the mask; the caller's mask is restored right after.
+ Helper threads must not call any PostgreSQL function (no elog, palloc, GUC reads):
+ copy what they need before starting them and report back through plain C++ state.
+*/
+template <typename Fn>
+std::thread start_worker_thread(Fn &&fn)
+{
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  std::thread t;
+  try
+  {
+    t = std::thread(std::forward<Fn>(fn));
+  }
+  catch (...)
+  {
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    throw;
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  return t;
+}
+
+#endif